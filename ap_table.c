@@ -0,0 +1,270 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file ap_table.c
+@brief Table of the access points seen by successive wifi scans.
+
+The table is only accessed by the wifi manager task and needs no locking.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event_loop.h"
+#include "esp_wifi.h"
+#include "esp_wifi_types.h"
+#include "esp_log.h"
+
+#include "wifi_manager.h"
+#include "ap_table.h"
+#include "json.h"
+
+static const char TAG[] = "APTABLE";
+
+/* @brief entries sorted by decreasing rssi_avg */
+static ap_table_entry_t ap_table[AP_TABLE_SIZE];
+static uint16_t ap_table_length = 0;
+
+
+/**
+ * @brief FNV-1a hash of a ssid.
+ */
+static uint32_t ap_table_hash(const uint8_t *ssid) {
+	uint32_t hash = 2166136261u;
+
+	for(int i = 0; i < sizeof(((ap_table_entry_t*)0)->ssid) && ssid[i]; i++){
+		hash = (hash ^ ssid[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+
+/**
+ * @brief Moves an entry whose signal strength changed to its place in the table.
+ * @return the new index of the entry.
+ */
+static uint16_t ap_table_sort(uint16_t index) {
+	ap_table_entry_t entry = ap_table[index];
+
+	while(index > 0 && ap_table[index - 1].rssi_avg < entry.rssi_avg){
+		ap_table[index] = ap_table[index - 1];
+		index--;
+	}
+	while(index + 1 < ap_table_length && ap_table[index + 1].rssi_avg > entry.rssi_avg){
+		ap_table[index] = ap_table[index + 1];
+		index++;
+	}
+	ap_table[index] = entry;
+
+	return index;
+}
+
+
+void ap_table_clear() {
+	ap_table_length = 0;
+}
+
+
+void ap_table_update(const wifi_ap_record_t *records, uint16_t count) {
+	TickType_t now = xTaskGetTickCount();
+
+	for(int i = 0; i < count; i++){
+		const wifi_ap_record_t *record = &records[i];
+		int16_t rssi = record->rssi * 16;
+		int index = -1;
+
+		for(int j = 0; j < ap_table_length && index < 0; j++){
+			if(memcmp(ap_table[j].bssid, record->bssid, sizeof(record->bssid)) == 0) index = j;
+		}
+
+		if(index >= 0){
+			/* exponentially weighted moving average */
+			ap_table[index].rssi_avg += (rssi - ap_table[index].rssi_avg) / (1 << AP_TABLE_RSSI_EWMA_SHIFT);
+		}
+		else if(ap_table_length < AP_TABLE_SIZE){
+			index = ap_table_length++;
+			ap_table[index].rssi_avg = rssi;
+		}
+		else if(ap_table[ap_table_length - 1].rssi_avg < rssi){
+			/* the table is full: the weakest access point makes room */
+			index = ap_table_length - 1;
+			ap_table[index].rssi_avg = rssi;
+		}
+		else{
+			continue;
+		}
+
+		ap_table_entry_t *entry = &ap_table[index];
+		memcpy(entry->bssid, record->bssid, sizeof(entry->bssid));
+		memcpy(entry->ssid, record->ssid, sizeof(entry->ssid));
+		entry->ssid[sizeof(entry->ssid) - 1] = '\0';
+		entry->ssid_hash = ap_table_hash(entry->ssid);
+		entry->primary = record->primary;
+		entry->second = record->second;
+		entry->authmode = record->authmode;
+		entry->last_seen = now;
+
+		ap_table_sort(index);
+	}
+}
+
+
+void ap_table_expire() {
+	TickType_t now = xTaskGetTickCount();
+	uint16_t kept = 0;
+
+	/* removing entries keeps the others sorted */
+	for(int i = 0; i < ap_table_length; i++){
+		if(now - ap_table[i].last_seen < pdMS_TO_TICKS(AP_TABLE_MAX_AGE_MS)){
+			if(kept != i) ap_table[kept] = ap_table[i];
+			kept++;
+		}
+	}
+	ap_table_length = kept;
+}
+
+
+uint16_t ap_table_count() {
+	return ap_table_length;
+}
+
+
+const ap_table_entry_t* ap_table_get(uint16_t index) {
+	return &ap_table[index];
+}
+
+
+int8_t ap_table_rssi(const ap_table_entry_t *entry) {
+	/* rounded to the nearest dBm */
+	return (entry->rssi_avg - 8) / 16;
+}
+
+
+bool ap_table_is_duplicate(uint16_t index) {
+	const ap_table_entry_t *entry = &ap_table[index];
+
+	for(int i = 0; i < index; i++){
+		if(ap_table[i].ssid_hash == entry->ssid_hash && strcmp((const char*)ap_table[i].ssid, (const char*)entry->ssid) == 0){
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+size_t ap_table_get_static_size() {
+	return sizeof(ap_table);
+}
+
+size_t ap_table_json_size() {
+	/* "[" "]\n" encapsulation and the terminating NUL */
+	return ap_table_length * JSON_ONE_APP_SIZE + 4;
+}
+
+
+size_t ap_table_format_json(char *buffer, size_t size) {
+	const char oneap_str[] = ",\"chan\":%d,\"rssi\":%d,\"auth\":%d}";
+
+	/* the list is written through a cursor: every access point is appended in constant time */
+	char *cursor = buffer;
+	/* keep room for the closing "]\n" */
+	char *end = buffer + size - sizeof("]\n");
+	*cursor++ = '[';
+
+	/* the table is sorted by signal strength: the strongest access point of each ssid is listed first */
+	bool first = true;
+	for(int i = 0; i < ap_table_length; i++){
+
+		if(ap_table_is_duplicate(i)) continue;
+
+		const ap_table_entry_t *ap = &ap_table[i];
+		size_t len, ssid_len = 0;
+
+		len = snprintf(cursor, end - cursor, "%s{\"ssid\":", first?"":",\n");
+
+		/* ssid needs to be json escaped. It is directly printed at the correct address */
+		if(len < end - cursor){
+			ssid_len = json_print_string(ap->ssid, sizeof(ap->ssid), (unsigned char*)cursor + len, end - cursor - len);
+			len += ssid_len;
+		}
+
+		/* print the rest of the json for this access point: no more string to escape */
+		if(ssid_len){
+			len += snprintf(cursor + len, end - cursor - len, oneap_str,
+					ap->primary,
+					ap_table_rssi(ap),
+					ap->authmode);
+		}
+
+		if(ssid_len == 0 || len >= end - cursor){
+			/* the buffer is full: the remaining access points are left out rather than overflowing it */
+			ESP_LOGW(TAG, "access point list truncated at entry %d", i);
+			break;
+		}
+		cursor += len;
+		first = false;
+	}
+	strcpy(cursor, "]\n");
+
+	return cursor + sizeof("]\n") - 1 - buffer;
+}
+
+
+/**
+ * @brief Load a signal centered on a channel puts on another channel.
+ */
+static uint32_t ap_table_overlap(int channel, int center, uint32_t weight) {
+	int distance = channel > center ? channel - center : center - channel;
+
+	return distance < 5 ? weight * (5 - distance) : 0;
+}
+
+
+uint32_t ap_table_channel_load(uint8_t channel, bool ht40) {
+	int secondary = channel <= 7 ? channel + 4 : channel - 4;
+	uint32_t load = 0;
+
+	for(int i = 0; i < ap_table_length; i++){
+		const ap_table_entry_t *entry = &ap_table[i];
+		int rssi = ap_table_rssi(entry);
+		uint32_t weight = AP_TABLE_CHANNEL_AP_WEIGHT + (rssi > AP_TABLE_CHANNEL_RSSI_FLOOR ? rssi - AP_TABLE_CHANNEL_RSSI_FLOOR : 0);
+		int centers[2] = { entry->primary, 0 };
+		int count = 1;
+
+		if(entry->second == WIFI_SECOND_CHAN_ABOVE) centers[count++] = entry->primary + 4;
+		else if(entry->second == WIFI_SECOND_CHAN_BELOW) centers[count++] = entry->primary - 4;
+
+		for(int c = 0; c < count; c++){
+			load += ap_table_overlap(channel, centers[c], weight);
+			if(ht40) load += ap_table_overlap(secondary, centers[c], weight);
+		}
+	}
+
+	return load;
+}
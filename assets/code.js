@@ -15,6 +15,7 @@ var apList = null;
 var selectedSSID = "";
 var refreshAPInterval = null;
 var checkStatusInterval = null;
+var eventSource = null;
 
 
 function stopCheckStatusInterval(){
@@ -32,11 +33,40 @@ function stopRefreshAPInterval(){
 }
 
 function startCheckStatusInterval(){
-	checkStatusInterval = setInterval(checkStatus, 950);
+	//status is pushed by the server when the event stream is up
+	if(eventSource == null){
+		checkStatusInterval = setInterval(checkStatus, 950);
+	}
 }
 
 function startRefreshAPInterval(){
-	refreshAPInterval = setInterval(refreshAP, 2800);
+	if(eventSource == null){
+		refreshAPInterval = setInterval(refreshAP, 2800);
+	}
+}
+
+function startEvents(){
+	if(!window.EventSource){
+		return false;
+	}
+
+	eventSource = new EventSource("/events");
+	eventSource.addEventListener("status", function(e) {
+		onStatus(JSON.parse(e.data));
+	});
+	eventSource.addEventListener("ap", function(e) {
+		onAPList(JSON.parse(e.data));
+	});
+	eventSource.onerror = function() {
+		//stream not available or lost: fall back to polling for good
+		eventSource.close();
+		eventSource = null;
+		refreshAP();
+		startCheckStatusInterval();
+		startRefreshAPInterval();
+	};
+
+	return true;
 }
 
 $(document).ready(function(){
@@ -132,10 +162,12 @@ $(document).ready(function(){
 
 
 
-	//first time the page loads: attempt get the connection status and start the wifi scan
-	refreshAP();
-	startCheckStatusInterval();
-	startRefreshAPInterval();
+	//first time the page loads: subscribe to status and wifi scan updates, or poll for them
+	if(!startEvents()){
+		refreshAP();
+		startCheckStatusInterval();
+		startRefreshAPInterval();
+	}
 
 
 
@@ -176,7 +208,8 @@ function performConnect(){
 		data: { 'timestamp': Date.now()}
 	});
 
-	connectInterruption = true;
+	//when polling, the next status can be a remnant of a previous connection. Pushed status is always current.
+	connectInterruption = (eventSource == null);
 
 	//now we can re-set the intervals regardless of result
 	startCheckStatusInterval();
@@ -203,20 +236,20 @@ function rssiToIcon(rssi){
 
 
 function refreshAP(){
-	$.getJSON( "/ap.json", function( data ) {
-		if(data.length > 0){
-			//sort by signal strength
-			data.sort(function (a, b) {
-				var x = a["rssi"]; var y = b["rssi"];
-				return ((x < y) ? 1 : ((x > y) ? -1 : 0));
-			});
-			apList = data;
-			refreshAPHTML(apList);
-			$('#wifi-list .spinner').hide();
-		} else {
-			$('#wifi-list .spinner').show();
-		}
-	});
+	$.getJSON( "/ap.json", onAPList);
+}
+
+function onAPList(data){
+	//age is the time in ms since the list was scanned, null before the first scan completes
+	data = data.aps;
+	if(data.length > 0){
+		//already sorted by signal strength, one entry per ssid
+		apList = data;
+		refreshAPHTML(apList);
+		$('#wifi-list .spinner').hide();
+	} else {
+		$('#wifi-list .spinner').show();
+	}
 }
 
 function refreshAPHTML(data){
@@ -238,68 +271,76 @@ function checkStatus(){
 			connectInterruption = false;
 			return;
 		}
-		if(data.hasOwnProperty('ssid') && data['ssid'] != ""){
-			if(data["ssid"] === selectedSSID){
-				//that's a connection attempt
-				if(data["urc"] === 0){
-					//got connection
-					$("#connected-to span").text(data["ssid"]);
-					$("#connect-details h1").text(data["ssid"]);
-					$("#ip").text(data["ip"]);
-					$("#netmask").text(data["netmask"]);
-					$("#gw").text(data["gw"]);
-					$("#wifi-status").slideDown( "fast", function() {});
-
-					//unlock the wait screen if needed
-					$( "#ok-connect" ).prop("disabled",false);
-
-					//update wait screen
-					$( "#loading" ).hide();
-					$( "#connect-success" ).show();
-					$( "#connect-fail" ).hide();
-				}
-				else if(data["urc"] === 1){
-					//failed attempt
-					$("#connected-to span").text('');
-					$("#connect-details h1").text('');
-					$("#ip").text('0.0.0.0');
-					$("#netmask").text('0.0.0.0');
-					$("#gw").text('0.0.0.0');
-
-					//don't show any connection
-					$("#wifi-status").slideUp( "fast", function() {});
-
-					//unlock the wait screen
-					$( "#ok-connect" ).prop("disabled",false);
-
-					//update wait screen
-					$( "#loading" ).hide();
-					$( "#connect-fail" ).show();
-					$( "#connect-success" ).hide();
-				}
+		onStatus(data);
+	})
+	.fail(function() {
+		//don't do anything, the server might be down while esp32 recalibrates radio
+	});
+}
+
+function onStatus(data){
+	if(data.hasOwnProperty('ssid') && data['ssid'] != ""){
+		if(data["ssid"] === selectedSSID){
+			//that's a connection attempt
+			if(data["urc"] === 0){
+				//got connection
+				$("#connected-to span").text(data["ssid"]);
+				$("#connect-details h1").text(data["ssid"]);
+				$("#ip").text(data["ip"]);
+				$("#netmask").text(data["netmask"]);
+				$("#gw").text(data["gw"]);
+				$("#wifi-status").slideDown( "fast", function() {});
+
+				//unlock the wait screen if needed
+				$( "#ok-connect" ).prop("disabled",false);
+
+				//update wait screen
+				$( "#loading" ).hide();
+				$( "#connect-success" ).show();
+				$( "#connect-fail" ).hide();
 			}
-			else if(data.hasOwnProperty('urc') && data['urc'] === 0){
-				//ESP32 is already connected to a wifi without having the user do anything
-				if( !($("#wifi-status").is(":visible")) ){
-					$("#connected-to span").text(data["ssid"]);
-					$("#connect-details h1").text(data["ssid"]);
-					$("#ip").text(data["ip"]);
-					$("#netmask").text(data["netmask"]);
-					$("#gw").text(data["gw"]);
-					$("#wifi-status").slideDown( "fast", function() {});
-				}
+			else if(data["urc"] === 1){
+				//failed attempt
+				$("#connected-to span").text('');
+				$("#connect-details h1").text('');
+				$("#ip").text('0.0.0.0');
+				$("#netmask").text('0.0.0.0');
+				$("#gw").text('0.0.0.0');
+
+				//don't show any connection
+				$("#wifi-status").slideUp( "fast", function() {});
+
+				//unlock the wait screen
+				$( "#ok-connect" ).prop("disabled",false);
+
+				//update wait screen
+				$( "#loading" ).hide();
+				$( "#connect-fail" ).show();
+				$( "#connect-success" ).hide();
+			}
+		}
+		else if(data.hasOwnProperty('urc') && data['urc'] === 0){
+			//ESP32 is already connected to a wifi without having the user do anything
+			if( !($("#wifi-status").is(":visible")) ){
+				$("#connected-to span").text(data["ssid"]);
+				$("#connect-details h1").text(data["ssid"]);
+				$("#ip").text(data["ip"]);
+				$("#netmask").text(data["netmask"]);
+				$("#gw").text(data["gw"]);
+				$("#wifi-status").slideDown( "fast", function() {});
 			}
 		}
-		else if(data.hasOwnProperty('urc') && data['urc'] === 2){
-			//that's a manual disconnect
+		else if(data.hasOwnProperty('urc') && data['urc'] === 3){
+			//connection lost: the ESP32 reconnects on its own
 			if($("#wifi-status").is(":visible")){
 				$("#wifi-status").slideUp( "fast", function() {});
 			}
 		}
-	})
-	.fail(function() {
-		//don't do anything, the server might be down while esp32 recalibrates radio
-	});
-
-
+	}
+	else if(data.hasOwnProperty('urc') && data['urc'] === 2){
+		//that's a manual disconnect
+		if($("#wifi-status").is(":visible")){
+			$("#wifi-status").slideUp( "fast", function() {});
+		}
+	}
 }
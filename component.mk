@@ -1,6 +1,19 @@
 #
 # "main" pseudo-component makefile.
 #
-# (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
+# (Adds 'include' to include path. Objects are listed explicitly as http_assets.c is generated in the build directory.)
 
-COMPONENT_EMBED_FILES := assets/style.css assets/jquery.gz assets/code.js assets/index.html
+# portal files: minified, gzipped and fingerprinted into http_assets.c at build time
+HTTP_ASSETS := /=$(COMPONENT_PATH)/assets/index.html /code.js=$(COMPONENT_PATH)/assets/code.js /style.css=$(COMPONENT_PATH)/assets/style.css /jquery.js=$(COMPONENT_PATH)/assets/jquery.gz
+HTTP_ASSETS_FILES := $(foreach asset,$(HTTP_ASSETS),$(lastword $(subst =, ,$(asset))))
+
+COMPONENT_OBJS := ap_table.o http_parser.o http_server.o json.o metrics.o trace.o wifi_link.o wifi_scan.o wifi_timeline.o wifi_manager.o wifi_nvs.o http_assets.o
+COMPONENT_EXTRA_CLEAN := http_assets.c
+
+http_assets.c: $(COMPONENT_PATH)/tools/gen_assets.py $(HTTP_ASSETS_FILES)
+	$(summary) GEN $@
+	$(PYTHON) $(COMPONENT_PATH)/tools/gen_assets.py --output $@ $(HTTP_ASSETS)
+
+http_assets.o: http_assets.c
+	$(summary) CC $@
+	$(CC) $(CFLAGS) $(CPPFLAGS) $(addprefix -I ,$(COMPONENT_INCLUDES)) $(addprefix -I ,$(COMPONENT_EXTRA_INCLUDES)) -c $< -o $@
@@ -0,0 +1,270 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_parser.c
+@brief Incremental, zero-copy parser for the request line and headers of an HTTP request.
+
+The parser never writes into the request: it records the offset and length of the
+method, path, query string and of the handful of headers the server cares about.
+It can be fed a buffer that grows as more data is received and resumes where it
+stopped, so every byte of the request is examined exactly once.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "http_parser.h"
+
+
+/** @brief Content-Length values above this are rejected: nothing the server handles comes close. */
+#define HTTP_PARSER_MAX_CONTENT_LENGTH	65535
+
+typedef enum http_parser_state_t {
+	HTTP_PARSER_STATE_METHOD = 0,
+	HTTP_PARSER_STATE_PATH,
+	HTTP_PARSER_STATE_QUERY,
+	HTTP_PARSER_STATE_VERSION,
+	HTTP_PARSER_STATE_LINE_LF,
+	HTTP_PARSER_STATE_HEADER_START,
+	HTTP_PARSER_STATE_HEADER_NAME,
+	HTTP_PARSER_STATE_HEADER_VALUE_START,
+	HTTP_PARSER_STATE_HEADER_VALUE,
+	HTTP_PARSER_STATE_HEADER_LF,
+	HTTP_PARSER_STATE_END_LF,
+	HTTP_PARSER_STATE_DONE,
+	HTTP_PARSER_STATE_ERROR
+}http_parser_state_t;
+
+typedef struct {
+	const char *name;
+	uint8_t length;
+} http_parser_header_name_t;
+
+/* lower case names of the headers in http_header_t order */
+#define HTTP_PARSER_HEADER(name) { name, sizeof(name) - 1 }
+static const http_parser_header_name_t http_parser_header_names[HTTP_HEADER_COUNT] = {
+	HTTP_PARSER_HEADER("host"),
+	HTTP_PARSER_HEADER("connection"),
+	HTTP_PARSER_HEADER("content-length"),
+	HTTP_PARSER_HEADER("x-custom-ssid"),
+	HTTP_PARSER_HEADER("x-custom-pwd"),
+	HTTP_PARSER_HEADER("if-none-match"),
+	HTTP_PARSER_HEADER("accept-encoding")
+};
+
+#define HTTP_PARSER_ALL_CANDIDATES	((uint8_t)((1u << HTTP_HEADER_COUNT) - 1))
+
+
+static http_method_t http_parser_method(const char *method, uint16_t length) {
+	switch(length){
+	case 3:
+		return memcmp(method, "GET", 3) == 0 ? HTTP_METHOD_GET : HTTP_METHOD_UNKNOWN;
+	case 4:
+		return memcmp(method, "POST", 4) == 0 ? HTTP_METHOD_POST : HTTP_METHOD_UNKNOWN;
+	case 6:
+		return memcmp(method, "DELETE", 6) == 0 ? HTTP_METHOD_DELETE : HTTP_METHOD_UNKNOWN;
+	default:
+		return HTTP_METHOD_UNKNOWN;
+	}
+}
+
+
+void http_parser_init(http_parser_t *parser) {
+	memset(parser, 0x00, sizeof(http_parser_t));
+	parser->state = HTTP_PARSER_STATE_METHOD;
+	parser->header = -1;
+}
+
+
+bool http_parser_token_equals(const char *data, const http_token_t *token, const char *str) {
+	size_t len = strlen(str);
+	return token->length == len && memcmp(data + token->offset, str, len) == 0;
+}
+
+
+http_parser_status_t http_parser_execute(http_parser_t *parser, const char *data, uint16_t length) {
+
+	uint16_t i;
+
+	if(parser->state == HTTP_PARSER_STATE_DONE) return HTTP_PARSER_DONE;
+	if(parser->state == HTTP_PARSER_STATE_ERROR) return HTTP_PARSER_ERROR;
+
+	for(i = parser->position; i < length; i++){
+
+		char c = data[i];
+
+		switch(parser->state){
+
+		case HTTP_PARSER_STATE_METHOD:
+			if(c == ' '){
+				parser->method = http_parser_method(data + parser->mark, i - parser->mark);
+				parser->mark = i + 1;
+				parser->state = HTTP_PARSER_STATE_PATH;
+			}
+			else if(c < 'A' || c > 'Z' || i - parser->mark >= 8){
+				goto error;
+			}
+			break;
+
+		case HTTP_PARSER_STATE_PATH:
+			if(c == ' ' || c == '?'){
+				if(i == parser->mark || data[parser->mark] != '/') goto error;
+				parser->path.offset = parser->mark;
+				parser->path.length = i - parser->mark;
+				parser->mark = i + 1;
+				parser->state = (c == ' ') ? HTTP_PARSER_STATE_VERSION : HTTP_PARSER_STATE_QUERY;
+			}
+			else if((unsigned char)c < ' '){
+				goto error;
+			}
+			break;
+
+		case HTTP_PARSER_STATE_QUERY:
+			if(c == ' '){
+				parser->query.offset = parser->mark;
+				parser->query.length = i - parser->mark;
+				parser->mark = i + 1;
+				parser->state = HTTP_PARSER_STATE_VERSION;
+			}
+			else if((unsigned char)c < ' '){
+				goto error;
+			}
+			break;
+
+		case HTTP_PARSER_STATE_VERSION:
+			if(c == '\r' || c == '\n'){
+				const char *version = data + parser->mark;
+				if(i - parser->mark != 8 || memcmp(version, "HTTP/1.", 7) != 0 || version[7] < '0' || version[7] > '9') goto error;
+				parser->version_minor = version[7] - '0';
+				parser->state = (c == '\r') ? HTTP_PARSER_STATE_LINE_LF : HTTP_PARSER_STATE_HEADER_START;
+			}
+			else if(i - parser->mark >= 8){
+				goto error;
+			}
+			break;
+
+		case HTTP_PARSER_STATE_LINE_LF:
+		case HTTP_PARSER_STATE_HEADER_LF:
+			if(c != '\n') goto error;
+			parser->state = HTTP_PARSER_STATE_HEADER_START;
+			break;
+
+		case HTTP_PARSER_STATE_HEADER_START:
+			if(c == '\r'){
+				parser->state = HTTP_PARSER_STATE_END_LF;
+				break;
+			}
+			if(c == '\n'){
+				goto done;
+			}
+			if(c == ' ' || c == '\t'){
+				/* obsolete line folding is not supported */
+				goto error;
+			}
+			parser->candidates = HTTP_PARSER_ALL_CANDIDATES;
+			parser->name_length = 0;
+			parser->state = HTTP_PARSER_STATE_HEADER_NAME;
+			/* fall through */
+
+		case HTTP_PARSER_STATE_HEADER_NAME:
+			if(c == ':'){
+				/* the header is known if a candidate matched all the way to its last character */
+				parser->header = -1;
+				for(int h = 0; h < HTTP_HEADER_COUNT; h++){
+					if((parser->candidates & (1u << h)) && http_parser_header_names[h].length == parser->name_length){
+						parser->header = h;
+						break;
+					}
+				}
+				if(parser->header == HTTP_HEADER_CONTENT_LENGTH){
+					parser->content_length = 0;
+				}
+				parser->state = HTTP_PARSER_STATE_HEADER_VALUE_START;
+			}
+			else if((unsigned char)c <= ' '){
+				goto error;
+			}
+			else if(parser->candidates){
+				char lower = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+				for(int h = 0; h < HTTP_HEADER_COUNT; h++){
+					if((parser->candidates & (1u << h)) &&
+							(parser->name_length >= http_parser_header_names[h].length || http_parser_header_names[h].name[parser->name_length] != lower)){
+						parser->candidates &= ~(1u << h);
+					}
+				}
+				parser->name_length++;
+			}
+			break;
+
+		case HTTP_PARSER_STATE_HEADER_VALUE_START:
+			if(c == ' ' || c == '\t'){
+				break;
+			}
+			parser->mark = i;
+			parser->state = HTTP_PARSER_STATE_HEADER_VALUE;
+			/* fall through */
+
+		case HTTP_PARSER_STATE_HEADER_VALUE:
+			if(c == '\r' || c == '\n'){
+				if(parser->header >= 0){
+					/* trailing whitespace is not part of the value */
+					uint16_t end = i;
+					while(end > parser->mark && (data[end-1] == ' ' || data[end-1] == '\t')) end--;
+					parser->headers[parser->header].offset = parser->mark;
+					parser->headers[parser->header].length = end - parser->mark;
+					parser->found |= (1u << parser->header);
+				}
+				parser->state = (c == '\r') ? HTTP_PARSER_STATE_HEADER_LF : HTTP_PARSER_STATE_HEADER_START;
+			}
+			else if(parser->header == HTTP_HEADER_CONTENT_LENGTH && c != ' ' && c != '\t'){
+				if(c < '0' || c > '9') goto error;
+				parser->content_length = parser->content_length * 10 + (c - '0');
+				if(parser->content_length > HTTP_PARSER_MAX_CONTENT_LENGTH) goto error;
+			}
+			break;
+
+		case HTTP_PARSER_STATE_END_LF:
+			if(c != '\n') goto error;
+			goto done;
+
+		default:
+			goto error;
+		}
+	}
+
+	parser->position = length;
+	return HTTP_PARSER_INCOMPLETE;
+
+done:
+	parser->position = i + 1;
+	parser->header_length = i + 1;
+	parser->state = HTTP_PARSER_STATE_DONE;
+	return HTTP_PARSER_DONE;
+
+error:
+	parser->position = i;
+	parser->state = HTTP_PARSER_STATE_ERROR;
+	return HTTP_PARSER_ERROR;
+}
@@ -33,15 +33,19 @@ function to process requests, decode URLs, serve files, etc. etc.
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "mdns.h"
 #include "lwip/api.h"
@@ -57,67 +61,432 @@ function to process requests, decode URLs, serve files, etc. etc.
 #include "lwip/priv/tcpip_priv.h"
 
 #include "http_server.h"
+#include "http_parser.h"
+#include "http_assets.h"
 #include "wifi_manager.h"
 #include "wifi_nvs.h"
+#include "metrics.h"
+#include "wifi_timeline.h"
+#include "trace.h"
 
 static const char TAG[] = "HTTPSRV";
 
 EventGroupHandle_t http_server_event_group;
 EventBits_t uxBits;
 
-/* embedded binary data */
-extern const uint8_t style_css_start[] asm("_binary_style_css_start");
-extern const uint8_t style_css_end[]   asm("_binary_style_css_end");
-extern const uint8_t jquery_gz_start[] asm("_binary_jquery_gz_start");
-extern const uint8_t jquery_gz_end[] asm("_binary_jquery_gz_end");
-extern const uint8_t code_js_start[] asm("_binary_code_js_start");
-extern const uint8_t code_js_end[] asm("_binary_code_js_end");
-extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-extern const uint8_t index_html_end[] asm("_binary_index_html_end");
-
-
-/* const http headers stored in ROM */
-const static char http_redirect_hdr[] = "HTTP/1.1 302 Found\nLocation: http://192.168.1.1/\n\n";
-const static char http_html_hdr[] = "HTTP/1.1 200 OK\nContent-type: text/html\n\n";
-const static char http_css_hdr[] = "HTTP/1.1 200 OK\nContent-type: text/css\nCache-Control: public, max-age=31536000\n\n";
-const static char http_js_hdr[] = "HTTP/1.1 200 OK\nContent-type: text/javascript\n\n";
-const static char http_jquery_gz_hdr[] = "HTTP/1.1 200 OK\nContent-type: text/javascript\nAccept-Ranges: bytes\nContent-Length: 29995\nContent-Encoding: gzip\n\n";
-const static char http_400_hdr[] = "HTTP/1.1 400 Bad Request\nContent-Length: 0\n\n";
-const static char http_404_hdr[] = "HTTP/1.1 404 Not Found\nContent-Length: 0\n\n";
-const static char http_503_hdr[] = "HTTP/1.1 503 Service Unavailable\nContent-Length: 0\n\n";
-const static char http_ok_json_no_cache_hdr[] = "HTTP/1.1 200 OK\nContent-type: application/json\nCache-Control: no-store, no-cache, must-revalidate, max-age=0\nPragma: no-cache\n\n";
+/* @brief accepted connections waiting to be picked up by a worker */
+static QueueHandle_t http_server_connection_queue = NULL;
+
+/* @brief notification bits of the event task */
+#define HTTP_SERVER_EVENT_AP_LIST		( 1 << 0 )
+#define HTTP_SERVER_EVENT_STATUS		( 1 << 1 )
+#define HTTP_SERVER_EVENT_SUBSCRIBE		( 1 << 2 )
+#define HTTP_SERVER_EVENT_STOP			( 1 << 3 )
+
+
+static TaskHandle_t http_server_events_task = NULL;
+
+/* @brief connections subscribing to /events, waiting to be picked up by the event task */
+static QueueHandle_t http_server_subscription_queue = NULL;
+
+/* @brief connections of the /events clients. Only ever accessed by the event task. */
+static struct netconn *http_server_event_clients[HTTP_SERVER_MAX_EVENT_CLIENTS];
+
+/* @brief the route table is defined with its handlers, further down */
+static void http_server_register_routes();
+
+/* @brief /metrics.json and /timeline.json are written here by one worker at a time */
+static char http_server_report_buffer[HTTP_SERVER_REPORT_SIZE];
+static atomic_flag http_server_report_busy = ATOMIC_FLAG_INIT;
+
+/* @brief last event formatted by the event task. Grows with the largest json sent so far. */
+static char *http_server_event_frame = NULL;
+static size_t http_server_event_frame_size = 0;
+
+/* const http headers stored in ROM.
+ * Content-Length and Connection are appended by http_server_send_response so that every response can be
+ * framed on a persistent connection. */
+const static char http_redirect_hdr[] = "HTTP/1.1 302 Found\r\nLocation: http://" DEFAULT_AP_IP "/\r\n";
+const static char http_400_hdr[] = "HTTP/1.1 400 Bad Request\r\n";
+const static char http_431_hdr[] = "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+const static char http_404_hdr[] = "HTTP/1.1 404 Not Found\r\n";
+const static char http_503_hdr[] = "HTTP/1.1 503 Service Unavailable\r\n";
+const static char http_ok_json_no_cache_hdr[] = "HTTP/1.1 200 OK\r\nContent-type: application/json\r\nCache-Control: no-store, no-cache, must-revalidate, max-age=0\r\nPragma: no-cache\r\n";
+const static char http_ok_json_revalidate_hdr[] = "HTTP/1.1 200 OK\r\nContent-type: application/json\r\nCache-Control: no-cache\r\n";
+const static char http_304_json_hdr[] = "HTTP/1.1 304 Not Modified\r\nCache-Control: no-cache\r\n";
+const static char http_connection_close_hdr[] = "Connection: close\r\n";
+const static char http_event_stream_hdr[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n";
+const static char http_event_keep_alive[] = ": keep-alive\n\n";
+const static char http_ap_list_suffix[] = "}";
+#if TRACE_ENABLED
+const static char http_ok_trace_hdr[] = "HTTP/1.1 200 OK\r\nContent-type: application/octet-stream\r\nCache-Control: no-store\r\n";
+#endif
+
+/* @brief size of the buffer holding the beginning of the access point list document */
+#define HTTP_SERVER_AP_LIST_PREFIX_SIZE	32
+
+#if WIFI_MANAGER_STATIC_ALLOCATION
+/* @brief size of the event frame in static memory mode: the largest access point list, with "data: " prefixed to
+ * each of its lines. An access point takes more than 24 bytes of json. */
+#define HTTP_SERVER_STATIC_EVENT_FRAME_SIZE	(WIFI_MANAGER_STATIC_AP_LIST_SIZE + WIFI_MANAGER_STATIC_AP_LIST_SIZE / 4 + HTTP_SERVER_AP_LIST_PREFIX_SIZE + 32)
+
+/* @brief every buffer, RTOS object and task of the server, allocated at compile time */
+static struct {
+	StaticEventGroup_t event_group;
+	StaticQueue_t connection_queue;
+	struct netconn *connection_queue_storage[HTTP_SERVER_BACKLOG_SIZE];
+	StaticQueue_t subscription_queue;
+	struct netconn *subscription_queue_storage[HTTP_SERVER_MAX_EVENT_CLIENTS];
+	StaticTask_t workers[HTTP_SERVER_WORKER_COUNT];
+	StackType_t worker_stacks[HTTP_SERVER_WORKER_COUNT][HTTP_SERVER_WORKER_STACK_SIZE];
+	StaticTask_t events_task;
+	StackType_t events_stack[HTTP_SERVER_EVENTS_STACK_SIZE];
+	char event_frame[HTTP_SERVER_STATIC_EVENT_FRAME_SIZE];
+	/* a worker serves one connection at a time: one request buffer each is enough */
+	char request_buffers[HTTP_SERVER_WORKER_COUNT][HTTP_SERVER_REQUEST_BUFFER_SIZE];
+	atomic_bool request_buffer_used[HTTP_SERVER_WORKER_COUNT];
+} http_server_arena;
+#endif
 
 
 void http_server_set_event_start(){
+	TRACE(TRACE_EVENT_GROUP_SET, TRACE_OBJECT_HTTP_SERVER_EVENTS, HTTP_SERVER_START_BIT_0);
 	xEventGroupSetBits(http_server_event_group, HTTP_SERVER_START_BIT_0 );
 }
 
+size_t http_server_get_static_size(){
+	size_t size = sizeof(http_server_report_buffer) + sizeof(http_server_event_clients);
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	size += sizeof(http_server_arena);
+#endif
+	return size;
+}
+
+void http_server_set_event_stop(){
+	if(http_server_event_group){
+		TRACE(TRACE_EVENT_GROUP_CLEAR, TRACE_OBJECT_HTTP_SERVER_EVENTS, HTTP_SERVER_START_BIT_0);
+		xEventGroupClearBits(http_server_event_group, HTTP_SERVER_START_BIT_0 );
+	}
+	if(http_server_events_task){
+		xTaskNotify(http_server_events_task, HTTP_SERVER_EVENT_STOP, eSetBits);
+	}
+}
+
+
+static void http_server_worker(void *pvParameters) {
+
+	struct netconn *conn;
+
+	metrics_register_task();
+	TRACE_REGISTER_TASK();
+	for(;;){
+		if(xQueueReceive(http_server_connection_queue, &conn, portMAX_DELAY) == pdTRUE){
+			/* a client that never sends its request must not hold on to a worker forever */
+			netconn_set_recvtimeout(conn, HTTP_SERVER_RECV_TIMEOUT_MS);
+			http_server_netconn_serve(conn);
+		}
+	}
+}
+
+
+void http_server_notify_ap_list(){
+	if(http_server_events_task){
+		xTaskNotify(http_server_events_task, HTTP_SERVER_EVENT_AP_LIST, eSetBits);
+	}
+}
+
+
+void http_server_notify_status(){
+	if(http_server_events_task){
+		xTaskNotify(http_server_events_task, HTTP_SERVER_EVENT_STATUS, eSetBits);
+	}
+}
+
+
+/**
+ * @brief Formats the beginning of the access point list document: {"age":<ms>,"aps":
+ *
+ * The age of the scan results lets clients tell cached results from fresh ones. It is null until the first
+ * scan completes. The document ends with http_ap_list_suffix.
+ */
+static void http_server_ap_list_prefix(char *prefix, size_t size, const wifi_manager_json_t *ap_list) {
+	uint32_t age = wifi_manager_get_json_age(ap_list);
+
+	if(age == UINT32_MAX){
+		snprintf(prefix, size, "{\"age\":null,\"aps\":");
+	}
+	else{
+		snprintf(prefix, size, "{\"age\":%u,\"aps\":", (unsigned int)age);
+	}
+}
+
+
+/**
+ * @brief Size of the server-sent event carrying a json: each of its lines is prefixed by "data: ".
+ * @param prefix text preceding the json, NULL for none. The document then ends with suffix.
+ */
+static size_t http_server_event_size(const char *event, const char *prefix, const char *json, const char *suffix) {
+	size_t size = sizeof("event: \ndata: \n\n") + strlen(event) + strlen(json);
+
+	for(const char *c = json; *c; c++){
+		if(*c == '\n') size += sizeof("data: ") - 1;
+	}
+	if(prefix){
+		size += strlen(prefix) + strlen(suffix);
+	}
+
+	return size;
+}
+
+
+/**
+ * @brief Formats a json document as a server-sent event.
+ * @param prefix text preceding the json, NULL for none. The document then ends with suffix.
+ * @return length of the event, 0 if it does not fit in the frame.
+ */
+static size_t http_server_build_event(char *frame, size_t size, const char *event, const char *prefix, const char *json, const char *suffix) {
+	int len = snprintf(frame, size, "event: %s\ndata: %s", event, prefix ? prefix : "");
+	const char *line = json;
+
+	while(len > 0 && len < size && *line){
+		const char *end = strchr(line, '\n');
+		int line_len = end ? end - line : strlen(line);
+		len += snprintf(frame + len, size - len, "%.*s%s", line_len, line, end && end[1] ? "\ndata: " : "");
+		line += line_len + (end ? 1 : 0);
+	}
+	if(len > 0 && len < size){
+		len += snprintf(frame + len, size - len, "%s\n\n", prefix ? suffix : "");
+	}
+	if(len <= 0 || len >= size){
+		return 0;
+	}
+
+	return len;
+}
+
+
+/**
+ * @brief Formats a json document as an event in http_server_event_frame, growing it as needed.
+ * @return length of the event, 0 on failure.
+ */
+static size_t http_server_format_event(const char *event, const char *prefix, const char *json, const char *suffix) {
+	size_t size = http_server_event_size(event, prefix, json, suffix);
+
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	if(http_server_event_frame == NULL){
+		http_server_event_frame = http_server_arena.event_frame;
+		http_server_event_frame_size = sizeof(http_server_arena.event_frame);
+	}
+#endif
+
+	if(size > http_server_event_frame_size){
+#if WIFI_MANAGER_STATIC_ALLOCATION
+		/* the frame cannot grow */
+		ESP_LOGE(TAG, "an event of %u bytes does not fit in the frame", (unsigned int)size);
+		return 0;
+#else
+		char *frame = (char*)realloc(http_server_event_frame, size);
+		if(frame == NULL){
+			ESP_LOGE(TAG, "could not allocate %u bytes for an event", (unsigned int)size);
+			return 0;
+		}
+		http_server_event_frame = frame;
+		http_server_event_frame_size = size;
+#endif
+	}
+
+	return http_server_build_event(http_server_event_frame, http_server_event_frame_size, event, prefix, json, suffix);
+}
+
+
+/**
+ * @brief Formats the current version of a json maintained by the wifi manager as an event.
+ * @return length of the event in http_server_event_frame, 0 on failure.
+ */
+static size_t http_server_read_event(uint32_t event) {
+	size_t len = 0;
+	const wifi_manager_json_t *json;
+
+	if(event == HTTP_SERVER_EVENT_AP_LIST){
+		char prefix[HTTP_SERVER_AP_LIST_PREFIX_SIZE];
+		json = wifi_manager_acquire_ap_list_json();
+		http_server_ap_list_prefix(prefix, sizeof(prefix), json);
+		if(json->json) len = http_server_format_event("ap", prefix, json->json, http_ap_list_suffix);
+	}
+	else{
+		json = wifi_manager_acquire_ip_info_json();
+		if(json->json) len = http_server_format_event("status", NULL, json->json, NULL);
+	}
+	wifi_manager_release_json(json);
+
+	return len;
+}
+
+
+/**
+ * @brief Writes to an /events client, dropping it if it cannot keep up or went away.
+ */
+static void http_server_event_write(int client, const char *data, size_t len) {
+	struct netconn *conn = http_server_event_clients[client];
+
+	if(conn && netconn_write(conn, data, len, NETCONN_COPY) != ERR_OK){
+		ESP_LOGD(TAG, "dropping event client %d", client);
+		TRACE(TRACE_HTTP_CLOSE, TRACE_OBJECT_NONE, (uintptr_t)conn);
+		netconn_close(conn);
+		netconn_delete(conn);
+		http_server_event_clients[client] = NULL;
+	}
+}
+
+
+/**
+ * @brief Task pushing the connection status and access point list to /events clients.
+ *
+ * It owns the connections of all subscribed clients and wakes up whenever the wifi manager regenerates a json,
+ * when a client subscribes, or every HTTP_SERVER_EVENTS_PERIOD_MS.
+ */
+static void http_server_events(void *pvParameters) {
+
+	uint32_t events;
+	size_t len;
+	TickType_t last_scan_request = 0;
+
+	metrics_register_task();
+	TRACE_REGISTER_TASK();
+	for(;;){
+		events = 0;
+		xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(HTTP_SERVER_EVENTS_PERIOD_MS));
+
+		/* new clients get the current state right away */
+		struct netconn *conn;
+		while(xQueueReceive(http_server_subscription_queue, &conn, 0) == pdTRUE){
+			int client = -1;
+			for(int i = 0; i < HTTP_SERVER_MAX_EVENT_CLIENTS && client < 0; i++){
+				if(http_server_event_clients[i] == NULL) client = i;
+			}
+			if(client < 0){
+				/* the client will fall back to polling */
+				TRACE(TRACE_HTTP_CLOSE, TRACE_OBJECT_NONE, (uintptr_t)conn);
+				netconn_close(conn);
+				netconn_delete(conn);
+				continue;
+			}
+			netconn_set_sendtimeout(conn, HTTP_SERVER_EVENTS_SEND_TIMEOUT_MS);
+			http_server_event_clients[client] = conn;
+			if((len = http_server_read_event(HTTP_SERVER_EVENT_STATUS))) http_server_event_write(client, http_server_event_frame, len);
+			if((len = http_server_read_event(HTTP_SERVER_EVENT_AP_LIST))) http_server_event_write(client, http_server_event_frame, len);
+		}
+
+		/* the server is stopped: streams are closed, the clients reconnect if it comes back */
+		if(events & HTTP_SERVER_EVENT_STOP){
+			for(int i = 0; i < HTTP_SERVER_MAX_EVENT_CLIENTS; i++){
+				if(http_server_event_clients[i]){
+					TRACE(TRACE_HTTP_CLOSE, TRACE_OBJECT_NONE, (uintptr_t)http_server_event_clients[i]);
+					netconn_close(http_server_event_clients[i]);
+					netconn_delete(http_server_event_clients[i]);
+					http_server_event_clients[i] = NULL;
+				}
+			}
+		}
+
+		if(events & (HTTP_SERVER_EVENT_STATUS | HTTP_SERVER_EVENT_AP_LIST)){
+			const uint32_t types[] = { HTTP_SERVER_EVENT_STATUS, HTTP_SERVER_EVENT_AP_LIST };
+			for(int t = 0; t < sizeof(types) / sizeof(types[0]); t++){
+				if((events & types[t]) && (len = http_server_read_event(types[t]))){
+					for(int i = 0; i < HTTP_SERVER_MAX_EVENT_CLIENTS; i++) http_server_event_write(i, http_server_event_frame, len);
+				}
+			}
+		}
+		else if(events == 0){
+			for(int i = 0; i < HTTP_SERVER_MAX_EVENT_CLIENTS; i++) http_server_event_write(i, http_event_keep_alive, sizeof(http_event_keep_alive) - 1);
+		}
+
+		/* the stream replaces the /ap.json polling that kept the access point list fresh */
+		bool subscribed = false;
+		for(int i = 0; i < HTTP_SERVER_MAX_EVENT_CLIENTS; i++) subscribed |= http_server_event_clients[i] != NULL;
+		if(subscribed && xTaskGetTickCount() - last_scan_request >= pdMS_TO_TICKS(HTTP_SERVER_EVENTS_PERIOD_MS)){
+			wifi_manager_scan_async();
+			last_scan_request = xTaskGetTickCount();
+		}
+	}
+}
+
 
 void http_server(void *pvParameters) {
 
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	http_server_event_group = xEventGroupCreateStatic(&http_server_arena.event_group);
+	http_server_connection_queue = xQueueCreateStatic(HTTP_SERVER_BACKLOG_SIZE, sizeof(struct netconn *),
+			(uint8_t*)http_server_arena.connection_queue_storage, &http_server_arena.connection_queue);
+	http_server_subscription_queue = xQueueCreateStatic(HTTP_SERVER_MAX_EVENT_CLIENTS, sizeof(struct netconn *),
+			(uint8_t*)http_server_arena.subscription_queue_storage, &http_server_arena.subscription_queue);
+#else
 	http_server_event_group = xEventGroupCreate();
+	http_server_connection_queue = xQueueCreate(HTTP_SERVER_BACKLOG_SIZE, sizeof(struct netconn *));
+	http_server_subscription_queue = xQueueCreate(HTTP_SERVER_MAX_EVENT_CLIENTS, sizeof(struct netconn *));
+#endif
 
 	/* do not start the task until wifi_manager says it's safe to do so! */
 	ESP_LOGD(TAG, "waiting for start bit");
 	uxBits = xEventGroupWaitBits(http_server_event_group, HTTP_SERVER_START_BIT_0, pdFALSE, pdTRUE, portMAX_DELAY );
 	ESP_LOGD(TAG, "received start bit, starting server");
+	metrics_register_task();
+	TRACE_REGISTER_TASK();
+	http_server_register_routes();
+
+	/* start the workers that will process connections in parallel */
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	for(int i = 0; i < HTTP_SERVER_WORKER_COUNT; i++){
+		xTaskCreateStatic(&http_server_worker, "http_worker", HTTP_SERVER_WORKER_STACK_SIZE, NULL, priority,
+				http_server_arena.worker_stacks[i], &http_server_arena.workers[i]);
+	}
+	http_server_events_task = xTaskCreateStatic(&http_server_events, "http_events", HTTP_SERVER_EVENTS_STACK_SIZE, NULL, priority,
+			http_server_arena.events_stack, &http_server_arena.events_task);
+#else
+	for(int i = 0; i < HTTP_SERVER_WORKER_COUNT; i++){
+		if(xTaskCreate(&http_server_worker, "http_worker", HTTP_SERVER_WORKER_STACK_SIZE, NULL, priority, NULL) != pdPASS){
+			ESP_LOGE(TAG, "could not create http worker %d", i);
+		}
+	}
+	if(xTaskCreate(&http_server_events, "http_events", HTTP_SERVER_EVENTS_STACK_SIZE, NULL, priority, &http_server_events_task) != pdPASS){
+		ESP_LOGE(TAG, "could not create http event task");
+		http_server_events_task = NULL;
+	}
+#endif
 
 	struct netconn *conn, *newconn;
 	err_t err;
-	conn = netconn_new(NETCONN_TCP);
-	netconn_bind(conn, IP_ADDR_ANY, 80);
-	netconn_listen(conn);
-	printf("HTTP Server listening...\n");
-	do {
-		err = netconn_accept(conn, &newconn);
-		if (err == ERR_OK) {
-			http_server_netconn_serve(newconn);
-			netconn_delete(newconn);
+	for(;;){
+		conn = netconn_new(NETCONN_TCP);
+		netconn_bind(conn, IP_ADDR_ANY, 80);
+		netconn_listen(conn);
+		/* accept returns periodically so that a stop request is noticed */
+		netconn_set_recvtimeout(conn, HTTP_SERVER_ACCEPT_TIMEOUT_MS);
+		printf("HTTP Server listening...\n");
+		do {
+			err = netconn_accept(conn, &newconn);
+			if (err == ERR_OK) {
+				TRACE(TRACE_HTTP_ACCEPT, TRACE_OBJECT_NONE, (uintptr_t)newconn);
+				/* blocks when all workers are busy and the backlog is full: lwIP will hold further clients */
+				xQueueSendToBack(http_server_connection_queue, &newconn, portMAX_DELAY);
+			}
+		} while((err == ERR_OK || err == ERR_TIMEOUT) && (xEventGroupGetBits(http_server_event_group) & HTTP_SERVER_START_BIT_0));
+		netconn_close(conn);
+		netconn_delete(conn);
+
+		if(err != ERR_OK && err != ERR_TIMEOUT){
+			/* the listener failed: do not spin on it */
+			ESP_LOGE(TAG, "accept failed (%d), restarting the listener", err);
+			vTaskDelay(pdMS_TO_TICKS(HTTP_SERVER_ACCEPT_TIMEOUT_MS));
+		}
+		else{
+			/* connections already accepted are served to completion, port 80 is closed until the server is started again */
+			ESP_LOGI(TAG, "HTTP Server stopped");
 		}
-		vTaskDelay( (TickType_t)10); /* allows the freeRTOS scheduler to take over if needed */
-	} while(err == ERR_OK);
-	netconn_close(conn);
-	netconn_delete(conn);
+
+		uxBits = xEventGroupWaitBits(http_server_event_group, HTTP_SERVER_START_BIT_0, pdFALSE, pdTRUE, portMAX_DELAY );
+	}
 }
 
 
@@ -140,123 +509,664 @@ char* http_server_get_header(char *request, char *header_name, int *len) {
 }
 
 
-void http_server_netconn_serve(struct netconn *conn) {
+/**
+ * @brief Counts a response in the metrics.
+ * @param header status line and headers: every response starts with "HTTP/1.1 " and the status code.
+ */
+static void http_server_count_response(const char *header, size_t bytes) {
+	uint16_t status = (header[9] - '0') * 100 + (header[10] - '0') * 10 + (header[11] - '0');
+	metrics_count_response(status, bytes);
+}
 
-	struct netbuf *inbuf;
-	char *buf = NULL;
-	u16_t buflen;
+
+/**
+ * @brief Writes the status line and headers of a response, including the framing headers.
+ * @param header status line and headers, each terminated by CRLF. Must stay valid: it is not copied.
+ * @param extra_header additional headers built on the fly, each terminated by CRLF. Can be NULL.
+ * @param keep_alive false to announce that the connection will be closed after this response.
+ */
+static err_t http_server_send_head(struct netconn *conn, const char *header, const char *extra_header, size_t content_length, bool keep_alive) {
+	char framing[128];
+	int framing_len;
 	err_t err;
-	const char new_line[2] = "\n";
 
-	err = netconn_recv(conn, &inbuf);
-	if (err == ERR_OK) {
+	framing_len = snprintf(framing, sizeof(framing), "%sContent-Length: %u\r\n%s\r\n", extra_header ? extra_header : "", (unsigned int)content_length, keep_alive ? "" : http_connection_close_hdr);
 
-		netbuf_data(inbuf, (void**)&buf, &buflen);
+	http_server_count_response(header, strlen(header) + framing_len + content_length);
+	err = netconn_write(conn, header, strlen(header), NETCONN_NOCOPY | NETCONN_MORE);
+	if(err == ERR_OK){
+		err = netconn_write(conn, framing, framing_len, NETCONN_COPY | (content_length ? NETCONN_MORE : 0));
+	}
 
-		/* extract the first line of the request */
-		char *save_ptr = buf;
-		char *line = strtok_r(save_ptr, new_line, &save_ptr);
+	return err;
+}
 
-		if(line) {
 
-			// If a Host header is included, redirect to our IP
-			int lenH = 0;
-			char *host = NULL;
-			host = http_server_get_header(save_ptr, "Host: ", &lenH);
-			if ((sizeof(host) > 0) && !strstr(host, "192.168.1.1")) {
-				netconn_write(conn, http_redirect_hdr, sizeof(http_redirect_hdr) - 1, NETCONN_NOCOPY);
-			}
+/**
+ * @brief Writes a complete response: status line and headers, framing headers and the body if any.
+ * @param header status line and headers, each terminated by CRLF. Must stay valid: it is not copied.
+ * @param extra_header additional headers built on the fly, each terminated by CRLF. Can be NULL.
+ * @param body_flags netconn write flags for the body. Use NETCONN_COPY for buffers that can change once the call returns.
+ * @param keep_alive false to announce that the connection will be closed after this response.
+ */
+static err_t http_server_send_response(struct netconn *conn, const char *header, const char *extra_header, const void *body, size_t body_len, u8_t body_flags, bool keep_alive) {
+	err_t err;
 
-			// default page
-			else if(strstr(line, "GET / ")) {
-				netconn_write(conn, http_html_hdr, sizeof(http_html_hdr) - 1, NETCONN_NOCOPY);
-				netconn_write(conn, index_html_start, index_html_end - index_html_start, NETCONN_NOCOPY);
-			}
-			else if(strstr(line, "GET /jquery.js ")) {
-				netconn_write(conn, http_jquery_gz_hdr, sizeof(http_jquery_gz_hdr) - 1, NETCONN_NOCOPY);
-				netconn_write(conn, jquery_gz_start, jquery_gz_end - jquery_gz_start, NETCONN_NOCOPY);
+	err = http_server_send_head(conn, header, extra_header, body_len, keep_alive);
+	if(err == ERR_OK && body_len){
+		err = netconn_write(conn, body, body_len, body_flags);
+	}
+
+	return err;
+}
+
+
+/**
+ * @brief Writes a 304 Not Modified response. It has no body, hence no Content-Length.
+ * @param header status line and headers, each terminated by CRLF. Must stay valid: it is not copied.
+ * @param extra_header additional headers built on the fly, each terminated by CRLF. Can be NULL.
+ */
+static err_t http_server_send_not_modified(struct netconn *conn, const char *header, const char *extra_header, bool keep_alive) {
+	char framing[128];
+	int framing_len;
+	err_t err;
+
+	framing_len = snprintf(framing, sizeof(framing), "%s%s\r\n", extra_header ? extra_header : "", keep_alive ? "" : http_connection_close_hdr);
+
+	http_server_count_response(header, strlen(header) + framing_len);
+	err = netconn_write(conn, header, strlen(header), NETCONN_NOCOPY | NETCONN_MORE);
+	if(err == ERR_OK){
+		err = netconn_write(conn, framing, framing_len, NETCONN_COPY);
+	}
+
+	return err;
+}
+
+
+/**
+ * @brief Checks if the entity tag is listed in the If-None-Match header of the request.
+ *
+ * The weak comparison of RFC 7232 applies: a W/ prefix in the header does not prevent a match.
+ * @param etag quoted entity tag.
+ */
+static bool http_server_etag_matches(const char *request, const http_parser_t *parser, const char *etag) {
+	const http_token_t *if_none_match = &parser->headers[HTTP_HEADER_IF_NONE_MATCH];
+	const char *value = request + if_none_match->offset;
+	size_t len = strlen(etag);
+
+	if(if_none_match->length == 1 && value[0] == '*'){
+		return true;
+	}
+	for(size_t i = 0; i + len <= if_none_match->length; i++){
+		if(memcmp(value + i, etag, len) == 0){
+			return true;
+		}
+	}
+	return false;
+}
+
+
+#if HTTP_ASSETS_IDENTITY
+/**
+ * @brief Tells whether the client accepts the gzip content coding, as per RFC 7231 section 5.3.4.
+ *
+ * A request without Accept-Encoding accepts any coding. Otherwise gzip, x-gzip or * must be listed without a zero
+ * quality value. An explicit gzip entry takes precedence over *.
+ */
+static bool http_server_accepts_gzip(const char *request, const http_parser_t *parser) {
+	const http_token_t *accept_encoding = &parser->headers[HTTP_HEADER_ACCEPT_ENCODING];
+	const char *p = request + accept_encoding->offset;
+	const char *end = p + accept_encoding->length;
+	int gzip = -1, any = -1; /* -1 when not listed, else whether it is accepted */
+
+	if(!(parser->found & (1u << HTTP_HEADER_ACCEPT_ENCODING))){
+		return true;
+	}
+
+	while(p < end){
+		while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+		const char *coding = p;
+		while(p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+		size_t coding_length = p - coding;
+
+		/* parameters: only a q=0 (or 0.0...) matters */
+		bool accepted = true;
+		while(p < end && *p != ','){
+			if((*p == 'q' || *p == 'Q') && p + 1 < end && p[1] == '=' && (p[-1] == ';' || p[-1] == ' ' || p[-1] == '\t')){
+				p += 2;
+				while(p < end && (*p == '0' || *p == '.')) p++;
+				accepted = p < end && *p >= '1' && *p <= '9';
 			}
-			else if(strstr(line, "GET /code.js ")) {
-				netconn_write(conn, http_js_hdr, sizeof(http_js_hdr) - 1, NETCONN_NOCOPY);
-				netconn_write(conn, code_js_start, code_js_end - code_js_start, NETCONN_NOCOPY);
+			else{
+				p++;
 			}
-			else if(strstr(line, "GET /ap.json ")) {
-				/* if we can get the mutex, write the last version of the AP list */
-				if(wifi_manager_lock_json_buffer(( TickType_t ) 10)){
-					netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY);
-					char *buff = wifi_manager_get_ap_list_json();
-					netconn_write(conn, buff, strlen(buff), NETCONN_NOCOPY);
-					wifi_manager_unlock_json_buffer();
+		}
+
+		if((coding_length == 4 && strncasecmp(coding, "gzip", 4) == 0) || (coding_length == 6 && strncasecmp(coding, "x-gzip", 6) == 0)){
+			gzip = accepted;
+		}
+		else if(coding_length == 1 && *coding == '*'){
+			any = accepted;
+		}
+	}
+
+	return gzip >= 0 ? gzip : any > 0;
+}
+#endif
+
+
+/**
+ * @brief Writes one of the json documents maintained by the wifi manager.
+ *
+ * The entity tag is derived from the generation of the document, so a client polling a document that did not
+ * change since its last request gets an empty 304 answer.
+ *
+ * @param tag one character identifying the document in the entity tag.
+ * @param generation generation of the document as returned by the wifi manager.
+ * @param prefix text written before the json, NULL for none. The body then ends with suffix.
+ * @param suffix text written after the json when there is a prefix.
+ * @param weak true if the body can change while the document does not. It is then served with a weak entity tag.
+ */
+static err_t http_server_send_json(struct netconn *conn, const char *request, const http_parser_t *parser, char tag, uint32_t generation, const char *prefix, const char *json, const char *suffix, bool weak, bool keep_alive) {
+	char etag[16];
+	char etag_header[32];
+	size_t prefix_len = prefix ? strlen(prefix) : 0;
+	size_t suffix_len = prefix ? strlen(suffix) : 0;
+	size_t json_len = strlen(json);
+	err_t err;
+
+	snprintf(etag, sizeof(etag), "\"%c%08x\"", tag, generation);
+	snprintf(etag_header, sizeof(etag_header), "ETag: %s%s\r\n", weak ? "W/" : "", etag);
+
+	if(http_server_etag_matches(request, parser, etag)){
+		return http_server_send_not_modified(conn, http_304_json_hdr, etag_header, keep_alive);
+	}
+
+	/* the json can be regenerated as soon as the caller releases it: lwIP must own a copy */
+	err = http_server_send_head(conn, http_ok_json_revalidate_hdr, etag_header, prefix_len + json_len + suffix_len, keep_alive);
+	if(err == ERR_OK && prefix_len){
+		err = netconn_write(conn, prefix, prefix_len, NETCONN_COPY | NETCONN_MORE);
+	}
+	if(err == ERR_OK){
+		err = netconn_write(conn, json, json_len, NETCONN_COPY | (suffix_len ? NETCONN_MORE : 0));
+	}
+	if(err == ERR_OK && suffix_len){
+		err = netconn_write(conn, suffix, suffix_len, NETCONN_COPY);
+	}
+
+	return err;
+}
+
+
+/**
+ * @brief Decides if the connection can serve another request after this one.
+ *
+ * HTTP/1.1 clients keep the connection unless they send "Connection: close", HTTP/1.0 clients only if they
+ * explicitly ask for it. The connection is also closed once it served its share of requests or when other
+ * clients are waiting for a worker.
+ */
+static bool http_server_keep_alive(const char *request, const http_parser_t *parser, uint16_t requests) {
+	const http_token_t *connection = &parser->headers[HTTP_HEADER_CONNECTION];
+	bool keep_alive;
+
+	if(parser->version_minor >= 1){
+		keep_alive = !(connection->length == 5 && strncasecmp(request + connection->offset, "close", 5) == 0);
+	}
+	else{
+		keep_alive = connection->length == 10 && strncasecmp(request + connection->offset, "keep-alive", 10) == 0;
+	}
+
+	if(requests >= HTTP_SERVER_MAX_REQUESTS_PER_CONNECTION || uxQueueMessagesWaiting(http_server_connection_queue) > 0){
+		keep_alive = false;
+	}
+
+	return keep_alive;
+}
+
+
+/**
+ * @brief State of a connection being served.
+ */
+typedef struct {
+	struct netconn *conn;
+	http_parser_t parser;
+	char *buffer;				/* assembles a request spanning several segments, allocated on first use */
+	uint16_t buffer_length;		/* bytes of the pending request in buffer */
+	size_t discard;				/* bytes of a request body that still need to be skipped */
+	uint16_t requests;
+	bool keep_alive;
+	bool detached;				/* the connection was handed over and must neither be served nor closed anymore */
+} http_server_connection_t;
+
+
+/**
+ * @brief A route handler.
+ * @param request start of the request. Tokens of the parser are relative to it.
+ */
+typedef void (*http_server_handler_t)(http_server_connection_t *c, const char *request, const http_parser_t *parser);
+
+typedef struct {
+	http_method_t method;
+	uint8_t path_length;
+	const char *path;
+	http_server_handler_t handler;
+} http_server_route_t;
+
+
+static void http_server_get_ap_json(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	/* the version acquired stays valid while it is written, even if a scan publishes a new one meanwhile */
+	const wifi_manager_json_t *ap_list = wifi_manager_acquire_ap_list_json();
+	if(ap_list->json){
+		char prefix[HTTP_SERVER_AP_LIST_PREFIX_SIZE];
+		http_server_ap_list_prefix(prefix, sizeof(prefix), ap_list);
+		http_server_send_json(c->conn, request, parser, 'a', ap_list->generation, prefix, ap_list->json, http_ap_list_suffix, true, c->keep_alive);
+	}
+	else{
+		http_server_send_response(c->conn, http_503_hdr, NULL, NULL, 0, 0, c->keep_alive);
+	}
+	wifi_manager_release_json(ap_list);
+
+	/* request a wifi scan */
+	wifi_manager_scan_async();
+}
+
+static void http_server_get_status_json(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	const wifi_manager_json_t *ip_info = wifi_manager_acquire_ip_info_json();
+	if(ip_info->json){
+		http_server_send_json(c->conn, request, parser, 's', ip_info->generation, NULL, ip_info->json, NULL, false, c->keep_alive);
+	}
+	else{
+		http_server_send_response(c->conn, http_503_hdr, NULL, NULL, 0, 0, c->keep_alive);
+	}
+	wifi_manager_release_json(ip_info);
+}
+
+static void http_server_get_events(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	/* the stream is never framed: it lasts until either side closes the connection */
+	c->keep_alive = false;
+	if(http_server_events_task == NULL){
+		http_server_send_response(c->conn, http_503_hdr, NULL, NULL, 0, 0, c->keep_alive);
+		return;
+	}
+	if(netconn_write(c->conn, http_event_stream_hdr, sizeof(http_event_stream_hdr) - 1, NETCONN_NOCOPY) == ERR_OK &&
+			xQueueSendToBack(http_server_subscription_queue, &c->conn, 0) == pdTRUE){
+		c->detached = true;
+		xTaskNotify(http_server_events_task, HTTP_SERVER_EVENT_SUBSCRIBE, eSetBits);
+	}
+}
+
+static void http_server_delete_connect_json(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	ESP_LOGD(TAG, "DELETE /connect.json");
+
+	/* request a disconnection from wifi and forget about it */
+	wifi_manager_disconnect_async();
+	http_server_send_response(c->conn, http_ok_json_no_cache_hdr, NULL, NULL, 0, 0, c->keep_alive); /* 200 ok */
+}
+
+static void http_server_post_connect_json(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	ESP_LOGD(TAG, "POST /connect.json");
+
+	const http_token_t *ssid = &parser->headers[HTTP_HEADER_X_CUSTOM_SSID];
+	const http_token_t *password = &parser->headers[HTTP_HEADER_X_CUSTOM_PWD];
+
+	/* an open network has an empty password, but the header must still be present */
+	bool has_password = parser->found & (1u << HTTP_HEADER_X_CUSTOM_PWD);
+
+	if(ssid->length && ssid->length <= MAX_SSID_SIZE && has_password && password->length <= MAX_PASSWORD_SIZE){
+		/* the credentials travel with the command: ssid and password are not necessarily NUL terminated when they
+		 * use the full field */
+		wifi_manager_command_t command;
+		memset(&command, 0x00, sizeof(command));
+		command.id = WIFI_MANAGER_CMD_CONNECT;
+		memcpy(command.ssid, request + ssid->offset, ssid->length);
+		memcpy(command.password, request + password->offset, password->length);
+		ESP_LOGI(TAG, "New credentials: %.*s, %.*s", MAX_SSID_SIZE, command.ssid, MAX_PASSWORD_SIZE, command.password);
+
+		/* the wifi manager adds the network to the credential store once it connected */
+		if(wifi_manager_send_command(&command, 0) == ESP_OK){
+			http_server_send_response(c->conn, http_ok_json_no_cache_hdr, NULL, NULL, 0, 0, c->keep_alive); //200ok
+		}
+		else{
+			http_server_send_response(c->conn, http_503_hdr, NULL, NULL, 0, 0, c->keep_alive);
+		}
+	} else {
+		/* bad request the authentification header is not complete/not the correct format */
+		http_server_send_response(c->conn, http_400_hdr, NULL, NULL, 0, 0, c->keep_alive);
+	}
+}
+
+
+/**
+ * @brief Sends the JSON document written by format in the shared report buffer.
+ * @param format returns the length of the document, 0 if it does not fit.
+ */
+static void http_server_send_report(http_server_connection_t *c, size_t (*format)(char *buffer, size_t size)) {
+	size_t len = 0;
+
+	/* the buffer is shared: a request arriving while another one is served is told to retry */
+	if(!atomic_flag_test_and_set(&http_server_report_busy)){
+		len = format(http_server_report_buffer, sizeof(http_server_report_buffer));
+		if(len){
+			http_server_send_response(c->conn, http_ok_json_no_cache_hdr, NULL, http_server_report_buffer, len, NETCONN_COPY, c->keep_alive);
+		}
+		atomic_flag_clear(&http_server_report_busy);
+	}
+	if(len == 0){
+		http_server_send_response(c->conn, http_503_hdr, NULL, NULL, 0, 0, c->keep_alive);
+	}
+}
+
+
+static void http_server_get_metrics_json(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	http_server_send_report(c, metrics_format_json);
+}
+
+
+static void http_server_get_timeline_json(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	http_server_send_report(c, wifi_timeline_format_json);
+}
+
+
+#if TRACE_ENABLED
+static bool http_server_trace_write(const void *data, size_t size, void *context) {
+	return netconn_write((struct netconn*)context, data, size, NETCONN_COPY | NETCONN_MORE) == ERR_OK;
+}
+
+
+static void http_server_get_trace_bin(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+	/* the rings are copied by lwIP straight from memory: tasks keep recording while the dump is sent */
+	if(http_server_send_head(c->conn, http_ok_trace_hdr, NULL, trace_dump_size(), c->keep_alive) != ERR_OK || !trace_dump(http_server_trace_write, c->conn)){
+		c->keep_alive = false;
+	}
+}
+#endif
+
+
+/* dynamic resources served by the HTTP server. Static files are in http_assets. */
+#define HTTP_SERVER_ROUTE(method, path, handler) { method, sizeof(path) - 1, path, handler }
+static const http_server_route_t http_server_routes[] = {
+	HTTP_SERVER_ROUTE(HTTP_METHOD_GET, "/ap.json", http_server_get_ap_json),
+	HTTP_SERVER_ROUTE(HTTP_METHOD_GET, "/status.json", http_server_get_status_json),
+	HTTP_SERVER_ROUTE(HTTP_METHOD_GET, "/events", http_server_get_events),
+	HTTP_SERVER_ROUTE(HTTP_METHOD_DELETE, "/connect.json", http_server_delete_connect_json),
+	HTTP_SERVER_ROUTE(HTTP_METHOD_POST, "/connect.json", http_server_post_connect_json),
+	HTTP_SERVER_ROUTE(HTTP_METHOD_GET, "/metrics.json", http_server_get_metrics_json),
+	HTTP_SERVER_ROUTE(HTTP_METHOD_GET, "/timeline.json", http_server_get_timeline_json),
+#if TRACE_ENABLED
+	HTTP_SERVER_ROUTE(HTTP_METHOD_GET, "/trace.bin", http_server_get_trace_bin),
+#endif
+};
+#define HTTP_SERVER_ROUTE_COUNT		(sizeof(http_server_routes) / sizeof(http_server_routes[0]))
+
+/* @brief requests that match no route are counted as these */
+#define HTTP_SERVER_ROUTE_ASSET		(HTTP_SERVER_ROUTE_COUNT)
+#define HTTP_SERVER_ROUTE_REDIRECT	(HTTP_SERVER_ROUTE_COUNT + 1)
+#define HTTP_SERVER_ROUTE_NOT_FOUND	(HTTP_SERVER_ROUTE_COUNT + 2)
+
+
+/**
+ * @brief Names the routes requests are counted for in the metrics.
+ */
+static void http_server_register_routes() {
+	static const char * const methods[] = { "?", "GET", "POST", "DELETE" };
+
+	for(int i = 0; i < HTTP_SERVER_ROUTE_COUNT; i++){
+		metrics_register_route(i, methods[http_server_routes[i].method], http_server_routes[i].path);
+	}
+	metrics_register_route(HTTP_SERVER_ROUTE_ASSET, "GET", "(asset)");
+	metrics_register_route(HTTP_SERVER_ROUTE_REDIRECT, "*", "(redirect)");
+	metrics_register_route(HTTP_SERVER_ROUTE_NOT_FOUND, "*", "(not found)");
+}
+
+
+/**
+ * @brief Tells if a Host header names the softAP: DEFAULT_AP_IP alone, or followed by a port.
+ */
+static bool http_server_host_is_ap(const char *host, size_t length) {
+	const size_t ip_length = sizeof(DEFAULT_AP_IP) - 1;
+
+	if(length < ip_length || memcmp(host, DEFAULT_AP_IP, ip_length) != 0) return false;
+	if(length == ip_length) return true;
+
+	/* ":" and 1 to 5 digits */
+	if(host[ip_length] != ':' || length < ip_length + 2 || length > ip_length + 6) return false;
+	for(size_t i = ip_length + 1; i < length; i++){
+		if(host[i] < '0' || host[i] > '9') return false;
+	}
+	return true;
+}
+
+
+/**
+ * @brief Finds the handler of a parsed request and runs it.
+ */
+static void http_server_dispatch(http_server_connection_t *c, const char *request, const http_parser_t *parser) {
+
+	/* If a Host header is included, redirect to our IP. A port can follow the address. */
+	const http_token_t *host = &parser->headers[HTTP_HEADER_HOST];
+	if (host->length && !http_server_host_is_ap(request + host->offset, host->length)) {
+		metrics_count_route(HTTP_SERVER_ROUTE_REDIRECT);
+		http_server_send_response(c->conn, http_redirect_hdr, NULL, NULL, 0, 0, c->keep_alive);
+		return;
+	}
+
+	const char *path = request + parser->path.offset;
+	for(int i = 0; i < HTTP_SERVER_ROUTE_COUNT; i++){
+		const http_server_route_t *route = &http_server_routes[i];
+		if(route->method == parser->method && route->path_length == parser->path.length && memcmp(route->path, path, route->path_length) == 0){
+			metrics_count_route(i);
+			route->handler(c, request, parser);
+			return;
+		}
+	}
+
+	if(parser->method == HTTP_METHOD_GET){
+		for(int i = 0; i < http_assets_count; i++){
+			const http_asset_t *asset = &http_assets[i];
+			if(asset->path_length == parser->path.length && memcmp(asset->path, path, asset->path_length) == 0){
+				const http_asset_representation_t *representation = &asset->gzip;
+#if HTTP_ASSETS_IDENTITY
+				if(!http_server_accepts_gzip(request, parser)){
+					representation = &asset->identity;
+				}
+#endif
+				metrics_count_route(HTTP_SERVER_ROUTE_ASSET);
+				if(http_server_etag_matches(request, parser, representation->etag)){
+					http_server_send_not_modified(c->conn, representation->header_not_modified, NULL, c->keep_alive);
 				}
 				else{
-					netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
-					ESP_LOGD(TAG, "GET /ap.json failed to obtain mutex");
+					http_server_send_response(c->conn, representation->header, NULL, representation->data, representation->length, NETCONN_NOCOPY, c->keep_alive);
 				}
-				/* request a wifi scan */
-				wifi_manager_scan_async();
+				return;
 			}
-			else if(strstr(line, "GET /style.css ")) {
-				netconn_write(conn, http_css_hdr, sizeof(http_css_hdr) - 1, NETCONN_NOCOPY);
-				netconn_write(conn, style_css_start, style_css_end - style_css_start, NETCONN_NOCOPY);
+		}
+	}
+
+	metrics_count_route(HTTP_SERVER_ROUTE_NOT_FOUND);
+	http_server_send_response(c->conn, http_404_hdr, NULL, NULL, 0, 0, c->keep_alive);
+}
+
+
+
+
+/**
+ * @brief Runs the request whose header block was fully parsed.
+ */
+static void http_server_complete_request(http_server_connection_t *c, const char *request) {
+	c->discard = c->parser.content_length;
+	c->requests++;
+	c->keep_alive = http_server_keep_alive(request, &c->parser, c->requests);
+
+	int64_t start = esp_timer_get_time();
+	http_server_dispatch(c, request, &c->parser);
+	metrics_observe(METRICS_HTTP_SERVICE_TIME, esp_timer_get_time() - start);
+}
+
+
+/**
+ * @brief Gets a buffer of HTTP_SERVER_REQUEST_BUFFER_SIZE bytes to assemble a request.
+ * @return NULL if none is available.
+ */
+static char* http_server_alloc_request_buffer() {
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	for(int i = 0; i < HTTP_SERVER_WORKER_COUNT; i++){
+		bool used = false;
+		if(atomic_compare_exchange_strong(&http_server_arena.request_buffer_used[i], &used, true)){
+			return http_server_arena.request_buffers[i];
+		}
+	}
+	return NULL;
+#else
+	return (char*)malloc(HTTP_SERVER_REQUEST_BUFFER_SIZE);
+#endif
+}
+
+
+/**
+ * @brief Gives back a buffer obtained from http_server_alloc_request_buffer. NULL is ignored.
+ */
+static void http_server_free_request_buffer(char *buffer) {
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	for(int i = 0; i < HTTP_SERVER_WORKER_COUNT; i++){
+		if(buffer == http_server_arena.request_buffers[i]){
+			atomic_store(&http_server_arena.request_buffer_used[i], false);
+		}
+	}
+#else
+	free(buffer);
+#endif
+}
+
+
+/**
+ * @brief Feeds a received fragment to the connection.
+ *
+ * Requests entirely contained in the fragment are parsed and served in place. Only a request that
+ * continues in a later fragment is copied to the connection buffer, up to HTTP_SERVER_REQUEST_BUFFER_SIZE.
+ */
+static void http_server_receive(http_server_connection_t *c, const char *data, u16_t len) {
+
+	u16_t offset = 0;
+
+	while(c->keep_alive && offset < len) {
+
+		if(c->discard) {
+			u16_t skip = (len - offset) < c->discard ? (len - offset) : (u16_t)c->discard;
+			offset += skip;
+			c->discard -= skip;
+			continue;
+		}
+
+		http_parser_status_t status;
+
+		if(c->buffer_length == 0) {
+			/* common case: parse the request where it lies */
+			const char *request = data + offset;
+			http_parser_init(&c->parser);
+			status = http_parser_execute(&c->parser, request, len - offset);
+			if(status == HTTP_PARSER_DONE) {
+				offset += c->parser.header_length;
+				http_server_complete_request(c, request);
+				continue;
 			}
-			else if(strstr(line, "GET /status.json ")){
-				if(wifi_manager_lock_json_buffer(( TickType_t ) 10)){
-					char *buff = wifi_manager_get_ip_info_json();
-					if(buff){
-						netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY);
-						netconn_write(conn, buff, strlen(buff), NETCONN_NOCOPY);
-						wifi_manager_unlock_json_buffer();
-					}
-					else{
-						netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
-					}
+			else if(status == HTTP_PARSER_INCOMPLETE) {
+				/* the rest of the request is in a later fragment: keep what we have. The parser resumes
+				 * from its position since the buffer also starts with the request. */
+				if(c->buffer == NULL) {
+					c->buffer = http_server_alloc_request_buffer();
 				}
-				else{
-					netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
-					ESP_LOGD(TAG, "GET /status failed to obtain mutex");
+				if(c->buffer == NULL || len - offset > HTTP_SERVER_REQUEST_BUFFER_SIZE) {
+					http_server_send_response(c->conn, c->buffer ? http_431_hdr : http_503_hdr, NULL, NULL, 0, 0, false);
+					c->keep_alive = false;
+					break;
 				}
+				memcpy(c->buffer, request, len - offset);
+				c->buffer_length = len - offset;
+				offset = len;
+				continue;
 			}
-			else if(strstr(line, "DELETE /connect.json ")) {
-				ESP_LOGD(TAG, "DELETE /connect.json");
-
-				/* request a disconnection from wifi and forget about it */
-				wifi_manager_disconnect_async();
-				netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); /* 200 ok */
+		}
+		else {
+			/* append only what fits: anything past the header block belongs to the body or the next request */
+			u16_t previous_length = c->buffer_length;
+			u16_t chunk = len - offset;
+			if(chunk > HTTP_SERVER_REQUEST_BUFFER_SIZE - previous_length) {
+				chunk = HTTP_SERVER_REQUEST_BUFFER_SIZE - previous_length;
 			}
-			else if(strstr(line, "POST /connect.json ")) {
-				ESP_LOGD(TAG, "POST /connect.json");
-
-
-				int lenS = 0, lenP = 0;
-				char *ssid = NULL, *password = NULL;
-				ssid = http_server_get_header(save_ptr, "X-Custom-ssid: ", &lenS);
-				password = http_server_get_header(save_ptr, "X-Custom-pwd: ", &lenP);
-
-				if(ssid && lenS <= MAX_SSID_SIZE && password && lenP <= MAX_PASSWORD_SIZE){
-					wifi_config_t * config = wifi_manager_get_sta_config();
-					snprintf((char *)&config->sta.ssid, MAX_SSID_SIZE, "%.*s", lenS, ssid);
-					snprintf((char *)&config->sta.password, MAX_PASSWORD_SIZE, "%.*s", lenP, password);
-					ESP_LOGI(TAG, "New credentials: %s, %s", config->sta.ssid, config->sta.password);
-					wifi_manager_save_sta_config(config);
-
-					ESP_LOGD(TAG, "wifi_manager_connect_async() call");
-					wifi_manager_connect_async();
-					netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); //200ok
-				} else {
-					/* bad request the authentification header is not complete/not the correct format */
-					netconn_write(conn, http_400_hdr, sizeof(http_400_hdr) - 1, NETCONN_NOCOPY);
-				}
+			memcpy(c->buffer + previous_length, data + offset, chunk);
+			c->buffer_length += chunk;
 
+			status = http_parser_execute(&c->parser, c->buffer, c->buffer_length);
+			if(status == HTTP_PARSER_DONE) {
+				offset += c->parser.header_length - previous_length;
+				c->buffer_length = 0;
+				http_server_complete_request(c, c->buffer);
+				continue;
 			}
-			else{
-				netconn_write(conn, http_400_hdr, sizeof(http_400_hdr) - 1, NETCONN_NOCOPY);
+			else if(status == HTTP_PARSER_INCOMPLETE) {
+				if(c->buffer_length == HTTP_SERVER_REQUEST_BUFFER_SIZE) {
+					http_server_send_response(c->conn, http_431_hdr, NULL, NULL, 0, 0, false);
+					c->keep_alive = false;
+					break;
+				}
+				offset += chunk;
+				continue;
 			}
 		}
-		else{
-			netconn_write(conn, http_404_hdr, sizeof(http_404_hdr) - 1, NETCONN_NOCOPY);
+
+		/* malformed header block */
+		http_server_send_response(c->conn, http_400_hdr, NULL, NULL, 0, 0, false);
+		c->keep_alive = false;
+	}
+}
+
+
+void http_server_netconn_serve(struct netconn *conn) {
+
+	struct netbuf *inbuf;
+	char *buf = NULL;
+	u16_t buflen;
+	err_t err;
+	http_server_connection_t c = {
+		.conn = conn,
+		.buffer = NULL,
+		.buffer_length = 0,
+		.discard = 0,
+		.requests = 0,
+		.keep_alive = true,
+		.detached = false
+	};
+
+	while(c.keep_alive) {
+
+		err = netconn_recv(conn, &inbuf);
+		if(err != ERR_OK) {
+			/* client closed the connection or it was idle for too long */
+			break;
 		}
+
+		/* a netbuf can be a chain of pbufs: walk every fragment */
+		do {
+			netbuf_data(inbuf, (void**)&buf, &buflen);
+			http_server_receive(&c, buf, buflen);
+		} while(c.keep_alive && netbuf_next(inbuf) >= 0);
+
+		/* free the buffer */
+		netbuf_delete(inbuf);
+
+		if(c.detached) {
+			break;
+		}
+
+		/* waiting for the next request is bound by the idle timeout */
+		netconn_set_recvtimeout(conn, HTTP_SERVER_KEEP_ALIVE_TIMEOUT_MS);
 	}
 
-	/* free the buffer */
-	netbuf_delete(inbuf);
+	http_server_free_request_buffer(c.buffer);
+
+	if(!c.detached) {
+		TRACE(TRACE_HTTP_CLOSE, TRACE_OBJECT_NONE, (uintptr_t)conn);
+		netconn_close(conn);
+		netconn_delete(conn);
+	}
 }
@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file ap_table.h
+@brief Table of the access points seen by successive wifi scans.
+
+Access points are keyed by BSSID. Every scan updates the entries it sees and smooths their
+signal strength, entries not seen for a while expire, and the table is kept sorted from the
+strongest to the weakest signal so the list can be served as is.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef AP_TABLE_H_INCLUDED
+#define AP_TABLE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Defines the number of access points the table can hold. */
+#define AP_TABLE_SIZE				MAX_AP_NUM
+
+/** @brief Defines the time in ms after which an access point no scan has seen is removed from the table. */
+#define AP_TABLE_MAX_AGE_MS			60000
+
+/**
+ * @brief Defines the weight of a new measurement in the smoothed signal strength, as a power of two.
+ *
+ * Each scan moves the smoothed value 1/2^AP_TABLE_RSSI_EWMA_SHIFT of the way towards the new measurement.
+ * 0 disables smoothing.
+ */
+#define AP_TABLE_RSSI_EWMA_SHIFT	2
+
+/** @brief Defines the load an access point puts on its channel, whatever its signal strength. */
+#define AP_TABLE_CHANNEL_AP_WEIGHT	10
+
+/** @brief Defines the signal strength in dBm above which an access point adds 1 to the load per dBm. */
+#define AP_TABLE_CHANNEL_RSSI_FLOOR	-95
+
+
+typedef struct {
+	uint8_t bssid[6];
+	uint8_t ssid[33];
+	uint8_t primary;				/* channel */
+	wifi_second_chan_t second;		/* secondary channel of 40 MHz access points */
+	wifi_auth_mode_t authmode;
+	int16_t rssi_avg;				/* smoothed signal strength in 1/16 dBm */
+	uint32_t ssid_hash;				/* speeds up the comparison of ssids */
+	TickType_t last_seen;
+} ap_table_entry_t;
+
+
+/**
+ * @brief Empties the table.
+ */
+void ap_table_clear();
+
+/**
+ * @brief Merges the records returned by a scan, or by the scan of some channels only, into the table.
+ *
+ * Known access points are updated, new ones are added. Once the table is full, a new access point only
+ * replaces the weakest one if its signal is stronger.
+ */
+void ap_table_update(const wifi_ap_record_t *records, uint16_t count);
+
+/**
+ * @brief Removes the access points not seen for AP_TABLE_MAX_AGE_MS.
+ */
+void ap_table_expire();
+
+/** @brief Gets the number of access points in the table. */
+uint16_t ap_table_count();
+
+/**
+ * @brief Gets an access point. Entries are sorted by decreasing smoothed signal strength.
+ * @param index from 0 to ap_table_count() - 1.
+ */
+const ap_table_entry_t* ap_table_get(uint16_t index);
+
+/**
+ * @brief Gets the smoothed signal strength of an access point in dBm.
+ */
+int8_t ap_table_rssi(const ap_table_entry_t *entry);
+
+/**
+ * @brief Tells if an access point with a stronger signal has the same ssid.
+ *
+ * Mesh networks broadcast the same ssid from many access points: listing the strongest one is enough
+ * to connect.
+ */
+bool ap_table_is_duplicate(uint16_t index);
+
+/** @brief Gets the RAM in bytes taken by the table. @see wifi_manager_get_static_size */
+size_t ap_table_get_static_size();
+
+/**
+ * @brief Gets the size of the buffer needed to list every access point of the table in json.
+ *
+ * Room is kept for ssids needing some escaping: ssids made of control characters may not fit.
+ */
+size_t ap_table_json_size();
+
+/**
+ * @brief Writes the access point list served as /ap.json.
+ *
+ * Access points are listed by decreasing signal strength, only the strongest one of each ssid. When the buffer
+ * is too small the weakest access points are left out: the json stays valid.
+ * @param size size of buffer, at least 4 bytes.
+ * @return the length of the json, terminating NUL excluded.
+ */
+size_t ap_table_format_json(char *buffer, size_t size);
+
+/**
+ * @brief Scores the congestion of a 2.4 GHz channel from the access points in the table.
+ *
+ * Every access point adds AP_TABLE_CHANNEL_AP_WEIGHT plus its signal strength above AP_TABLE_CHANNEL_RSSI_FLOOR
+ * to the channels it uses. Channels are 5 MHz apart for 20 MHz wide signals: an access point also loads the
+ * 4 channels on each side of it, less and less the further away they are. 40 MHz access points load the
+ * channels around their secondary channel as well.
+ *
+ * @param ht40 true to score a 40 MHz signal, whose secondary channel is assumed above the primary up to
+ * channel 7 and below it from channel 8.
+ * @return the load, 0 if no access point overlaps the channel.
+ */
+uint32_t ap_table_channel_load(uint8_t channel, bool ht40);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AP_TABLE_H_INCLUDED */
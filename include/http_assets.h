@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+@file http_assets.h
+@brief Static table of the files served by the HTTP server.
+
+The table itself is generated at build time by tools/gen_assets.py from the
+content of the assets folder: every file is minified, gzipped and fingerprinted.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef HTTP_ASSETS_H_INCLUDED
+#define HTTP_ASSETS_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Defines whether the uncompressed content of the assets is built in, for clients that do not accept gzip.
+ *
+ * It roughly triples the flash used by the assets. When disabled every client gets the gzipped content:
+ * all browsers accept it, but a client refusing gzip will not be able to use the portal.
+ */
+#ifndef HTTP_ASSETS_IDENTITY
+#define HTTP_ASSETS_IDENTITY	0
+#endif
+
+/**
+ * @brief One encoding of a file.
+ */
+typedef struct {
+	const char *header;		/* status line and headers: content type, encoding, caching policy and ETag */
+	const char *header_not_modified; /* status line and headers of the 304 answer to a matching If-None-Match */
+	const char *etag;		/* quoted strong entity tag, different for each encoding */
+	const uint8_t *data;
+	uint32_t length;
+} http_asset_representation_t;
+
+/**
+ * @brief A file that can be served as is.
+ */
+typedef struct {
+	const char *path;		/* URL path of the file, fingerprinted or not */
+	uint8_t path_length;
+	http_asset_representation_t gzip;
+	http_asset_representation_t identity;	/* all NULL unless HTTP_ASSETS_IDENTITY is set */
+} http_asset_t;
+
+/** @brief all files served by the HTTP server */
+extern const http_asset_t http_assets[];
+
+/** @brief number of entries in http_assets */
+extern const size_t http_assets_count;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTTP_ASSETS_H_INCLUDED */
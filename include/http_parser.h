@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_parser.h
+@brief Incremental, zero-copy parser for the request line and headers of an HTTP request.
+
+The parser never writes into the request: it records the offset and length of the
+method, path, query string and of the handful of headers the server cares about.
+It can be fed a buffer that grows as more data is received and resumes where it
+stopped, so every byte of the request is examined exactly once.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef HTTP_PARSER_H_INCLUDED
+#define HTTP_PARSER_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum http_method_t {
+	HTTP_METHOD_UNKNOWN = 0,
+	HTTP_METHOD_GET = 1,
+	HTTP_METHOD_POST = 2,
+	HTTP_METHOD_DELETE = 3
+}http_method_t;
+
+/**
+ * @brief Headers extracted by the parser. All other headers are skipped.
+ * @note Names are matched case insensitively as per RFC 7230.
+ */
+typedef enum http_header_t {
+	HTTP_HEADER_HOST = 0,
+	HTTP_HEADER_CONNECTION = 1,
+	HTTP_HEADER_CONTENT_LENGTH = 2,
+	HTTP_HEADER_X_CUSTOM_SSID = 3,
+	HTTP_HEADER_X_CUSTOM_PWD = 4,
+	HTTP_HEADER_IF_NONE_MATCH = 5,
+	HTTP_HEADER_ACCEPT_ENCODING = 6,
+	HTTP_HEADER_COUNT
+}http_header_t;
+
+typedef enum http_parser_status_t {
+	HTTP_PARSER_INCOMPLETE = 0,
+	HTTP_PARSER_DONE = 1,
+	HTTP_PARSER_ERROR = 2
+}http_parser_status_t;
+
+/**
+ * @brief Location of a token inside the request.
+ */
+typedef struct {
+	uint16_t offset;
+	uint16_t length;
+} http_token_t;
+
+typedef struct {
+	/* parsing state: do not use */
+	uint8_t state;
+	uint8_t candidates;
+	uint8_t name_length;
+	int8_t header;
+	uint16_t position;
+	uint16_t mark;
+
+	/* results, valid once HTTP_PARSER_DONE is returned */
+	http_method_t method;
+	http_token_t path;
+	http_token_t query;
+	uint8_t version_minor;
+	http_token_t headers[HTTP_HEADER_COUNT];
+	uint8_t found; /* bit n is set when header n is present, even with an empty value */
+	uint32_t content_length;
+	uint16_t header_length; /* size of the request line and headers including the terminating blank line */
+} http_parser_t;
+
+
+/**
+ * @brief Resets the parser so it can process a new request.
+ */
+void http_parser_init(http_parser_t *parser);
+
+/**
+ * @brief Parses the request contained in data.
+ *
+ * data must always point to the first byte of the request. When more bytes are received the same parser
+ * can be called again with the larger buffer: parsing resumes where it previously stopped.
+ *
+ * @param data start of the request.
+ * @param length number of bytes currently available.
+ * @return HTTP_PARSER_DONE once the blank line ending the headers was found, HTTP_PARSER_INCOMPLETE if more
+ * data is needed and HTTP_PARSER_ERROR if the request is malformed.
+ */
+http_parser_status_t http_parser_execute(http_parser_t *parser, const char *data, uint16_t length);
+
+/**
+ * @brief Compares a token to a string.
+ * @return true if the token is exactly str.
+ */
+bool http_parser_token_equals(const char *data, const http_token_t *token, const char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTTP_PARSER_H_INCLUDED */
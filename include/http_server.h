@@ -40,11 +40,111 @@ extern "C" {
 
 #define HTTP_SERVER_START_BIT_0	( 1 << 0 )
 
+/**
+ * @brief Defines the number of worker tasks serving HTTP connections in parallel.
+ *
+ * By default there is one worker per client the softAP accepts so that a slow device
+ * cannot stall page loads for everyone else.
+ */
+#define HTTP_SERVER_WORKER_COUNT		AP_MAX_CONNECTIONS
+
+/** @brief Defines the stack size in bytes of each HTTP worker task. */
+#define HTTP_SERVER_WORKER_STACK_SIZE	3072
+
+/** @brief Defines how many accepted connections can wait for a free worker before the listener blocks. */
+#define HTTP_SERVER_BACKLOG_SIZE		AP_MAX_CONNECTIONS
+
+/** @brief Defines the time in ms a worker waits for a client to send its request before giving up. */
+#define HTTP_SERVER_RECV_TIMEOUT_MS		5000
+
+/** @brief Defines the time in ms an idle persistent connection waits for the next request before it is closed. */
+#define HTTP_SERVER_KEEP_ALIVE_TIMEOUT_MS	3000
+
+/**
+ * @brief Defines the size in bytes of the buffer assembling a request whose header block spans several segments.
+ *
+ * Requests received in a single segment are parsed in place and never use it. Larger header blocks are answered
+ * with a 431 status.
+ */
+#define HTTP_SERVER_REQUEST_BUFFER_SIZE	2048
+
+/** @brief Defines the maximum number of requests served over a single persistent connection. */
+#define HTTP_SERVER_MAX_REQUESTS_PER_CONNECTION	100
+
+/** @brief Defines the maximum number of clients subscribed to the /events stream at the same time. */
+#define HTTP_SERVER_MAX_EVENT_CLIENTS	AP_MAX_CONNECTIONS
+
+/**
+ * @brief Defines the period in ms at which /events clients receive a keep-alive.
+ *
+ * A wifi scan is also requested at this pace for as long as a client is subscribed, since the stream
+ * replaces the polling of /ap.json that used to trigger scans.
+ */
+#define HTTP_SERVER_EVENTS_PERIOD_MS	10000
+
+/** @brief Defines the time in ms an /events client has to accept data before it is dropped. */
+#define HTTP_SERVER_EVENTS_SEND_TIMEOUT_MS	2000
+
+/**
+ * @brief Defines the size in bytes of the buffer /metrics.json and /timeline.json are written in.
+ *
+ * The whole timeline always fits, and the metrics get at least 3 KB.
+ */
+#define HTTP_SERVER_REPORT_SIZE			(WIFI_TIMELINE_JSON_SIZE > 3072 ? WIFI_TIMELINE_JSON_SIZE : 3072)
+
+/** @brief Defines how often in ms the listening task checks whether the server was stopped. */
+#define HTTP_SERVER_ACCEPT_TIMEOUT_MS	1000
 
+/** @brief Defines the stack size in bytes of the task pushing events to /events clients. */
+#define HTTP_SERVER_EVENTS_STACK_SIZE	2560
+
+
+/**
+ * @brief Main task for the HTTP server.
+ *
+ * Listens on port 80 and hands every accepted connection over to a pool of
+ * HTTP_SERVER_WORKER_COUNT worker tasks. Workers run at the priority of this task.
+ */
 void http_server(void *pvParameters);
+/**
+ * @brief Serves all requests of a connection, then closes and deletes it.
+ *
+ * Requests are processed in order for as long as the connection is persistent: until the client asks to
+ * close it, stays idle for HTTP_SERVER_KEEP_ALIVE_TIMEOUT_MS or reaches HTTP_SERVER_MAX_REQUESTS_PER_CONNECTION.
+ * A connection subscribing to /events is handed over to the event task instead of being closed.
+ */
 void http_server_netconn_serve(struct netconn *conn);
 void http_server_set_event_start();
 
+/**
+ * @brief Stops listening on port 80 and closes the /events streams.
+ *
+ * Connections already accepted are served to completion. The worker tasks stay idle until
+ * http_server_set_event_start is called again.
+ */
+void http_server_set_event_stop();
+
+/**
+ * @brief Gets the RAM in bytes the http server takes in static storage: the report buffer and the /events client
+ * list, plus its tasks, queues and request buffers when WIFI_MANAGER_STATIC_ALLOCATION is set.
+ * @see wifi_manager_get_static_size
+ */
+size_t http_server_get_static_size();
+
+/**
+ * @brief Pushes the access point list json to /events clients.
+ *
+ * Called by the wifi manager every time the list is regenerated. Notifications are coalesced: only the latest
+ * version of the json is sent. Safe to call before the server is started.
+ */
+void http_server_notify_ap_list();
+
+/**
+ * @brief Pushes the connection status json to /events clients.
+ * @see http_server_notify_ap_list
+ */
+void http_server_notify_status();
+
 /**
  * @brief gets a char* pointer to the first occurence of header_name withing the complete http request request.
  *
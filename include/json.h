@@ -32,13 +32,27 @@ OTHER DEALINGS IN THE SOFTWARE.
 extern "C" {
 #endif
 
+/**
+ * @brief Size of a buffer large enough for the JSON string of a cstring of length n: quotes, escape sequences
+ * and terminating NUL included.
+ */
+#define JSON_ESCAPED_SIZE(n)	(6 * (n) + 3)
+
 /**
  * @brief Render the cstring provided to a JSON escaped version that can be printed.
- * @param input the input buffer to be escaped.
- * @param output_buffer the output buffer to write to. You must ensure it is big enough to contain the final string.
- * @see cJSON equivlaent static cJSON_bool print_string_ptr(const unsigned char * const input, printbuffer * const output_buffer)
+ *
+ * Quotes, backslashes and control characters are escaped, all other bytes are copied as is.
+ *
+ * @param input the input buffer to be escaped. NULL is rendered as an empty string.
+ * @param input_size maximum number of characters to read from input. Reading stops earlier at a NUL character,
+ * so fixed size fields that are not always terminated can be passed directly. All input_size bytes must be
+ * readable though: they are tested a word at a time, a few bytes past the NUL can be read.
+ * @param output_buffer the output buffer to write to.
+ * @param output_size size of output_buffer. JSON_ESCAPED_SIZE(input_size) is always enough.
+ * @return the length of the JSON string written, quotes included and terminating NUL excluded.
+ * 0 if it does not fit in output_buffer, which then holds an empty cstring.
  */
-bool json_print_string(const unsigned char *input, unsigned char *output_buffer);
+size_t json_print_string(const unsigned char *input, size_t input_size, unsigned char *output_buffer, size_t output_size);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file metrics.h
+@brief In-memory metrics of the wifi manager and the HTTP server, served as /metrics.json.
+
+Counters and histograms are fixed size arrays of atomics updated with relaxed atomic adds: recording a
+measurement never takes a lock nor allocates memory, and can be done from any task. Readers get a
+snapshot that is consistent per value, not across values.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Defines the number of buckets of a histogram. The last one counts everything above the others. */
+#define METRICS_HISTOGRAM_BUCKETS		20
+
+/** @brief Defines the upper bound in µs of the first bucket of a histogram. Each bucket doubles the previous bound. */
+#define METRICS_HISTOGRAM_FIRST_BOUND_US	128
+
+/** @brief Defines the number of routes requests are counted for. */
+#define METRICS_MAX_ROUTES				12
+
+/** @brief Defines the number of tasks whose stack high-water mark is reported. */
+#define METRICS_MAX_TASKS				8
+
+/**
+ * @brief Defines the number of disconnection reasons counted separately.
+ * Reasons from 200 on are specific to the esp32 and counted after the standard ones, the others are counted as 0.
+ */
+#define METRICS_DISCONNECT_REASONS		72
+
+typedef enum metrics_counter_t {
+	METRICS_HTTP_2XX = 0,
+	METRICS_HTTP_3XX = 1,
+	METRICS_HTTP_4XX = 2,
+	METRICS_HTTP_5XX = 3,
+	METRICS_HTTP_503 = 4,				/* also counted in METRICS_HTTP_5XX */
+	METRICS_HTTP_BYTES = 5,				/* status lines, headers and bodies of responses */
+	METRICS_JSON_LOCK_TIMEOUTS = 6,		/* wifi_manager_lock_json_buffer calls that gave up */
+	METRICS_WIFI_CONNECTS = 7,			/* connection attempts that got an IP */
+	METRICS_WIFI_CONNECT_FAILURES = 8,	/* a failed targeted attempt followed by a full scan counts once for each */
+	METRICS_COUNTER_COUNT
+}metrics_counter_t;
+
+typedef enum metrics_histogram_t {
+	METRICS_HTTP_SERVICE_TIME = 0,		/* from a complete request to its response handed to lwIP */
+	METRICS_JSON_LOCK_WAIT = 1,			/* wait for wifi_manager_json_mutex */
+	METRICS_WIFI_SCAN_TIME = 2,			/* scans of all channels */
+	METRICS_WIFI_CONNECT_TIME = 3,		/* from a connection request to an IP, successful attempts only */
+	METRICS_HISTOGRAM_COUNT
+}metrics_histogram_t;
+
+
+/**
+ * @brief Adds value to a counter.
+ */
+void metrics_add(metrics_counter_t counter, uint32_t value);
+
+/**
+ * @brief Records a duration in a histogram.
+ */
+void metrics_observe(metrics_histogram_t histogram, uint32_t duration_us);
+
+/**
+ * @brief Counts a response by status class, and its size.
+ */
+void metrics_count_response(uint16_t status, uint32_t bytes);
+
+/**
+ * @brief Names a route. Both strings must stay valid: they are not copied.
+ * @param route from 0 to METRICS_MAX_ROUTES - 1.
+ */
+void metrics_register_route(uint8_t route, const char *method, const char *path);
+
+/**
+ * @brief Counts a request to a route registered with metrics_register_route.
+ */
+void metrics_count_route(uint8_t route);
+
+/**
+ * @brief Counts a disconnection of the STA interface.
+ * @param reason as reported by SYSTEM_EVENT_STA_DISCONNECTED.
+ */
+void metrics_count_disconnect(uint8_t reason);
+
+/**
+ * @brief Adds the calling task to the tasks whose stack high-water mark is reported.
+ */
+void metrics_register_task();
+
+/** @brief Gets the RAM in bytes taken by the counters, histograms and task list. @see wifi_manager_get_static_size */
+size_t metrics_get_static_size();
+
+/**
+ * @brief Writes all metrics as a json document.
+ * @return the length of the json, 0 if it does not fit in size.
+ */
+size_t metrics_format_json(char *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H_INCLUDED */
@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file trace.h
+@brief Binary trace of the events of the wifi manager and the HTTP server, served as /trace.bin.
+
+Each core records into its own ring of fixed size records. A writer claims a slot with an atomic increment of
+the head of the ring of its core, fills it and stamps it with its sequence number last: recording never takes a
+lock and never blocks, and the oldest records are overwritten. A reader can copy the rings at any time: records
+overwritten while it copies have a sequence number that does not match their slot and are dropped by
+tools/trace_decode.py, which turns a dump into the Chrome trace format.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Defines whether events are traced.
+ * When 0 the TRACE macros compile to nothing, the rings take no memory and /trace.bin is not served.
+ */
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED					0
+#endif
+
+/** @brief Defines the number of records of the ring of each core. Must be a power of 2 no larger than 32768. */
+#define TRACE_RING_SIZE					256
+
+/** @brief Defines the number of tasks named in a dump. Records of other tasks are identified by their handle. */
+#define TRACE_MAX_TASKS					12
+
+/** @brief Identifies a dump: "WMTR" in little endian. */
+#define TRACE_MAGIC						0x52544d57
+
+/** @brief Defines the version of the dump format, increased with every incompatible change. */
+#define TRACE_VERSION					1
+
+typedef enum trace_event_t {
+	TRACE_EVENT_GROUP_SET = 1,		/* arg: bits */
+	TRACE_EVENT_GROUP_CLEAR = 2,	/* arg: bits */
+	TRACE_MUTEX_WAIT = 3,			/* arg: ticks to wait */
+	TRACE_MUTEX_TAKE = 4,			/* arg: 1 if taken, 0 on timeout */
+	TRACE_MUTEX_GIVE = 5,
+	TRACE_HTTP_ACCEPT = 6,			/* arg: netconn */
+	TRACE_HTTP_CLOSE = 7,			/* arg: netconn */
+	TRACE_SCAN_START = 8,			/* arg: channel, 0 for all */
+	TRACE_SCAN_END = 9,				/* arg: access points found */
+	TRACE_NVS_WRITE_START = 10,		/* arg: size */
+	TRACE_NVS_WRITE_END = 11		/* arg: esp_err_t */
+}trace_event_t;
+
+typedef enum trace_object_t {
+	TRACE_OBJECT_NONE = 0,
+	TRACE_OBJECT_WIFI_MANAGER_EVENTS = 1,
+	TRACE_OBJECT_HTTP_SERVER_EVENTS = 2,
+	TRACE_OBJECT_JSON_MUTEX = 3,
+	TRACE_OBJECT_JSON_WRITER_MUTEX = 4
+}trace_object_t;
+
+/**
+ * @brief A record as found in the rings of a dump.
+ */
+typedef struct trace_record_t {
+	uint32_t time_us;		/* low 32 bits of esp_timer_get_time */
+	uint32_t task;			/* handle of the task that recorded the event */
+	uint8_t event;			/* trace_event_t */
+	uint8_t object;			/* trace_object_t */
+	uint16_t sequence;		/* low 16 bits of the slot number plus one, written last */
+	uint32_t arg;
+}trace_record_t;
+
+/**
+ * @brief Start of a dump. It is followed by TRACE_MAX_TASKS trace_task_t, the heads of the rings as uint32_t
+ * and the rings, all in the byte order of the esp32, little endian.
+ */
+typedef struct trace_header_t {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint64_t now_us;		/* esp_timer_get_time when the dump started: time_us of records wraps every 71 minutes */
+	uint16_t ring_size;
+	uint8_t cores;
+	uint8_t max_tasks;
+}trace_header_t;
+
+typedef struct trace_task_t {
+	uint32_t task;			/* 0 for an unused slot */
+	char name[16];
+}trace_task_t;
+
+/**
+ * @brief Called by trace_dump with each part of the dump in order.
+ * @return false to stop the dump.
+ */
+typedef bool (*trace_writer_t)(const void *data, size_t size, void *context);
+
+/**
+ * @brief Records an event. Can be called from any task.
+ */
+void trace_record(trace_event_t event, trace_object_t object, uint32_t arg);
+
+/**
+ * @brief Names the calling task in dumps.
+ */
+void trace_register_task();
+
+/**
+ * @brief Size in bytes of a dump.
+ */
+size_t trace_dump_size();
+
+/**
+ * @brief Writes a dump through writer. Events keep being recorded while it is written.
+ * @return false if writer stopped it.
+ */
+bool trace_dump(trace_writer_t writer, void *context);
+
+/** @brief Gets the RAM in bytes taken by the rings and the task list, 0 unless TRACE_ENABLED. @see wifi_manager_get_static_size */
+size_t trace_get_static_size();
+
+#if TRACE_ENABLED
+#define TRACE(event, object, arg)		trace_record((event), (object), (uint32_t)(arg))
+#define TRACE_REGISTER_TASK()			trace_register_task()
+#else
+#define TRACE(event, object, arg)
+#define TRACE_REGISTER_TASK()
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H_INCLUDED */
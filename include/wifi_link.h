@@ -0,0 +1,112 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+@file wifi_link.h
+@brief Supervision of the STA link: when to reconnect after a connection was lost or an attempt failed.
+
+The state machine does not touch the driver. The wifi manager task feeds it the connection events
+with the current time and a random number, and retries when wifi_link_get_retry_at() is reached.
+Retries are spaced by a capped exponential backoff with jitter, so that devices disconnected by the
+same event, such as a power cut of the access point, do not all come back at the same moment.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_LINK_H_INCLUDED
+#define WIFI_LINK_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Defines the delay in ms before the first retry. Each failed retry doubles it. */
+#define WIFI_LINK_BACKOFF_BASE_MS	1000
+
+/** @brief Defines the longest delay in ms between two retries. */
+#define WIFI_LINK_BACKOFF_MAX_MS	60000
+
+
+typedef enum wifi_link_state_t {
+	WIFI_LINK_IDLE = 0,			/* no connection wanted: nothing saved, or the user disconnected */
+	WIFI_LINK_CONNECTING = 1,	/* an attempt is in progress */
+	WIFI_LINK_CONNECTED = 2,
+	WIFI_LINK_BACKOFF = 3		/* waiting for the next retry */
+}wifi_link_state_t;
+
+
+/**
+ * @brief An attempt to connect starts.
+ */
+void wifi_link_attempt();
+
+/**
+ * @brief The attempt in progress obtained an IP. The backoff starts over.
+ */
+void wifi_link_connected();
+
+/**
+ * @brief The connection was lost.
+ * @param reason wifi_err_reason_t of the disconnection.
+ * @param now current esp_timer time in us.
+ * @param random random number spreading the retry.
+ * @return true if the link was up: the loss must be reported.
+ */
+bool wifi_link_lost(uint8_t reason, int64_t now, uint32_t random);
+
+/**
+ * @brief The attempt in progress failed.
+ * @param retry false if there is nothing to retry with: the link becomes idle.
+ */
+void wifi_link_failed(uint8_t reason, int64_t now, uint32_t random, bool retry);
+
+/**
+ * @brief No connection is wanted anymore: pending retries are cancelled.
+ */
+void wifi_link_stop();
+
+wifi_link_state_t wifi_link_get_state();
+
+/**
+ * @brief Gets the esp_timer time in us of the next retry.
+ * @return 0 if no retry is scheduled.
+ */
+int64_t wifi_link_get_retry_at();
+
+/**
+ * @brief Gets the reason code of the last disconnection or failed attempt.
+ */
+uint8_t wifi_link_get_reason();
+
+/**
+ * @brief Computes the delay before a retry.
+ *
+ * The delay doubles with every failed retry up to WIFI_LINK_BACKOFF_MAX_MS. Half of it is fixed and the other half
+ * random. When the access point rejected the credentials a quick retry cannot succeed: the longest delay is used
+ * right away.
+ * @param failures failed retries since the link was lost.
+ */
+uint32_t wifi_link_backoff_ms(uint8_t failures, uint8_t reason, uint32_t random);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_LINK_H_INCLUDED */
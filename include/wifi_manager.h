@@ -55,8 +55,73 @@ extern "C" {
  *
  * To save memory and avoid nasty out of memory errors,
  * we can limit the number of APs detected in a wifi scan.
+ * The scan records are allocated for this many access points, the json buffers only for the access points
+ * actually found.
  */
-#define MAX_AP_NUM 			15
+#define MAX_AP_NUM 			64
+
+
+/**
+ * @brief Defines how long in ms the results of a wifi scan are considered fresh.
+ *
+ * Scan requests received within this time of the last scan are served from the cached results and
+ * never reach the radio, no matter how many clients request them.
+ */
+#define WIFI_MANAGER_SCAN_CACHE_TTL_MS		8000
+
+/**
+ * @brief Defines the minimum time in ms between the end of a wifi scan and the start of the next one.
+ *
+ * Requests arriving sooner are deferred rather than dropped. This only matters when WIFI_MANAGER_SCAN_CACHE_TTL_MS
+ * is lower: with a TTL of 0 every request asks for fresh results and scans are rate limited to this interval.
+ */
+#define WIFI_MANAGER_SCAN_MIN_INTERVAL_MS	4000
+
+/**
+ * @brief Defines the maximum time in ms spent listening on each channel while scanning with an established connection.
+ *
+ * When connected, the scan visits a single channel at a time and the radio goes back to the channel of the access
+ * point in between, so the uplink is never away for longer than this.
+ */
+#define WIFI_MANAGER_SCAN_DWELL_MS			100
+
+/**
+ * @brief Defines the time in ms spent on the channel of the access point between two channels of a scan made
+ * with an established connection.
+ */
+#define WIFI_MANAGER_SCAN_SLICE_INTERVAL_MS	250
+
+/**
+ * @brief Defines the signal strength in dBm a saved network loses in the ranking for every failed attempt in a row.
+ * Only networks of the same priority are compared.
+ */
+#define WIFI_MANAGER_FAILURE_PENALTY_DBM	10
+
+/**
+ * @brief Defines the number of commands that can wait for the wifi manager task.
+ * Sending a command fails while that many are queued.
+ */
+#define WIFI_MANAGER_COMMAND_QUEUE_SIZE		8
+
+/**
+ * @brief Defines the time in ms the softAP stays up once it is no longer needed when sta_only is set.
+ * This gives the device that sent the credentials the time to see the result before it is disconnected.
+ */
+#define WIFI_MANAGER_SOFTAP_SHUTDOWN_DELAY_MS	5000
+
+/**
+ * @brief Defines if the softAP stays up in sta_only mode while a device is associated to it.
+ *  Value: 0 turns the softAP off once connected, even if a device uses the portal
+ *  Value: 1 waits for the last device to leave, then for WIFI_MANAGER_SOFTAP_SHUTDOWN_DELAY_MS
+ */
+#define WIFI_MANAGER_POLICY_KEEP_AP_WITH_CLIENTS	1
+
+/**
+ * @brief Defines if the esp32 restarts once connected to a network chosen through the portal.
+ *  Value: 0 keeps the connection and switches to station mode in place
+ *  Value: 1 restarts as previous versions did
+ */
+#define WIFI_MANAGER_RESTART_ON_CONNECT		0
 
 
 /** @brief Defines the auth mode as an access point
@@ -65,6 +130,11 @@ extern "C" {
  */
 #define AP_AUTHMODE 		WIFI_AUTH_WPA2_PSK
 
+/** @brief Defines the address of the access point, its gateway and netmask. Clients are redirected to DEFAULT_AP_IP. */
+#define DEFAULT_AP_IP					"192.168.1.1"
+#define DEFAULT_AP_GATEWAY				"192.168.1.1"
+#define DEFAULT_AP_NETMASK				"255.255.255.0"
+
 /** @brief Defines visibility of the access point. 0: visible AP. 1: hidden */
 #define DEFAULT_AP_SSID_HIDDEN 		0
 
@@ -80,12 +150,45 @@ extern "C" {
  *  Good practice for minimal channel interference to use
  *  For 20 MHz: 1, 6 or 11 in USA and 1, 5, 9 or 13 in most parts of the world
  *  For 40 MHz: 3 in USA and 3 or 11 in most parts of the world
+ *  Value: WIFI_MANAGER_AP_CHANNEL_AUTO to pick the least congested channel
  */
 #define DEFAULT_AP_CHANNEL 			6
 
+/**
+ * @brief Value of wifi_settings_t.ap_channel that lets the wifi manager pick the least congested channel.
+ *
+ * All channels are scanned when the softAP starts, and it moves to the channel with the lowest load
+ * (see ap_table_channel_load). While connected, the softAP shares the channel of the access point.
+ */
+#define WIFI_MANAGER_AP_CHANNEL_AUTO		0
+
+/**
+ * @brief Defines how often in ms the channel of the softAP is reconsidered in auto channel mode.
+ * This only happens while the STA interface is not connected and no device is associated to the softAP.
+ */
+#define WIFI_MANAGER_AP_CHANNEL_PERIOD_MS	600000
+
+/**
+ * @brief Defines by how much in percent the load of a channel must be lower than the load of the current one
+ * for the softAP to move there. Avoids hopping between channels of similar load.
+ */
+#define WIFI_MANAGER_AP_CHANNEL_HYSTERESIS	25
+
 /** @brief Defines access point's maximum number of clients. */
 #define AP_MAX_CONNECTIONS 	4
 
+/**
+ * @brief Defines the number of versions of each json document that can exist at the same time.
+ *
+ * A reader keeps the version it acquired while newer ones get published. One version per http worker, for the
+ * event task and for the holder of wifi_manager_lock_json_buffer, plus the current version and the one being
+ * written, guarantees the writer always finds a free one: wifi_manager.c checks it against HTTP_SERVER_WORKER_COUNT.
+ * With fewer versions an update finding them all held is written once one is released.
+ * Buffers are allocated on first use, so versions only cost memory when readers are slow enough to need them,
+ * unless WIFI_MANAGER_STATIC_ALLOCATION is set.
+ */
+#define WIFI_MANAGER_JSON_VERSIONS	(AP_MAX_CONNECTIONS + 4)
+
 /** @brief Defines access point's beacon interval. 100ms is the recommended default. */
 #define AP_BEACON_INTERVAL 	25
 
@@ -117,9 +220,26 @@ extern "C" {
 /**
  * @brief Defines the maximum length in bytes of a JSON representation of the IP information
  * assuming all ips are 4*3 digits, and all characters in the ssid require to be escaped.
- * example: {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"192.168.1.119","netmask":"255.255.255.0","gw":"192.168.1.1","urc":0}
+ * example: {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"192.168.1.119","netmask":"255.255.255.0","gw":"192.168.1.1","urc":0,"ipsrc":"static"}
+ */
+#define JSON_IP_INFO_SIZE 168
+
+/**
+ * @brief Defines if the component allocates all of its buffers and RTOS objects at compile time.
+ *  Value: 0 allocates buffers on the heap, as they are needed
+ *  Value: 1 places every buffer in static storage and creates RTOS objects with the ...Static FreeRTOS APIs
+ *  Static allocation requires CONFIG_SUPPORT_STATIC_ALLOCATION. The memory it takes is reported by
+ *  wifi_manager_get_static_size.
+ */
+#ifndef WIFI_MANAGER_STATIC_ALLOCATION
+#define WIFI_MANAGER_STATIC_ALLOCATION	0
+#endif
+
+/**
+ * @brief Defines the size in bytes of each version of the access point list json in static memory mode.
+ * The weakest access points are left out of the list when it does not fit.
  */
-#define JSON_IP_INFO_SIZE 150
+#define WIFI_MANAGER_STATIC_AP_LIST_SIZE	(16 * JSON_ONE_APP_SIZE + 4)
 
 
 
@@ -144,20 +264,172 @@ typedef struct {
 } wifi_settings_t;
 
 
+/**
+ * @brief How a connection to the saved access point was attempted.
+ */
+typedef enum wifi_manager_connect_path_t {
+	WIFI_MANAGER_CONNECT_FAST = 0,		/* straight to the BSSID and channel of the last successful association */
+	WIFI_MANAGER_CONNECT_FULL_SCAN = 1	/* probe of all channels, when there is no such association or it failed */
+}wifi_manager_connect_path_t;
+
+/**
+ * @brief Instrumentation hook called after every connection attempt.
+ * @param success true if an IP was obtained.
+ * @param elapsed_ms time since the connection was requested. When the fast path failed, the full scan attempt
+ * includes the time it wasted.
+ */
+typedef void (*wifi_manager_connect_hook_t)(wifi_manager_connect_path_t path, bool success, uint32_t elapsed_ms);
+
+/**
+ * @brief Hook called whenever the station connection or the softAP changes state.
+ * @param sta_connected true if the STA interface is connected and has an IP.
+ * @param softap_running false once the softAP, the HTTP server and the captive portal are no longer needed.
+ * The DNS server of the captive portal is started once and keeps running: the application is expected to stop it
+ * then, and to restart it when the softAP comes back, if its DNS server component allows it.
+ */
+typedef void (*wifi_manager_mode_hook_t)(bool sta_connected, bool softap_running);
+
+/**
+ * @brief Where the address of the STA interface comes from. Reported as "ipsrc" in the ip info json.
+ */
+typedef enum wifi_manager_ip_source_t {
+	WIFI_MANAGER_IP_DHCP = 0,	/* full DHCP exchange */
+	WIFI_MANAGER_IP_LEASE = 1,	/* lease cached from a previous connection to the same network, renewed by DHCP at its renewal time */
+	WIFI_MANAGER_IP_STATIC = 2	/* static profile saved for the network with wifi_manager_save_static_ip */
+}wifi_manager_ip_source_t;
+
+/**
+ * @brief Commands processed by the wifi manager task, by order of priority.
+ */
+typedef enum wifi_manager_command_id_t {
+	WIFI_MANAGER_CMD_DISCONNECT = 0,	/* disconnect and forget the network */
+	WIFI_MANAGER_CMD_CONNECT = 1,		/* connect to the network of the command, or to the best saved network if its ssid is empty */
+	WIFI_MANAGER_CMD_SCAN = 2,
+	WIFI_MANAGER_CMD_DRIVER_EVENT = 3	/* internal: posted by the event handler to wake up the task */
+}wifi_manager_command_id_t;
+
+typedef struct wifi_manager_command_t wifi_manager_command_t;
+
+/**
+ * @brief Called in the wifi manager task once a command completed: it must return quickly.
+ * @param result ESP_OK on success, ESP_FAIL if the connection failed, ESP_ERR_INVALID_STATE if a newer connection
+ * command replaced it before it started, ESP_ERR_NO_MEM if too many commands were pending.
+ */
+typedef void (*wifi_manager_command_cb_t)(const wifi_manager_command_t *command, esp_err_t result);
+
+/**
+ * @brief A command for the wifi manager task. The command is copied when sent along with its payload.
+ *
+ * Scans and disconnections sent while one is pending are served by it. A connection replaces the pending one.
+ */
+struct wifi_manager_command_t {
+	wifi_manager_command_id_t id;
+	uint8_t ssid[MAX_SSID_SIZE];			/* connection only, padded with zeros */
+	uint8_t password[MAX_PASSWORD_SIZE];	/* connection only, padded with zeros */
+	wifi_manager_command_cb_t callback;		/* optional */
+	void *arg;								/* for the callback */
+	TaskHandle_t notify;					/* optional task notified with the result as its notification value */
+};
+
+/**
+ * @brief A published version of a json document. It never changes until it is released.
+ */
+typedef struct {
+	const char *json;
+	uint32_t generation;	/* changes with every version and starts from a random value on boot: usable as an entity tag */
+	TickType_t timestamp;	/* tick count of the data the json was generated from, only meaningful if timestamped */
+	bool timestamped;
+} wifi_manager_json_t;
+
+
 /**
  * Frees up all memory allocated by the wifi_manager and kill the task.
  */
 void wifi_manager_destroy();
 
+/**
+ * @brief Gets the RAM in bytes the component takes in static storage. The sum of:
+ *  - the json documents and pending commands of the wifi manager task
+ *  - the credential store (wifi_nvs_get_static_size)
+ *  - the access point table (ap_table_get_static_size)
+ *  - the counters, histograms and task list of the metrics (metrics_get_static_size)
+ *  - the ring of connection attempts (wifi_timeline_get_static_size)
+ *  - the trace rings when TRACE_ENABLED is set (trace_get_static_size)
+ *  - the report buffer and /events client list of the http server (http_server_get_static_size)
+ *  - when WIFI_MANAGER_STATIC_ALLOCATION is set: the json buffers, scan records and RTOS objects of the wifi manager
+ *    task, and the queues, request buffers, event frame and tasks of the http server, stacks included
+ *
+ * With WIFI_MANAGER_STATIC_ALLOCATION the component never uses the heap and this is its peak footprint; otherwise
+ * heap buffers come on top. Neither counts the stacks of the wifi_manager and http_server tasks, which are created
+ * by the application, the DHCP lease kept in RTC memory, nor the memory used by lwIP and the wifi driver.
+ * @return the size in bytes.
+ */
+size_t wifi_manager_get_static_size();
+
 /**
  * Main task for the wifi_manager
  */
 void wifi_manager( void * pvParameters );
 
 
+/**
+ * @brief Gets the current version of the access point list json.
+ *
+ * This never blocks and never delays the wifi manager: a newer version can be published while the returned one
+ * is in use. Every version acquired must be released with wifi_manager_release_json, as soon as possible.
+ */
+const wifi_manager_json_t* wifi_manager_acquire_ap_list_json();
+
+/**
+ * @brief Gets the current version of the connection status json.
+ * @see wifi_manager_acquire_ap_list_json
+ */
+const wifi_manager_json_t* wifi_manager_acquire_ip_info_json();
+
+/**
+ * @brief Releases a version of a json document acquired with wifi_manager_acquire_ap_list_json or
+ * wifi_manager_acquire_ip_info_json.
+ */
+void wifi_manager_release_json(const wifi_manager_json_t *json);
+
+/**
+ * @brief Gets the time elapsed in ms since the data of a json was obtained.
+ * @return the age of the json, UINT32_MAX if it is not timestamped.
+ */
+uint32_t wifi_manager_get_json_age(const wifi_manager_json_t *json);
+
+/**
+ * @note Kept for compatibility. This is not thread-safe and should be called only if wifi_manager_lock_json_buffer
+ * call is successful.
+ */
 char* wifi_manager_get_ap_list_json();
 char* wifi_manager_get_ip_info_json();
 
+/**
+ * @brief Gets the generation of the access point list json.
+ * @note Kept for compatibility. This is not thread-safe and should be called only if wifi_manager_lock_json_buffer
+ * call is successful.
+ */
+uint32_t wifi_manager_get_ap_list_json_generation();
+
+/**
+ * @brief Gets the generation of the connection status json.
+ * @note Kept for compatibility. This is not thread-safe and should be called only if wifi_manager_lock_json_buffer
+ * call is successful.
+ */
+uint32_t wifi_manager_get_ip_info_json_generation();
+
+/**
+ * @brief Gets the time elapsed in ms since the scan the access point list json was generated from.
+ * @return the age of the list, UINT32_MAX if no scan completed yet.
+ */
+uint32_t wifi_manager_get_ap_list_age();
+
+/**
+ * @brief Gets where the current address of the STA interface comes from.
+ */
+wifi_manager_ip_source_t wifi_manager_get_ip_source();
+
 
 
 
@@ -192,12 +464,42 @@ esp_err_t wifi_manager_event_handler(void *ctx, system_event_t *event);
 wifi_config_t * wifi_manager_get_sta_config();
 
 /**
- * @brief requests a connection to an access point that will be process in the main task thread.
+ * @brief Registers a hook measuring the time to obtain an IP. NULL removes it.
+ * @note the hook runs in the wifi manager task: it must return quickly.
+ */
+void wifi_manager_set_connect_hook(wifi_manager_connect_hook_t hook);
+
+/**
+ * @brief Registers a hook notified of connections, losses and softAP shutdowns. NULL removes it.
+ * @note the hook runs in the wifi manager task: it must return quickly.
+ */
+void wifi_manager_set_mode_hook(wifi_manager_mode_hook_t hook);
+
+/**
+ * @brief Tells whether the softAP and the HTTP server are running.
+ */
+bool wifi_manager_is_softap_running();
+
+/**
+ * @brief Sends a command to the wifi manager task.
+ * @param ticks_to_wait how long to wait for room in the queue.
+ * @return ESP_OK if it was queued, ESP_ERR_TIMEOUT if the queue is full, ESP_ERR_INVALID_STATE if the wifi manager
+ * is not started.
+ */
+esp_err_t wifi_manager_send_command(const wifi_manager_command_t *command, TickType_t ticks_to_wait);
+
+/**
+ * @brief requests a connection to the access point of the sta config.
+ * @note Kept for compatibility: the sta config is shared with the wifi manager task. wifi_manager_send_command carries
+ * the credentials with the command.
  */
 void wifi_manager_connect_async();
 
 /**
  * @brief requests a wifi scan
+ *
+ * Requests are coalesced: any number of them results in a single scan, and none at all while the
+ * results of the previous scan are younger than WIFI_MANAGER_SCAN_CACHE_TTL_MS.
  */
 void wifi_manager_scan_async();
 
@@ -207,47 +509,43 @@ void wifi_manager_scan_async();
 void wifi_manager_disconnect_async();
 
 /**
- * @brief Tries to get access to json buffer mutex.
- *
- * The HTTP server can try to access the json to serve clients while the wifi manager thread can try
- * to update it. These two tasks are synchronized through a mutex.
- *
- * The mutex is used by both the access point list json and the connection status json.\n
- * These two resources should technically have their own mutex but we lose some flexibility to save
- * on memory.
+ * @brief Gives the caller access to the json documents through wifi_manager_get_ap_list_json and
+ * wifi_manager_get_ip_info_json.
  *
- * This is a simple wrapper around freeRTOS function xSemaphoreTake.
+ * Kept for compatibility: the versions current when the lock is taken are acquired on behalf of the caller and
+ * stay valid until wifi_manager_unlock_json_buffer. The wifi manager never waits for this lock, only other callers
+ * of this function do. New code should use wifi_manager_acquire_ap_list_json and wifi_manager_acquire_ip_info_json.
  *
- * @param xTicksToWait The time in ticks to wait for the semaphore to become available.
+ * @param xTicksToWait The time in ticks to wait for the lock to become available.
  * @return true in success, false otherwise.
  */
 bool wifi_manager_lock_json_buffer(TickType_t xTicksToWait);
 
 /**
- * @brief Releases the json buffer mutex.
+ * @brief Releases the json documents acquired by wifi_manager_lock_json_buffer.
  */
 void wifi_manager_unlock_json_buffer();
 
 /**
  * @brief Generates the connection status json: ssid and IP addresses.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @note Writers are serialized by the wifi manager. Readers are never blocked: they keep the version they acquired.
  */
 void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code);
 /**
  * @brief Clears the connection status json.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @note Writers are serialized by the wifi manager. Readers are never blocked: they keep the version they acquired.
  */
 void wifi_manager_clear_ip_info_json();
 
 /**
  * @brief Generates the list of access points after a wifi scan.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @note Writers are serialized by the wifi manager. Readers are never blocked: they keep the version they acquired.
  */
 void wifi_manager_generate_acess_points_json();
 
 /**
  * @brief Clear the list of access points.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @note Writers are serialized by the wifi manager. Readers are never blocked: they keep the version they acquired.
  */
 void wifi_manager_clear_access_points_json();
 
@@ -1,6 +1,133 @@
 #include "esp_wifi.h"
 #include "esp_wifi_types.h"
+#include "tcpip_adapter.h"
 
+/** @brief Defines the number of networks the credential store can hold. */
+#define WIFI_NVS_MAX_NETWORKS 8
+
+/**
+ * @brief Defines the number of networks of the largest credential store that can be loaded.
+ *
+ * A store saved by a firmware holding more networks than WIFI_NVS_MAX_NETWORKS is read in place, then only the
+ * best WIFI_NVS_MAX_NETWORKS are kept. The room for the others is static RAM; a store larger than this is ignored.
+ */
+#define WIFI_NVS_MAX_LOADED_NETWORKS (2 * WIFI_NVS_MAX_NETWORKS)
+
+/**
+ * @brief A network of the credential store.
+ *
+ * The access point of the last successful association is kept with the credentials: connecting straight to a
+ * known BSSID on a known channel skips the all channel probe done by esp_wifi_connect.
+ */
+typedef struct {
+	uint8_t ssid[32];
+	uint8_t password[64];
+	uint8_t bssid[6];
+	uint8_t channel;				/* 0 until the first successful association */
+	uint8_t priority;				/* networks with a higher priority are tried first */
+	wifi_auth_mode_t authmode;
+	uint8_t failures;				/* consecutive failed attempts, saturates at 255 */
+	uint32_t last_success;			/* sequence number of the last successful association, 0 if there was none */
+} wifi_nvs_network_t;
+
+/**
+ * @brief Address configuration of the STA interface for one network: a cached DHCP lease or a static profile.
+ */
+typedef struct {
+	uint8_t ssid[32];						/* network the configuration belongs to */
+	tcpip_adapter_ip_info_t ip_info;
+	tcpip_adapter_dns_info_t dns;
+	int64_t obtained;						/* lease only: gettimeofday seconds when the lease was obtained, renewals are not saved */
+	uint32_t lease_time;					/* lease only: duration of the lease in seconds */
+} wifi_nvs_ip_config_t;
+
+/**
+ * @brief erases the credential store and everything else saved by the wifi manager.
+ */
 esp_err_t wifi_manager_clear_sta_config();
+
+/**
+ * @brief adds the network of the sta config to the credential store, or updates its password.
+ *
+ * When the store is full the network with the lowest priority that connected least recently makes room.
+ * @note the credential store is only accessed from the wifi manager task.
+ */
 esp_err_t wifi_manager_save_sta_config(wifi_config_t* config);
+
+/**
+ * @brief fetch the network of the last successful association, or the one with the highest priority if none
+ * ever connected.
+ * @return true if the store is not empty, false otherwise.
+ */
 bool wifi_manager_load_sta_config(wifi_config_t* config);
+
+/** @brief Gets the RAM in bytes taken by the credential store. @see wifi_manager_get_static_size */
+size_t wifi_nvs_get_static_size();
+
+/** @brief Gets the number of networks in the credential store. */
+uint8_t wifi_manager_get_network_count();
+
+/**
+ * @brief Gets a network of the credential store.
+ * @param index from 0 to wifi_manager_get_network_count() - 1. Indexes change when the store is modified.
+ */
+const wifi_nvs_network_t* wifi_manager_get_network(uint8_t index);
+
+/**
+ * @brief Finds a network of the credential store by ssid.
+ * @param ssid 32 bytes, padded with zeros.
+ * @return the network, NULL if it is not in the store.
+ */
+const wifi_nvs_network_t* wifi_manager_find_network(const uint8_t *ssid);
+
+/**
+ * @brief Changes the priority of a network of the credential store.
+ * @return ESP_ERR_NOT_FOUND if it is not in the store.
+ */
+esp_err_t wifi_manager_set_network_priority(const uint8_t *ssid, uint8_t priority);
+
+/**
+ * @brief Removes a network from the credential store.
+ */
+esp_err_t wifi_manager_forget_network(const uint8_t *ssid);
+
+/**
+ * @brief saves the network of the sta config with the access point it just associated with.
+ * Its failure count is reset. Nothing is written when the network was already the most recent one with the same
+ * access point and password.
+ */
+esp_err_t wifi_manager_save_network_success(const wifi_config_t* config, const wifi_ap_record_t* ap);
+
+/**
+ * @brief counts a failed attempt to connect to a network of the credential store.
+ * The count is written to flash when it reaches a power of two, or with the next change of the store.
+ */
+esp_err_t wifi_manager_save_network_failure(const uint8_t *ssid);
+
+/**
+ * @brief saves the lease the DHCP client obtained on the network of ip_config->ssid, replacing any previous one.
+ */
+esp_err_t wifi_manager_save_ip_lease(const wifi_nvs_ip_config_t* ip_config);
+
+/**
+ * @brief fetch the lease of the last DHCP exchange.
+ * @return true if it was found, false otherwise.
+ */
+bool wifi_manager_load_ip_lease(wifi_nvs_ip_config_t* ip_config);
+
+/**
+ * @brief saves a static address for the network of ip_config->ssid. The DHCP client is not used on that network
+ * until the profile is cleared.
+ */
+esp_err_t wifi_manager_save_static_ip(const wifi_nvs_ip_config_t* ip_config);
+
+/**
+ * @brief fetch the static address profile.
+ * @return true if it was found, false otherwise.
+ */
+bool wifi_manager_load_static_ip(wifi_nvs_ip_config_t* ip_config);
+
+/**
+ * @brief removes the static address profile: DHCP is used again from the next connection.
+ */
+esp_err_t wifi_manager_clear_static_ip();
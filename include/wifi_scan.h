@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+@file wifi_scan.h
+@brief Scan made one channel at a time while the STA is connected.
+
+An all channel scan keeps the radio away from the access point for seconds. While connected the scan
+visits a single channel per slice for at most WIFI_MANAGER_SCAN_DWELL_MS, and the wifi manager task stays
+on the channel of the access point for WIFI_MANAGER_SCAN_SLICE_INTERVAL_MS between two slices.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_SCAN_H_INCLUDED
+#define WIFI_SCAN_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief Starts a sliced scan over the channels of the country configured in the driver.
+ */
+void wifi_scan_slices_start();
+
+/**
+ * @brief Tells if a sliced scan is in progress.
+ */
+bool wifi_scan_slices_running();
+
+/**
+ * @brief Gets the channel the next slice will scan, 0 if no sliced scan is in progress.
+ */
+uint8_t wifi_scan_slices_channel();
+
+/**
+ * @brief Scans the next channel of the sliced scan. Blocks for at most WIFI_MANAGER_SCAN_DWELL_MS.
+ *
+ * The driver can refuse to scan while it is busy with the connection: the channel is then skipped.
+ * @param config scan configuration: the channel and scan time are replaced by those of the slice.
+ * @param records receives the access points found on the channel.
+ * @param count capacity of records, then number of access points found: 0 if the channel was skipped.
+ * @param delay receives the ticks to wait before the next slice.
+ * @return true once the last channel was scanned.
+ */
+bool wifi_scan_slice(const wifi_scan_config_t *config, wifi_ap_record_t *records, uint16_t *count, TickType_t *delay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_SCAN_H_INCLUDED */
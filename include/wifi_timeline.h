@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file wifi_timeline.h
+@brief Timestamps of the phases of the last connection attempts of the STA interface.
+
+Every call to esp_wifi_connect opens an attempt in a ring of WIFI_TIMELINE_SIZE entries. The wifi manager
+task records when the connection was requested and when the previous connection was dropped, the event
+handler when the access point accepted the station, when an IP was obtained or why the attempt failed.
+A slow connection can then be attributed to the wait for the disconnection, to the scan, to the association
+with its 4-way handshake, or to DHCP. The reason of a failure tells which step of the association failed.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_TIMELINE_H_INCLUDED
+#define WIFI_TIMELINE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_wifi_types.h"
+#include "json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Defines the number of attempts kept. Older attempts are overwritten. */
+#define WIFI_TIMELINE_SIZE		8
+
+/**
+ * @brief Phases of an attempt. Times are in µs since the connection was requested.
+ */
+typedef enum wifi_timeline_phase_t {
+	WIFI_TIMELINE_DISCONNECTED = 0,		/* the previous connection was dropped before connecting */
+	WIFI_TIMELINE_CONNECT = 1,			/* esp_wifi_connect was issued */
+	WIFI_TIMELINE_ASSOCIATED = 2,		/* SYSTEM_EVENT_STA_CONNECTED: authentication, association and handshake done */
+	WIFI_TIMELINE_GOT_IP = 3,			/* SYSTEM_EVENT_STA_GOT_IP */
+	WIFI_TIMELINE_FAILED = 4,			/* SYSTEM_EVENT_STA_DISCONNECTED, see reason */
+	WIFI_TIMELINE_PHASE_COUNT
+}wifi_timeline_phase_t;
+
+typedef struct {
+	uint32_t sequence;							/* increases with every attempt */
+	uint32_t requested_ms;						/* ms since boot the connection was requested at */
+	uint32_t phases[WIFI_TIMELINE_PHASE_COUNT];	/* µs since the request, 0 if the phase did not happen */
+	uint8_t ssid[32];							/* not NUL terminated when 32 characters long */
+	uint8_t bssid[6];							/* of the association, or of the access point targeted */
+	uint8_t channel;							/* of the association, or of the access point targeted, 0 if unknown */
+	uint8_t reason;								/* disconnection reason of a failed attempt */
+	bool targeted;								/* straight to a known access point rather than after a scan */
+} wifi_timeline_attempt_t;
+
+/** @brief Defines the size of the json of one attempt but its ssid, every number at its widest. */
+#define WIFI_TIMELINE_JSON_FIXED_SIZE	224
+
+/** @brief Defines the size of a buffer wifi_timeline_format_json always fits in, even with ssids needing the most escaping. */
+#define WIFI_TIMELINE_JSON_SIZE		(WIFI_TIMELINE_SIZE * (JSON_ESCAPED_SIZE(sizeof(((wifi_timeline_attempt_t*)0)->ssid)) + WIFI_TIMELINE_JSON_FIXED_SIZE) + sizeof("[]\n"))
+
+
+/**
+ * @brief Marks the time a connection is requested at. Following attempts are timed from it.
+ */
+void wifi_timeline_request();
+
+/**
+ * @brief Records that the previous connection was dropped before connecting again.
+ */
+void wifi_timeline_disconnected();
+
+/**
+ * @brief Opens a new attempt, just before esp_wifi_connect is called with config.
+ */
+void wifi_timeline_connect(const wifi_config_t *config);
+
+/**
+ * @brief Records the association of the attempt in progress. Called from the event handler.
+ */
+void wifi_timeline_associated(const uint8_t *bssid, uint8_t channel);
+
+/**
+ * @brief Records the IP of the attempt in progress. Called from the event handler.
+ */
+void wifi_timeline_got_ip();
+
+/**
+ * @brief Records the failure of the attempt in progress. Called from the event handler.
+ * A disconnection after the attempt obtained an IP is a lost connection, not a failure: it is ignored.
+ */
+void wifi_timeline_failed(uint8_t reason);
+
+/**
+ * @brief Copies the most recent attempts, most recent first.
+ * @param attempts room for count attempts.
+ * @return the number of attempts copied.
+ */
+uint8_t wifi_timeline_get(wifi_timeline_attempt_t *attempts, uint8_t count);
+
+/** @brief Gets the RAM in bytes taken by the ring of attempts. @see wifi_manager_get_static_size */
+size_t wifi_timeline_get_static_size();
+
+/**
+ * @brief Writes the most recent attempts as a json array, most recent first.
+ * Phases that did not happen are null.
+ * @return the length of the json, 0 if it does not fit in size.
+ */
+size_t wifi_timeline_format_json(char *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_TIMELINE_H_INCLUDED */
@@ -26,118 +26,121 @@ OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include "json.h"
 
 
-bool json_print_string(const unsigned char *input, unsigned char *output_buffer)
+/**
+ * @brief Escape sequence of every byte: 0 for bytes copied as is, otherwise the character following the
+ * backslash. 'u' means the byte is written as a \u00XX unicode codepoint.
+ */
+static const unsigned char json_escape_table[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['\"'] = '\"',
+	['\\'] = '\\'
+};
+
+static const char json_hex_digits[] = "0123456789abcdef";
+
+
+/**
+ * @brief Tells if any of the 4 bytes of a word needs to be escaped or is the end of the string: a control
+ * character, a quote or a backslash.
+ * @see https://graphics.stanford.edu/~seander/bithacks.html#HasLessInWord
+ */
+static inline bool json_word_needs_escape(uint32_t word)
 {
-	const unsigned char *input_pointer = NULL;
-	unsigned char *output = NULL;
-	unsigned char *output_pointer = NULL;
-	size_t output_length = 0;
-	/* numbers of additional characters needed for escaping */
-	size_t escape_characters = 0;
-
-	if (output_buffer == NULL)
+	const uint32_t ones = 0x01010101;
+	const uint32_t quote = word ^ (ones * '\"');
+	const uint32_t backslash = word ^ (ones * '\\');
+
+	return (((word - ones * 0x20) & ~word) | ((quote - ones) & ~quote) | ((backslash - ones) & ~backslash)) & (ones * 0x80);
+}
+
+
+size_t json_print_string(const unsigned char *input, size_t input_size, unsigned char *output_buffer, size_t output_size)
+{
+	unsigned char *output_pointer = output_buffer;
+	/* room is always kept for the closing quote and the terminating NUL */
+	unsigned char *output_end;
+	size_t i = 0;
+
+	if (output_buffer == NULL || output_size == 0)
 	{
-		return false;
+		return 0;
 	}
-
-	/* empty string */
-	if (input == NULL)
+	if (output_size < sizeof("\"\""))
 	{
-		//output = ensure(output_buffer, sizeof("\"\""), hooks);
-		if (output == NULL)
-		{
-			return false;
-		}
-		strcpy((char*)output, "\"\"");
-
-		return true;
+		goto overflow;
 	}
+	output_end = output_buffer + output_size - 2;
+
+	*output_pointer++ = '\"';
 
-	/* set "flag" to 1 if something needs to be escaped */
-	for (input_pointer = input; *input_pointer; input_pointer++)
+	/* a NULL input is rendered as an empty string */
+	while (input != NULL && i < input_size)
 	{
-		if (strchr("\"\\\b\f\n\r\t", *input_pointer))
+		/* fast path: most strings have nothing to escape and are copied a word at a time */
+		while (input_size - i >= sizeof(uint32_t) && output_end - output_pointer >= (ptrdiff_t)sizeof(uint32_t))
 		{
-			/* one character escape sequence */
-			escape_characters++;
+			uint32_t word;
+			memcpy(&word, input + i, sizeof(word));
+			if (json_word_needs_escape(word))
+			{
+				break;
+			}
+			memcpy(output_pointer, &word, sizeof(word));
+			output_pointer += sizeof(word);
+			i += sizeof(word);
 		}
-		else if (*input_pointer < 32)
+		if (i >= input_size || input[i] == '\0')
 		{
-			/* UTF-16 escape sequence uXXXX */
-			escape_characters += 5;
+			break;
 		}
-	}
-	output_length = (size_t)(input_pointer - input) + escape_characters;
-
-	/* in the original cJSON it is possible to realloc here in case output buffer is too small.
-	 * This is overkill for an embedded system. */
-	output = output_buffer;
 
-	/* no characters have to be escaped */
-	if (escape_characters == 0)
-	{
-		output[0] = '\"';
-		memcpy(output + 1, input, output_length);
-		output[output_length + 1] = '\"';
-		output[output_length + 2] = '\0';
-
-		return true;
-	}
-
-	output[0] = '\"';
-	output_pointer = output + 1;
-	/* copy the string */
-	for (input_pointer = input; *input_pointer != '\0'; (void)input_pointer++, output_pointer++)
-	{
-		if ((*input_pointer > 31) && (*input_pointer != '\"') && (*input_pointer != '\\'))
+		const unsigned char c = input[i++];
+		const unsigned char escape = json_escape_table[c];
+		if (escape == 0)
 		{
-			/* normal character, copy */
-			*output_pointer = *input_pointer;
+			if (output_end - output_pointer < 1)
+			{
+				goto overflow;
+			}
+			*output_pointer++ = c;
 		}
-		else
+		else if (escape != 'u')
 		{
-			/* character needs to be escaped */
+			if (output_end - output_pointer < 2)
+			{
+				goto overflow;
+			}
 			*output_pointer++ = '\\';
-			switch (*input_pointer)
+			*output_pointer++ = escape;
+		}
+		else
+		{
+			if (output_end - output_pointer < 6)
 			{
-			case '\\':
-				*output_pointer = '\\';
-				break;
-			case '\"':
-				*output_pointer = '\"';
-				break;
-			case '\b':
-				*output_pointer = 'b';
-				break;
-			case '\f':
-				*output_pointer = 'f';
-				break;
-			case '\n':
-				*output_pointer = 'n';
-				break;
-			case '\r':
-				*output_pointer = 'r';
-				break;
-			case '\t':
-				*output_pointer = 't';
-				break;
-			default:
-				/* escape and print as unicode codepoint */
-				sprintf((char*)output_pointer, "u%04x", *input_pointer);
-				output_pointer += 4;
-				break;
+				goto overflow;
 			}
+			memcpy(output_pointer, "\\u00", 4);
+			output_pointer[4] = json_hex_digits[c >> 4];
+			output_pointer[5] = json_hex_digits[c & 0x0f];
+			output_pointer += 6;
 		}
 	}
-	output[output_length + 1] = '\"';
-	output[output_length + 2] = '\0';
 
-	return true;
-}
+	*output_pointer++ = '\"';
+	*output_pointer = '\0';
 
+	return (size_t)(output_pointer - output_buffer);
+
+overflow:
+	output_buffer[0] = '\0';
+	return 0;
+}
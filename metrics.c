@@ -0,0 +1,226 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file metrics.c
+@brief In-memory metrics of the wifi manager and the HTTP server, served as /metrics.json.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "metrics.h"
+
+typedef struct {
+	atomic_uint buckets[METRICS_HISTOGRAM_BUCKETS];
+	atomic_uint sum_ms;
+} metrics_histogram_data_t;
+
+typedef struct {
+	const char *method;
+	const char *path;
+	atomic_uint requests;
+} metrics_route_t;
+
+static atomic_uint counters[METRICS_COUNTER_COUNT];
+static metrics_histogram_data_t histograms[METRICS_HISTOGRAM_COUNT];
+static metrics_route_t routes[METRICS_MAX_ROUTES];
+static atomic_uint disconnect_reasons[METRICS_DISCONNECT_REASONS];
+
+/* @brief slots are claimed by incrementing task_count before the handle is written */
+static atomic_uint task_count;
+static TaskHandle_t tasks[METRICS_MAX_TASKS];
+
+static const char * const counter_names[METRICS_COUNTER_COUNT] = {
+	"http_2xx", "http_3xx", "http_4xx", "http_5xx", "http_503", "http_bytes",
+	"json_lock_timeouts", "wifi_connects", "wifi_connect_failures"
+};
+
+static const char * const histogram_names[METRICS_HISTOGRAM_COUNT] = {
+	"http_service_us", "json_lock_wait_us", "wifi_scan_us", "wifi_connect_us"
+};
+
+
+void metrics_add(metrics_counter_t counter, uint32_t value) {
+	atomic_fetch_add_explicit(&counters[counter], value, memory_order_relaxed);
+}
+
+
+void metrics_observe(metrics_histogram_t histogram, uint32_t duration_us) {
+	metrics_histogram_data_t *h = &histograms[histogram];
+	uint32_t bucket = 0;
+
+	/* bucket n holds durations up to METRICS_HISTOGRAM_FIRST_BOUND_US * 2^n */
+	if(duration_us > METRICS_HISTOGRAM_FIRST_BOUND_US){
+		bucket = 32 - __builtin_clz((duration_us - 1) / METRICS_HISTOGRAM_FIRST_BOUND_US);
+		if(bucket >= METRICS_HISTOGRAM_BUCKETS) bucket = METRICS_HISTOGRAM_BUCKETS - 1;
+	}
+
+	atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum_ms, (duration_us + 500) / 1000, memory_order_relaxed);
+}
+
+
+void metrics_count_response(uint16_t status, uint32_t bytes) {
+	if(status >= 200 && status < 600){
+		metrics_add(METRICS_HTTP_2XX + status / 100 - 2, 1);
+	}
+	if(status == 503){
+		metrics_add(METRICS_HTTP_503, 1);
+	}
+	metrics_add(METRICS_HTTP_BYTES, bytes);
+}
+
+
+void metrics_register_route(uint8_t route, const char *method, const char *path) {
+	if(route < METRICS_MAX_ROUTES){
+		routes[route].method = method;
+		routes[route].path = path;
+	}
+}
+
+
+void metrics_count_route(uint8_t route) {
+	if(route < METRICS_MAX_ROUTES){
+		atomic_fetch_add_explicit(&routes[route].requests, 1, memory_order_relaxed);
+	}
+}
+
+
+void metrics_count_disconnect(uint8_t reason) {
+	uint32_t index = 0;
+
+	if(reason < 64){
+		index = reason;
+	}
+	else if(reason >= 200 && reason < 200 + METRICS_DISCONNECT_REASONS - 64){
+		index = reason - 200 + 64;
+	}
+	atomic_fetch_add_explicit(&disconnect_reasons[index], 1, memory_order_relaxed);
+}
+
+
+void metrics_register_task() {
+	unsigned int slot = atomic_fetch_add(&task_count, 1);
+
+	if(slot < METRICS_MAX_TASKS){
+		tasks[slot] = xTaskGetCurrentTaskHandle();
+	}
+}
+
+
+/**
+ * @brief Appends to a json being written, keeping track of the room left.
+ * @return false once the buffer is full.
+ */
+static bool metrics_print(char *buffer, size_t size, size_t *len, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+static bool metrics_print(char *buffer, size_t size, size_t *len, const char *format, ...) {
+	va_list args;
+	int written;
+
+	if(*len >= size){
+		return false;
+	}
+	va_start(args, format);
+	written = vsnprintf(buffer + *len, size - *len, format, args);
+	va_end(args);
+	if(written < 0 || written >= size - *len){
+		*len = size;
+		return false;
+	}
+	*len += written;
+
+	return true;
+}
+
+
+size_t metrics_get_static_size() {
+	return sizeof(counters) + sizeof(histograms) + sizeof(routes) + sizeof(disconnect_reasons) + sizeof(tasks);
+}
+
+size_t metrics_format_json(char *buffer, size_t size) {
+	size_t len = 0;
+	const char *separator;
+
+	metrics_print(buffer, size, &len, "{\"uptime_ms\":%u,\"counters\":{", (unsigned int)(esp_timer_get_time() / 1000));
+	for(int i = 0; i < METRICS_COUNTER_COUNT; i++){
+		metrics_print(buffer, size, &len, "%s\"%s\":%u", i ? "," : "", counter_names[i], atomic_load_explicit(&counters[i], memory_order_relaxed));
+	}
+
+	metrics_print(buffer, size, &len, "},\"routes\":{");
+	separator = "";
+	for(int i = 0; i < METRICS_MAX_ROUTES; i++){
+		if(routes[i].path == NULL) continue;
+		metrics_print(buffer, size, &len, "%s\"%s %s\":%u", separator, routes[i].method, routes[i].path, atomic_load_explicit(&routes[i].requests, memory_order_relaxed));
+		separator = ",";
+	}
+
+	metrics_print(buffer, size, &len, "},\"disconnect_reasons\":{");
+	separator = "";
+	for(int i = 0; i < METRICS_DISCONNECT_REASONS; i++){
+		unsigned int count = atomic_load_explicit(&disconnect_reasons[i], memory_order_relaxed);
+		if(count == 0) continue;
+		metrics_print(buffer, size, &len, "%s\"%d\":%u", separator, i < 64 ? i : i - 64 + 200, count);
+		separator = ",";
+	}
+
+	/* bounds are the same for every histogram, the last bucket has none */
+	metrics_print(buffer, size, &len, "},\"histogram_bounds_us\":[");
+	for(int i = 0; i < METRICS_HISTOGRAM_BUCKETS - 1; i++){
+		metrics_print(buffer, size, &len, "%s%u", i ? "," : "", (unsigned int)METRICS_HISTOGRAM_FIRST_BOUND_US << i);
+	}
+	metrics_print(buffer, size, &len, "]");
+	for(int h = 0; h < METRICS_HISTOGRAM_COUNT; h++){
+		unsigned int count = 0;
+		metrics_print(buffer, size, &len, ",\"%s\":{\"buckets\":[", histogram_names[h]);
+		for(int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++){
+			unsigned int bucket = atomic_load_explicit(&histograms[h].buckets[i], memory_order_relaxed);
+			metrics_print(buffer, size, &len, "%s%u", i ? "," : "", bucket);
+			count += bucket;
+		}
+		metrics_print(buffer, size, &len, "],\"count\":%u,\"sum_ms\":%u}", count, atomic_load_explicit(&histograms[h].sum_ms, memory_order_relaxed));
+	}
+
+	/* in bytes on the esp32. Tasks are listed rather than keyed by name: http workers share theirs */
+	metrics_print(buffer, size, &len, ",\"stack_free\":[");
+	unsigned int count = atomic_load(&task_count);
+	separator = "";
+	for(int i = 0; i < count && i < METRICS_MAX_TASKS; i++){
+		if(tasks[i] == NULL) continue;
+		metrics_print(buffer, size, &len, "%s{\"task\":\"%s\",\"bytes\":%u}", separator, pcTaskGetTaskName(tasks[i]), (unsigned int)uxTaskGetStackHighWaterMark(tasks[i]));
+		separator = ",";
+	}
+
+	if(!metrics_print(buffer, size, &len, "]}\n")){
+		return 0;
+	}
+
+	return len;
+}
@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file bench_ap_list_json.c
+@brief Measures the merge of scan results and the generation of /ap.json for growing numbers of access points.
+
+The table holds at most AP_TABLE_SIZE access points: scans returning more keep the strongest ones. With
+WIFI_MANAGER_STATIC_ALLOCATION the json buffer is WIFI_MANAGER_STATIC_AP_LIST_SIZE bytes and the weakest
+access points are left out of the list. Both sizes are measured.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "wifi_manager.h"
+#include "ap_table.h"
+#include "test.h"
+#include "fake_idf.h"
+
+#define ITERATIONS	2000
+
+static wifi_ap_record_t records[256];
+
+
+/**
+ * @brief Fills records with access points of distinct bssids. One ssid in 8 needs escaping, one in 4 is shared
+ * by several access points like a mesh network.
+ */
+static void make_records(int count, uint32_t seed) {
+	memset(records, 0, sizeof(records));
+	for(int i = 0; i < count; i++){
+		wifi_ap_record_t *r = &records[i];
+		r->bssid[0] = 0x24;
+		r->bssid[4] = i >> 8;
+		r->bssid[5] = i;
+		if(i % 4 == 3) snprintf((char*)r->ssid, sizeof(r->ssid), "mesh-%d", (int)(test_random(&seed) % 4));
+		else if(i % 8 == 1) snprintf((char*)r->ssid, sizeof(r->ssid), "\"quoted\\network\" %d", i);
+		else snprintf((char*)r->ssid, sizeof(r->ssid), "network-%d-%08x", i, (unsigned int)test_random(&seed));
+		r->primary = 1 + test_random(&seed) % 13;
+		r->rssi = -30 - (int)(test_random(&seed) % 65);
+		r->authmode = WIFI_AUTH_WPA2_PSK;
+	}
+}
+
+static int count_entries(const char *json) {
+	int count = 0;
+	for(const char *p = json; (p = strstr(p, "{\"ssid\":")) != NULL; p++) count++;
+	return count;
+}
+
+
+static void bench(int count) {
+	static char buffer[256 * JSON_ONE_APP_SIZE + 4];
+	volatile size_t sink = 0;
+	uint64_t start;
+
+	make_records(count, 0x12345678);
+
+	start = test_now_ns();
+	for(int i = 0; i < ITERATIONS; i++){
+		ap_table_clear();
+		ap_table_update(records, count);
+	}
+	double update_us = (double)(test_now_ns() - start) / ITERATIONS / 1000;
+
+	/* a second scan: every access point is known and averaged */
+	start = test_now_ns();
+	for(int i = 0; i < ITERATIONS; i++){
+		ap_table_update(records, count);
+	}
+	double merge_us = (double)(test_now_ns() - start) / ITERATIONS / 1000;
+
+	size_t sizes[] = { ap_table_json_size(), WIFI_MANAGER_STATIC_AP_LIST_SIZE };
+	for(int s = 0; s < 2; s++){
+		size_t size = sizes[s];
+		if(s == 1 && size > sizes[0]) size = sizes[0];
+		start = test_now_ns();
+		for(int i = 0; i < ITERATIONS; i++){
+			sink += ap_table_format_json(buffer, size);
+		}
+		double format_us = (double)(test_now_ns() - start) / ITERATIONS / 1000;
+		size_t length = ap_table_format_json(buffer, size);
+
+		printf("%7d %7u %9.2f %9.2f %7s %7u %7u %7d %9.2f\n", count, ap_table_count(), update_us, merge_us,
+				s ? "static" : "dynamic", (unsigned int)size, (unsigned int)length, count_entries(buffer), format_us);
+	}
+}
+
+
+int main() {
+	printf("%7s %7s %9s %9s %7s %7s %7s %7s %9s\n", "records", "table", "insert us", "merge us", "buffer", "size", "length", "listed", "json us");
+	bench(15);
+	bench(64);
+	bench(256);
+
+	return 0;
+}
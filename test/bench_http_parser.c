@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file bench_http_parser.c
+@brief Measures the HTTP request parser on typical requests of the portal.
+
+Each request is parsed whole, then resumed after a split in its middle as when it spans two TCP segments.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "http_parser.h"
+#include "test.h"
+
+#define ITERATIONS	200000
+
+static const char *requests[] = {
+	"GET /ap.json HTTP/1.1\r\nHost: 192.168.1.1\r\nConnection: keep-alive\r\nIf-None-Match: W/\"a00000abc\"\r\n\r\n",
+	"GET / HTTP/1.1\r\nHost: 192.168.1.1\r\nConnection: keep-alive\r\nUser-Agent: Mozilla/5.0 (Linux; Android 10; SM-G973F) AppleWebKit/537.36 "
+			"(KHTML, like Gecko) Chrome/83.0.4103.106 Mobile Safari/537.36\r\nAccept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+			"image/webp,*/*;q=0.8\r\nAccept-Encoding: gzip, deflate\r\nAccept-Language: en-US,en;q=0.9\r\n\r\n",
+	"POST /connect.json HTTP/1.1\r\nHost: 192.168.1.1\r\nX-Custom-ssid: my network\r\nX-Custom-pwd: password1234\r\nContent-Length: 0\r\n\r\n",
+};
+
+
+int main() {
+	http_parser_t parser;
+	volatile uint32_t sink = 0;
+
+	printf("%-22s %6s %12s %10s\n", "request", "bytes", "ns/request", "ns/byte");
+	for(int r = 0; r < sizeof(requests) / sizeof(requests[0]); r++){
+		const char *request = requests[r];
+		uint16_t length = strlen(request);
+		char name[32];
+
+		snprintf(name, sizeof(name), "%.*s", (int)(strstr(request, " HTTP/") - request), request);
+		for(int split = 0; split < 2; split++){
+			uint64_t start = test_now_ns();
+			for(int i = 0; i < ITERATIONS; i++){
+				http_parser_init(&parser);
+				if(split) http_parser_execute(&parser, request, length / 2);
+				http_parser_execute(&parser, request, length);
+				sink += parser.header_length;
+			}
+			double ns = (double)(test_now_ns() - start) / ITERATIONS;
+			printf("%-22s %6u %12.1f %10.2f%s\n", name, length, ns, ns / length, split ? " (split)" : "");
+		}
+	}
+
+	return sink == 0;
+}
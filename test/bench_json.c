@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file bench_json.c
+@brief Measures json_print_string against the escaper it replaced on typical SSIDs.
+
+Most SSIDs need no escape at all; the word at a time scan is meant for them. SSIDs with a few quotes or
+control characters show the cost of the escapes.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+#include "json_reference.h"
+#include "test.h"
+
+#define ITERATIONS	1000000
+
+static const char *ssids[] = {
+	"home",
+	"NETGEAR-5G-Guest",
+	"Livebox-A1B2 extended network",
+	"my \"quoted\" wifi",
+	"tab\there\\back\nline",
+};
+
+
+int main() {
+	unsigned char output[JSON_ESCAPED_SIZE(32) + 1];
+	volatile size_t sink = 0;
+
+	printf("%-34s %6s %12s %12s\n", "ssid", "bytes", "ns previous", "ns current");
+	for(int s = 0; s < sizeof(ssids) / sizeof(ssids[0]); s++){
+		/* fixed size fields as in wifi_ap_record_t, padded with NULs */
+		unsigned char ssid[33] = { 0 };
+		size_t length = strlen(ssids[s]);
+		memcpy(ssid, ssids[s], length);
+
+		uint64_t start = test_now_ns();
+		for(int i = 0; i < ITERATIONS; i++){
+			sink += json_print_string_reference(ssid, output);
+		}
+		double previous = (double)(test_now_ns() - start) / ITERATIONS;
+
+		start = test_now_ns();
+		for(int i = 0; i < ITERATIONS; i++){
+			sink += json_print_string(ssid, sizeof(ssid), output, sizeof(output));
+		}
+		double current = (double)(test_now_ns() - start) / ITERATIONS;
+
+		char name[40];
+		snprintf(name, sizeof(name), "\"%.31s\"", ssids[s]);
+		for(char *c = name; *c; c++) if(*c < ' ') *c = ' ';
+		printf("%-34s %6zu %12.1f %12.1f\n", name, length, previous, current);
+	}
+
+	return sink == 0;
+}
@@ -0,0 +1,317 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file fake_idf.c
+@brief Host implementations of the FreeRTOS, esp, nvs and lwIP functions the component calls.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "lwip/api.h"
+
+#include "fake_idf.h"
+
+#define FAKE_MAX_SEGMENTS	4096
+#define FAKE_NVS_KEYS		16
+
+int64_t fake_time_us = 0;
+int64_t fake_time_step_us = 0;
+int fake_core = 0;
+void *fake_task = (void*)0x3ffb0000;
+const char *fake_task_name = "test";
+int fake_nvs_writes = 0;
+void (*fake_block)(TickType_t ticks) = NULL;
+
+ip_addr_t ip_addr_any;
+
+static struct {
+	const char *data;
+	size_t length;
+} segments[FAKE_MAX_SEGMENTS];
+static int segment_count = 0;
+static int segment_next = 0;
+static struct netbuf received;
+
+static struct {
+	char key[16];
+	void *data;
+	size_t size;
+} nvs_blobs[FAKE_NVS_KEYS];
+
+/* @brief a queue: the header of a StaticQueue_t, or of the allocation followed by its items */
+typedef struct {
+	uint8_t *storage;
+	UBaseType_t length;
+	UBaseType_t size;
+	UBaseType_t head;
+	UBaseType_t count;
+} fake_queue_t;
+
+_Static_assert(sizeof(fake_queue_t) <= sizeof(StaticQueue_t), "a queue must fit in a StaticQueue_t");
+
+static char *output = NULL;
+static size_t output_length = 0;
+static size_t output_size = 0;
+
+
+void fake_netconn_reset() {
+	segment_count = segment_next = 0;
+	output_length = 0;
+	if(output) output[0] = '\0';
+}
+
+void fake_netconn_add_segment(const char *data, size_t length) {
+	if(segment_count < FAKE_MAX_SEGMENTS){
+		segments[segment_count].data = data;
+		segments[segment_count].length = length;
+		segment_count++;
+	}
+}
+
+const char* fake_netconn_output(size_t *length) {
+	if(length) *length = output_length;
+	return output ? output : "";
+}
+
+
+/* lwIP */
+
+err_t netconn_recv(struct netconn *conn, struct netbuf **buf) {
+	if(segment_next >= segment_count) return ERR_CLSD;
+	received.x = segment_next++;
+	*buf = &received;
+	return ERR_OK;
+}
+
+err_t netbuf_data(struct netbuf *buf, void **data, u16_t *length) {
+	*data = (void*)segments[buf->x].data;
+	*length = (u16_t)segments[buf->x].length;
+	return ERR_OK;
+}
+
+int8_t netbuf_next(struct netbuf *buf) { return -1; }
+void netbuf_delete(struct netbuf *buf) {}
+
+err_t netconn_write(struct netconn *conn, const void *data, size_t length, u8_t flags) {
+	if(output_length + length + 1 > output_size){
+		output_size = (output_length + length + 1) * 2;
+		output = realloc(output, output_size);
+	}
+	memcpy(output + output_length, data, length);
+	output_length += length;
+	output[output_length] = '\0';
+	return ERR_OK;
+}
+
+struct netconn *netconn_new(enum netconn_type type) { return NULL; }
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, u16_t port) { return ERR_OK; }
+err_t netconn_listen(struct netconn *conn) { return ERR_OK; }
+err_t netconn_accept(struct netconn *conn, struct netconn **client) { return ERR_CLSD; }
+err_t netconn_close(struct netconn *conn) { return ERR_OK; }
+err_t netconn_delete(struct netconn *conn) { return ERR_OK; }
+void netconn_set_recvtimeout(struct netconn *conn, int timeout) {}
+void netconn_set_sendtimeout(struct netconn *conn, int timeout) {}
+
+
+/* FreeRTOS */
+
+void portENTER_CRITICAL(portMUX_TYPE *mux) {}
+void portEXIT_CRITICAL(portMUX_TYPE *mux) {}
+int xPortGetCoreID(void) { return fake_core; }
+
+TickType_t xTaskGetTickCount(void) { return (TickType_t)(fake_time_us / 1000 / portTICK_PERIOD_MS); }
+void vTaskDelay(TickType_t ticks) { fake_time_us += (int64_t)ticks * portTICK_PERIOD_MS * 1000; }
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return fake_task; }
+char *pcTaskGetTaskName(TaskHandle_t task) { return (char*)fake_task_name; }
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) { return 5; }
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 1024; }
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *param, UBaseType_t priority, TaskHandle_t *task) { return pdPASS; }
+TaskHandle_t xTaskCreateStatic(TaskFunction_t code, const char *name, uint32_t stack, void *param, UBaseType_t priority, StackType_t *stack_buffer, StaticTask_t *task_buffer) { return (TaskHandle_t)task_buffer; }
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, int action) { return pdPASS; }
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks) { return pdFALSE; }
+void vTaskDelete(TaskHandle_t task) {}
+
+EventGroupHandle_t xEventGroupCreate(void) { return calloc(1, sizeof(EventBits_t)); }
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer) { memset(buffer, 0, sizeof(*buffer)); return buffer; }
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) { return *(EventBits_t*)group; }
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) { return *(EventBits_t*)group |= bits; }
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+	EventBits_t previous = *(EventBits_t*)group;
+	*(EventBits_t*)group &= ~bits;
+	return previous;
+}
+static bool fake_bits_set(EventGroupHandle_t group, EventBits_t bits, BaseType_t all) {
+	EventBits_t value = *(EventBits_t*)group & bits;
+	return all ? value == bits : value != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks) {
+	if(ticks > 0 && fake_block && !fake_bits_set(group, bits, all)) fake_block(ticks);
+	EventBits_t value = *(EventBits_t*)group;
+	if(clear) *(EventBits_t*)group &= ~bits;
+	return value;
+}
+void vEventGroupDelete(EventGroupHandle_t group) {}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t size, uint8_t *storage, StaticQueue_t *buffer) {
+	fake_queue_t *q = (fake_queue_t*)buffer;
+	*q = (fake_queue_t){ .storage = storage, .length = length, .size = size };
+	return q;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size) {
+	fake_queue_t *q = calloc(1, sizeof(fake_queue_t) + length * size);
+	*q = (fake_queue_t){ .storage = (uint8_t*)(q + 1), .length = length, .size = size };
+	return q;
+}
+
+static BaseType_t fake_queue_send(QueueHandle_t queue, const void *item, bool front) {
+	fake_queue_t *q = queue;
+	if(q == NULL || q->count == q->length) return pdFALSE;
+	UBaseType_t slot;
+	if(front){
+		q->head = (q->head + q->length - 1) % q->length;
+		slot = q->head;
+	}
+	else{
+		slot = (q->head + q->count) % q->length;
+	}
+	memcpy(q->storage + slot * q->size, item, q->size);
+	q->count++;
+	return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks) { return fake_queue_send(queue, item, false); }
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks) { return fake_queue_send(queue, item, true); }
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+	fake_queue_t *q = queue;
+	if(q == NULL) return pdFALSE;
+	if(q->count == 0 && ticks > 0 && fake_block) fake_block(ticks);
+	if(q->count == 0) return pdFALSE;
+	memcpy(item, q->storage + q->head * q->size, q->size);
+	q->head = (q->head + 1) % q->length;
+	q->count--;
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue ? ((fake_queue_t*)queue)->count : 0; }
+void vQueueDelete(QueueHandle_t queue) {}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return calloc(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) { return buffer; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) { return pdTRUE; }
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {}
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
+
+
+/* esp */
+
+int64_t esp_timer_get_time(void) {
+	int64_t now = fake_time_us;
+	fake_time_us += fake_time_step_us;
+	return now;
+}
+
+uint32_t esp_random(void) {
+	static uint32_t state = 2463534242u;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+
+/* nvs: a single namespace of blobs, committed as soon as they are set */
+
+void fake_nvs_reset() {
+	for(int i = 0; i < FAKE_NVS_KEYS; i++){
+		free(nvs_blobs[i].data);
+	}
+	memset(nvs_blobs, 0, sizeof(nvs_blobs));
+	fake_nvs_writes = 0;
+}
+
+static int fake_nvs_find(const char *key) {
+	for(int i = 0; i < FAKE_NVS_KEYS; i++){
+		if(nvs_blobs[i].data != NULL && strcmp(nvs_blobs[i].key, key) == 0) return i;
+	}
+	return -1;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle) { *handle = 1; return ESP_OK; }
+void nvs_close(nvs_handle handle) {}
+esp_err_t nvs_commit(nvs_handle handle) { return ESP_OK; }
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *data, size_t size) {
+	int i = fake_nvs_find(key);
+
+	if(i < 0){
+		for(i = 0; i < FAKE_NVS_KEYS && nvs_blobs[i].data != NULL; i++);
+		if(i == FAKE_NVS_KEYS) return ESP_FAIL;
+		snprintf(nvs_blobs[i].key, sizeof(nvs_blobs[i].key), "%s", key);
+	}
+	free(nvs_blobs[i].data);
+	nvs_blobs[i].data = malloc(size + 1);
+	memcpy(nvs_blobs[i].data, data, size);
+	nvs_blobs[i].size = size;
+	fake_nvs_writes++;
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *data, size_t *size) {
+	int i = fake_nvs_find(key);
+
+	if(i < 0) return ESP_ERR_NVS_NOT_FOUND;
+	if(data != NULL && *size < nvs_blobs[i].size){
+		*size = nvs_blobs[i].size;
+		return ESP_ERR_NVS_INVALID_LENGTH;
+	}
+	if(data != NULL) memcpy(data, nvs_blobs[i].data, nvs_blobs[i].size);
+	*size = nvs_blobs[i].size;
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key) {
+	int i = fake_nvs_find(key);
+
+	if(i < 0) return ESP_ERR_NVS_NOT_FOUND;
+	free(nvs_blobs[i].data);
+	memset(&nvs_blobs[i], 0, sizeof(nvs_blobs[i]));
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle handle) {
+	int writes = fake_nvs_writes;
+
+	fake_nvs_reset();
+	fake_nvs_writes = writes;
+	return ESP_OK;
+}
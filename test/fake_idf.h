@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file fake_idf.h
+@brief Host implementations of the FreeRTOS, esp, nvs and lwIP functions the component calls.
+
+Nothing runs concurrently: event groups, semaphores and queues never block, and the clock only moves when
+esp_timer_get_time is called or a test sets it. A task that would block on an empty queue or on event bits calls
+fake_block instead, where a test plays the other tasks and the driver. NVS holds a single namespace in memory. A
+netconn replays the segments a test queued and records everything written to it.
+*/
+
+#ifndef FAKE_IDF_H_INCLUDED
+#define FAKE_IDF_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+/* @brief value returned by the next esp_timer_get_time call */
+extern int64_t fake_time_us;
+
+/* @brief added to fake_time_us by every esp_timer_get_time call */
+extern int64_t fake_time_step_us;
+
+/* @brief returned by xPortGetCoreID */
+extern int fake_core;
+
+/* @brief returned by xTaskGetCurrentTaskHandle and pcTaskGetTaskName */
+extern void *fake_task;
+extern const char *fake_task_name;
+
+/* @brief number of blobs written to nvs since the last fake_nvs_reset */
+extern int fake_nvs_writes;
+
+/* @brief if set, called by xQueueReceive on an empty queue and xEventGroupWaitBits on unset bits, with their timeout */
+extern void (*fake_block)(TickType_t ticks);
+
+/**
+ * @brief Erases every blob of nvs and zeroes fake_nvs_writes.
+ */
+void fake_nvs_reset();
+
+/**
+ * @brief Forgets the queued segments and the recorded output.
+ */
+void fake_netconn_reset();
+
+/**
+ * @brief Queues a segment received by the next netconn_recv. Once all are received netconn_recv reports a closed
+ * connection. The data is not copied.
+ */
+void fake_netconn_add_segment(const char *data, size_t length);
+
+/**
+ * @brief Gets everything written with netconn_write since the last reset, NUL terminated.
+ */
+const char* fake_netconn_output(size_t *length);
+
+#endif /* FAKE_IDF_H_INCLUDED */
@@ -0,0 +1,2 @@
+#pragma once
+void init_dns_server(void);
@@ -0,0 +1,30 @@
+/*
+ * Host stubs of the ESP-IDF 3.x headers used by the component: only the declarations the sources need to
+ * compile on Linux. Functions the code under test calls are implemented by fake_idf.c or by the test itself.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERROR_CHECK(x) do { (void)(x); } while(0)
+/* from soc/soc.h on the target */
+#define BIT0 1
+#define BIT1 2
+#define BIT2 4
+#define BIT3 8
+#define BIT4 16
+#define BIT5 32
+#define BIT6 64
+#define BIT7 128
+#define BIT8 256
+#define BIT9 512
+#define BIT10 1024
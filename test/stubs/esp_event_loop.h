@@ -0,0 +1,3 @@
+#pragma once
+#include "esp_event.h"
+system_event_cb_t esp_event_loop_set_cb(system_event_cb_t, void*);
@@ -0,0 +1,9 @@
+#pragma once
+#include <stdio.h>
+/* logs are compiled for their format checks but not printed */
+#define ESP_LOG_HOST(tag, fmt, ...) do { if(0) printf("%s: " fmt, tag, ##__VA_ARGS__); } while(0)
+#define ESP_LOGD(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
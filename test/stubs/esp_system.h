@@ -0,0 +1,3 @@
+#pragma once
+#include "esp_err.h"
+void esp_restart(void); uint32_t esp_random(void); size_t esp_get_free_heap_size(void);
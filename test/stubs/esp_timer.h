@@ -0,0 +1,3 @@
+#pragma once
+#include "esp_err.h"
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,29 @@
+#pragma once
+#include "esp_err.h"
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA, WIFI_MODE_AP, WIFI_MODE_APSTA } wifi_mode_t;
+typedef enum { WIFI_IF_STA, WIFI_IF_AP } wifi_interface_t;
+typedef enum { WIFI_AUTH_OPEN, WIFI_AUTH_WEP, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WPA2_PSK, WIFI_AUTH_WPA_WPA2_PSK, WIFI_AUTH_WPA2_ENTERPRISE, WIFI_AUTH_MAX } wifi_auth_mode_t;
+typedef enum { WIFI_BW_HT20 = 1, WIFI_BW_HT40 } wifi_bandwidth_t;
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+typedef enum { WIFI_SECOND_CHAN_NONE, WIFI_SECOND_CHAN_ABOVE, WIFI_SECOND_CHAN_BELOW } wifi_second_chan_t;
+typedef enum { WIFI_SCAN_TYPE_ACTIVE, WIFI_SCAN_TYPE_PASSIVE } wifi_scan_type_t;
+typedef enum { WIFI_FAST_SCAN, WIFI_ALL_CHANNEL_SCAN } wifi_scan_method_t;
+typedef enum { WIFI_CONNECT_AP_BY_SIGNAL, WIFI_CONNECT_AP_BY_SECURITY } wifi_sort_method_t;
+typedef struct { uint32_t min, max; } wifi_active_scan_time_t;
+typedef struct { wifi_active_scan_time_t active; uint32_t passive; } wifi_scan_time_t;
+typedef struct { uint8_t *ssid; uint8_t *bssid; uint8_t channel; bool show_hidden; wifi_scan_type_t scan_type; wifi_scan_time_t scan_time; } wifi_scan_config_t;
+typedef struct { uint8_t bssid[6]; uint8_t ssid[33]; uint8_t primary; wifi_second_chan_t second; int8_t rssi; wifi_auth_mode_t authmode; } wifi_ap_record_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; uint8_t ssid_len; uint8_t channel; wifi_auth_mode_t authmode; uint8_t ssid_hidden; uint8_t max_connection; uint16_t beacon_interval; } wifi_ap_config_t;
+typedef struct { int8_t rssi; wifi_auth_mode_t authmode; } wifi_fast_scan_threshold_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; wifi_scan_method_t scan_method; bool bssid_set; uint8_t bssid[6]; uint8_t channel; uint16_t listen_interval; wifi_sort_method_t sort_method; wifi_fast_scan_threshold_t threshold; } wifi_sta_config_t;
+typedef union { wifi_ap_config_t ap; wifi_sta_config_t sta; } wifi_config_t;
+typedef enum { WIFI_STORAGE_FLASH, WIFI_STORAGE_RAM } wifi_storage_t;
+typedef struct { uint8_t mac[6]; } wifi_sta_info_t;
+typedef struct { wifi_sta_info_t sta[10]; int num; } wifi_sta_list_t;
+typedef enum {
+ WIFI_REASON_UNSPECIFIED=1, WIFI_REASON_AUTH_EXPIRE=2, WIFI_REASON_AUTH_LEAVE=3, WIFI_REASON_ASSOC_EXPIRE=4, WIFI_REASON_ASSOC_TOOMANY=5,
+ WIFI_REASON_NOT_AUTHED=6, WIFI_REASON_NOT_ASSOCED=7, WIFI_REASON_ASSOC_LEAVE=8, WIFI_REASON_ASSOC_NOT_AUTHED=9,
+ WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT=15, WIFI_REASON_GROUP_KEY_UPDATE_TIMEOUT=16, WIFI_REASON_IE_IN_4WAY_DIFFERS=17,
+ WIFI_REASON_802_1X_AUTH_FAILED=23,
+ WIFI_REASON_BEACON_TIMEOUT=200, WIFI_REASON_NO_AP_FOUND=201, WIFI_REASON_AUTH_FAIL=202, WIFI_REASON_ASSOC_FAIL=203, WIFI_REASON_HANDSHAKE_TIMEOUT=204 } wifi_err_reason_t;
+typedef struct { char cc[3]; uint8_t schan; uint8_t nchan; int8_t max_tx_power; int policy; } wifi_country_t;
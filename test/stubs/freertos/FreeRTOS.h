@@ -0,0 +1,23 @@
+#pragma once
+#include "esp_err.h"
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t StackType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(x) ((TickType_t)(x)/10)
+#define configTICK_RATE_HZ 100
+typedef struct { int a; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+void portENTER_CRITICAL(portMUX_TYPE*); void portEXIT_CRITICAL(portMUX_TYPE*);
+typedef struct { char d[64]; } StaticQueue_t; typedef StaticQueue_t StaticSemaphore_t; typedef StaticQueue_t StaticEventGroup_t; typedef struct { char d[400]; } StaticTask_t;
+#define configMINIMAL_STACK_SIZE 768
+#define tskNO_AFFINITY 0x7fffffff
+int xPortGetCoreID(void);
+#define portNUM_PROCESSORS 2
+#define configSUPPORT_STATIC_ALLOCATION 1
@@ -0,0 +1,7 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef void* QueueHandle_t;
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t); QueueHandle_t xQueueCreateStatic(UBaseType_t, UBaseType_t, uint8_t*, StaticQueue_t*);
+BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t); BaseType_t xQueueSendToBack(QueueHandle_t, const void*, TickType_t);
+BaseType_t xQueueSendToFront(QueueHandle_t, const void*, TickType_t); BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t);
+void vQueueDelete(QueueHandle_t); UBaseType_t uxQueueMessagesWaiting(QueueHandle_t);
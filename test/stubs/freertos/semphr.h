@@ -0,0 +1,5 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef void* SemaphoreHandle_t;
+SemaphoreHandle_t xSemaphoreCreateMutex(void); SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t*);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t); BaseType_t xSemaphoreGive(SemaphoreHandle_t); void vSemaphoreDelete(SemaphoreHandle_t);
@@ -0,0 +1,16 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, StackType_t*, StaticTask_t*);
+void vTaskDelete(TaskHandle_t); void vTaskDelay(TickType_t); TickType_t xTaskGetTickCount(void);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t); UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t); uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+BaseType_t xTaskNotify(TaskHandle_t, uint32_t, int); BaseType_t xTaskNotifyWait(uint32_t,uint32_t,uint32_t*,TickType_t);
+#define eSetBits 1
+#define eSetValueWithOverwrite 3
+#define eIncrement 2
+char *pcTaskGetTaskName(TaskHandle_t);
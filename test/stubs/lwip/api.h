@@ -0,0 +1,30 @@
+#pragma once
+#include "lwip/ip4_addr.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+typedef int8_t err_t; typedef uint16_t u16_t; typedef uint8_t u8_t; typedef uint32_t u32_t;
+#define ERR_OK 0
+#define ERR_MEM -1
+#define ERR_TIMEOUT -3
+#define ERR_WOULDBLOCK -7
+#define ERR_CLSD -15
+enum netconn_type { NETCONN_TCP = 0x10 };
+struct netconn { int x; };
+struct netbuf { int x; };
+#define NETCONN_NOCOPY 0
+#define NETCONN_COPY 1
+#define NETCONN_MORE 2
+#define NETCONN_DONTBLOCK 4
+struct netconn *netconn_new(enum netconn_type);
+err_t netconn_bind(struct netconn*, const ip_addr_t*, u16_t); err_t netconn_listen(struct netconn*);
+err_t netconn_accept(struct netconn*, struct netconn**); err_t netconn_recv(struct netconn*, struct netbuf**);
+err_t netconn_write(struct netconn*, const void*, size_t, u8_t);
+err_t netconn_write_partly(struct netconn*, const void*, size_t, u8_t, size_t*);
+err_t netconn_close(struct netconn*); err_t netconn_delete(struct netconn*);
+void netconn_set_recvtimeout(struct netconn*, int); void netconn_set_sendtimeout(struct netconn*, int);
+err_t netconn_getaddr(struct netconn*, ip_addr_t*, u16_t*, u8_t);
+#define netconn_peer(c,i,p) netconn_getaddr(c,i,p,0)
+err_t netbuf_data(struct netbuf*, void**, u16_t*); int8_t netbuf_next(struct netbuf*); void netbuf_first(struct netbuf*);
+void netbuf_delete(struct netbuf*); u16_t netbuf_len(struct netbuf*);
+u16_t netbuf_copy_partial(struct netbuf*, void*, u16_t, u16_t);
+#define netbuf_copy(b,d,l) netbuf_copy_partial(b,d,l,0)
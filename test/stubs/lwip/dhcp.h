@@ -0,0 +1,5 @@
+#pragma once
+#include "lwip/api.h"
+struct dhcp { u32_t offered_t0_lease; };
+struct netif { int x; };
+struct dhcp *netif_dhcp_data(struct netif*);
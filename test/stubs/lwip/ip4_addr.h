@@ -0,0 +1,13 @@
+#pragma once
+#include "esp_err.h"
+typedef struct { uint32_t addr; } ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+#define IP4ADDR_STRLEN_MAX 16
+char *ip4addr_ntoa(const ip4_addr_t*);
+int ip4addr_aton(const char*, ip4_addr_t*);
+char *ip4addr_ntoa_r(const ip4_addr_t*, char*, int);
+#define IP4_ADDR(a, b,c,d,e) ((a)->addr = 0)
+#define ip4_addr_isany_val(a) ((a).addr == 0)
+#define ip4_addr_cmp(a,b) ((a)->addr == (b)->addr)
+extern ip_addr_t ip_addr_any;
+#define IP_ADDR_ANY (&ip_addr_any)
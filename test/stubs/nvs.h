@@ -0,0 +1,11 @@
+#pragma once
+#include "esp_err.h"
+typedef uint32_t nvs_handle;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode;
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_INVALID_LENGTH 0x110c
+esp_err_t nvs_open(const char*, nvs_open_mode, nvs_handle*); void nvs_close(nvs_handle);
+esp_err_t nvs_set_blob(nvs_handle, const char*, const void*, size_t); esp_err_t nvs_get_blob(nvs_handle, const char*, void*, size_t*);
+esp_err_t nvs_erase_all(nvs_handle); esp_err_t nvs_erase_key(nvs_handle, const char*); esp_err_t nvs_commit(nvs_handle);
+esp_err_t nvs_set_u8(nvs_handle, const char*, uint8_t); esp_err_t nvs_get_u8(nvs_handle, const char*, uint8_t*);
+esp_err_t nvs_set_u32(nvs_handle, const char*, uint32_t); esp_err_t nvs_get_u32(nvs_handle, const char*, uint32_t*);
@@ -0,0 +1,16 @@
+#pragma once
+#include "lwip/ip4_addr.h"
+typedef struct { ip4_addr_t ip, netmask, gw; } tcpip_adapter_ip_info_t;
+typedef enum { TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_IF_AP } tcpip_adapter_if_t;
+typedef enum { TCPIP_ADAPTER_DHCP_INIT, TCPIP_ADAPTER_DHCP_STARTED, TCPIP_ADAPTER_DHCP_STOPPED } tcpip_adapter_dhcp_status_t;
+typedef enum { TCPIP_ADAPTER_DNS_MAIN, TCPIP_ADAPTER_DNS_BACKUP } tcpip_adapter_dns_type_t;
+typedef struct { ip_addr_t ip; } tcpip_adapter_dns_info_t;
+void tcpip_adapter_init(void);
+esp_err_t tcpip_adapter_dhcps_stop(tcpip_adapter_if_t); esp_err_t tcpip_adapter_dhcps_start(tcpip_adapter_if_t);
+esp_err_t tcpip_adapter_dhcpc_stop(tcpip_adapter_if_t); esp_err_t tcpip_adapter_dhcpc_start(tcpip_adapter_if_t);
+esp_err_t tcpip_adapter_dhcpc_get_status(tcpip_adapter_if_t, tcpip_adapter_dhcp_status_t*);
+esp_err_t tcpip_adapter_set_ip_info(tcpip_adapter_if_t, const tcpip_adapter_ip_info_t*);
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t, tcpip_adapter_ip_info_t*);
+esp_err_t tcpip_adapter_set_dns_info(tcpip_adapter_if_t, tcpip_adapter_dns_type_t, tcpip_adapter_dns_info_t*);
+esp_err_t tcpip_adapter_get_dns_info(tcpip_adapter_if_t, tcpip_adapter_dns_type_t, tcpip_adapter_dns_info_t*);
+esp_err_t tcpip_adapter_get_netif(tcpip_adapter_if_t, void**);
@@ -0,0 +1,102 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test.h
+@brief Assertions and timing shared by the host tests and benchmarks.
+
+A failed assertion is reported with its location and the test goes on: test_report gives the exit status.
+*/
+
+#ifndef TEST_H_INCLUDED
+#define TEST_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static int test_checks = 0;
+static int test_failures = 0;
+
+#define TEST_ASSERT(condition) do { \
+	test_checks++; \
+	if(!(condition)){ \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #condition); \
+	} \
+} while(0)
+
+#define TEST_ASSERT_EQUAL_INT(expected, actual) do { \
+	long long test_expected = (long long)(expected), test_actual = (long long)(actual); \
+	test_checks++; \
+	if(test_expected != test_actual){ \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: %s: expected %lld, got %lld\n", __FILE__, __LINE__, #actual, test_expected, test_actual); \
+	} \
+} while(0)
+
+#define TEST_ASSERT_EQUAL_STRING(expected, actual) do { \
+	const char *test_expected = (expected), *test_actual = (actual); \
+	test_checks++; \
+	if(strcmp(test_expected, test_actual) != 0){ \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: %s: expected \"%s\", got \"%s\"\n", __FILE__, __LINE__, #actual, test_expected, test_actual); \
+	} \
+} while(0)
+
+#define TEST_ASSERT_EQUAL_MEMORY(expected, actual, size) do { \
+	test_checks++; \
+	if(memcmp((expected), (actual), (size)) != 0){ \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: %s differs from %s\n", __FILE__, __LINE__, #actual, #expected); \
+	} \
+} while(0)
+
+/**
+ * @brief Prints the totals of the test.
+ * @return the exit status of the test.
+ */
+static inline int test_report(const char *name) {
+	printf("%s: %d checks, %d failures\n", name, test_checks, test_failures);
+	return test_failures ? 1 : 0;
+}
+
+/**
+ * @brief Monotonic time in ns, for benchmarks.
+ */
+static inline uint64_t test_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * @brief xorshift32: the fuzzers must be reproducible.
+ */
+static inline uint32_t test_random(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+#endif /* TEST_H_INCLUDED */
@@ -0,0 +1,382 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_ap_table.c
+@brief Tests the table of the access points seen by the scans and the /ap.json it generates.
+
+The clock of the table is the tick count of fake_idf.c, moved by setting fake_time_us.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "wifi_manager.h"
+#include "ap_table.h"
+#include "test.h"
+#include "fake_idf.h"
+
+
+static wifi_ap_record_t record(uint8_t id, const char *ssid, uint8_t channel, int8_t rssi) {
+	wifi_ap_record_t r;
+
+	memset(&r, 0, sizeof(r));
+	r.bssid[0] = 0x24;
+	r.bssid[5] = id;
+	snprintf((char*)r.ssid, sizeof(r.ssid), "%s", ssid);
+	r.primary = channel;
+	r.rssi = rssi;
+	r.authmode = WIFI_AUTH_WPA2_PSK;
+	return r;
+}
+
+static wifi_ap_record_t record_ht40(uint8_t id, uint8_t channel, wifi_second_chan_t second, int8_t rssi) {
+	wifi_ap_record_t r = record(id, "ht40", channel, rssi);
+
+	r.second = second;
+	return r;
+}
+
+static int count_char(const char *s, char c) {
+	int count = 0;
+	for(; *s; s++) count += *s == c;
+	return count;
+}
+
+
+static void test_json_empty() {
+	char buffer[16];
+
+	ap_table_clear();
+	TEST_ASSERT_EQUAL_INT(4, ap_table_json_size());
+	TEST_ASSERT_EQUAL_INT(3, ap_table_format_json(buffer, 4));
+	TEST_ASSERT_EQUAL_STRING("[]\n", buffer);
+}
+
+
+static void test_json_content() {
+	wifi_ap_record_t records[] = {
+		record(1, "home", 6, -40),
+		record(2, "say \"hi\"\\", 11, -70),
+		record(3, "home", 1, -60),
+	};
+	char buffer[512];
+
+	ap_table_clear();
+	ap_table_update(records, 3);
+	TEST_ASSERT_EQUAL_INT(3 * JSON_ONE_APP_SIZE + 4, ap_table_json_size());
+	size_t length = ap_table_format_json(buffer, ap_table_json_size());
+	TEST_ASSERT_EQUAL_STRING("[{\"ssid\":\"home\",\"chan\":6,\"rssi\":-40,\"auth\":3},\n"
+			"{\"ssid\":\"say \\\"hi\\\"\\\\\",\"chan\":11,\"rssi\":-70,\"auth\":3}]\n", buffer);
+	TEST_ASSERT_EQUAL_INT(strlen(buffer), length);
+}
+
+
+/**
+ * @brief Whatever the size of the buffer the json stays valid: the access points that do not fit are left out whole.
+ */
+static void test_json_truncation() {
+	wifi_ap_record_t records[MAX_AP_NUM];
+	static char buffer[MAX_AP_NUM * JSON_ONE_APP_SIZE + 4 + 16];
+	char ssid[33];
+	int previous = 0;
+
+	ap_table_clear();
+	for(int i = 0; i < MAX_AP_NUM; i++){
+		snprintf(ssid, sizeof(ssid), i % 5 ? "network %d" : "\"%d\"\t\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"", i);
+		records[i] = record(i, ssid, 1 + i % 13, -30 - i);
+	}
+	ap_table_update(records, MAX_AP_NUM);
+	TEST_ASSERT_EQUAL_INT(MAX_AP_NUM, ap_table_count());
+
+	size_t full = ap_table_json_size();
+	for(size_t size = 4; size <= full; size++){
+		/* canary past the end of the buffer */
+		memset(buffer, 'x', size + 16);
+		size_t length = ap_table_format_json(buffer, size);
+		TEST_ASSERT(length < size);
+		TEST_ASSERT_EQUAL_INT(length, strlen(buffer));
+		TEST_ASSERT_EQUAL_INT('x', buffer[size]);
+		TEST_ASSERT(buffer[0] == '[' && strcmp(buffer + length - 2, "]\n") == 0);
+
+		int entries = 0;
+		for(const char *p = buffer; (p = strstr(p, "{\"ssid\":")) != NULL; p++) entries++;
+		TEST_ASSERT_EQUAL_INT(entries, count_char(buffer, '}'));
+		TEST_ASSERT(entries >= previous);
+		previous = entries;
+	}
+	TEST_ASSERT_EQUAL_INT(MAX_AP_NUM, previous);
+
+	/* the static buffer lists the strongest access points first */
+	ap_table_format_json(buffer, WIFI_MANAGER_STATIC_AP_LIST_SIZE);
+	TEST_ASSERT(strstr(buffer, "\"network 1\"") != NULL);
+	TEST_ASSERT(strstr(buffer, "\"network 63\"") == NULL);
+}
+
+/**
+ * @brief The table stays sorted by decreasing smoothed signal strength, without duplicate BSSIDs, whatever the
+ * order of the updates.
+ */
+static void test_sort_order() {
+	uint32_t state = 12345;
+
+	ap_table_clear();
+	for(int n = 0; n < 2000; n++){
+		uint16_t count = 1 + test_random(&state) % 8;
+		wifi_ap_record_t records[8];
+
+		for(int i = 0; i < count; i++){
+			records[i] = record(test_random(&state) % 100, "sorted", 1 + i, -20 - (int)(test_random(&state) % 80));
+		}
+		ap_table_update(records, count);
+
+		TEST_ASSERT(ap_table_count() <= AP_TABLE_SIZE);
+		for(int i = 0; i + 1 < ap_table_count(); i++){
+			TEST_ASSERT(ap_table_get(i)->rssi_avg >= ap_table_get(i + 1)->rssi_avg);
+			for(int j = i + 1; j < ap_table_count(); j++){
+				TEST_ASSERT(memcmp(ap_table_get(i)->bssid, ap_table_get(j)->bssid, 6) != 0);
+			}
+		}
+	}
+	TEST_ASSERT_EQUAL_INT(AP_TABLE_SIZE, ap_table_count());
+}
+
+
+/**
+ * @brief Once the table is full a new access point only replaces the weakest one if its signal is stronger.
+ */
+static void test_full_table() {
+	wifi_ap_record_t r;
+
+	ap_table_clear();
+	for(int i = 0; i < AP_TABLE_SIZE; i++){
+		r = record(i, "full", 1, -30 - i);
+		ap_table_update(&r, 1);
+	}
+	TEST_ASSERT_EQUAL_INT(AP_TABLE_SIZE, ap_table_count());
+
+	r = record(200, "weaker", 1, -30 - AP_TABLE_SIZE);
+	ap_table_update(&r, 1);
+	TEST_ASSERT_EQUAL_INT(AP_TABLE_SIZE, ap_table_count());
+	TEST_ASSERT_EQUAL_INT(-30 - (AP_TABLE_SIZE - 1), ap_table_rssi(ap_table_get(AP_TABLE_SIZE - 1)));
+
+	r = record(201, "stronger", 1, -50);
+	ap_table_update(&r, 1);
+	TEST_ASSERT_EQUAL_INT(AP_TABLE_SIZE, ap_table_count());
+	TEST_ASSERT_EQUAL_INT(201, ap_table_get(21)->bssid[5]);
+	TEST_ASSERT_EQUAL_INT(AP_TABLE_SIZE - 2, ap_table_get(AP_TABLE_SIZE - 1)->bssid[5]);
+}
+
+
+/**
+ * @brief Every scan moves the smoothed signal strength a quarter of the way towards the new measurement.
+ */
+static void test_ewma() {
+	wifi_ap_record_t r = record(1, "ewma", 6, -40);
+
+	ap_table_clear();
+	ap_table_update(&r, 1);
+	TEST_ASSERT_EQUAL_INT(-40 * 16, ap_table_get(0)->rssi_avg);
+	TEST_ASSERT_EQUAL_INT(-40, ap_table_rssi(ap_table_get(0)));
+
+	r.rssi = -60;
+	ap_table_update(&r, 1);
+	TEST_ASSERT_EQUAL_INT(-40 * 16 + (-60 * 16 + 40 * 16) / (1 << AP_TABLE_RSSI_EWMA_SHIFT), ap_table_get(0)->rssi_avg);
+	TEST_ASSERT_EQUAL_INT(-45, ap_table_rssi(ap_table_get(0)));
+	ap_table_update(&r, 1);
+	TEST_ASSERT_EQUAL_INT(-780, ap_table_get(0)->rssi_avg);
+	TEST_ASSERT_EQUAL_INT(-49, ap_table_rssi(ap_table_get(0)));
+
+	/* the truncated steps stop short of the measurement, by less than 1/2 dBm */
+	for(int i = 0; i < 100; i++) ap_table_update(&r, 1);
+	TEST_ASSERT(ap_table_get(0)->rssi_avg > -60 * 16 - (1 << AP_TABLE_RSSI_EWMA_SHIFT));
+	TEST_ASSERT_EQUAL_INT(-60, ap_table_rssi(ap_table_get(0)));
+
+	r.rssi = -70;
+	for(int i = 0; i < 100; i++) ap_table_update(&r, 1);
+	TEST_ASSERT(ap_table_get(0)->rssi_avg < -70 * 16 + (1 << AP_TABLE_RSSI_EWMA_SHIFT));
+	TEST_ASSERT_EQUAL_INT(-70, ap_table_rssi(ap_table_get(0)));
+
+	/* an access point overtaking another one moves up the table */
+	wifi_ap_record_t other = record(2, "other", 1, -65);
+	ap_table_update(&other, 1);
+	TEST_ASSERT_EQUAL_INT(2, ap_table_get(0)->bssid[5]);
+	r.rssi = -30;
+	ap_table_update(&r, 1);
+	TEST_ASSERT_EQUAL_INT(1, ap_table_get(0)->bssid[5]);
+	TEST_ASSERT_EQUAL_INT(-60, ap_table_rssi(ap_table_get(0)));
+}
+
+
+/**
+ * @brief ap_table_rssi rounds the smoothed signal strength to the nearest dBm, halves away from zero.
+ */
+static void test_rssi_rounding() {
+	ap_table_entry_t entry;
+
+	memset(&entry, 0, sizeof(entry));
+	for(int avg = -128 * 16; avg <= 0; avg++){
+		entry.rssi_avg = avg;
+		TEST_ASSERT_EQUAL_INT(-((-avg + 8) / 16), ap_table_rssi(&entry));
+	}
+
+	entry.rssi_avg = -70 * 16 + 7;
+	TEST_ASSERT_EQUAL_INT(-70, ap_table_rssi(&entry));
+	entry.rssi_avg = -70 * 16 + 9;
+	TEST_ASSERT_EQUAL_INT(-69, ap_table_rssi(&entry));
+	entry.rssi_avg = -70 * 16 + 8;
+	TEST_ASSERT_EQUAL_INT(-70, ap_table_rssi(&entry));
+}
+
+
+/**
+ * @brief Access points are removed AP_TABLE_MAX_AGE_MS after the last scan that saw them.
+ */
+static void test_expiry() {
+	wifi_ap_record_t first = record(1, "first", 1, -40);
+	wifi_ap_record_t second = record(2, "second", 6, -50);
+
+	fake_time_us = 1000000;
+	ap_table_clear();
+	ap_table_update(&first, 1);
+	fake_time_us += 30000000;
+	ap_table_update(&second, 1);
+
+	fake_time_us = 1000000 + AP_TABLE_MAX_AGE_MS * 1000LL - portTICK_PERIOD_MS * 1000;
+	ap_table_expire();
+	TEST_ASSERT_EQUAL_INT(2, ap_table_count());
+
+	fake_time_us = 1000000 + AP_TABLE_MAX_AGE_MS * 1000LL;
+	ap_table_expire();
+	TEST_ASSERT_EQUAL_INT(1, ap_table_count());
+	TEST_ASSERT_EQUAL_STRING("second", (const char*)ap_table_get(0)->ssid);
+
+	/* a scan seeing an access point again keeps it */
+	fake_time_us += 20000000;
+	ap_table_update(&first, 1);
+	fake_time_us = 31000000 + AP_TABLE_MAX_AGE_MS * 1000LL;
+	ap_table_expire();
+	TEST_ASSERT_EQUAL_INT(1, ap_table_count());
+	TEST_ASSERT_EQUAL_STRING("first", (const char*)ap_table_get(0)->ssid);
+
+	fake_time_us += 60000000;
+	ap_table_expire();
+	TEST_ASSERT_EQUAL_INT(0, ap_table_count());
+	fake_time_us = 0;
+}
+
+
+/**
+ * @brief Only the strongest access point of an ssid is listed, ssids with the same hash are told apart.
+ */
+static void test_duplicates() {
+	/* "net162789" and "net379192" have the same FNV-1a hash, 0xf8d0434b */
+	wifi_ap_record_t records[] = {
+		record(1, "mesh", 1, -40),
+		record(2, "net162789", 6, -50),
+		record(3, "mesh", 11, -60),
+		record(4, "net379192", 6, -70),
+		record(5, "net162789", 11, -80),
+	};
+	char buffer[512];
+
+	ap_table_clear();
+	ap_table_update(records, 5);
+	TEST_ASSERT_EQUAL_INT(ap_table_get(1)->ssid_hash, ap_table_get(3)->ssid_hash);
+	TEST_ASSERT(!ap_table_is_duplicate(0));
+	TEST_ASSERT(!ap_table_is_duplicate(1));
+	TEST_ASSERT(ap_table_is_duplicate(2));
+	TEST_ASSERT(!ap_table_is_duplicate(3));
+	TEST_ASSERT(ap_table_is_duplicate(4));
+
+	ap_table_format_json(buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL_STRING("[{\"ssid\":\"mesh\",\"chan\":1,\"rssi\":-40,\"auth\":3},\n"
+			"{\"ssid\":\"net162789\",\"chan\":6,\"rssi\":-50,\"auth\":3},\n"
+			"{\"ssid\":\"net379192\",\"chan\":6,\"rssi\":-70,\"auth\":3}]\n", buffer);
+}
+
+
+/**
+ * @brief Channel load of 20 and 40 MHz access points, scored for 20 and 40 MHz signals.
+ */
+static void test_channel_load() {
+	/* weight 10 + 50 dBm above the floor, 20 MHz on channel 6 */
+	wifi_ap_record_t ht20 = record_ht40(1, 6, WIFI_SECOND_CHAN_NONE, -45);
+	/* weight 10 only, 40 MHz on channels 1 and 5 */
+	wifi_ap_record_t above = record_ht40(2, 1, WIFI_SECOND_CHAN_ABOVE, -95);
+	/* weight 20, 40 MHz on channels 11 and 7 */
+	wifi_ap_record_t below = record_ht40(3, 11, WIFI_SECOND_CHAN_BELOW, -85);
+
+	ap_table_clear();
+	TEST_ASSERT_EQUAL_INT(0, ap_table_channel_load(6, false));
+
+	ap_table_update(&ht20, 1);
+	TEST_ASSERT_EQUAL_INT(60 * 5, ap_table_channel_load(6, false));
+	TEST_ASSERT_EQUAL_INT(60 * 3, ap_table_channel_load(8, false));
+	TEST_ASSERT_EQUAL_INT(60 * 1, ap_table_channel_load(2, false));
+	TEST_ASSERT_EQUAL_INT(0, ap_table_channel_load(11, false));
+	TEST_ASSERT_EQUAL_INT(0, ap_table_channel_load(1, false));
+	/* a 40 MHz signal on channel 1 also uses channel 5, on channel 13 also channel 9 */
+	TEST_ASSERT_EQUAL_INT(60 * 4, ap_table_channel_load(1, true));
+	TEST_ASSERT_EQUAL_INT(60 * 2, ap_table_channel_load(13, true));
+	TEST_ASSERT_EQUAL_INT(60 * 5 + 60 * 1, ap_table_channel_load(6, true));
+
+	ap_table_clear();
+	ap_table_update(&above, 1);
+	TEST_ASSERT_EQUAL_INT(10 * 5 + 10 * 1, ap_table_channel_load(1, false));
+	TEST_ASSERT_EQUAL_INT(10 * 3 + 10 * 3, ap_table_channel_load(3, false));
+	TEST_ASSERT_EQUAL_INT(10 * 5 + 10 * 1, ap_table_channel_load(5, false));
+	TEST_ASSERT_EQUAL_INT(10 * 2, ap_table_channel_load(8, false));
+	TEST_ASSERT_EQUAL_INT(10 * 1, ap_table_channel_load(9, false));
+	TEST_ASSERT_EQUAL_INT(0, ap_table_channel_load(10, false));
+	TEST_ASSERT_EQUAL_INT(10 * 3 + 10 * 3 + 10 * 3, ap_table_channel_load(3, true));
+
+	ap_table_clear();
+	ap_table_update(&below, 1);
+	TEST_ASSERT_EQUAL_INT(20 * 5 + 20 * 1, ap_table_channel_load(11, false));
+	TEST_ASSERT_EQUAL_INT(20 * 3 + 20 * 3, ap_table_channel_load(9, false));
+	TEST_ASSERT_EQUAL_INT(20 * 1, ap_table_channel_load(3, false));
+
+	/* the loads of several access points add up */
+	ap_table_update(&ht20, 1);
+	ap_table_update(&above, 1);
+	TEST_ASSERT_EQUAL_INT(60 * 2 + 10 * 1 + 20 * 3 + 20 * 3, ap_table_channel_load(9, false));
+	TEST_ASSERT_EQUAL_INT(60 * 2 + 10 * 3 + 10 * 3 + 20 * 1 + 60 * 4 + 10 * 3 + 20 * 5 + 20 * 1, ap_table_channel_load(3, true));
+}
+
+
+int main() {
+	test_sort_order();
+	test_full_table();
+	test_ewma();
+	test_rssi_rounding();
+	test_expiry();
+	test_duplicates();
+	test_channel_load();
+	test_json_empty();
+	test_json_content();
+	test_json_truncation();
+
+	return test_report("ap_table");
+}
@@ -0,0 +1,340 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_http_parser.c
+@brief Corpus-driven and fuzz test of the HTTP request parser.
+
+Every request of the corpus is parsed in one shot, resumed after a split at every offset and fed one byte
+at a time: all three must give the same result. Files starting with ok_ must parse, files starting with bad_
+must be rejected. The fuzzer then mutates the corpus and checks the same equivalence plus the bounds of
+every token.
+
+usage: test_http_parser corpus/http [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "http_parser.h"
+#include "test.h"
+
+#define MAX_REQUEST_SIZE	4096
+
+typedef struct {
+	char name[64];
+	char data[MAX_REQUEST_SIZE];
+	uint16_t length;
+} corpus_entry_t;
+
+static corpus_entry_t corpus[64];
+static int corpus_count = 0;
+
+
+static void load_corpus(const char *directory) {
+	DIR *dir = opendir(directory);
+	struct dirent *entry;
+	char path[512];
+
+	if(dir == NULL){
+		perror(directory);
+		exit(2);
+	}
+	while((entry = readdir(dir)) != NULL && corpus_count < sizeof(corpus) / sizeof(corpus[0])){
+		if(entry->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+		FILE *f = fopen(path, "rb");
+		if(f == NULL) continue;
+		corpus_entry_t *c = &corpus[corpus_count++];
+		snprintf(c->name, sizeof(c->name), "%.63s", entry->d_name);
+		c->length = fread(c->data, 1, sizeof(c->data), f);
+		fclose(f);
+	}
+	closedir(dir);
+}
+
+
+static const corpus_entry_t* find(const char *name) {
+	for(int i = 0; i < corpus_count; i++){
+		if(strcmp(corpus[i].name, name) == 0) return &corpus[i];
+	}
+	fprintf(stderr, "corpus file %s is missing\n", name);
+	exit(2);
+}
+
+
+/**
+ * @brief Compares the results of two parsers that went through the same request.
+ */
+static bool same_result(http_parser_status_t status_a, const http_parser_t *a, http_parser_status_t status_b, const http_parser_t *b) {
+	if(status_a != status_b) return false;
+	if(status_a != HTTP_PARSER_DONE) return true;
+	return a->method == b->method && memcmp(&a->path, &b->path, sizeof(a->path)) == 0 && memcmp(&a->query, &b->query, sizeof(a->query)) == 0 &&
+			a->version_minor == b->version_minor && memcmp(a->headers, b->headers, sizeof(a->headers)) == 0 && a->found == b->found &&
+			a->content_length == b->content_length && a->header_length == b->header_length;
+}
+
+
+static http_parser_status_t parse_split(http_parser_t *parser, const char *data, uint16_t length, uint16_t split) {
+	http_parser_status_t status;
+
+	http_parser_init(parser);
+	status = http_parser_execute(parser, data, split);
+	if(status == HTTP_PARSER_INCOMPLETE){
+		status = http_parser_execute(parser, data, length);
+	}
+	return status;
+}
+
+
+static http_parser_status_t parse_bytes(http_parser_t *parser, const char *data, uint16_t length) {
+	http_parser_status_t status = HTTP_PARSER_INCOMPLETE;
+
+	http_parser_init(parser);
+	for(uint16_t i = 1; i <= length && status == HTTP_PARSER_INCOMPLETE; i++){
+		status = http_parser_execute(parser, data, i);
+	}
+	return status;
+}
+
+
+/**
+ * @brief Checks that every token found lies within the header block.
+ */
+static bool tokens_in_bounds(const http_parser_t *parser, uint16_t length) {
+	if(parser->header_length > length) return false;
+	if(parser->path.offset + parser->path.length > parser->header_length) return false;
+	if(parser->query.offset + parser->query.length > parser->header_length) return false;
+	for(int h = 0; h < HTTP_HEADER_COUNT; h++){
+		if((parser->found & (1u << h)) && parser->headers[h].offset + parser->headers[h].length > parser->header_length) return false;
+	}
+	return true;
+}
+
+
+/**
+ * @brief Parses a request every way and checks the results agree.
+ * @return the status of the one shot parse.
+ */
+static http_parser_status_t check_equivalence(const char *name, const char *data, uint16_t length, http_parser_t *result) {
+	http_parser_t other;
+	http_parser_status_t status, other_status;
+
+	http_parser_init(result);
+	status = http_parser_execute(result, data, length);
+	if(status == HTTP_PARSER_DONE){
+		TEST_ASSERT(tokens_in_bounds(result, length));
+	}
+
+	for(uint16_t split = 0; split <= length; split++){
+		other_status = parse_split(&other, data, length, split);
+		bool same = same_result(status, result, other_status, &other);
+		TEST_ASSERT(same);
+		if(!same){
+			fprintf(stderr, "  %s split at %u\n", name, split);
+			break;
+		}
+	}
+
+	other_status = parse_bytes(&other, data, length);
+	bool same = same_result(status, result, other_status, &other);
+	TEST_ASSERT(same);
+	if(!same){
+		fprintf(stderr, "  %s byte by byte\n", name);
+	}
+
+	return status;
+}
+
+
+static bool token_is(const char *data, const http_parser_t *parser, http_header_t header, const char *value) {
+	return (parser->found & (1u << header)) && http_parser_token_equals(data, &parser->headers[header], value);
+}
+
+
+static void test_corpus() {
+	http_parser_t parser;
+
+	for(int i = 0; i < corpus_count; i++){
+		const corpus_entry_t *c = &corpus[i];
+		http_parser_status_t status = check_equivalence(c->name, c->data, c->length, &parser);
+		if(strncmp(c->name, "ok_", 3) == 0 && status != HTTP_PARSER_DONE){
+			TEST_ASSERT(!"corpus request rejected");
+			fprintf(stderr, "  %s: status %d\n", c->name, status);
+		}
+		if(strncmp(c->name, "bad_", 4) == 0 && status != HTTP_PARSER_ERROR){
+			TEST_ASSERT(!"malformed corpus request accepted");
+			fprintf(stderr, "  %s: status %d\n", c->name, status);
+		}
+	}
+}
+
+
+static void test_fields() {
+	http_parser_t p;
+	const corpus_entry_t *c;
+
+	c = find("ok_get_root.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT_EQUAL_INT(HTTP_METHOD_GET, p.method);
+	TEST_ASSERT(http_parser_token_equals(c->data, &p.path, "/"));
+	TEST_ASSERT_EQUAL_INT(1, p.version_minor);
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_HOST, "192.168.1.1"));
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_CONNECTION, "keep-alive"));
+	TEST_ASSERT_EQUAL_INT(c->length, p.header_length);
+
+	c = find("ok_get_query.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT(http_parser_token_equals(c->data, &p.path, "/status.json"));
+	TEST_ASSERT(http_parser_token_equals(c->data, &p.query, "t=1234&x=y"));
+	TEST_ASSERT_EQUAL_INT(0, p.version_minor);
+	TEST_ASSERT_EQUAL_INT(0, p.found);
+
+	c = find("ok_post_connect.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT_EQUAL_INT(HTTP_METHOD_POST, p.method);
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_X_CUSTOM_SSID, "my network"));
+	/* trailing whitespace is dropped, inner whitespace kept */
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_X_CUSTOM_PWD, "p@ss word"));
+	TEST_ASSERT(p.found & (1u << HTTP_HEADER_CONTENT_LENGTH));
+	TEST_ASSERT_EQUAL_INT(0, p.content_length);
+
+	c = find("ok_post_body.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT_EQUAL_INT(5, p.content_length);
+	TEST_ASSERT_EQUAL_INT(c->length - 5, p.header_length);
+
+	c = find("ok_delete.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT_EQUAL_INT(HTTP_METHOD_DELETE, p.method);
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_CONNECTION, "close"));
+
+	c = find("ok_bare_lf.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_IF_NONE_MATCH, "\"1234abcd\""));
+
+	c = find("ok_case_insensitive.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_HOST, "192.168.1.1"));
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_CONNECTION, "close"));
+	TEST_ASSERT_EQUAL_INT(12, p.content_length);
+
+	c = find("ok_empty_value.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_HOST, ""));
+	TEST_ASSERT(token_is(c->data, &p, HTTP_HEADER_X_CUSTOM_SSID, ""));
+
+	c = find("ok_unknown_method.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT_EQUAL_INT(HTTP_METHOD_UNKNOWN, p.method);
+
+	/* names sharing a prefix with a known header are not that header */
+	c = find("ok_prefix_names.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT_EQUAL_INT(0, p.found);
+
+	c = find("ok_content_length_max.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT_EQUAL_INT(65535, p.content_length);
+
+	/* the parser stops at the end of the first request */
+	c = find("ok_pipelined.http");
+	check_equivalence(c->name, c->data, c->length, &p);
+	TEST_ASSERT(http_parser_token_equals(c->data, &p.path, "/ap.json"));
+	TEST_ASSERT_EQUAL_INT(strlen("GET /ap.json HTTP/1.1\r\n\r\n"), p.header_length);
+}
+
+
+static void test_incomplete() {
+	http_parser_t p;
+	const corpus_entry_t *c = find("ok_get_root.http");
+
+	/* a request missing its blank line is never reported as done */
+	http_parser_init(&p);
+	TEST_ASSERT_EQUAL_INT(HTTP_PARSER_INCOMPLETE, http_parser_execute(&p, c->data, c->length - 2));
+	TEST_ASSERT_EQUAL_INT(HTTP_PARSER_INCOMPLETE, http_parser_execute(&p, c->data, c->length - 1));
+	TEST_ASSERT_EQUAL_INT(HTTP_PARSER_DONE, http_parser_execute(&p, c->data, c->length));
+	/* done is sticky */
+	TEST_ASSERT_EQUAL_INT(HTTP_PARSER_DONE, http_parser_execute(&p, c->data, c->length));
+
+	http_parser_init(&p);
+	TEST_ASSERT_EQUAL_INT(HTTP_PARSER_INCOMPLETE, http_parser_execute(&p, c->data, 0));
+}
+
+
+/**
+ * @brief Mutates corpus requests and checks that all ways of parsing them agree and stay in bounds.
+ */
+static void test_fuzz(unsigned int iterations) {
+	static const char dictionary[] = " :\r\n/?-0123456789HTTP/1.GETPOSTContent-Length";
+	uint32_t state = 0x2545f491;
+	char data[MAX_REQUEST_SIZE];
+	http_parser_t parser;
+	char name[96];
+
+	for(unsigned int n = 0; n < iterations; n++){
+		const corpus_entry_t *c = &corpus[test_random(&state) % corpus_count];
+		uint16_t length = c->length;
+		memcpy(data, c->data, length);
+
+		int mutations = 1 + test_random(&state) % 4;
+		for(int m = 0; m < mutations && length > 0; m++){
+			uint16_t at = test_random(&state) % length;
+			switch(test_random(&state) % 5){
+			case 0:
+				data[at] ^= 1 << (test_random(&state) % 8);
+				break;
+			case 1:
+				data[at] = dictionary[test_random(&state) % (sizeof(dictionary) - 1)];
+				break;
+			case 2:
+				if(length < sizeof(data)){
+					memmove(data + at + 1, data + at, length - at);
+					data[at] = dictionary[test_random(&state) % (sizeof(dictionary) - 1)];
+					length++;
+				}
+				break;
+			case 3:
+				memmove(data + at, data + at + 1, length - at - 1);
+				length--;
+				break;
+			default:
+				length = at;
+				break;
+			}
+		}
+
+		snprintf(name, sizeof(name), "%s mutation %u", c->name, n);
+		check_equivalence(name, data, length, &parser);
+	}
+}
+
+
+int main(int argc, char **argv) {
+	load_corpus(argc > 1 ? argv[1] : "corpus/http");
+	test_corpus();
+	test_fields();
+	test_incomplete();
+	test_fuzz(argc > 2 ? atoi(argv[2]) : 2000);
+
+	return test_report("http_parser");
+}
@@ -0,0 +1,368 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_http_server.c
+@brief Tests how the HTTP server frames requests received in arbitrary segments.
+
+The server runs against a fake netconn replaying the segments queued by the test, and a stub of the wifi manager.
+A request must get the same response however TCP split it; malformed requests get a 400 and header blocks
+larger than HTTP_SERVER_REQUEST_BUFFER_SIZE a 431.
+
+usage: test_http_server corpus/http
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "lwip/api.h"
+#include "http_server.h"
+#include "http_assets.h"
+#include "wifi_manager.h"
+#include "test.h"
+#include "fake_idf.h"
+
+
+/* wifi manager stub */
+
+static wifi_config_t sta_config;
+static wifi_manager_json_t ap_list_json = { "[]\n", 0xabc, 0, true };
+static wifi_manager_json_t ip_info_json = { "{}\n", 7, 0, false };
+static int json_references = 0;
+static wifi_manager_command_t last_command;
+
+const wifi_manager_json_t* wifi_manager_acquire_ap_list_json() { json_references++; return &ap_list_json; }
+const wifi_manager_json_t* wifi_manager_acquire_ip_info_json() { json_references++; return &ip_info_json; }
+void wifi_manager_release_json(const wifi_manager_json_t *json) { json_references--; }
+uint32_t wifi_manager_get_json_age(const wifi_manager_json_t *json) { return json->timestamped ? 1234 : UINT32_MAX; }
+void wifi_manager_scan_async() {}
+void wifi_manager_disconnect_async() {}
+void wifi_manager_connect_async() {}
+esp_err_t wifi_manager_send_command(const wifi_manager_command_t *command, TickType_t ticks) { last_command = *command; return ESP_OK; }
+wifi_config_t* wifi_manager_get_sta_config() { return &sta_config; }
+esp_err_t wifi_manager_save_sta_config(wifi_config_t *config) { return ESP_OK; }
+
+
+/**
+ * @brief Serves a connection receiving the given segments.
+ * @return the response, valid until the next call.
+ */
+static const char* serve(const char *const *segments, const size_t *lengths, int count) {
+	struct netconn conn;
+
+	fake_netconn_reset();
+	for(int i = 0; i < count; i++) fake_netconn_add_segment(segments[i], lengths[i]);
+	http_server_netconn_serve(&conn);
+	TEST_ASSERT_EQUAL_INT(0, json_references);
+	return fake_netconn_output(NULL);
+}
+
+static char* serve_copy(const char *data, size_t length) {
+	const char *segments[] = { data };
+	return strdup(serve(segments, &length, 1));
+}
+
+static char* serve_split_copy(const char *data, size_t length, size_t split) {
+	const char *segments[] = { data, data + split };
+	size_t lengths[] = { split, length - split };
+	return strdup(serve(segments, lengths, 2));
+}
+
+static bool starts_with(const char *s, const char *prefix) {
+	return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static int count_responses(const char *output) {
+	int count = 0;
+	for(const char *p = output; (p = strstr(p, "HTTP/1.1 ")) != NULL; p++) count++;
+	return count;
+}
+
+
+/**
+ * @brief Every corpus request gets the same response whole or split at any offset: 400 if it is malformed.
+ */
+static void test_corpus(const char *directory) {
+	DIR *dir = opendir(directory);
+	struct dirent *entry;
+	char path[512];
+	static char data[4096];
+
+	if(dir == NULL){
+		perror(directory);
+		exit(2);
+	}
+	while((entry = readdir(dir)) != NULL){
+		if(entry->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+		FILE *f = fopen(path, "rb");
+		if(f == NULL) continue;
+		size_t length = fread(data, 1, sizeof(data), f);
+		fclose(f);
+
+		char *whole = serve_copy(data, length);
+		if(starts_with(entry->d_name, "bad_")){
+			/* a framing error closes the connection, unlike a 400 for invalid credentials */
+			if(!starts_with(whole, "HTTP/1.1 400 ") || strstr(whole, "Connection: close\r\n") == NULL){
+				TEST_ASSERT(!"malformed request not answered with 400");
+				fprintf(stderr, "  %s: %.40s\n", entry->d_name, whole);
+			}
+		}
+		else{
+			TEST_ASSERT(count_responses(whole) > 0);
+			TEST_ASSERT(strstr(whole, "HTTP/1.1 400 ") == NULL);
+		}
+
+		for(size_t split = 1; split < length; split++){
+			char *split_response = serve_split_copy(data, length, split);
+			if(strcmp(whole, split_response) != 0){
+				TEST_ASSERT(!"response differs when the request is split");
+				fprintf(stderr, "  %s split at %u\n", entry->d_name, (unsigned int)split);
+				free(split_response);
+				break;
+			}
+			free(split_response);
+		}
+		free(whole);
+	}
+	closedir(dir);
+}
+
+
+/**
+ * @brief Header blocks that do not fit the request buffer get a 431, unless they arrive whole.
+ */
+static void test_oversize() {
+	static char request[HTTP_SERVER_REQUEST_BUFFER_SIZE + 256];
+	int length = sprintf(request, "GET / HTTP/1.1\r\nX-Padding: ");
+	while(length < HTTP_SERVER_REQUEST_BUFFER_SIZE + 64) request[length++] = 'a';
+	length += sprintf(request + length, "\r\n\r\n");
+
+	/* split in two: the first part alone is already larger than the buffer */
+	char *response = serve_split_copy(request, length, HTTP_SERVER_REQUEST_BUFFER_SIZE + 10);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 431 "));
+	TEST_ASSERT(strstr(response, "Connection: close\r\n") != NULL);
+	TEST_ASSERT_EQUAL_INT(1, count_responses(response));
+	free(response);
+
+	/* split in two: the buffer fills up while the second part is appended */
+	response = serve_split_copy(request, length, 100);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 431 "));
+	TEST_ASSERT_EQUAL_INT(1, count_responses(response));
+	free(response);
+
+	/* many small segments */
+	const char *segments[64];
+	size_t lengths[64];
+	int count = 0;
+	for(int offset = 0; offset < length; offset += 64){
+		segments[count] = request + offset;
+		lengths[count++] = length - offset < 64 ? length - offset : 64;
+	}
+	TEST_ASSERT(starts_with(serve(segments, lengths, count), "HTTP/1.1 431 "));
+
+	/* exactly at the limit still fits */
+	length = sprintf(request, "GET / HTTP/1.1\r\nX-Padding: ");
+	while(length < HTTP_SERVER_REQUEST_BUFFER_SIZE - 4) request[length++] = 'a';
+	length += sprintf(request + length, "\r\n\r\n");
+	TEST_ASSERT_EQUAL_INT(HTTP_SERVER_REQUEST_BUFFER_SIZE, length);
+	response = serve_split_copy(request, length, 1);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 200 "));
+	free(response);
+}
+
+
+/**
+ * @brief Content-Length is capped at 65535: the cap is accepted, anything above is a 400.
+ */
+static void test_content_length() {
+	static const char at_cap[] = "POST /connect.json HTTP/1.1\r\nHost: 192.168.1.1\r\nX-Custom-ssid: a\r\nX-Custom-pwd: b\r\nContent-Length: 65535\r\n\r\n";
+	static const char over_cap[] = "POST /connect.json HTTP/1.1\r\nHost: 192.168.1.1\r\nX-Custom-ssid: a\r\nX-Custom-pwd: b\r\nContent-Length: 65536\r\n\r\n";
+	char *response;
+
+	response = serve_copy(at_cap, sizeof(at_cap) - 1);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 200 "));
+	free(response);
+
+	response = serve_copy(over_cap, sizeof(over_cap) - 1);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 400 "));
+	TEST_ASSERT_EQUAL_INT(1, count_responses(response));
+	free(response);
+}
+
+
+/**
+ * @brief A malformed request ends the connection: pipelined requests after it are not served.
+ */
+static void test_malformed_closes() {
+	static const char requests[] = "GET /ap.json HTTP/1.1\r\n\r\nGARBAGE\r\n\r\nGET /ap.json HTTP/1.1\r\n\r\n";
+	char *response = serve_copy(requests, sizeof(requests) - 1);
+
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 200 "));
+	TEST_ASSERT(strstr(response, "HTTP/1.1 400 ") != NULL);
+	TEST_ASSERT_EQUAL_INT(2, count_responses(response));
+	free(response);
+}
+
+
+/**
+ * @brief The body of a connect request is skipped whatever the segmentation, and the command is sent.
+ */
+static void test_body_discard() {
+	static const char requests[] = "POST /connect.json HTTP/1.1\r\nX-Custom-ssid: abc\r\nX-Custom-pwd: secret\r\nContent-Length: 5\r\n\r\n"
+			"abcdeGET /ap.json HTTP/1.1\r\nConnection: close\r\n\r\n";
+	char *whole = serve_copy(requests, sizeof(requests) - 1);
+
+	TEST_ASSERT_EQUAL_INT(2, count_responses(whole));
+	TEST_ASSERT_EQUAL_STRING("abc", (const char*)last_command.ssid);
+	TEST_ASSERT_EQUAL_STRING("secret", (const char*)last_command.password);
+	for(size_t split = 1; split < sizeof(requests) - 1; split++){
+		char *response = serve_split_copy(requests, sizeof(requests) - 1, split);
+		TEST_ASSERT_EQUAL_STRING(whole, response);
+		free(response);
+	}
+	free(whole);
+}
+
+
+/**
+ * @brief Serves / with the given Accept-Encoding header, none if NULL.
+ * @return true if the gzipped content was sent.
+ */
+static bool served_gzip(const char *accept_encoding) {
+	char request[256];
+	int length;
+
+	if(accept_encoding){
+		length = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\nAccept-Encoding: %s\r\n\r\n", accept_encoding);
+	}
+	else{
+		length = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\n\r\n");
+	}
+	char *response = serve_copy(request, length);
+	bool gzip = strstr(response, "Content-Encoding: gzip\r\n") != NULL;
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 200 "));
+	TEST_ASSERT(strstr(response, "Vary: Accept-Encoding\r\n") != NULL);
+	free(response);
+	return gzip;
+}
+
+
+/**
+ * @brief Assets are sent uncompressed to clients refusing gzip, each encoding with its own entity tag.
+ */
+static void test_accept_encoding() {
+	TEST_ASSERT(served_gzip(NULL));
+	TEST_ASSERT(served_gzip("gzip, deflate, br"));
+	TEST_ASSERT(served_gzip("deflate, x-gzip"));
+	TEST_ASSERT(served_gzip("GZIP;Q=0.5"));
+	TEST_ASSERT(served_gzip("*"));
+	TEST_ASSERT(served_gzip("gzip;q=1, *;q=0"));
+#if HTTP_ASSETS_IDENTITY
+	TEST_ASSERT(!served_gzip(""));
+	TEST_ASSERT(!served_gzip("identity"));
+	TEST_ASSERT(!served_gzip("deflate"));
+	TEST_ASSERT(!served_gzip("gzip;q=0"));
+	TEST_ASSERT(!served_gzip("gzip; q=0.000, deflate"));
+	TEST_ASSERT(!served_gzip("*;q=0"));
+	TEST_ASSERT(!served_gzip("gzip;q=0, *"));
+	TEST_ASSERT(!served_gzip("gzipped"));
+
+	const http_asset_t *asset = &http_assets[0];
+	char request[256];
+	int length = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\nAccept-Encoding: identity\r\n\r\n");
+	size_t response_length;
+	char *response = serve_copy(request, length);
+	response_length = strlen(response);
+	TEST_ASSERT(response_length > asset->identity.length);
+	TEST_ASSERT_EQUAL_MEMORY(asset->identity.data, response + response_length - asset->identity.length, asset->identity.length);
+	free(response);
+
+	/* the gzip entity tag does not validate the uncompressed content, and the other way round */
+	length = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\nAccept-Encoding: identity\r\nIf-None-Match: %s\r\n\r\n", asset->gzip.etag);
+	response = serve_copy(request, length);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 200 "));
+	free(response);
+	length = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\nAccept-Encoding: identity\r\nIf-None-Match: %s\r\n\r\n", asset->identity.etag);
+	response = serve_copy(request, length);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 304 "));
+	free(response);
+	length = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\nIf-None-Match: %s\r\n\r\n", asset->identity.etag);
+	response = serve_copy(request, length);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 200 "));
+	free(response);
+#else
+	/* without the uncompressed content every client gets gzip */
+	TEST_ASSERT(served_gzip("identity"));
+#endif
+}
+
+
+/**
+ * @brief Requests naming another host than the softAP are redirected to it, a port can follow its address.
+ */
+static bool served_host(const char *host) {
+	char request[256];
+	int length = snprintf(request, sizeof(request), "GET /ap.json HTTP/1.1\r\nHost: %s\r\n\r\n", host);
+	char *response = serve_copy(request, length);
+	bool served = starts_with(response, "HTTP/1.1 200 ");
+
+	TEST_ASSERT(served || starts_with(response, "HTTP/1.1 302 Found\r\nLocation: http://" DEFAULT_AP_IP "/\r\n"));
+	free(response);
+	return served;
+}
+
+static void test_host() {
+	TEST_ASSERT(served_host(DEFAULT_AP_IP));
+	TEST_ASSERT(served_host(DEFAULT_AP_IP ":80"));
+	TEST_ASSERT(served_host(DEFAULT_AP_IP ":65535"));
+	TEST_ASSERT(!served_host(DEFAULT_AP_IP "0"));
+	TEST_ASSERT(!served_host(DEFAULT_AP_IP "23.evil"));
+	TEST_ASSERT(!served_host(DEFAULT_AP_IP ".evil.com"));
+	TEST_ASSERT(!served_host(DEFAULT_AP_IP ":"));
+	TEST_ASSERT(!served_host(DEFAULT_AP_IP ":8a"));
+	TEST_ASSERT(!served_host(DEFAULT_AP_IP ":123456"));
+	TEST_ASSERT(!served_host("192.168.1"));
+	TEST_ASSERT(!served_host("captive.apple.com"));
+
+	/* HTTP/1.0 clients may send no Host at all */
+	static const char no_host[] = "GET /ap.json HTTP/1.1\r\n\r\n";
+	char *response = serve_copy(no_host, sizeof(no_host) - 1);
+	TEST_ASSERT(starts_with(response, "HTTP/1.1 200 "));
+	free(response);
+}
+
+
+int main(int argc, char **argv) {
+	test_corpus(argc > 1 ? argv[1] : "corpus/http");
+	test_oversize();
+	test_content_length();
+	test_malformed_closes();
+	test_body_discard();
+	test_accept_encoding();
+	test_host();
+
+	return test_report("http_server");
+}
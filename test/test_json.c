@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_json.c
+@brief Differential test of json_print_string against the escaper it replaced.
+
+The previous escaper, in json_reference.h, is the reference. Both must produce the same output for every input it
+handled: any NUL terminated string with room enough for the result. The word at a time path is exercised by
+putting the bytes to escape at every offset of strings of every length up to a few words. The new escaper
+must also stop at input_size, render NULL as an empty string and never write past output_size.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+#include "json_reference.h"
+#include "test.h"
+
+#define MAX_INPUT	40
+
+
+
+/**
+ * @brief Escapes input with both escapers and compares the results. input must be NUL terminated.
+ */
+static void check_same(const unsigned char *input, size_t length) {
+	unsigned char expected[JSON_ESCAPED_SIZE(MAX_INPUT) + 1];
+	unsigned char actual[JSON_ESCAPED_SIZE(MAX_INPUT) + 1];
+	unsigned char field[2 * MAX_INPUT + 1];
+	size_t expected_length = json_print_string_reference(input, expected);
+
+	/* input_size past the NUL, at the NUL and exactly the length must not matter: the field is padded with
+	 * bytes that would be escaped */
+	size_t sizes[] = { length + 1 + MAX_INPUT, length + 1, length };
+	memset(field, '"', sizeof(field));
+	memcpy(field, input, length + 1);
+	for(int s = 0; s < 3; s++){
+		memset(actual, 'x', sizeof(actual));
+		size_t actual_length = json_print_string(field, sizes[s], actual, JSON_ESCAPED_SIZE(length));
+		TEST_ASSERT_EQUAL_INT(expected_length, actual_length);
+		TEST_ASSERT_EQUAL_STRING((const char*)expected, (const char*)actual);
+		TEST_ASSERT_EQUAL_INT('x', actual[JSON_ESCAPED_SIZE(length)]);
+	}
+}
+
+
+static void test_null() {
+	unsigned char output[8];
+
+	TEST_ASSERT_EQUAL_INT(2, json_print_string(NULL, 10, output, sizeof(output)));
+	TEST_ASSERT_EQUAL_STRING("\"\"", (const char*)output);
+	TEST_ASSERT_EQUAL_INT(2, json_print_string((const unsigned char*)"abc", 0, output, sizeof(output)));
+	TEST_ASSERT_EQUAL_STRING("\"\"", (const char*)output);
+	TEST_ASSERT_EQUAL_INT(0, json_print_string((const unsigned char*)"abc", 3, NULL, 10));
+	TEST_ASSERT_EQUAL_INT(0, json_print_string((const unsigned char*)"abc", 3, output, 0));
+}
+
+
+/**
+ * @brief Every byte alone, and between plain characters at every offset of a word.
+ */
+static void test_every_byte() {
+	unsigned char input[MAX_INPUT + 1];
+
+	for(int c = 1; c < 256; c++){
+		for(size_t length = 1; length <= 12; length++){
+			for(size_t at = 0; at < length; at++){
+				memset(input, 'a', length);
+				input[at] = c;
+				input[length] = '\0';
+				check_same(input, length);
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief Quotes, backslashes and control characters on both sides of word boundaries, with bytes around the
+ * thresholds of the word test: 0x1f and 0x20, 0x7f and 0x80, 0xff.
+ */
+static void test_word_boundaries() {
+	static const unsigned char specials[] = { '"', '\\', 0x01, 0x1f, '\n', 0x20, 0x21, 0x5b, 0x5d, 0x7f, 0x80, 0xa2, 0xdc, 0xff };
+	unsigned char input[MAX_INPUT + 1];
+
+	for(size_t length = 2; length <= 20; length++){
+		for(size_t at = 0; at + 1 < length; at++){
+			for(size_t a = 0; a < sizeof(specials); a++){
+				for(size_t b = 0; b < sizeof(specials); b++){
+					memset(input, 'w', length);
+					input[at] = specials[a];
+					input[at + 1] = specials[b];
+					input[length] = '\0';
+					check_same(input, length);
+				}
+			}
+		}
+	}
+}
+
+
+static void test_random_strings() {
+	static const unsigned char alphabet[] = "aZ09 \"\\\b\f\n\r\t\x01\x1f\x7f\x80\xff/";
+	unsigned char input[MAX_INPUT + 1];
+	uint32_t state = 0x9e3779b9;
+
+	for(int n = 0; n < 200000; n++){
+		size_t length = test_random(&state) % (MAX_INPUT + 1);
+		for(size_t i = 0; i < length; i++){
+			input[i] = test_random(&state) % 4 ? 'a' + test_random(&state) % 26 : alphabet[test_random(&state) % (sizeof(alphabet) - 1)];
+		}
+		input[length] = '\0';
+		check_same(input, length);
+	}
+}
+
+
+/**
+ * @brief A buffer too small gets an empty cstring and 0, a large enough one the full string: nothing is ever
+ * written past output_size.
+ */
+static void test_truncation() {
+	static const char *inputs[] = { "", "a", "abcd", "abcdefgh", "network\"name\\", "\x01\x02\x03\x04\x05", "mesh\tnode 12345678" };
+	unsigned char expected[JSON_ESCAPED_SIZE(MAX_INPUT)];
+	unsigned char output[JSON_ESCAPED_SIZE(MAX_INPUT) + 8];
+
+	for(size_t n = 0; n < sizeof(inputs) / sizeof(inputs[0]); n++){
+		const unsigned char *input = (const unsigned char*)inputs[n];
+		size_t length = strlen(inputs[n]);
+		size_t expected_length = json_print_string_reference(input, expected);
+
+		for(size_t size = 1; size <= JSON_ESCAPED_SIZE(length); size++){
+			memset(output, 'x', sizeof(output));
+			size_t written = json_print_string(input, length, output, size);
+			TEST_ASSERT_EQUAL_INT('x', output[size]);
+			if(size > expected_length){
+				TEST_ASSERT_EQUAL_INT(expected_length, written);
+				TEST_ASSERT_EQUAL_STRING((const char*)expected, (const char*)output);
+			}
+			else{
+				TEST_ASSERT_EQUAL_INT(0, written);
+				TEST_ASSERT_EQUAL_INT('\0', output[0]);
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief Fixed size fields such as a 32 character ssid are not always terminated: reading stops at input_size.
+ */
+static void test_unterminated() {
+	unsigned char ssid[32];
+	unsigned char output[JSON_ESCAPED_SIZE(32)];
+
+	memset(ssid, 'z', sizeof(ssid));
+	TEST_ASSERT_EQUAL_INT(34, json_print_string(ssid, sizeof(ssid), output, sizeof(output)));
+	TEST_ASSERT_EQUAL_INT('"', output[33]);
+	TEST_ASSERT_EQUAL_INT(9, json_print_string(ssid, 7, output, sizeof(output)));
+	TEST_ASSERT_EQUAL_STRING("\"zzzzzzz\"", (const char*)output);
+
+	ssid[31] = '"';
+	TEST_ASSERT_EQUAL_INT(35, json_print_string(ssid, sizeof(ssid), output, sizeof(output)));
+	TEST_ASSERT_EQUAL_STRING("\\\"\"", (const char*)output + 32);
+}
+
+
+int main() {
+	test_null();
+	test_every_byte();
+	test_word_boundaries();
+	test_random_strings();
+	test_truncation();
+	test_unterminated();
+
+	return test_report("json");
+}
@@ -0,0 +1,124 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_trace.c
+@brief Records a known sequence of events with TRACE_ENABLED and writes the dump for test_trace_decode.py.
+
+The events overflow the ring of core 0 and their times cross a wrap of the low 32 bits of the clock. The records
+expected in the dump are written next to it, one per line: time in µs, core, task, event, object and arg.
+
+usage: test_trace dump.bin expected.txt
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "trace.h"
+#include "test.h"
+#include "fake_idf.h"
+
+#if !TRACE_ENABLED
+#error "test_trace is built with -DTRACE_ENABLED=1"
+#endif
+
+#define TASK_MANAGER	((void*)0x3ffb1000)
+#define TASK_HTTPD		((void*)0x3ffb2000)
+
+static size_t dumped = 0;
+
+
+static bool write_file(const void *data, size_t size, void *context) {
+	dumped += size;
+	return fwrite(data, 1, size, (FILE*)context) == size;
+}
+
+static bool write_nothing(const void *data, size_t size, void *context) {
+	return false;
+}
+
+/**
+ * @brief Records an event as task on core at a given time, and tells if it is expected in the dump.
+ */
+static void record(FILE *expected, int core, void *task, int64_t time_us, trace_event_t event, trace_object_t object, uint32_t arg, bool kept) {
+	fake_core = core;
+	fake_task = task;
+	fake_time_us = time_us;
+	trace_record(event, object, arg);
+	if(kept){
+		fprintf(expected, "%lld %d %u %d %d %u\n", (long long)time_us, core, (unsigned int)(uintptr_t)task, event, object, (unsigned int)arg);
+	}
+}
+
+
+int main(int argc, char *argv[]) {
+	if(argc != 3){
+		fprintf(stderr, "usage: %s dump.bin expected.txt\n", argv[0]);
+		return 2;
+	}
+	FILE *expected = fopen(argv[2], "w");
+	FILE *dump = fopen(argv[1], "wb");
+	TEST_ASSERT(expected != NULL && dump != NULL);
+
+	/* the layouts tools/trace_decode.py reads with struct */
+	TEST_ASSERT_EQUAL_INT(24, sizeof(trace_header_t));
+	TEST_ASSERT_EQUAL_INT(20, sizeof(trace_task_t));
+	TEST_ASSERT_EQUAL_INT(16, sizeof(trace_record_t));
+
+	fake_task = TASK_MANAGER;
+	fake_task_name = "wifi_manager";
+	trace_register_task();
+	fake_task = TASK_HTTPD;
+	fake_task_name = "httpd_worker";
+	trace_register_task();
+
+	/* 0x100000000 µs is 71 minutes after boot: the records straddle it */
+	int64_t start = 0x100000000LL - 1000000;
+	int total = TRACE_RING_SIZE + 44;
+	for(int i = 0; i < total; i++){
+		int64_t t = start + i * 10000LL;
+		bool kept = i >= total - TRACE_RING_SIZE;
+		switch(i % 4){
+		case 0: record(expected, 0, TASK_MANAGER, t, TRACE_MUTEX_WAIT, TRACE_OBJECT_JSON_MUTEX, i % 8 ? 100 : portMAX_DELAY, kept); break;
+		case 1: record(expected, 0, TASK_MANAGER, t, TRACE_MUTEX_TAKE, TRACE_OBJECT_JSON_MUTEX, 1, kept); break;
+		case 2: record(expected, 0, TASK_MANAGER, t, TRACE_EVENT_GROUP_SET, TRACE_OBJECT_WIFI_MANAGER_EVENTS, 1 << (i % 8), kept); break;
+		case 3: record(expected, 0, TASK_MANAGER, t, TRACE_MUTEX_GIVE, TRACE_OBJECT_JSON_MUTEX, 0, kept); break;
+		}
+	}
+	for(int i = 0; i < 10; i++){
+		int64_t t = start + i * 10000LL + 5000;
+		record(expected, 1, TASK_HTTPD, t, i % 2 ? TRACE_HTTP_CLOSE : TRACE_HTTP_ACCEPT, TRACE_OBJECT_NONE, 0x3ffc0000 + i / 2 * 16, true);
+	}
+	/* a task that was never registered */
+	record(expected, 1, (void*)0x3ffb3000, start + 20003, TRACE_NVS_WRITE_START, TRACE_OBJECT_NONE, 1234, true);
+	record(expected, 1, (void*)0x3ffb3000, start + 40003, TRACE_NVS_WRITE_END, TRACE_OBJECT_NONE, 0, true);
+
+	fake_time_us = start + total * 10000LL;
+	TEST_ASSERT(trace_dump(write_file, dump));
+	TEST_ASSERT_EQUAL_INT(trace_dump_size(), dumped);
+	TEST_ASSERT(!trace_dump(write_nothing, NULL));
+
+	fclose(dump);
+	fclose(expected);
+
+	return test_report("trace");
+}
@@ -0,0 +1,75 @@
+#!/usr/bin/env python
+#
+# Decodes the dump written by test_trace with tools/trace_decode.py and checks
+# it against the records test_trace expects in it, so that the layouts of
+# include/trace.h and of the decoder cannot drift apart.
+#
+# usage: test_trace_decode.py dump.bin expected.txt
+
+from __future__ import print_function
+
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tools'))
+import trace_decode
+
+failures = []
+
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+        print('%s: %s' % (sys.argv[0], message))
+
+
+def main():
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+    with open(sys.argv[2]) as f:
+        expected = sorted(tuple(int(field) for field in line.split()) for line in f if line.strip())
+
+    check(trace_decode.HEADER.size == 24, 'header of %d bytes' % trace_decode.HEADER.size)
+    check(trace_decode.TASK.size == 20, 'task of %d bytes' % trace_decode.TASK.size)
+    check(trace_decode.RECORD.size == 16, 'record of %d bytes' % trace_decode.RECORD.size)
+
+    tasks, records, dropped = trace_decode.parse(data)
+    check(tasks == {0x3ffb1000: 'wifi_manager', 0x3ffb2000: 'httpd_worker'}, 'tasks %r' % tasks)
+    check(dropped == 0, '%d records dropped' % dropped)
+    check(len(records) == len(expected), '%d records, %d expected' % (len(records), len(expected)))
+    for got, want in zip(records, expected):
+        if got != want:
+            check(False, 'record %r, expected %r' % (got, want))
+            break
+
+    trace = trace_decode.convert(tasks, records, dropped)
+    events = trace['traceEvents']
+    names = set(e['name'] for e in events)
+    for name in ('wait wifi_manager_json_mutex', 'hold wifi_manager_json_mutex', 'connection', 'nvs write', 'thread_name'):
+        check(name in names, 'no %s event' % name)
+    check(any(e['name'] == 'set AP_STARTED' for e in events), 'no event group bit names')
+    check(any(e.get('args', {}).get('name') == 'task 0x3ffb3000' for e in events), 'unregistered task not named by its handle')
+    check(all(e.get('dur', 0) >= 0 for e in events), 'negative slice duration')
+
+    # a record being written while the dump was taken has a sequence that does not match its slot
+    header = trace_decode.HEADER.unpack_from(data, 0)
+    ring_size, cores, max_tasks = header[4], header[5], header[6]
+    rings = trace_decode.HEADER.size + max_tasks * trace_decode.TASK.size + 4 * cores
+    corrupted = bytearray(data)
+    struct.pack_into('<H', corrupted, rings + ring_size * trace_decode.RECORD.size + 10, 0)
+    check(trace_decode.parse(bytes(corrupted))[2] == 1, 'overwritten record not dropped')
+
+    for broken, message in ((data[:20], 'dump too short'), (b'\0' * 4 + data[4:], 'not a trace dump'), (data[:-1], 'dump truncated')):
+        try:
+            trace_decode.parse(broken)
+            check(False, 'no error for %s' % message)
+        except trace_decode.DumpError as e:
+            check(str(e) == message, 'error %s for %s' % (e, message))
+
+    print('trace_decode: %d failures' % len(failures))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
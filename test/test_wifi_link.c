@@ -0,0 +1,182 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_wifi_link.c
+@brief Tests the reconnection backoff of the STA link: base delay, cap, jitter bounds and rejections.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_wifi_types.h"
+#include "wifi_link.h"
+#include "test.h"
+
+static const uint8_t rejections[] = {
+	WIFI_REASON_AUTH_FAIL, WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT, WIFI_REASON_HANDSHAKE_TIMEOUT, WIFI_REASON_802_1X_AUTH_FAILED
+};
+
+
+/**
+ * @brief The delay doubles from WIFI_LINK_BACKOFF_BASE_MS up to WIFI_LINK_BACKOFF_MAX_MS, half of it random.
+ */
+static void test_backoff_bounds() {
+	uint32_t state = 1;
+
+	for(int failures = 0; failures <= UINT8_MAX; failures++){
+		uint32_t delay = failures < 16 ? (uint32_t)WIFI_LINK_BACKOFF_BASE_MS << failures : WIFI_LINK_BACKOFF_MAX_MS;
+		if(delay > WIFI_LINK_BACKOFF_MAX_MS) delay = WIFI_LINK_BACKOFF_MAX_MS;
+
+		/* both ends of the jitter are reached */
+		TEST_ASSERT_EQUAL_INT(delay / 2, wifi_link_backoff_ms(failures, WIFI_REASON_BEACON_TIMEOUT, 0));
+		TEST_ASSERT_EQUAL_INT(delay, wifi_link_backoff_ms(failures, WIFI_REASON_BEACON_TIMEOUT, delay / 2));
+		TEST_ASSERT_EQUAL_INT(delay / 2, wifi_link_backoff_ms(failures, WIFI_REASON_BEACON_TIMEOUT, delay / 2 + 1));
+		TEST_ASSERT_EQUAL_INT(delay / 2 + 4, wifi_link_backoff_ms(failures, WIFI_REASON_BEACON_TIMEOUT, 4));
+
+		for(int i = 0; i < 1000; i++){
+			uint32_t random = test_random(&state);
+			uint32_t ms = wifi_link_backoff_ms(failures, WIFI_REASON_NO_AP_FOUND, random);
+			TEST_ASSERT(ms >= delay / 2 && ms <= delay);
+			TEST_ASSERT_EQUAL_INT(delay / 2 + random % (delay / 2 + 1), ms);
+		}
+	}
+
+	TEST_ASSERT_EQUAL_INT(WIFI_LINK_BACKOFF_MAX_MS, wifi_link_backoff_ms(6, WIFI_REASON_BEACON_TIMEOUT, WIFI_LINK_BACKOFF_MAX_MS / 2));
+	TEST_ASSERT_EQUAL_INT(32000, wifi_link_backoff_ms(5, WIFI_REASON_BEACON_TIMEOUT, 16000));
+}
+
+
+/**
+ * @brief The access point refusing the credentials jumps straight to the longest delay.
+ */
+static void test_rejections() {
+	for(int r = 0; r < sizeof(rejections); r++){
+		for(int failures = 0; failures < 20; failures++){
+			TEST_ASSERT_EQUAL_INT(WIFI_LINK_BACKOFF_MAX_MS / 2, wifi_link_backoff_ms(failures, rejections[r], 0));
+			TEST_ASSERT_EQUAL_INT(WIFI_LINK_BACKOFF_MAX_MS, wifi_link_backoff_ms(failures, rejections[r], WIFI_LINK_BACKOFF_MAX_MS / 2));
+		}
+	}
+
+	/* any other reason backs off from the base delay */
+	for(int reason = 0; reason <= UINT8_MAX; reason++){
+		if(memchr(rejections, reason, sizeof(rejections)) != NULL) continue;
+		TEST_ASSERT_EQUAL_INT(WIFI_LINK_BACKOFF_BASE_MS, wifi_link_backoff_ms(0, reason, WIFI_LINK_BACKOFF_BASE_MS / 2));
+	}
+}
+
+
+/**
+ * @brief A lost connection is retried after the base delay, each failed retry doubling it up to the cap, and
+ * a successful retry starts the backoff over.
+ */
+static void test_lost_and_failed() {
+	int64_t now = 5000000;
+
+	wifi_link_stop();
+	TEST_ASSERT_EQUAL_INT(WIFI_LINK_IDLE, wifi_link_get_state());
+	TEST_ASSERT_EQUAL_INT(0, wifi_link_get_retry_at());
+
+	/* only a link that was up reports its loss */
+	TEST_ASSERT(!wifi_link_lost(WIFI_REASON_BEACON_TIMEOUT, now, 0));
+	TEST_ASSERT_EQUAL_INT(WIFI_LINK_IDLE, wifi_link_get_state());
+	wifi_link_attempt();
+	TEST_ASSERT_EQUAL_INT(WIFI_LINK_CONNECTING, wifi_link_get_state());
+	TEST_ASSERT(!wifi_link_lost(WIFI_REASON_BEACON_TIMEOUT, now, 0));
+
+	for(int round = 0; round < 2; round++){
+		wifi_link_attempt();
+		wifi_link_connected();
+		TEST_ASSERT_EQUAL_INT(WIFI_LINK_CONNECTED, wifi_link_get_state());
+		TEST_ASSERT_EQUAL_INT(0, wifi_link_get_retry_at());
+
+		/* the maximum random number reaches the full delay */
+		TEST_ASSERT(wifi_link_lost(WIFI_REASON_BEACON_TIMEOUT, now, WIFI_LINK_BACKOFF_BASE_MS / 2));
+		TEST_ASSERT_EQUAL_INT(WIFI_LINK_BACKOFF, wifi_link_get_state());
+		TEST_ASSERT_EQUAL_INT(WIFI_REASON_BEACON_TIMEOUT, wifi_link_get_reason());
+		TEST_ASSERT_EQUAL_INT(now + WIFI_LINK_BACKOFF_BASE_MS * 1000LL, wifi_link_get_retry_at());
+
+		uint32_t delay = WIFI_LINK_BACKOFF_BASE_MS;
+		for(int retry = 0; retry < 12; retry++){
+			now = wifi_link_get_retry_at();
+			wifi_link_attempt();
+			TEST_ASSERT_EQUAL_INT(0, wifi_link_get_retry_at());
+			delay = delay * 2 > WIFI_LINK_BACKOFF_MAX_MS ? WIFI_LINK_BACKOFF_MAX_MS : delay * 2;
+
+			/* the minimum random number gives half of it */
+			wifi_link_failed(WIFI_REASON_NO_AP_FOUND, now, 0, true);
+			TEST_ASSERT_EQUAL_INT(WIFI_LINK_BACKOFF, wifi_link_get_state());
+			TEST_ASSERT_EQUAL_INT(WIFI_REASON_NO_AP_FOUND, wifi_link_get_reason());
+			TEST_ASSERT_EQUAL_INT(now + delay / 2 * 1000LL, wifi_link_get_retry_at());
+		}
+		TEST_ASSERT_EQUAL_INT(WIFI_LINK_BACKOFF_MAX_MS, delay);
+	}
+
+	/* a rejection of the credentials waits the longest delay right away */
+	wifi_link_attempt();
+	wifi_link_connected();
+	TEST_ASSERT(wifi_link_lost(WIFI_REASON_BEACON_TIMEOUT, now, 0));
+	wifi_link_attempt();
+	wifi_link_failed(WIFI_REASON_AUTH_FAIL, now, WIFI_LINK_BACKOFF_MAX_MS / 2, true);
+	TEST_ASSERT_EQUAL_INT(now + WIFI_LINK_BACKOFF_MAX_MS * 1000LL, wifi_link_get_retry_at());
+	TEST_ASSERT_EQUAL_INT(WIFI_REASON_AUTH_FAIL, wifi_link_get_reason());
+
+	/* with nothing to retry the link is idle, and keeps the reason */
+	wifi_link_attempt();
+	wifi_link_failed(WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT, now, 0, false);
+	TEST_ASSERT_EQUAL_INT(WIFI_LINK_IDLE, wifi_link_get_state());
+	TEST_ASSERT_EQUAL_INT(0, wifi_link_get_retry_at());
+	TEST_ASSERT_EQUAL_INT(WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT, wifi_link_get_reason());
+
+	/* a stop cancels the pending retry */
+	wifi_link_attempt();
+	wifi_link_connected();
+	wifi_link_lost(WIFI_REASON_BEACON_TIMEOUT, now, 0);
+	wifi_link_stop();
+	TEST_ASSERT_EQUAL_INT(WIFI_LINK_IDLE, wifi_link_get_state());
+	TEST_ASSERT_EQUAL_INT(0, wifi_link_get_retry_at());
+}
+
+
+/**
+ * @brief The random part of the delay spreads the retries of devices losing the link at the same moment.
+ */
+static void test_jitter_spread() {
+	uint32_t state = 99;
+	int buckets[10] = { 0 };
+
+	for(int i = 0; i < 100000; i++){
+		uint32_t ms = wifi_link_backoff_ms(3, WIFI_REASON_BEACON_TIMEOUT, test_random(&state));
+		buckets[(ms - 4000) * 10 / 4001]++;
+	}
+	for(int b = 0; b < 10; b++){
+		TEST_ASSERT(buckets[b] > 9000 && buckets[b] < 11000);
+	}
+}
+
+
+int main() {
+	test_backoff_bounds();
+	test_rejections();
+	test_lost_and_failed();
+	test_jitter_spread();
+
+	return test_report("wifi_link");
+}
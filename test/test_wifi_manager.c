@@ -0,0 +1,437 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_wifi_manager.c
+@brief Tests how the wifi manager task reacts to lost connections, against a simulated driver and access point.
+
+The task runs for real until it has nothing left to wait for. Whenever it would block, the simulated world moves
+the clock to its next scripted event: the link drops, the access point goes away or comes back, or a connection or
+disconnection is requested. The driver answers esp_wifi_connect at once: an IP if the access point is up, a
+disconnection otherwise.
+
+Every loss must be reported once as UPDATE_LOST_CONNECTION, even when the driver reports it twice. Retries never
+overlap: each one waits for the backoff of wifi_link, which grows while the access point stays away and starts over
+after a successful connection. A drop while a connection or disconnection is pending is handled by that command.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "esp_event_loop.h"
+#include "tcpip_adapter.h"
+#include "lwip/dhcp.h"
+#include "wifi_manager.h"
+#include "wifi_nvs.h"
+#include "wifi_link.h"
+#include "test.h"
+#include "fake_idf.h"
+
+#define NOW_MS						(fake_time_us / 1000)
+
+/* @brief time the driver takes to associate and get an IP, to give up on an absent access point, to scan */
+#define FAKE_CONNECT_MS				500
+#define FAKE_CONNECT_FAILURE_MS		2000
+#define FAKE_SCAN_MS				1500
+
+/* @brief a retry waits at most a tick longer than its backoff */
+#define RETRY_TOLERANCE_MS			portTICK_PERIOD_MS
+
+/* @brief simulated time after which the task is considered stuck */
+#define SIMULATION_LIMIT_MS			(60 * 60 * 1000)
+
+#define MAX_LOSSES					16
+#define MAX_RETRIES					16
+
+static const uint8_t home_bssid[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+static const uint8_t home_channel = 6;
+
+
+/* simulated driver */
+
+static system_event_cb_t event_handler;
+static bool ap_up = true;
+static bool associated = false;
+
+/* what the task did */
+typedef struct {
+	int64_t at_ms;
+	int reports;						/* UPDATE_LOST_CONNECTION reported for the loss */
+	int retries;
+	uint32_t gaps_ms[MAX_RETRIES];		/* from the drop or the end of the previous failed retry */
+	bool recovered;
+} loss_t;
+
+static loss_t losses[MAX_LOSSES];
+static int loss_count = 0;
+static bool loss_in_progress = false;
+
+static int attempts = 0;
+static int failure_reports = 0;			/* UPDATE_LOST_CONNECTION reported for a failed automatic retry */
+static int user_disconnect_reports = 0;
+static bool attempt_failed = false;
+static int64_t round_end_ms = 0;		/* when the link dropped or the driver last returned from a failed attempt */
+static bool waited = false;				/* the task blocked since the driver last returned */
+
+static void post(system_event_id_t id, uint8_t reason) {
+	system_event_t event;
+
+	memset(&event, 0, sizeof(event));
+	event.event_id = id;
+	if(id == SYSTEM_EVENT_STA_CONNECTED){
+		memcpy(event.event_info.connected.bssid, home_bssid, sizeof(home_bssid));
+		event.event_info.connected.channel = home_channel;
+	}
+	else if(id == SYSTEM_EVENT_STA_DISCONNECTED){
+		event.event_info.disconnected.reason = reason;
+	}
+	event_handler(NULL, &event);
+}
+
+system_event_cb_t esp_event_loop_set_cb(system_event_cb_t cb, void *ctx) {
+	event_handler = cb;
+	return NULL;
+}
+
+esp_err_t esp_wifi_connect(void) {
+	/* an attempt never starts over a live link */
+	TEST_ASSERT(!associated);
+	if(loss_in_progress){
+		/* nor right after the previous one: the task waits for the backoff in between */
+		loss_t *loss = &losses[loss_count - 1];
+		TEST_ASSERT(waited);
+		if(loss->retries < MAX_RETRIES){
+			loss->gaps_ms[loss->retries] = (uint32_t)(NOW_MS - round_end_ms);
+		}
+		loss->retries++;
+	}
+	attempts++;
+	waited = false;
+
+	if(ap_up){
+		fake_time_us += FAKE_CONNECT_MS * 1000;
+		associated = true;
+		if(loss_in_progress){
+			losses[loss_count - 1].recovered = true;
+			loss_in_progress = false;
+		}
+		post(SYSTEM_EVENT_STA_CONNECTED, 0);
+		post(SYSTEM_EVENT_STA_GOT_IP, 0);
+	}
+	else{
+		fake_time_us += FAKE_CONNECT_FAILURE_MS * 1000;
+		attempt_failed = true;
+		post(SYSTEM_EVENT_STA_DISCONNECTED, WIFI_REASON_NO_AP_FOUND);
+	}
+	round_end_ms = NOW_MS;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+	if(associated){
+		associated = false;
+		post(SYSTEM_EVENT_STA_DISCONNECTED, WIFI_REASON_ASSOC_LEAVE);
+	}
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+	post(SYSTEM_EVENT_AP_START, 0);
+	post(SYSTEM_EVENT_STA_START, 0);
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block) {
+	fake_time_us += FAKE_SCAN_MS * 1000;
+	round_end_ms = NOW_MS;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *count, wifi_ap_record_t *records) {
+	if(!ap_up || *count == 0){
+		*count = 0;
+		return ESP_OK;
+	}
+	memset(records, 0, sizeof(*records));
+	memcpy(records[0].bssid, home_bssid, sizeof(home_bssid));
+	strcpy((char*)records[0].ssid, "home");
+	records[0].primary = home_channel;
+	records[0].rssi = -50;
+	records[0].authmode = WIFI_AUTH_WPA2_PSK;
+	*count = 1;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap) {
+	uint16_t count = 1;
+
+	if(!associated) return ESP_FAIL;
+	return esp_wifi_scan_get_ap_records(&count, ap);
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) { return ESP_OK; }
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) { return ESP_OK; }
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) { return ESP_OK; }
+esp_err_t esp_wifi_set_bandwidth(wifi_interface_t interface, wifi_bandwidth_t bandwidth) { return ESP_OK; }
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) { return ESP_OK; }
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *config) { return ESP_OK; }
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *config) { memset(config, 0, sizeof(*config)); return ESP_OK; }
+esp_err_t esp_wifi_get_country(wifi_country_t *country) { return ESP_FAIL; }
+
+void tcpip_adapter_init(void) {}
+esp_err_t tcpip_adapter_dhcps_stop(tcpip_adapter_if_t interface) { return ESP_OK; }
+esp_err_t tcpip_adapter_dhcps_start(tcpip_adapter_if_t interface) { return ESP_OK; }
+esp_err_t tcpip_adapter_dhcpc_stop(tcpip_adapter_if_t interface) { return ESP_OK; }
+esp_err_t tcpip_adapter_dhcpc_start(tcpip_adapter_if_t interface) { return ESP_OK; }
+esp_err_t tcpip_adapter_dhcpc_get_status(tcpip_adapter_if_t interface, tcpip_adapter_dhcp_status_t *status) { *status = TCPIP_ADAPTER_DHCP_STARTED; return ESP_OK; }
+esp_err_t tcpip_adapter_set_ip_info(tcpip_adapter_if_t interface, const tcpip_adapter_ip_info_t *info) { return ESP_OK; }
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t interface, tcpip_adapter_ip_info_t *info) { memset(info, 0, sizeof(*info)); return ESP_OK; }
+esp_err_t tcpip_adapter_set_dns_info(tcpip_adapter_if_t interface, tcpip_adapter_dns_type_t type, tcpip_adapter_dns_info_t *dns) { return ESP_OK; }
+esp_err_t tcpip_adapter_get_dns_info(tcpip_adapter_if_t interface, tcpip_adapter_dns_type_t type, tcpip_adapter_dns_info_t *dns) { memset(dns, 0, sizeof(*dns)); return ESP_OK; }
+/* no DHCP lease is cached: every connection asks for a new one */
+esp_err_t tcpip_adapter_get_netif(tcpip_adapter_if_t interface, void **netif) { return ESP_FAIL; }
+struct dhcp *netif_dhcp_data(struct netif *netif) { return NULL; }
+char *ip4addr_ntoa(const ip4_addr_t *addr) { return "0.0.0.0"; }
+int ip4addr_aton(const char *text, ip4_addr_t *addr) { addr->addr = 0; return 1; }
+
+void init_dns_server(void) {}
+
+
+/* http server stub: reads the reason of every ip info update */
+
+void http_server_set_event_start() {}
+void http_server_set_event_stop() {}
+void http_server_notify_ap_list() {}
+size_t http_server_get_static_size() { return 0; }
+
+void http_server_notify_status() {
+	const char *urc = strstr(wifi_manager_get_ip_info_json(), "\"urc\":");
+
+	if(urc == NULL){
+		return;
+	}
+	switch(atoi(urc + strlen("\"urc\":"))){
+	case UPDATE_LOST_CONNECTION:
+		/* automatic retries that fail keep reporting the connection as lost */
+		if(attempt_failed) failure_reports++;
+		else if(loss_count > 0) losses[loss_count - 1].reports++;
+		else TEST_ASSERT(false);
+		attempt_failed = false;
+		break;
+	case UPDATE_USER_DISCONNECT:
+		user_disconnect_reports++;
+		break;
+	default:
+		break;
+	}
+}
+
+
+/* simulated world */
+
+typedef enum {
+	WORLD_DROP,					/* the link drops: the driver reports it twice, as it can on a beacon timeout */
+	WORLD_AP_DOWN,				/* the access point goes away, taking the link with it */
+	WORLD_AP_UP,
+	WORLD_DROP_AND_CONNECT,		/* the link drops while the user asks for a connection */
+	WORLD_DROP_AND_DISCONNECT	/* the link drops while the user asks for a disconnection */
+} world_action_t;
+
+typedef struct {
+	uint32_t delay_ms;			/* after the previous event */
+	world_action_t action;
+} world_event_t;
+
+static const world_event_t *script;
+static int script_length;
+static int script_next;
+static int64_t last_event_ms;
+static jmp_buf task_done;
+
+static void drop(bool loss) {
+	TEST_ASSERT(associated);
+	associated = false;
+	post(SYSTEM_EVENT_STA_DISCONNECTED, WIFI_REASON_BEACON_TIMEOUT);
+	post(SYSTEM_EVENT_STA_DISCONNECTED, WIFI_REASON_BEACON_TIMEOUT);
+	round_end_ms = NOW_MS;
+	if(loss && loss_count < MAX_LOSSES){
+		memset(&losses[loss_count], 0, sizeof(losses[loss_count]));
+		losses[loss_count++].at_ms = NOW_MS;
+		loss_in_progress = true;
+	}
+}
+
+static void world_apply(world_action_t action) {
+	switch(action){
+	case WORLD_DROP:
+		drop(true);
+		break;
+	case WORLD_AP_DOWN:
+		ap_up = false;
+		drop(true);
+		break;
+	case WORLD_AP_UP:
+		ap_up = true;
+		break;
+	case WORLD_DROP_AND_CONNECT:
+		drop(false);
+		wifi_manager_connect_async();
+		break;
+	case WORLD_DROP_AND_DISCONNECT:
+		drop(false);
+		wifi_manager_disconnect_async();
+		break;
+	}
+}
+
+/**
+ * @brief The task blocks: time moves to its timeout or to the next scripted event, whichever comes first.
+ * Once the script is over and the task waits for nothing, the run is over.
+ */
+static void world_block(TickType_t ticks) {
+	int64_t wake_ms = ticks == portMAX_DELAY ? INT64_MAX : NOW_MS + (int64_t)ticks * portTICK_PERIOD_MS;
+
+	waited = true;
+	if(script_next < script_length){
+		int64_t at_ms = last_event_ms + script[script_next].delay_ms;
+		if(at_ms <= wake_ms){
+			if(at_ms > NOW_MS) fake_time_us = at_ms * 1000;
+			last_event_ms = NOW_MS;
+			world_apply(script[script_next++].action);
+			return;
+		}
+	}
+	else if(ticks == portMAX_DELAY){
+		longjmp(task_done, 1);
+	}
+
+	if(wake_ms > SIMULATION_LIMIT_MS){
+		fprintf(stderr, "the task is still busy at %lld ms\n", (long long)NOW_MS);
+		TEST_ASSERT(false);
+		longjmp(task_done, 1);
+	}
+	fake_time_us = wake_ms * 1000;
+}
+
+/**
+ * @brief Runs the wifi manager task through a script. It only runs once: it starts once per boot.
+ */
+static void run(const world_event_t *events, int count) {
+	static wifi_settings_t settings = {
+		.ap_ssid = "esp32",
+		.ap_channel = 1,
+		.ap_bandwidth = WIFI_BW_HT20,
+		.sta_power_save = WIFI_PS_NONE,
+	};
+
+	script = events;
+	script_length = count;
+	script_next = 0;
+	last_event_ms = NOW_MS;
+	fake_block = world_block;
+	if(setjmp(task_done) == 0){
+		wifi_manager(&settings);
+	}
+	fake_block = NULL;
+	TEST_ASSERT_EQUAL_INT(count, script_next);
+}
+
+/**
+ * @brief Checks the retries of a loss against the backoff of wifi_link: it doubles with every failed retry.
+ */
+static void check_retries(const loss_t *loss) {
+	TEST_ASSERT(loss->recovered);
+	for(int i = 0; i < loss->retries && i < MAX_RETRIES; i++){
+		uint32_t backoff = (uint32_t)WIFI_LINK_BACKOFF_BASE_MS << i;
+		if(backoff > WIFI_LINK_BACKOFF_MAX_MS) backoff = WIFI_LINK_BACKOFF_MAX_MS;
+		TEST_ASSERT(loss->gaps_ms[i] >= backoff / 2);
+		TEST_ASSERT(loss->gaps_ms[i] <= backoff + RETRY_TOLERANCE_MS);
+	}
+}
+
+
+static void test_losses() {
+	static const world_event_t events[] = {
+		/* the link flaps with the access point in range: every loss is retried once, after the shortest backoff */
+		{ 10000, WORLD_DROP },
+		{ 10000, WORLD_DROP },
+		{ 10000, WORLD_DROP },
+		{ 10000, WORLD_DROP },
+		{ 10000, WORLD_DROP },
+		/* a storm: the access point is gone for two and a half minutes */
+		{ 10000, WORLD_AP_DOWN },
+		{ 150000, WORLD_AP_UP },
+		/* back in range: the backoff started over */
+		{ 90000, WORLD_DROP },
+		{ 10000, WORLD_DROP_AND_CONNECT },
+		{ 10000, WORLD_DROP_AND_DISCONNECT },
+	};
+	wifi_config_t home;
+	wifi_ap_record_t ap;
+	uint16_t count = 1;
+
+	/* the network was saved with its access point: the task connects at boot */
+	memset(&home, 0, sizeof(home));
+	strcpy((char*)home.sta.ssid, "home");
+	strcpy((char*)home.sta.password, "password");
+	esp_wifi_scan_get_ap_records(&count, &ap);
+	TEST_ASSERT_EQUAL_INT(ESP_OK, wifi_manager_save_network_success(&home, &ap));
+
+	run(events, sizeof(events) / sizeof(events[0]));
+
+	TEST_ASSERT_EQUAL_INT(7, loss_count);
+	for(int i = 0; i < loss_count; i++){
+		TEST_ASSERT_EQUAL_INT(1, losses[i].reports);
+		check_retries(&losses[i]);
+	}
+
+	/* flaps and the loss after the storm: one retry, which got the link back */
+	for(int i = 0; i < 5; i++) TEST_ASSERT_EQUAL_INT(1, losses[i].retries);
+	TEST_ASSERT_EQUAL_INT(1, losses[6].retries);
+
+	/* the storm: the retries spread out, up to the longest backoff, and every failure was reported */
+	const loss_t *storm = &losses[5];
+	TEST_ASSERT(storm->retries >= 7);
+	TEST_ASSERT(storm->retries <= MAX_RETRIES);
+	for(int i = 1; i < storm->retries && i < MAX_RETRIES; i++){
+		TEST_ASSERT(storm->gaps_ms[i] >= storm->gaps_ms[i - 1] || storm->gaps_ms[i] >= WIFI_LINK_BACKOFF_MAX_MS / 2);
+	}
+	TEST_ASSERT_EQUAL_INT(storm->retries - 1, failure_reports);
+
+	/* the pending connection took over the drop, the pending disconnection ended it for good */
+	TEST_ASSERT(!associated);
+	TEST_ASSERT_EQUAL_INT(1, user_disconnect_reports);
+	TEST_ASSERT_EQUAL_INT(0, wifi_manager_get_network_count());
+	TEST_ASSERT_EQUAL_INT(WIFI_LINK_IDLE, wifi_link_get_state());
+	/* boot, 5 flaps, the storm, the loss after it and the requested connection */
+	TEST_ASSERT_EQUAL_INT(1 + 5 + storm->retries + 1 + 1, attempts);
+}
+
+
+int main() {
+	test_losses();
+
+	return test_report("wifi_manager");
+}
@@ -0,0 +1,235 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_wifi_nvs.c
+@brief Tests the credential store on the nvs of fake_idf.c: writes are skipped when nothing persistent changed,
+failure counts are batched, and stores saved with more networks than WIFI_NVS_MAX_NETWORKS are loaded.
+
+The store is read from nvs once per process: the test of the load comes first.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nvs.h"
+#include "wifi_nvs.h"
+#include "test.h"
+#include "fake_idf.h"
+
+/* @brief header of the store blob, as laid out by wifi_nvs.c for WIFI_NVS_STORE_VERSION 2 */
+typedef struct {
+	uint8_t version;
+	uint8_t count;
+	uint16_t network_size;
+	uint32_t sequence;
+} store_header_t;
+
+
+static wifi_config_t config(const char *ssid, const char *password) {
+	wifi_config_t c;
+
+	memset(&c, 0, sizeof(c));
+	snprintf((char*)c.sta.ssid, sizeof(c.sta.ssid), "%s", ssid);
+	snprintf((char*)c.sta.password, sizeof(c.sta.password), "%s", password);
+	return c;
+}
+
+static wifi_ap_record_t ap(uint8_t id, uint8_t channel) {
+	wifi_ap_record_t r;
+
+	memset(&r, 0, sizeof(r));
+	r.bssid[0] = 0x24;
+	r.bssid[5] = id;
+	r.primary = channel;
+	r.authmode = WIFI_AUTH_WPA2_PSK;
+	return r;
+}
+
+static const wifi_nvs_network_t* find(const char *ssid) {
+	uint8_t padded[32] = { 0 };
+
+	memcpy(padded, ssid, strlen(ssid));
+	return wifi_manager_find_network(padded);
+}
+
+
+/**
+ * @brief A store saved by a firmware holding more networks keeps those with the highest priority that connected
+ * most recently.
+ */
+static void test_load_larger_store() {
+	const int count = WIFI_NVS_MAX_NETWORKS + 4;
+	static uint8_t blob[sizeof(store_header_t) + (WIFI_NVS_MAX_NETWORKS + 4) * sizeof(wifi_nvs_network_t)];
+	store_header_t *header = (store_header_t*)blob;
+	wifi_nvs_network_t *networks = (wifi_nvs_network_t*)(blob + sizeof(store_header_t));
+	nvs_handle handle;
+
+	fake_nvs_reset();
+	header->version = 2;
+	header->count = count;
+	header->network_size = sizeof(wifi_nvs_network_t);
+	header->sequence = count;
+	for(int i = 0; i < count; i++){
+		snprintf((char*)networks[i].ssid, sizeof(networks[i].ssid), "network %d", i);
+		/* networks 0 and 1 have a higher priority, the others connected in order */
+		networks[i].priority = i < 2 ? 1 : 0;
+		networks[i].last_success = i + 1;
+	}
+	nvs_open("espwifimgr", NVS_READWRITE, &handle);
+	nvs_set_blob(handle, "networks", blob, sizeof(blob));
+
+	TEST_ASSERT_EQUAL_INT(WIFI_NVS_MAX_NETWORKS, wifi_manager_get_network_count());
+	TEST_ASSERT(find("network 0") != NULL);
+	TEST_ASSERT(find("network 1") != NULL);
+	for(int i = 2; i < count; i++){
+		char ssid[32];
+		snprintf(ssid, sizeof(ssid), "network %d", i);
+		TEST_ASSERT_EQUAL_INT(i >= count - (WIFI_NVS_MAX_NETWORKS - 2), find(ssid) != NULL);
+	}
+
+	/* the most recent network is loaded first */
+	wifi_config_t c;
+	TEST_ASSERT(wifi_manager_load_sta_config(&c));
+	TEST_ASSERT_EQUAL_STRING("network 11", (const char*)c.sta.ssid);
+
+	/* the next write saves the networks kept */
+	TEST_ASSERT_EQUAL_INT(ESP_OK, wifi_manager_set_network_priority(find("network 11")->ssid, 2));
+	size_t size = sizeof(blob);
+	TEST_ASSERT_EQUAL_INT(ESP_OK, nvs_get_blob(handle, "networks", blob, &size));
+	TEST_ASSERT_EQUAL_INT(sizeof(store_header_t) + WIFI_NVS_MAX_NETWORKS * sizeof(wifi_nvs_network_t), size);
+	TEST_ASSERT_EQUAL_INT(WIFI_NVS_MAX_NETWORKS, header->count);
+}
+
+
+/**
+ * @brief Reconnecting to the most recent network with the same access point writes nothing.
+ */
+static void test_success_writes() {
+	wifi_config_t home = config("home", "password");
+	wifi_config_t office = config("office", "secret");
+	wifi_ap_record_t home_ap = ap(1, 6);
+
+	wifi_manager_clear_sta_config();
+	fake_nvs_writes = 0;
+
+	TEST_ASSERT_EQUAL_INT(ESP_OK, wifi_manager_save_network_success(&home, &home_ap));
+	TEST_ASSERT_EQUAL_INT(1, fake_nvs_writes);
+	for(int i = 0; i < 10; i++){
+		TEST_ASSERT_EQUAL_INT(ESP_OK, wifi_manager_save_network_success(&home, &home_ap));
+	}
+	TEST_ASSERT_EQUAL_INT(1, fake_nvs_writes);
+
+	/* another access point of the same network */
+	wifi_ap_record_t roamed = ap(2, 11);
+	wifi_manager_save_network_success(&home, &roamed);
+	TEST_ASSERT_EQUAL_INT(2, fake_nvs_writes);
+	TEST_ASSERT_EQUAL_INT(11, find("home")->channel);
+
+	/* a new password */
+	home = config("home", "new password");
+	wifi_manager_save_network_success(&home, &roamed);
+	TEST_ASSERT_EQUAL_INT(3, fake_nvs_writes);
+
+	/* another network becoming the most recent one is saved, so is the switch back */
+	wifi_manager_save_network_success(&office, &home_ap);
+	TEST_ASSERT_EQUAL_INT(4, fake_nvs_writes);
+	wifi_config_t c;
+	wifi_manager_load_sta_config(&c);
+	TEST_ASSERT_EQUAL_STRING("office", (const char*)c.sta.ssid);
+	wifi_manager_save_network_success(&home, &roamed);
+	TEST_ASSERT_EQUAL_INT(5, fake_nvs_writes);
+	wifi_manager_load_sta_config(&c);
+	TEST_ASSERT_EQUAL_STRING("home", (const char*)c.sta.ssid);
+
+	/* saving the same credentials again writes nothing */
+	wifi_manager_save_sta_config(&home);
+	TEST_ASSERT_EQUAL_INT(5, fake_nvs_writes);
+	TEST_ASSERT_EQUAL_INT(ESP_OK, wifi_manager_set_network_priority(home.sta.ssid, 0));
+	TEST_ASSERT_EQUAL_INT(5, fake_nvs_writes);
+}
+
+
+/**
+ * @brief Failure counts are written at powers of two, or with the next change of the store.
+ */
+static void test_failure_writes() {
+	wifi_config_t home = config("home", "password");
+	wifi_ap_record_t home_ap = ap(1, 6);
+	int expected = 0;
+
+	wifi_manager_clear_sta_config();
+	wifi_manager_save_network_success(&home, &home_ap);
+	fake_nvs_writes = 0;
+
+	for(int failures = 1; failures <= 300; failures++){
+		wifi_manager_save_network_failure(home.sta.ssid);
+		if(failures <= UINT8_MAX && ((failures & (failures - 1)) == 0 || failures == UINT8_MAX)) expected++;
+		TEST_ASSERT_EQUAL_INT(expected, fake_nvs_writes);
+		TEST_ASSERT_EQUAL_INT(failures < UINT8_MAX ? failures : UINT8_MAX, find("home")->failures);
+	}
+	TEST_ASSERT_EQUAL_INT(9, fake_nvs_writes);
+
+	/* a success resets the count, and the write carries it */
+	wifi_manager_save_network_success(&home, &home_ap);
+	TEST_ASSERT_EQUAL_INT(10, fake_nvs_writes);
+	TEST_ASSERT_EQUAL_INT(0, find("home")->failures);
+
+	/* unknown networks are not counted */
+	wifi_manager_save_network_failure((const uint8_t*)"unknown network\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0");
+	TEST_ASSERT_EQUAL_INT(10, fake_nvs_writes);
+}
+
+
+/**
+ * @brief The blob holds the header and the networks in use only.
+ */
+static void test_layouts() {
+	wifi_config_t home = config("home", "password");
+	wifi_ap_record_t home_ap = ap(1, 6);
+	store_header_t header;
+	nvs_handle handle;
+	size_t size;
+
+	wifi_manager_clear_sta_config();
+	wifi_manager_save_network_success(&home, &home_ap);
+	nvs_open("espwifimgr", NVS_READWRITE, &handle);
+	size = sizeof(header);
+	TEST_ASSERT_EQUAL_INT(ESP_ERR_NVS_INVALID_LENGTH, nvs_get_blob(handle, "networks", &header, &size));
+	TEST_ASSERT_EQUAL_INT(sizeof(store_header_t) + sizeof(wifi_nvs_network_t), size);
+
+	uint8_t blob[sizeof(store_header_t) + sizeof(wifi_nvs_network_t)];
+	TEST_ASSERT_EQUAL_INT(ESP_OK, nvs_get_blob(handle, "networks", blob, &size));
+	memcpy(&header, blob, sizeof(header));
+	TEST_ASSERT_EQUAL_INT(2, header.version);
+	TEST_ASSERT_EQUAL_INT(1, header.count);
+	TEST_ASSERT_EQUAL_INT(sizeof(wifi_nvs_network_t), header.network_size);
+	TEST_ASSERT_EQUAL_INT(1, header.sequence);
+}
+
+
+int main() {
+	test_load_larger_store();
+	test_success_writes();
+	test_failure_writes();
+	test_layouts();
+
+	return test_report("wifi_nvs");
+}
@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_wifi_scan.c
+@brief Tests the sliced scan against a simulated driver.
+
+The driver keeps a clock in ms. A scan switches the radio to the scanned channel, listens for probe responses,
+and switches back; the driver stamps the clock when the radio leaves the channel of the access point and when it
+is back. The uplink must never be away for longer than WIFI_MANAGER_SCAN_DWELL_MS in a row, must stay home for
+WIFI_MANAGER_SCAN_SLICE_INTERVAL_MS between two slices, and every channel of the country must be visited once.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "wifi_manager.h"
+#include "wifi_scan.h"
+#include "test.h"
+
+
+/* simulated driver */
+
+static uint32_t now_ms = 0;
+static wifi_country_t country;
+static esp_err_t country_result = ESP_OK;
+static uint8_t refused_channel = 0;
+
+/* the driver switches channel slower than wifi_scan.c budgets for, so only its own clock tells if the dwell holds */
+#define FAKE_CHANNEL_SWITCH_MS		4
+
+static uint8_t visited[32];
+static int visits = 0;
+
+/* times the radio left the channel of the access point and was back, per slice */
+static uint32_t left_ms[32];
+static uint32_t back_ms[32];
+static int slices = 0;
+
+static void radio_leaves() {
+	if(slices < sizeof(left_ms) / sizeof(left_ms[0])) left_ms[slices] = now_ms;
+}
+
+static void radio_back() {
+	if(slices < sizeof(back_ms) / sizeof(back_ms[0])) back_ms[slices] = now_ms;
+	slices++;
+}
+
+esp_err_t esp_wifi_get_country(wifi_country_t *c) {
+	*c = country;
+	return country_result;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block) {
+	TEST_ASSERT(block);
+	/* an all channel scan is never made while connected */
+	TEST_ASSERT(config->channel != 0);
+	TEST_ASSERT_EQUAL_INT(WIFI_SCAN_TYPE_ACTIVE, config->scan_type);
+	TEST_ASSERT(config->scan_time.active.min <= config->scan_time.active.max);
+
+	if(visits < sizeof(visited)) visited[visits] = config->channel;
+	visits++;
+
+	/* a refused scan leaves the radio home */
+	if(config->channel == refused_channel) return ESP_FAIL;
+
+	radio_leaves();
+	now_ms += FAKE_CHANNEL_SWITCH_MS;
+	/* every channel has an access point answering: the driver listens for the longest time allowed */
+	now_ms += config->scan_time.active.max ? config->scan_time.active.max : 120;
+	now_ms += FAKE_CHANNEL_SWITCH_MS;
+	radio_back();
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *count, wifi_ap_record_t *records) {
+	/* one access point per channel */
+	TEST_ASSERT(*count >= 1);
+	memset(records, 0, sizeof(*records));
+	records[0].primary = visited[visits - 1];
+	*count = 1;
+	return ESP_OK;
+}
+
+
+static void reset() {
+	now_ms = 0;
+	visits = 0;
+	slices = 0;
+	refused_channel = 0;
+	country_result = ESP_OK;
+}
+
+/**
+ * @brief Runs a sliced scan to completion the way the wifi manager task does.
+ * @return the number of access points found.
+ */
+static int run_scan() {
+	static const wifi_scan_config_t config = { .show_hidden = true };
+	wifi_ap_record_t records[4];
+	int found = 0;
+	bool complete = false;
+
+	TEST_ASSERT(!wifi_scan_slices_running());
+	wifi_scan_slices_start();
+	TEST_ASSERT(wifi_scan_slices_running());
+	for(int slices = 0; !complete && slices < 64; slices++){
+		uint16_t count = sizeof(records) / sizeof(records[0]);
+		TickType_t delay;
+		uint8_t channel = wifi_scan_slices_channel();
+		complete = wifi_scan_slice(&config, records, &count, &delay);
+		if(count){
+			TEST_ASSERT_EQUAL_INT(channel, records[0].primary);
+		}
+		found += count;
+		if(!complete){
+			TEST_ASSERT(wifi_scan_slices_running());
+			/* the task waits on the channel of the access point */
+			now_ms += delay * portTICK_PERIOD_MS;
+		}
+	}
+	TEST_ASSERT(complete);
+	TEST_ASSERT(!wifi_scan_slices_running());
+	TEST_ASSERT_EQUAL_INT(0, wifi_scan_slices_channel());
+	return found;
+}
+
+
+static void test_channels() {
+	reset();
+	country.schan = 1;
+	country.nchan = 13;
+	TEST_ASSERT_EQUAL_INT(13, run_scan());
+	TEST_ASSERT_EQUAL_INT(13, visits);
+	for(int i = 0; i < 13; i++) TEST_ASSERT_EQUAL_INT(i + 1, visited[i]);
+
+	reset();
+	country.schan = 3;
+	country.nchan = 4;
+	TEST_ASSERT_EQUAL_INT(4, run_scan());
+	TEST_ASSERT_EQUAL_INT(4, visits);
+	for(int i = 0; i < 4; i++) TEST_ASSERT_EQUAL_INT(i + 3, visited[i]);
+
+	/* no country: channels 1 to 11 */
+	reset();
+	country_result = ESP_FAIL;
+	TEST_ASSERT_EQUAL_INT(11, run_scan());
+	TEST_ASSERT_EQUAL_INT(11, visits);
+	TEST_ASSERT_EQUAL_INT(11, visited[10]);
+
+	reset();
+	country.schan = 1;
+	country.nchan = 0;
+	TEST_ASSERT_EQUAL_INT(11, run_scan());
+}
+
+
+static void test_away_time() {
+	reset();
+	country.schan = 1;
+	country.nchan = 14;
+	run_scan();
+
+	TEST_ASSERT_EQUAL_INT(14, slices);
+	for(int i = 0; i < slices; i++){
+		TEST_ASSERT(back_ms[i] > left_ms[i]);
+		TEST_ASSERT(back_ms[i] - left_ms[i] <= WIFI_MANAGER_SCAN_DWELL_MS);
+		if(i > 0) TEST_ASSERT(left_ms[i] - back_ms[i - 1] >= WIFI_MANAGER_SCAN_SLICE_INTERVAL_MS);
+	}
+	/* the whole scan takes at most a slice and an interval per channel */
+	TEST_ASSERT(now_ms <= 14 * WIFI_MANAGER_SCAN_DWELL_MS + 13 * WIFI_MANAGER_SCAN_SLICE_INTERVAL_MS);
+
+	/* a refused channel does not shorten the time home */
+	reset();
+	country.schan = 1;
+	country.nchan = 11;
+	refused_channel = 6;
+	run_scan();
+	TEST_ASSERT_EQUAL_INT(10, slices);
+	for(int i = 1; i < slices; i++) TEST_ASSERT(left_ms[i] - back_ms[i - 1] >= WIFI_MANAGER_SCAN_SLICE_INTERVAL_MS);
+}
+
+
+/**
+ * @brief A channel the driver refuses to scan is skipped without ending the scan.
+ */
+static void test_refused() {
+	reset();
+	country.schan = 1;
+	country.nchan = 11;
+	refused_channel = 6;
+	TEST_ASSERT_EQUAL_INT(10, run_scan());
+	TEST_ASSERT_EQUAL_INT(11, visits);
+	TEST_ASSERT_EQUAL_INT(7, visited[6]);
+
+	/* the last channel */
+	reset();
+	refused_channel = 11;
+	TEST_ASSERT_EQUAL_INT(10, run_scan());
+}
+
+
+int main() {
+	test_channels();
+	test_away_time();
+	test_refused();
+
+	return test_report("wifi_scan");
+}
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file test_wifi_timeline.c
+@brief Tests the timeline of connection attempts and that its json always fits in WIFI_TIMELINE_JSON_SIZE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_wifi_types.h"
+#include "wifi_timeline.h"
+#include "test.h"
+#include "fake_idf.h"
+
+
+static wifi_config_t config(uint8_t fill, bool targeted) {
+	wifi_config_t c;
+
+	memset(&c, 0, sizeof(c));
+	memset(c.sta.ssid, fill, sizeof(c.sta.ssid));
+	if(targeted){
+		c.sta.bssid_set = true;
+		memset(c.sta.bssid, 0xab, sizeof(c.sta.bssid));
+		c.sta.channel = 13;
+	}
+	return c;
+}
+
+
+static void test_phases() {
+	wifi_config_t c = config('a', true);
+	wifi_timeline_attempt_t attempts[WIFI_TIMELINE_SIZE];
+	const uint8_t bssid[6] = { 1, 2, 3, 4, 5, 6 };
+
+	fake_time_us = 1000000;
+	wifi_timeline_request();
+	fake_time_us += 200;
+	wifi_timeline_disconnected();
+	fake_time_us += 300;
+	wifi_timeline_connect(&c);
+	fake_time_us += 400;
+	wifi_timeline_associated(bssid, 6);
+	fake_time_us += 500;
+	wifi_timeline_got_ip();
+	/* a loss after the IP is not a failure of the attempt */
+	wifi_timeline_failed(WIFI_REASON_BEACON_TIMEOUT);
+
+	TEST_ASSERT_EQUAL_INT(1, wifi_timeline_get(attempts, WIFI_TIMELINE_SIZE));
+	TEST_ASSERT_EQUAL_INT(1000, attempts[0].requested_ms);
+	TEST_ASSERT_EQUAL_INT(200, attempts[0].phases[WIFI_TIMELINE_DISCONNECTED]);
+	TEST_ASSERT_EQUAL_INT(500, attempts[0].phases[WIFI_TIMELINE_CONNECT]);
+	TEST_ASSERT_EQUAL_INT(900, attempts[0].phases[WIFI_TIMELINE_ASSOCIATED]);
+	TEST_ASSERT_EQUAL_INT(1400, attempts[0].phases[WIFI_TIMELINE_GOT_IP]);
+	TEST_ASSERT_EQUAL_INT(0, attempts[0].phases[WIFI_TIMELINE_FAILED]);
+	TEST_ASSERT_EQUAL_INT(6, attempts[0].channel);
+	TEST_ASSERT(attempts[0].targeted);
+
+	/* an attempt failing before associating keeps the access point it targeted */
+	wifi_timeline_connect(&c);
+	fake_time_us += 100;
+	wifi_timeline_failed(WIFI_REASON_AUTH_FAIL);
+	TEST_ASSERT_EQUAL_INT(2, wifi_timeline_get(attempts, WIFI_TIMELINE_SIZE));
+	TEST_ASSERT_EQUAL_INT(2, attempts[0].sequence);
+	TEST_ASSERT_EQUAL_INT(WIFI_REASON_AUTH_FAIL, attempts[0].reason);
+	TEST_ASSERT_EQUAL_INT(13, attempts[0].channel);
+	TEST_ASSERT_EQUAL_INT(0xab, attempts[0].bssid[0]);
+}
+
+
+/**
+ * @brief A full ring of attempts with ssids of control characters and the widest numbers fits in
+ * WIFI_TIMELINE_JSON_SIZE, but not in the 3 KB the report buffer used to have.
+ */
+static void test_json_size() {
+	static char buffer[WIFI_TIMELINE_JSON_SIZE + 16];
+	const uint8_t bssid[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+	for(int i = 0; i < WIFI_TIMELINE_SIZE; i++){
+		wifi_config_t c = config(0x01, false);
+
+		fake_time_us = 4294967295000LL;
+		wifi_timeline_request();
+		fake_time_us += 4000000000LL;
+		wifi_timeline_disconnected();
+		wifi_timeline_connect(&c);
+		wifi_timeline_associated(bssid, 255);
+		wifi_timeline_got_ip();
+		/* the ring keeps the last attempt open so that every phase is written */
+		wifi_timeline_connect(&c);
+		wifi_timeline_associated(bssid, 255);
+		wifi_timeline_failed(255);
+	}
+
+	memset(buffer, 'x', sizeof(buffer));
+	size_t length = wifi_timeline_format_json(buffer, WIFI_TIMELINE_JSON_SIZE);
+	TEST_ASSERT(length > 0);
+	TEST_ASSERT_EQUAL_INT(length, strlen(buffer));
+	TEST_ASSERT_EQUAL_INT('x', buffer[WIFI_TIMELINE_JSON_SIZE]);
+	/* the estimate is tight: only the sequence numbers are shorter than 10 digits here */
+	TEST_ASSERT(length > WIFI_TIMELINE_JSON_SIZE - WIFI_TIMELINE_SIZE * 20);
+	int escapes = 0;
+	for(const char *p = buffer; (p = strstr(p, "\\u0001")) != NULL; p++) escapes++;
+	TEST_ASSERT_EQUAL_INT(WIFI_TIMELINE_SIZE * 32, escapes);
+	TEST_ASSERT_EQUAL_INT(0, wifi_timeline_format_json(buffer, 3072));
+}
+
+
+int main() {
+	test_phases();
+	test_json_size();
+
+	return test_report("wifi_timeline");
+}
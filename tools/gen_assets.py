@@ -0,0 +1,231 @@
+#!/usr/bin/env python
+#
+# Generates the static asset table served by http_server.c.
+#
+# Every portal file is minified, gzipped and fingerprinted with a hash of its
+# content. Each asset is served under its plain path and under a fingerprinted
+# path that can be cached forever. index.html is rewritten to reference the
+# fingerprinted paths, so a new firmware always busts the browser cache.
+# The fingerprint doubles as a strong ETag for conditional requests.
+#
+# usage: gen_assets.py --output http_assets.c /=assets/index.html /code.js=assets/code.js ...
+#
+# Files ending in .gz are considered already compressed and are served as is.
+#
+# The uncompressed content of every asset is also generated, for clients that
+# do not accept gzip. It is only compiled in when HTTP_ASSETS_IDENTITY is set
+# in http_assets.h: otherwise such clients get the gzipped content anyway.
+
+from __future__ import print_function
+
+import argparse
+import gzip
+import hashlib
+import io
+import os
+import re
+
+CONTENT_TYPES = {
+    '.html': 'text/html',
+    '.css': 'text/css',
+    '.js': 'text/javascript',
+    '.json': 'application/json',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+}
+
+CACHE_REVALIDATE = 'no-cache'
+CACHE_IMMUTABLE = 'public, max-age=31536000, immutable'
+
+FINGERPRINT_LENGTH = 8
+
+
+def minify_css(text):
+    # keep license notices, drop every other comment
+    text = re.sub(r'/\*(?![^*]*[Ll]icen[sc]e).*?\*/', '', text, flags=re.S)
+    text = re.sub(r'\s+', ' ', text)
+    text = re.sub(r'\s*([{};,])\s*', r'\1', text)
+    text = re.sub(r':\s+', ':', text)
+    return text.strip()
+
+
+def minify_js(text):
+    # conservative: line structure is kept so automatic semicolon insertion is unaffected
+    lines = (line.strip() for line in text.splitlines())
+    return '\n'.join(line for line in lines if line and not line.startswith('//'))
+
+
+def minify_html(text):
+    lines = (line.strip() for line in text.splitlines())
+    return '\n'.join(line for line in lines if line)
+
+
+MINIFIERS = {
+    '.css': minify_css,
+    '.js': minify_js,
+    '.html': minify_html,
+}
+
+
+def gzip_bytes(data):
+    out = io.BytesIO()
+    # mtime is fixed so that builds are reproducible
+    with gzip.GzipFile(filename='', mode='wb', fileobj=out, compresslevel=9, mtime=0) as f:
+        f.write(data)
+    return out.getvalue()
+
+
+class Asset(object):
+    def __init__(self, path, source):
+        self.path = path
+        self.source = source
+        self.extension = os.path.splitext(path if path != '/' else '/index.html')[1]
+        self.content_type = CONTENT_TYPES.get(self.extension, 'application/octet-stream')
+        self.data = None
+        self.identity = None
+        self.fingerprint = None
+
+    def build(self, rewrite=None):
+        with open(self.source, 'rb') as f:
+            raw = f.read()
+        if self.source.endswith('.gz'):
+            self.data = raw
+            with gzip.GzipFile(fileobj=io.BytesIO(raw), mode='rb') as f:
+                self.identity = f.read()
+        else:
+            minifier = MINIFIERS.get(self.extension)
+            if minifier:
+                text = minifier(raw.decode('utf-8'))
+                if rewrite:
+                    text = rewrite(text)
+                raw = text.encode('utf-8')
+            self.data = gzip_bytes(raw)
+            self.identity = raw
+        self.fingerprint = hashlib.sha256(self.data).hexdigest()[:FINGERPRINT_LENGTH]
+
+    def fingerprinted_path(self):
+        base, ext = os.path.splitext(self.path)
+        return '%s.%s%s' % (base, self.fingerprint, ext)
+
+
+def c_string(s):
+    return '"%s"' % s.replace('\\', '\\\\').replace('"', '\\"').replace('\r', '\\r').replace('\n', '\\n')
+
+
+def c_bytes(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        chunk = bytearray(data[i:i + 16])
+        lines.append('\t' + ', '.join('0x%02x' % b for b in chunk) + ',')
+    return '\n'.join(lines)
+
+
+def etag(asset, encoding):
+    # each representation needs its own strong entity tag
+    return '"%s"' % asset.fingerprint if encoding == 'gzip' else '"%s-%s"' % (asset.fingerprint, encoding)
+
+
+def http_header(asset, encoding, cache_control):
+    return ('HTTP/1.1 200 OK\r\n'
+            'Content-Type: %s\r\n'
+            '%s'
+            'Vary: Accept-Encoding\r\n'
+            'Cache-Control: %s\r\n'
+            'ETag: %s\r\n') % (asset.content_type, 'Content-Encoding: gzip\r\n' if encoding == 'gzip' else '',
+                                cache_control, etag(asset, encoding))
+
+
+def http_not_modified_header(asset, encoding, cache_control):
+    return ('HTTP/1.1 304 Not Modified\r\n'
+            'Vary: Accept-Encoding\r\n'
+            'Cache-Control: %s\r\n'
+            'ETag: %s\r\n') % (cache_control, etag(asset, encoding))
+
+
+def c_representation(asset, encoding, cache_control, data_name, length):
+    return '%s, %s, %s, %s, %d' % (c_string(http_header(asset, encoding, cache_control)),
+                                   c_string(http_not_modified_header(asset, encoding, cache_control)),
+                                   c_string(etag(asset, encoding)), data_name, length)
+
+
+def generate(assets, output):
+    entries = []
+    for asset in assets:
+        if asset.path == '/':
+            # the page referencing the fingerprinted resources must always be revalidated
+            entries.append((asset.path, asset, CACHE_REVALIDATE))
+        else:
+            # plain path stays available for clients holding an old copy of the page
+            entries.append((asset.path, asset, CACHE_REVALIDATE))
+            entries.append((asset.fingerprinted_path(), asset, CACHE_IMMUTABLE))
+
+    out = []
+    out.append('/* generated by tools/gen_assets.py: do not edit */\n')
+    out.append('#include <stdint.h>')
+    out.append('#include <stddef.h>')
+    out.append('#include "http_assets.h"\n')
+    for i, asset in enumerate(assets):
+        out.append('/* %s: %d bytes, fingerprint %s */' % (asset.source.replace(os.sep, '/').split('/')[-1], len(asset.data), asset.fingerprint))
+        out.append('static const uint8_t http_asset_data_%d[] = {' % i)
+        out.append(c_bytes(asset.data))
+        out.append('};\n')
+
+    out.append('#if HTTP_ASSETS_IDENTITY')
+    for i, asset in enumerate(assets):
+        out.append('static const uint8_t http_asset_identity_%d[] = {' % i)
+        out.append(c_bytes(asset.identity))
+        out.append('};\n')
+    out.append('#define HTTP_ASSET_IDENTITY(header, header_not_modified, etag, data, length) { header, header_not_modified, etag, data, length }')
+    out.append('#else')
+    out.append('#define HTTP_ASSET_IDENTITY(header, header_not_modified, etag, data, length) { NULL, NULL, NULL, NULL, 0 }')
+    out.append('#endif\n')
+
+    out.append('const http_asset_t http_assets[] = {')
+    for path, asset, cache_control in entries:
+        index = assets.index(asset)
+        out.append('\t{ %s, %d,' % (c_string(path), len(path)))
+        out.append('\t\t{ %s },' % c_representation(asset, 'gzip', cache_control, 'http_asset_data_%d' % index, len(asset.data)))
+        out.append('\t\tHTTP_ASSET_IDENTITY(%s) },' % c_representation(asset, 'identity', cache_control, 'http_asset_identity_%d' % index, len(asset.identity)))
+    out.append('};\n')
+    out.append('const size_t http_assets_count = sizeof(http_assets) / sizeof(http_assets[0]);')
+
+    content = '\n'.join(out) + '\n'
+    # do not touch the output if nothing changed to avoid needless rebuilds
+    if os.path.exists(output):
+        with open(output, 'r') as f:
+            if f.read() == content:
+                return
+    with open(output, 'w') as f:
+        f.write(content)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generates the HTTP server static asset table')
+    parser.add_argument('--output', required=True, help='C file to generate')
+    parser.add_argument('assets', nargs='+', metavar='PATH=FILE', help='URL path and source file of an asset')
+    args = parser.parse_args()
+
+    assets = []
+    for spec in args.assets:
+        path, source = spec.split('=', 1)
+        assets.append(Asset(path, source))
+
+    # pages are built last: they reference the fingerprints of everything else
+    resources = [a for a in assets if a.extension != '.html']
+    pages = [a for a in assets if a.extension == '.html']
+    for asset in resources:
+        asset.build()
+
+    def rewrite(text):
+        for asset in resources:
+            text = text.replace('"%s"' % asset.path, '"%s"' % asset.fingerprinted_path())
+        return text
+
+    for asset in pages:
+        asset.build(rewrite)
+
+    generate(assets, args.output)
+
+
+if __name__ == '__main__':
+    main()
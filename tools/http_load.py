@@ -0,0 +1,134 @@
+#!/usr/bin/env python
+#
+# Load test of the provisioning portal: concurrent clients on persistent
+# connections load the page and its assets and poll the json endpoints, like
+# phones joined to the softAP do.
+#
+# The run is repeated for every number of clients given, so that throughput
+# can be compared against HTTP_SERVER_WORKER_COUNT: it should grow with the
+# number of clients until all workers are busy, then level off.
+#
+# This is a device-only tool: run it from a machine joined to the softAP of a
+# board running the portal. It has no host counterpart and no reference
+# numbers; the worker pool only exists on the device, and a localhost server
+# would measure its own model instead of http_server.
+#
+# usage: http_load.py [--host 192.168.1.1] [--clients 1,2,4] [--duration 10]
+#
+# Requests must be addressed to 192.168.1.1: the server redirects any other Host.
+
+from __future__ import print_function, division
+
+import argparse
+import sys
+import threading
+import time
+
+try:
+    from http.client import HTTPConnection, HTTPException
+except ImportError:
+    from httplib import HTTPConnection, HTTPException
+
+import socket
+
+DEFAULT_PATHS = '/,/code.js,/style.css,/jquery.js,/ap.json,/status.json'
+
+
+class Client(threading.Thread):
+    def __init__(self, args, paths, deadline):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.args = args
+        self.paths = paths
+        self.deadline = deadline
+        self.latencies = []
+        self.bytes = 0
+        self.errors = 0
+        self.connections = 0
+
+    def connect(self):
+        self.connections += 1
+        return HTTPConnection(self.args.host, self.args.port, timeout=self.args.timeout)
+
+    def run(self):
+        conn = None
+        i = 0
+        while time.time() < self.deadline:
+            path = self.paths[i % len(self.paths)]
+            i += 1
+            if conn is None:
+                conn = self.connect()
+            start = time.time()
+            try:
+                conn.request('GET', path, headers={'Accept-Encoding': 'gzip'})
+                response = conn.getresponse()
+                body = response.read()
+            except (HTTPException, socket.error):
+                self.errors += 1
+                conn.close()
+                conn = None
+                continue
+            if response.status not in (200, 304):
+                self.errors += 1
+            self.latencies.append(time.time() - start)
+            self.bytes += len(body)
+            # the server closes connections after HTTP_SERVER_MAX_REQUESTS_PER_CONNECTION requests
+            if (response.getheader('Connection') or '').lower() == 'close':
+                conn.close()
+                conn = None
+        if conn is not None:
+            conn.close()
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+
+def run(args, paths, clients):
+    deadline = time.time() + args.duration
+    threads = [Client(args, paths, deadline) for _ in range(clients)]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+
+    latencies = [l for t in threads for l in t.latencies]
+    return {
+        'clients': clients,
+        'requests': len(latencies),
+        'rps': len(latencies) / elapsed,
+        'kbps': sum(t.bytes for t in threads) / 1024 / elapsed,
+        'p50': percentile(latencies, 0.5) * 1000,
+        'p95': percentile(latencies, 0.95) * 1000,
+        'max': max(latencies or [0]) * 1000,
+        'connections': sum(t.connections for t in threads),
+        'errors': sum(t.errors for t in threads),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Measures portal throughput against the number of concurrent clients.')
+    parser.add_argument('--host', default='192.168.1.1')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--clients', default='1,2,4', help='comma separated numbers of concurrent clients')
+    parser.add_argument('--duration', type=float, default=10, help='seconds of each run')
+    parser.add_argument('--timeout', type=float, default=10, help='seconds before a request is counted as an error')
+    parser.add_argument('--paths', default=DEFAULT_PATHS, help='comma separated paths requested in turn')
+    args = parser.parse_args()
+
+    paths = args.paths.split(',')
+    print('%7s %9s %9s %9s %8s %8s %8s %6s %6s' % ('clients', 'requests', 'req/s', 'KiB/s', 'p50 ms', 'p95 ms', 'max ms', 'conns', 'errors'))
+    for clients in [int(c) for c in args.clients.split(',')]:
+        r = run(args, paths, clients)
+        print('%(clients)7d %(requests)9d %(rps)9.1f %(kbps)9.1f %(p50)8.1f %(p95)8.1f %(max)8.1f %(connections)6d %(errors)6d' % r)
+        sys.stdout.flush()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
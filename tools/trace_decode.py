@@ -0,0 +1,200 @@
+#!/usr/bin/env python
+#
+# Converts a dump of the trace rings served as /trace.bin to the Chrome trace
+# event format, to be opened in chrome://tracing or https://ui.perfetto.dev.
+#
+# Every task is a thread. Mutex waits and holds, scans and NVS writes are
+# slices of the task that recorded them, event group transitions are instant
+# events and HTTP connections are async slices from accept to close.
+# Timestamps are microseconds since boot.
+#
+# usage: trace_decode.py [--output trace.json] trace.bin
+#        curl -s http://192.168.1.1/trace.bin | trace_decode.py - > trace.json
+#
+# The layout of the dump is described in include/trace.h.
+
+from __future__ import print_function
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x52544d57
+TRACE_VERSION = 1
+
+HEADER = struct.Struct('<IHHQHBB4x')
+TASK = struct.Struct('<I16s')
+RECORD = struct.Struct('<IIBBHI')
+
+EVENT_GROUP_SET = 1
+EVENT_GROUP_CLEAR = 2
+MUTEX_WAIT = 3
+MUTEX_TAKE = 4
+MUTEX_GIVE = 5
+HTTP_ACCEPT = 6
+HTTP_CLOSE = 7
+SCAN_START = 8
+SCAN_END = 9
+NVS_WRITE_START = 10
+NVS_WRITE_END = 11
+
+OBJECTS = {
+    0: 'none',
+    1: 'wifi_manager_event_group',
+    2: 'http_server_event_group',
+    3: 'wifi_manager_json_mutex',
+    4: 'wifi_manager_json_writer_mutex',
+}
+
+# names of the bits of each event group, as defined in wifi_manager.c and http_server.h
+EVENT_GROUP_BITS = {
+    1: {0: 'WIFI_CONNECTED', 1: 'AP_STA_CONNECTED', 2: 'AP_STARTED', 4: 'STA_DISCONNECT', 7: 'STA_GOT_IP'},
+    2: {0: 'START'},
+}
+
+PORT_MAX_DELAY = 0xffffffff
+
+
+class DumpError(Exception):
+    pass
+
+
+def parse(data):
+    if len(data) < HEADER.size:
+        raise DumpError('dump too short')
+    magic, version, record_size, now_us, ring_size, cores, max_tasks = HEADER.unpack_from(data, 0)
+    if magic != TRACE_MAGIC:
+        raise DumpError('not a trace dump')
+    if version != TRACE_VERSION or record_size != RECORD.size:
+        raise DumpError('unsupported dump version %d' % version)
+    offset = HEADER.size
+
+    tasks = {}
+    for _ in range(max_tasks):
+        handle, name = TASK.unpack_from(data, offset)
+        offset += TASK.size
+        if handle:
+            tasks[handle] = name.split(b'\0', 1)[0].decode('ascii', 'replace')
+
+    heads = struct.unpack_from('<%dI' % cores, data, offset)
+    offset += 4 * cores
+    if len(data) < offset + cores * ring_size * RECORD.size:
+        raise DumpError('dump truncated')
+
+    records = []
+    dropped = 0
+    for core in range(cores):
+        ring = offset + core * ring_size * RECORD.size
+        head = heads[core]
+        for slot in range(max(0, head - ring_size), head):
+            time_us, task, event, obj, sequence, arg = RECORD.unpack_from(data, ring + (slot % ring_size) * RECORD.size)
+            if sequence != (slot + 1) & 0xffff:
+                # overwritten or being written while the dump was sent
+                dropped += 1
+                continue
+            # time_us holds the low 32 bits of the time: records can be a few microseconds after the dump started
+            delta = (now_us - time_us) & 0xffffffff
+            if delta >= 0x80000000:
+                delta -= 0x100000000
+            records.append((now_us - delta, core, task, event, obj, arg))
+
+    records.sort(key=lambda record: record[0])
+    return tasks, records, dropped
+
+
+def bit_names(obj, bits):
+    names = EVENT_GROUP_BITS.get(obj, {})
+    return [names.get(bit, 'BIT%d' % bit) for bit in range(32) if bits & (1 << bit)]
+
+
+def convert(tasks, records, dropped):
+    events = [{'ph': 'M', 'pid': 1, 'name': 'process_name', 'args': {'name': 'esp32'}}]
+    threads = set()
+    # slices are paired here rather than with B/E events so that a ring starting in the middle of one is harmless
+    open_slices = {}
+
+    def thread(task):
+        if task not in threads:
+            threads.add(task)
+            name = tasks.get(task, 'task 0x%08x' % task)
+            events.append({'ph': 'M', 'pid': 1, 'tid': task, 'name': 'thread_name', 'args': {'name': name}})
+        return task
+
+    def begin(ts, task, name, args):
+        open_slices[(task, name)] = (ts, args)
+
+    def end(ts, task, name, args):
+        start = open_slices.pop((task, name), None)
+        if start is None:
+            return
+        merged = dict(start[1])
+        merged.update(args)
+        events.append({'ph': 'X', 'pid': 1, 'tid': thread(task), 'ts': start[0], 'dur': ts - start[0], 'name': name, 'args': merged})
+
+    def instant(ts, task, name, args):
+        events.append({'ph': 'i', 's': 't', 'pid': 1, 'tid': thread(task), 'ts': ts, 'name': name, 'args': args})
+
+    for ts, core, task, event, obj, arg in records:
+        name = OBJECTS.get(obj, 'object %d' % obj)
+        if event in (EVENT_GROUP_SET, EVENT_GROUP_CLEAR):
+            verb = 'set' if event == EVENT_GROUP_SET else 'clear'
+            instant(ts, task, '%s %s' % (verb, ' | '.join(bit_names(obj, arg))), {'group': name, 'bits': '0x%x' % arg, 'core': core})
+        elif event == MUTEX_WAIT:
+            begin(ts, task, 'wait ' + name, {'timeout_ticks': 'forever' if arg == PORT_MAX_DELAY else arg, 'core': core})
+        elif event == MUTEX_TAKE:
+            end(ts, task, 'wait ' + name, {'taken': bool(arg)})
+            if arg:
+                begin(ts, task, 'hold ' + name, {'core': core})
+        elif event == MUTEX_GIVE:
+            end(ts, task, 'hold ' + name, {})
+        elif event == SCAN_START:
+            begin(ts, task, 'scan', {'channel': arg or 'all', 'core': core})
+        elif event == SCAN_END:
+            end(ts, task, 'scan', {'found': arg})
+        elif event == NVS_WRITE_START:
+            begin(ts, task, 'nvs write', {'size': arg, 'core': core})
+        elif event == NVS_WRITE_END:
+            end(ts, task, 'nvs write', {'esp_err': arg})
+        elif event in (HTTP_ACCEPT, HTTP_CLOSE):
+            events.append({'ph': 'b' if event == HTTP_ACCEPT else 'e', 'cat': 'http', 'id': '0x%08x' % arg,
+                           'pid': 1, 'tid': thread(task), 'ts': ts, 'name': 'connection'})
+        else:
+            instant(ts, task, 'event %d' % event, {'object': obj, 'arg': arg, 'core': core})
+
+    # slices still open when the dump was taken end with the last record
+    last = records[-1][0] if records else 0
+    for task, name in list(open_slices):
+        end(last, task, name, {'unfinished': True})
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ms', 'otherData': {'records': len(records), 'dropped': dropped}}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Converts a /trace.bin dump to the Chrome trace event format.')
+    parser.add_argument('--output', help='json file to write, standard output by default')
+    parser.add_argument('dump', help='dump file, - for standard input')
+    args = parser.parse_args()
+
+    if args.dump == '-':
+        data = getattr(sys.stdin, 'buffer', sys.stdin).read()
+    else:
+        with open(args.dump, 'rb') as f:
+            data = f.read()
+
+    try:
+        trace = convert(*parse(data))
+    except (DumpError, struct.error) as e:
+        print('%s: %s' % (args.dump, e), file=sys.stderr)
+        return 1
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
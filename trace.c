@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file trace.c
+@brief Binary trace of the events of the wifi manager and the HTTP server, served as /trace.bin.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "trace.h"
+
+#if TRACE_ENABLED
+
+#if (TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) != 0 || TRACE_RING_SIZE > 32768
+#error "TRACE_RING_SIZE must be a power of 2 no larger than 32768"
+#endif
+
+typedef struct {
+	atomic_uint head;		/* number of slots claimed so far */
+	trace_record_t records[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static trace_ring_t rings[portNUM_PROCESSORS];
+
+/* @brief slots are claimed by incrementing task_count before they are written */
+static atomic_uint task_count;
+static trace_task_t tasks[TRACE_MAX_TASKS];
+
+
+void trace_record(trace_event_t event, trace_object_t object, uint32_t arg) {
+	/* a task moved to the other core between these lines merely records in the ring of the previous one */
+	trace_ring_t *ring = &rings[xPortGetCoreID()];
+	unsigned int slot = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+	trace_record_t *record = &ring->records[slot & (TRACE_RING_SIZE - 1)];
+
+	/* the slot is invalidated first: a reader copying it before it is complete drops it */
+	record->sequence = 0;
+	atomic_thread_fence(memory_order_release);
+	record->time_us = (uint32_t)esp_timer_get_time();
+	record->task = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+	record->event = event;
+	record->object = object;
+	record->arg = arg;
+	atomic_thread_fence(memory_order_release);
+	record->sequence = (uint16_t)(slot + 1);
+}
+
+
+void trace_register_task() {
+	unsigned int slot = atomic_fetch_add(&task_count, 1);
+
+	if(slot < TRACE_MAX_TASKS){
+		strncpy(tasks[slot].name, pcTaskGetTaskName(NULL), sizeof(tasks[slot].name) - 1);
+		tasks[slot].task = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+	}
+}
+
+
+size_t trace_dump_size() {
+	return sizeof(trace_header_t) + sizeof(tasks) + portNUM_PROCESSORS * (sizeof(uint32_t) + sizeof(rings[0].records));
+}
+
+
+bool trace_dump(trace_writer_t writer, void *context) {
+	trace_header_t header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(trace_record_t),
+		.now_us = (uint64_t)esp_timer_get_time(),
+		.ring_size = TRACE_RING_SIZE,
+		.cores = portNUM_PROCESSORS,
+		.max_tasks = TRACE_MAX_TASKS
+	};
+	uint32_t heads[portNUM_PROCESSORS];
+
+	/* the heads are read before the rings: records claimed after them are dropped by the decoder */
+	for(int core = 0; core < portNUM_PROCESSORS; core++){
+		heads[core] = atomic_load(&rings[core].head);
+	}
+	atomic_thread_fence(memory_order_acquire);
+
+	if(!writer(&header, sizeof(header), context) || !writer(tasks, sizeof(tasks), context) || !writer(heads, sizeof(heads), context)){
+		return false;
+	}
+	for(int core = 0; core < portNUM_PROCESSORS; core++){
+		if(!writer(rings[core].records, sizeof(rings[core].records), context)){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#endif
+
+size_t trace_get_static_size() {
+#if TRACE_ENABLED
+	return sizeof(rings) + sizeof(tasks);
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+@file wifi_link.c
+@brief Supervision of the STA link: when to reconnect after a connection was lost or an attempt failed.
+
+The state is only accessed by the wifi manager task and needs no locking.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_wifi_types.h"
+
+#include "wifi_link.h"
+
+static wifi_link_state_t state = WIFI_LINK_IDLE;
+
+/* @brief failed retries since the link was lost */
+static uint8_t failed_retries = 0;
+
+static uint8_t last_reason = 0;
+static int64_t retry_at = 0;
+
+
+/**
+ * @brief Tells if a disconnection reason means the access point refused the credentials.
+ */
+static bool wifi_link_is_rejection(uint8_t reason){
+	switch(reason){
+	case WIFI_REASON_AUTH_FAIL:
+	case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+	case WIFI_REASON_HANDSHAKE_TIMEOUT:
+	case WIFI_REASON_802_1X_AUTH_FAILED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint32_t wifi_link_backoff_ms(uint8_t failures, uint8_t reason, uint32_t random){
+	uint32_t delay = WIFI_LINK_BACKOFF_MAX_MS;
+
+	/* past 16 doublings any sensible maximum is reached: the shift cannot overflow */
+	if(!wifi_link_is_rejection(reason) && failures < 16){
+		delay = (uint32_t)WIFI_LINK_BACKOFF_BASE_MS << failures;
+		if(delay > WIFI_LINK_BACKOFF_MAX_MS){
+			delay = WIFI_LINK_BACKOFF_MAX_MS;
+		}
+	}
+
+	return delay / 2 + random % (delay / 2 + 1);
+}
+
+static void wifi_link_schedule(uint8_t reason, int64_t now, uint32_t random){
+	last_reason = reason;
+	state = WIFI_LINK_BACKOFF;
+	retry_at = now + (int64_t)wifi_link_backoff_ms(failed_retries, reason, random) * 1000;
+	if(failed_retries < UINT8_MAX){
+		failed_retries++;
+	}
+}
+
+void wifi_link_attempt(){
+	state = WIFI_LINK_CONNECTING;
+	retry_at = 0;
+}
+
+void wifi_link_connected(){
+	state = WIFI_LINK_CONNECTED;
+	failed_retries = 0;
+	retry_at = 0;
+}
+
+bool wifi_link_lost(uint8_t reason, int64_t now, uint32_t random){
+	if(state != WIFI_LINK_CONNECTED){
+		return false;
+	}
+	failed_retries = 0;
+	wifi_link_schedule(reason, now, random);
+	return true;
+}
+
+void wifi_link_failed(uint8_t reason, int64_t now, uint32_t random, bool retry){
+	if(retry){
+		wifi_link_schedule(reason, now, random);
+	}
+	else{
+		last_reason = reason;
+		wifi_link_stop();
+	}
+}
+
+void wifi_link_stop(){
+	state = WIFI_LINK_IDLE;
+	failed_retries = 0;
+	retry_at = 0;
+}
+
+wifi_link_state_t wifi_link_get_state(){
+	return state;
+}
+
+int64_t wifi_link_get_retry_at(){
+	return retry_at;
+}
+
+uint8_t wifi_link_get_reason(){
+	return last_reason;
+}
@@ -33,37 +33,191 @@ Contains the freeRTOS task and all necessary support
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/time.h>
 #include "esp_system.h"
+#include "esp_attr.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
 #include "esp_event_loop.h"
 #include "esp_wifi.h"
 #include "esp_wifi_types.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "mdns.h"
 #include "lwip/api.h"
 #include "lwip/err.h"
 #include "lwip/netdb.h"
+#include "lwip/dhcp.h"
 
 #include "json.h"
 #include "http_server.h"
 #include "dns_server.h"
 #include "wifi_manager.h"
 #include "wifi_nvs.h"
+#include "ap_table.h"
+#include "wifi_link.h"
+#include "wifi_scan.h"
+#include "metrics.h"
+#include "wifi_timeline.h"
+#include "trace.h"
 
 static const char TAG[] = "WIFIMGR";
 
-
+#if WIFI_MANAGER_STATIC_ALLOCATION && !configSUPPORT_STATIC_ALLOCATION
+#error "WIFI_MANAGER_STATIC_ALLOCATION requires CONFIG_SUPPORT_STATIC_ALLOCATION"
+#endif
+
+
+/**
+ * @brief One version of a json document. Readers see it through its json member.
+ */
+typedef struct {
+	wifi_manager_json_t json;	/* must stay the first member: released versions are cast back */
+	char *buffer;				/* allocated the first time the version is needed, grown when a larger json is written */
+	size_t size;				/* size of buffer */
+	atomic_uint readers;
+} wifi_manager_json_version_t;
+
+/**
+ * @brief A json document, published as immutable versions.
+ *
+ * The writer fills a version nobody reads and publishes it by switching current, readers take a reference to the
+ * current version. Neither ever waits for the other.
+ */
+typedef struct {
+	wifi_manager_json_version_t versions[WIFI_MANAGER_JSON_VERSIONS];
+	atomic_int current;
+	int draft;					/* version being written, only meaningful while writer_mutex is held */
+	uint32_t generation;
+	void (*refresh)();			/* writes the latest content requested, set by every writer */
+	atomic_bool stale;			/* the latest content could not be written because every version was held */
+} wifi_manager_json_document_t;
+
+static wifi_manager_json_document_t ap_list_document;
+static wifi_manager_json_document_t ip_info_document;
+
+/* @brief reason code of the latest ip info json requested, written by its refresh */
+static update_reason_code_t ip_info_reason;
+
+/* the writer always finds a free version: one can be held per http worker, by the event task and by the holder of
+ * wifi_manager_lock_json_buffer, plus the current version and the one being written */
+_Static_assert(WIFI_MANAGER_JSON_VERSIONS >= HTTP_SERVER_WORKER_COUNT + 2 + 2, "WIFI_MANAGER_JSON_VERSIONS is too low for HTTP_SERVER_WORKER_COUNT");
+
+/* @brief serializes the writers of both documents. Readers never take it. */
+SemaphoreHandle_t wifi_manager_json_writer_mutex = NULL;
+
+/* @brief only used by wifi_manager_lock_json_buffer, kept for compatibility */
 SemaphoreHandle_t wifi_manager_json_mutex = NULL;
-uint16_t ap_num = MAX_AP_NUM;
-wifi_ap_record_t *accessp_records; //[MAX_AP_NUM];
-char *accessp_json = NULL;
-char *ip_info_json = NULL;
+static const wifi_manager_json_t *locked_ap_list_json = NULL;
+static const wifi_manager_json_t *locked_ip_info_json = NULL;
+
+
+/* @brief tick count at the end of the last scan, only meaningful if scan_completed is true */
+TickType_t last_scan_tick = 0;
+bool scan_completed = false;
+
+/* @brief records returned by the driver for the last scan, merged into the access point table */
+wifi_ap_record_t *scan_records;
+
 wifi_config_t wifi_manager_config_sta;
 
+/* @brief called with the outcome of every connection attempt, see wifi_manager_set_connect_hook */
+static wifi_manager_connect_hook_t connect_hook = NULL;
+
+/* @brief notified of connections, losses and softAP shutdowns, see wifi_manager_set_mode_hook */
+static wifi_manager_mode_hook_t mode_hook = NULL;
+static bool mode_notified = false;
+static bool mode_sta_connected = false;
+static bool mode_softap_running = false;
+
+/* @brief settings the task was started with, needed to bring the softAP back */
+static wifi_settings_t *wifi_manager_settings = NULL;
+
+/* @brief false while the softAP and the HTTP server are turned off in sta_only mode */
+static bool softap_running = true;
+
+/* @brief time at which the softAP is turned off, 0 if it stays on */
+static int64_t softap_stop_at = 0;
+
+/* @brief power save mode currently applied to the driver */
+static wifi_ps_type_t power_save = WIFI_PS_NONE;
+
+/* @brief time of the last softAP and power save transitions, for the policy logs */
+static int64_t softap_since = 0;
+static int64_t power_save_since = 0;
+
+/* @brief number of devices associated to the softAP. Only written by the event handler. */
+static volatile uint8_t ap_clients = 0;
+
+/* @brief time at which the channel of the softAP is reconsidered in auto channel mode, 0 otherwise */
+static int64_t ap_channel_check_at = 0;
+
+#if WIFI_MANAGER_STATIC_ALLOCATION
+/* @brief every buffer and RTOS object of the wifi manager task, allocated at compile time */
+static struct {
+	wifi_ap_record_t scan_records[MAX_AP_NUM];
+	char ap_list[WIFI_MANAGER_JSON_VERSIONS][WIFI_MANAGER_STATIC_AP_LIST_SIZE];
+	char ip_info[WIFI_MANAGER_JSON_VERSIONS][JSON_IP_INFO_SIZE];
+	StaticSemaphore_t json_mutex;
+	StaticSemaphore_t json_writer_mutex;
+	StaticEventGroup_t event_group;
+	StaticQueue_t queue;
+	uint8_t queue_storage[WIFI_MANAGER_COMMAND_QUEUE_SIZE * sizeof(wifi_manager_command_t)];
+} wifi_manager_arena;
+#endif
+
+/* @brief where the address of the STA interface comes from for the current connection */
+static wifi_manager_ip_source_t ip_source = WIFI_MANAGER_IP_DHCP;
+
+/* @brief commands sent to the wifi manager task */
+static QueueHandle_t wifi_manager_queue = NULL;
+
+/* @brief commands received from the queue and not completed yet. Only accessed by the wifi manager task */
+static wifi_manager_command_t pending_commands[WIFI_MANAGER_COMMAND_QUEUE_SIZE];
+static uint8_t pending_count = 0;
+
+/* @brief a scan in progress or delayed by WIFI_MANAGER_SCAN_MIN_INTERVAL_MS resumes at scan_resume_tick */
+static bool scan_deferred = false;
+static TickType_t scan_resume_tick = 0;
+
+/* @brief all channel scan, used when the STA interface is not connected */
+static const wifi_scan_config_t scan_config = {
+	.ssid = 0,
+	.bssid = 0,
+	.channel = 0,
+	.show_hidden = false
+};
+
+/**
+ * @brief A saved network found by the last scan.
+ */
+typedef struct {
+	const wifi_nvs_network_t *network;
+	uint8_t bssid[6];
+	uint8_t channel;
+	wifi_auth_mode_t authmode;
+	int score;
+} wifi_manager_candidate_t;
+
+/* @brief wifi_err_reason_t of the last SYSTEM_EVENT_STA_DISCONNECTED, written before WIFI_MANAGER_STA_DISCONNECT_BIT is set */
+static uint8_t sta_disconnect_reason = 0;
+
+/* @brief esp_timer time at which a reused lease is handed back to the DHCP client, 0 when no lease is reused */
+static int64_t lease_renew_at = 0;
+
+/**
+ * @brief The lease cached in NVS, with the time it was last renewed at.
+ *
+ * Renewals only move the start of the lease: they are kept here rather than written to flash. RTC memory survives
+ * deep sleep, as does the clock the lease is timed with.
+ */
+static RTC_DATA_ATTR wifi_nvs_ip_config_t lease_held;
+
 
 
 
@@ -79,29 +233,270 @@ const int WIFI_MANAGER_AP_STA_CONNECTED_BIT = BIT1;
 /* @brief Set automatically once the SoftAP is started */
 const int WIFI_MANAGER_AP_STARTED = BIT2;
 
-/* @brief When set, means a client requested to connect to an access point.*/
-const int WIFI_MANAGER_REQUEST_STA_CONNECT_BIT = BIT3;
-
 /* @brief This bit is set automatically as soon as a connection was lost */
 const int WIFI_MANAGER_STA_DISCONNECT_BIT = BIT4;
 
-/* @brief When set, means a client requested to scan wireless networks. */
-const int WIFI_MANAGER_REQUEST_WIFI_SCAN = BIT5;
+/* @brief Set on every SYSTEM_EVENT_STA_GOT_IP, cleared once the manager processed the new address. */
+const int WIFI_MANAGER_STA_GOT_IP_BIT = BIT7;
+
+
+/* @brief the bits of wifi_manager_event_group are changed through these so that every transition is traced */
+static void wifi_manager_set_bits(EventBits_t bits){
+	TRACE(TRACE_EVENT_GROUP_SET, TRACE_OBJECT_WIFI_MANAGER_EVENTS, bits);
+	xEventGroupSetBits(wifi_manager_event_group, bits);
+}
+
+static void wifi_manager_clear_bits(EventBits_t bits){
+	TRACE(TRACE_EVENT_GROUP_CLEAR, TRACE_OBJECT_WIFI_MANAGER_EVENTS, bits);
+	xEventGroupClearBits(wifi_manager_event_group, bits);
+}
+
+
+/**
+ * @brief Takes a reference to the current version of a document.
+ *
+ * The reference only counts if the version is still current once taken: a version that stopped being current in
+ * the meantime may already be rewritten, so the reader starts over with the new current one.
+ */
+static const wifi_manager_json_t* wifi_manager_acquire_json(wifi_manager_json_document_t *document){
+	for(;;){
+		int current = atomic_load(&document->current);
+		wifi_manager_json_version_t *version = &document->versions[current];
+		atomic_fetch_add(&version->readers, 1);
+		if(atomic_load(&document->current) == current){
+			return &version->json;
+		}
+		atomic_fetch_sub(&version->readers, 1);
+	}
+}
+
+const wifi_manager_json_t* wifi_manager_acquire_ap_list_json(){
+	return wifi_manager_acquire_json(&ap_list_document);
+}
+
+const wifi_manager_json_t* wifi_manager_acquire_ip_info_json(){
+	return wifi_manager_acquire_json(&ip_info_document);
+}
+
+static void wifi_manager_wake_up();
+
+void wifi_manager_release_json(const wifi_manager_json_t *json){
+	if(json){
+		atomic_fetch_sub(&((wifi_manager_json_version_t*)json)->readers, 1);
+		/* a version is free again: the wifi manager task writes what could not be written */
+		if(atomic_load(&ap_list_document.stale) || atomic_load(&ip_info_document.stale)){
+			wifi_manager_wake_up();
+		}
+	}
+}
+
+
+/**
+ * @brief Starts writing a new version of a document.
+ *
+ * The version is neither the current one nor referenced by any reader, and no reader can reference it until it is
+ * published because it is not current: its buffer can safely be grown. On success the writer mutex is held until
+ * wifi_manager_publish_json.
+ *
+ * When no version is available the document is marked stale: refresh is called by the wifi manager task once a
+ * reader releases a version, so the update is delayed rather than lost.
+ * @param size size of the buffer needed to write the json.
+ * @param refresh writes the content the caller is about to write.
+ * @return the buffer to write the json in, NULL if no version is available.
+ */
+static char* wifi_manager_draft_json(wifi_manager_json_document_t *document, size_t size, void (*refresh)()){
+
+	TRACE(TRACE_MUTEX_WAIT, TRACE_OBJECT_JSON_WRITER_MUTEX, portMAX_DELAY);
+	xSemaphoreTake(wifi_manager_json_writer_mutex, portMAX_DELAY);
+	TRACE(TRACE_MUTEX_TAKE, TRACE_OBJECT_JSON_WRITER_MUTEX, 1);
+	document->refresh = refresh;
+
+	int current = atomic_load(&document->current);
+	int draft = -1;
+	for(int i = 0; i < WIFI_MANAGER_JSON_VERSIONS; i++){
+		wifi_manager_json_version_t *version = &document->versions[i];
+		if(i == current || atomic_load(&version->readers) != 0) continue;
+		/* prefer a version whose buffer is already large enough, then one that has a buffer */
+		if(version->size >= size){
+			draft = i;
+			break;
+		}
+		if(draft < 0 || (version->buffer && document->versions[draft].buffer == NULL)) draft = i;
+	}
+
+#if !WIFI_MANAGER_STATIC_ALLOCATION
+	if(draft >= 0 && document->versions[draft].size < size){
+		wifi_manager_json_version_t *version = &document->versions[draft];
+		char *buffer = (char*)realloc(version->buffer, size);
+		if(buffer){
+			version->buffer = buffer;
+			version->size = size;
+		}
+	}
+#endif
+	if(draft < 0 || document->versions[draft].size < size){
+		ESP_LOGW(TAG, "no json version available, update delayed");
+		atomic_store(&document->stale, true);
+		TRACE(TRACE_MUTEX_GIVE, TRACE_OBJECT_JSON_WRITER_MUTEX, 0);
+		xSemaphoreGive(wifi_manager_json_writer_mutex);
+		return NULL;
+	}
+
+	document->draft = draft;
+	return document->versions[draft].buffer;
+}
+
+
+/**
+ * @brief Makes the version started by wifi_manager_draft_json the current one and releases the writer mutex.
+ * @param timestamped true if timestamp is the time of the data the json was generated from.
+ */
+static void wifi_manager_publish_json(wifi_manager_json_document_t *document, TickType_t timestamp, bool timestamped){
+	wifi_manager_json_version_t *version = &document->versions[document->draft];
+
+	version->json.json = version->buffer;
+	version->json.generation = ++document->generation;
+	version->json.timestamp = timestamp;
+	version->json.timestamped = timestamped;
+	atomic_store(&document->current, document->draft);
+	atomic_store(&document->stale, false);
+
+	TRACE(TRACE_MUTEX_GIVE, TRACE_OBJECT_JSON_WRITER_MUTEX, 0);
+	xSemaphoreGive(wifi_manager_json_writer_mutex);
+}
+
+
+/**
+ * @brief Writes the documents whose latest update was delayed, see wifi_manager_draft_json.
+ */
+static void wifi_manager_refresh_stale_json(){
+	wifi_manager_json_document_t *documents[] = { &ap_list_document, &ip_info_document };
+
+	for(int i = 0; i < sizeof(documents) / sizeof(documents[0]); i++){
+		if(atomic_load(&documents[i]->stale) && documents[i]->refresh){
+			documents[i]->refresh();
+		}
+	}
+}
 
-/* @brief When set, means a client requested to disconnect from currently connected AP. */
-const int WIFI_MANAGER_REQUEST_WIFI_DISCONNECT = BIT6;
 
+esp_err_t wifi_manager_send_command(const wifi_manager_command_t *command, TickType_t ticks_to_wait){
+	if(wifi_manager_queue == NULL){
+		return ESP_ERR_INVALID_STATE;
+	}
+	if(command->id == WIFI_MANAGER_CMD_CONNECT){
+		/* in order to avoid a false positive on the front end app we need to quickly flush the ip json
+		 * There'se a risk the front end sees an IP or a password error when in fact
+		 * it's a remnant from a previous connection
+		 */
+		wifi_manager_clear_ip_info_json();
+	}
+	return xQueueSendToBack(wifi_manager_queue, command, ticks_to_wait) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+}
 
 void wifi_manager_scan_async(){
-	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_WIFI_SCAN);
+	wifi_manager_command_t command = { .id = WIFI_MANAGER_CMD_SCAN };
+	wifi_manager_send_command(&command, 0);
 }
 
 void wifi_manager_disconnect_async(){
-	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_WIFI_DISCONNECT);
+	wifi_manager_command_t command = { .id = WIFI_MANAGER_CMD_DISCONNECT };
+	if(wifi_manager_send_command(&command, 0) != ESP_OK){
+		ESP_LOGW(TAG, "disconnection request dropped: command queue full");
+	}
+}
+
+/**
+ * @brief Reports the result of a command to its sender.
+ */
+static void wifi_manager_notify(const wifi_manager_command_t *command, esp_err_t result){
+	if(command->callback){
+		command->callback(command, result);
+	}
+	if(command->notify){
+		xTaskNotify(command->notify, (uint32_t)result, eSetValueWithOverwrite);
+	}
+}
+
+static wifi_manager_command_t* wifi_manager_find_command(wifi_manager_command_id_t id){
+	for(uint8_t i = 0; i < pending_count; i++){
+		if(pending_commands[i].id == id){
+			return &pending_commands[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Completes all the pending commands of a kind with the same result.
+ */
+static void wifi_manager_complete_commands(wifi_manager_command_id_t id, esp_err_t result){
+	uint8_t kept = 0;
+
+	for(uint8_t i = 0; i < pending_count; i++){
+		if(pending_commands[i].id == id){
+			wifi_manager_notify(&pending_commands[i], result);
+		}
+		else{
+			pending_commands[kept++] = pending_commands[i];
+		}
+	}
+	pending_count = kept;
+}
+
+/**
+ * @brief Takes a command received from the queue.
+ *
+ * A connection replaces the pending one. A scan or a disconnection sent while one is pending is served by it: it
+ * is only kept if its sender waits for the result.
+ */
+static void wifi_manager_add_command(const wifi_manager_command_t *command){
+
+	switch(command->id){
+	case WIFI_MANAGER_CMD_DRIVER_EVENT:
+		/* only wakes up the task: the event bits tell what happened */
+		return;
+	case WIFI_MANAGER_CMD_CONNECT:
+		wifi_manager_complete_commands(WIFI_MANAGER_CMD_CONNECT, ESP_ERR_INVALID_STATE);
+		break;
+	default:
+		if(command->callback == NULL && command->notify == NULL && wifi_manager_find_command(command->id) != NULL){
+			return;
+		}
+		break;
+	}
+
+	if(pending_count == WIFI_MANAGER_COMMAND_QUEUE_SIZE){
+		wifi_manager_notify(command, ESP_ERR_NO_MEM);
+		return;
+	}
+	pending_commands[pending_count++] = *command;
+}
+
+/**
+ * @brief Gets how long the task can wait for new commands before it has pending work to do.
+ */
+static TickType_t wifi_manager_pending_wait(){
+	if(wifi_manager_find_command(WIFI_MANAGER_CMD_DISCONNECT) || wifi_manager_find_command(WIFI_MANAGER_CMD_CONNECT)){
+		return 0;
+	}
+	if(wifi_manager_find_command(WIFI_MANAGER_CMD_SCAN)){
+		TickType_t now = xTaskGetTickCount();
+		if(scan_deferred && (int32_t)(scan_resume_tick - now) > 0){
+			return scan_resume_tick - now;
+		}
+		return 0;
+	}
+	return portMAX_DELAY;
 }
 
 void wifi_manager_clear_ip_info_json(){
-	strcpy(ip_info_json, "{}\n");
+	char *ip_info_json = wifi_manager_draft_json(&ip_info_document, JSON_IP_INFO_SIZE, wifi_manager_clear_ip_info_json);
+	if(ip_info_json){
+		strcpy(ip_info_json, "{}\n");
+		wifi_manager_publish_json(&ip_info_document, 0, false);
+		http_server_notify_status();
+	}
 }
 
 void print_settings(wifi_settings_t *settings) {
@@ -114,137 +509,225 @@ void print_settings(wifi_settings_t *settings) {
 	ESP_LOGD(TAG, "sta_power_save (1 = yes): %i", settings->sta_power_save);
 }
 
+/**
+ * @brief Writes the ip info json again with the latest reason code.
+ */
+static void wifi_manager_refresh_ip_info_json(){
+	wifi_manager_generate_ip_info_json(ip_info_reason);
+}
+
 void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code){
 
 	wifi_config_t *config = &wifi_manager_config_sta;
+	ip_info_reason = update_reason_code;
+	char *ip_info_json = wifi_manager_draft_json(&ip_info_document, JSON_IP_INFO_SIZE, wifi_manager_refresh_ip_info_json);
+	if(ip_info_json == NULL){
+		return;
+	}
 	if(config){
 
-		const char ip_info_json_format[] = ",\"ip\":\"%s\",\"netmask\":\"%s\",\"gw\":\"%s\",\"urc\":%d}\n";
+		const char ip_info_json_format[] = "{\"ssid\":%s,\"ip\":\"%s\",\"netmask\":\"%s\",\"gw\":\"%s\",\"urc\":%d,\"ipsrc\":\"%s\"}\n";
+		const char *ipsrc = ip_source == WIFI_MANAGER_IP_STATIC ? "static" : ip_source == WIFI_MANAGER_IP_LEASE ? "lease" : "dhcp";
 
-		memset(ip_info_json, 0x00, JSON_IP_INFO_SIZE);
+		/* sta.ssid is not terminated when it is 32 characters long: the escaper is bounded by its size */
+		unsigned char escaped_ssid[JSON_ESCAPED_SIZE(MAX_SSID_SIZE)];
+		json_print_string(config->sta.ssid, MAX_SSID_SIZE, escaped_ssid, sizeof(escaped_ssid));
 
-		/* to avoid declaring a new buffer we copy the data directly into the buffer at its correct address */
-		strcpy(ip_info_json, "{\"ssid\":");
-		json_print_string(config->sta.ssid,  (unsigned char*)(ip_info_json+strlen(ip_info_json)) );
+		char ip[IP4ADDR_STRLEN_MAX] = "0"; /* note: IP4ADDR_STRLEN_MAX is defined in lwip */
+		char gw[IP4ADDR_STRLEN_MAX] = "0";
+		char netmask[IP4ADDR_STRLEN_MAX] = "0";
 
 		if(update_reason_code == UPDATE_CONNECTION_OK){
-			/* rest of the information is copied after the ssid */
 			tcpip_adapter_ip_info_t ip_info;
 			ESP_ERROR_CHECK(tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info));
-			char ip[IP4ADDR_STRLEN_MAX]; /* note: IP4ADDR_STRLEN_MAX is defined in lwip */
-			char gw[IP4ADDR_STRLEN_MAX];
-			char netmask[IP4ADDR_STRLEN_MAX];
 			strcpy(ip, ip4addr_ntoa(&ip_info.ip));
 			strcpy(netmask, ip4addr_ntoa(&ip_info.netmask));
 			strcpy(gw, ip4addr_ntoa(&ip_info.gw));
-
-			snprintf( (ip_info_json + strlen(ip_info_json)), JSON_IP_INFO_SIZE, ip_info_json_format,
-					ip,
-					netmask,
-					gw,
-					(int)update_reason_code);
 		}
-		else{
-			/* notify in the json output the reason code why this was updated without a connection */
-			snprintf( (ip_info_json + strlen(ip_info_json)), JSON_IP_INFO_SIZE, ip_info_json_format,
-								"0",
-								"0",
-								"0",
-								(int)update_reason_code);
+		/* otherwise the json notifies the reason code why this was updated without a connection */
+
+		if(snprintf(ip_info_json, JSON_IP_INFO_SIZE, ip_info_json_format, (char*)escaped_ssid, ip, netmask, gw, (int)update_reason_code, ipsrc) >= JSON_IP_INFO_SIZE){
+			/* only an ssid full of control characters can get there */
+			snprintf(ip_info_json, JSON_IP_INFO_SIZE, ip_info_json_format, "\"\"", ip, netmask, gw, (int)update_reason_code, ipsrc);
 		}
 	}
 	else{
-		wifi_manager_clear_ip_info_json();
+		strcpy(ip_info_json, "{}\n");
 	}
 
-
+	wifi_manager_publish_json(&ip_info_document, 0, false);
+	http_server_notify_status();
 }
 
 
 void wifi_manager_clear_access_points_json(){
-	strcpy(accessp_json, "[]\n");
+	char *accessp_json = wifi_manager_draft_json(&ap_list_document, sizeof("[]\n"), wifi_manager_clear_access_points_json);
+	if(accessp_json){
+		strcpy(accessp_json, "[]\n");
+		wifi_manager_publish_json(&ap_list_document, 0, false);
+		http_server_notify_ap_list();
+	}
 }
 void wifi_manager_generate_acess_points_json(){
 
-	strcpy(accessp_json, "[");
-
-
-	const char oneap_str[] = ",\"chan\":%d,\"rssi\":%d,\"auth\":%d}%c\n";
-
-	/* stack buffer to hold on to one AP until it's copied over to accessp_json */
-	char one_ap[JSON_ONE_APP_SIZE];
-
-	for(int i=0; i<ap_num;i++){
+	/* room for every access point unless ssids need a lot of escaping, and for the "[" "]\n" encapsulation */
+	size_t size = ap_table_json_size();
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	/* buffers cannot grow: the weakest access points are left out */
+	if(size > WIFI_MANAGER_STATIC_AP_LIST_SIZE){
+		size = WIFI_MANAGER_STATIC_AP_LIST_SIZE;
+	}
+#endif
+	char *accessp_json = wifi_manager_draft_json(&ap_list_document, size, wifi_manager_generate_acess_points_json);
+	if(accessp_json == NULL){
+		return;
+	}
 
-		wifi_ap_record_t ap = accessp_records[i];
+	ap_table_format_json(accessp_json, size);
 
-		/* ssid needs to be json escaped. To save on heap memory it's directly printed at the correct address */
-		strcat(accessp_json, "{\"ssid\":");
-		json_print_string( (unsigned char*)ap.ssid,  (unsigned char*)(accessp_json+strlen(accessp_json)) );
+	wifi_manager_publish_json(&ap_list_document, last_scan_tick, scan_completed);
+	http_server_notify_ap_list();
+}
 
-		/* print the rest of the json for this access point: no more string to escape */
-		snprintf(one_ap, (size_t)JSON_ONE_APP_SIZE, oneap_str,
-				ap.primary,
-				ap.rssi,
-				ap.authmode,
-				i==ap_num-1?']':',');
 
-		/* add it to the list */
-		strcat(accessp_json, one_ap);
-	}
+/**
+ * @brief Publishes the access points found by the scan that just completed.
+ */
+static void wifi_manager_publish_scan(){
+	ap_table_expire();
+	last_scan_tick = xTaskGetTickCount();
+	scan_completed = true;
+	wifi_manager_generate_acess_points_json();
+}
 
+/**
+ * @brief Scans all channels at once and publishes the results. Only done while the STA interface is not connected.
+ */
+static void wifi_manager_scan_all_channels(){
+
+	/* no uplink to preserve: stop any connection attempt and scan all channels at once */
+	int64_t start = esp_timer_get_time();
+	ESP_ERROR_CHECK(esp_wifi_disconnect());
+	TRACE(TRACE_SCAN_START, TRACE_OBJECT_NONE, 0);
+	ESP_ERROR_CHECK(esp_wifi_scan_start(&scan_config, true));
+	metrics_observe(METRICS_WIFI_SCAN_TIME, esp_timer_get_time() - start);
+
+	/* count is both the capacity of the array and the number of records returned */
+	uint16_t count = MAX_AP_NUM;
+	ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&count, scan_records));
+	TRACE(TRACE_SCAN_END, TRACE_OBJECT_NONE, count);
+	ap_table_update(scan_records, count);
+
+	/* requests received while the scan ran are still queued: they need a new one */
+	wifi_manager_publish_scan();
+	wifi_manager_complete_commands(WIFI_MANAGER_CMD_SCAN, ESP_OK);
 }
 
 
 bool wifi_manager_lock_json_buffer(TickType_t xTicksToWait){
-	if(wifi_manager_json_mutex){
-		if( xSemaphoreTake( wifi_manager_json_mutex, xTicksToWait ) == pdTRUE ) {
-			return true;
-		}
-		else{
-			return false;
-		}
+	TRACE(TRACE_MUTEX_WAIT, TRACE_OBJECT_JSON_MUTEX, xTicksToWait);
+	int64_t start = esp_timer_get_time();
+	bool locked = wifi_manager_json_mutex && xSemaphoreTake( wifi_manager_json_mutex, xTicksToWait ) == pdTRUE;
+
+	metrics_observe(METRICS_JSON_LOCK_WAIT, esp_timer_get_time() - start);
+	TRACE(TRACE_MUTEX_TAKE, TRACE_OBJECT_JSON_MUTEX, locked);
+	if(locked){
+		/* the holder of the lock reads the versions that were current when it was taken */
+		locked_ap_list_json = wifi_manager_acquire_ap_list_json();
+		locked_ip_info_json = wifi_manager_acquire_ip_info_json();
+		return true;
 	}
 	else{
+		metrics_add(METRICS_JSON_LOCK_TIMEOUTS, 1);
 		return false;
 	}
 
 }
 void wifi_manager_unlock_json_buffer(){
+	wifi_manager_release_json(locked_ap_list_json);
+	wifi_manager_release_json(locked_ip_info_json);
+	locked_ap_list_json = NULL;
+	locked_ip_info_json = NULL;
+	TRACE(TRACE_MUTEX_GIVE, TRACE_OBJECT_JSON_MUTEX, 0);
 	xSemaphoreGive( wifi_manager_json_mutex );
 }
 
 char* wifi_manager_get_ap_list_json(){
-	return accessp_json;
+	const wifi_manager_json_t *json = locked_ap_list_json ? locked_ap_list_json : &ap_list_document.versions[atomic_load(&ap_list_document.current)].json;
+	return (char*)json->json;
+}
+
+uint32_t wifi_manager_get_ap_list_json_generation(){
+	const wifi_manager_json_t *json = locked_ap_list_json ? locked_ap_list_json : &ap_list_document.versions[atomic_load(&ap_list_document.current)].json;
+	return json->generation;
 }
 
 
+/**
+ * @brief Wakes up the wifi manager task so that it looks at the event bits.
+ *
+ * The wake up goes to the front of the queue. It can only be lost if the queue is full, in which case the task
+ * wakes up anyway.
+ */
+static void wifi_manager_wake_up(){
+	wifi_manager_command_t command = { .id = WIFI_MANAGER_CMD_DRIVER_EVENT };
+	if(wifi_manager_queue){
+		xQueueSendToFront(wifi_manager_queue, &command, 0);
+	}
+}
+
 esp_err_t wifi_manager_event_handler(void *ctx, system_event_t *event)
 {
     switch(event->event_id) {
 
     case SYSTEM_EVENT_AP_START:
-    	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_AP_STARTED);
+    	wifi_manager_set_bits(WIFI_MANAGER_AP_STARTED);
+		break;
+
+    case SYSTEM_EVENT_AP_STOP:
+    	ap_clients = 0;
+    	wifi_manager_clear_bits(WIFI_MANAGER_AP_STARTED | WIFI_MANAGER_AP_STA_CONNECTED_BIT);
 		break;
 
     case SYSTEM_EVENT_AP_STACONNECTED:
-		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_AP_STA_CONNECTED_BIT);
+    	ap_clients++;
+		wifi_manager_set_bits(WIFI_MANAGER_AP_STA_CONNECTED_BIT);
+		wifi_manager_wake_up();
 		break;
 
     case SYSTEM_EVENT_AP_STADISCONNECTED:
-    	xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_AP_STA_CONNECTED_BIT);
+    	/* the bit stays set for as long as one device remains */
+    	if(ap_clients > 0) ap_clients--;
+    	if(ap_clients == 0){
+    		wifi_manager_clear_bits(WIFI_MANAGER_AP_STA_CONNECTED_BIT);
+    	}
+		wifi_manager_wake_up();
 		break;
 
     case SYSTEM_EVENT_STA_START:
+    	/* the handler runs in the event loop task */
+    	TRACE_REGISTER_TASK();
         break;
 
+	case SYSTEM_EVENT_STA_CONNECTED:
+		/* authentication, association and the 4-way handshake all completed */
+		wifi_timeline_associated(event->event_info.connected.bssid, event->event_info.connected.channel);
+		break;
+
 	case SYSTEM_EVENT_STA_GOT_IP:
-        xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT);
+		wifi_timeline_got_ip();
+        wifi_manager_set_bits(WIFI_MANAGER_WIFI_CONNECTED_BIT | WIFI_MANAGER_STA_GOT_IP_BIT);
+        wifi_manager_wake_up();
         break;
 
 	case SYSTEM_EVENT_STA_DISCONNECTED:
-		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT);
-		xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT);
+		/* the connected bit goes first: the manager tells a lost connection by the disconnect bit without it */
+		sta_disconnect_reason = event->event_info.disconnected.reason;
+		metrics_count_disconnect(sta_disconnect_reason);
+		wifi_timeline_failed(sta_disconnect_reason);
+		wifi_manager_clear_bits(WIFI_MANAGER_WIFI_CONNECTED_BIT);
+		wifi_manager_set_bits(WIFI_MANAGER_STA_DISCONNECT_BIT);
+		wifi_manager_wake_up();
         break;
 
 	default:
@@ -263,78 +746,567 @@ wifi_config_t * wifi_manager_get_sta_config() {
 
 
 void wifi_manager_connect_async(){
-	/* in order to avoid a false positive on the front end app we need to quickly flush the ip json
-	 * There'se a risk the front end sees an IP or a password error when in fact
-	 * it's a remnant from a previous connection
-	 */
-	if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-		wifi_manager_clear_ip_info_json();
-		wifi_manager_unlock_json_buffer();
+	wifi_manager_command_t command = { .id = WIFI_MANAGER_CMD_CONNECT };
+	memcpy(command.ssid, wifi_manager_config_sta.sta.ssid, sizeof(command.ssid));
+	memcpy(command.password, wifi_manager_config_sta.sta.password, sizeof(command.password));
+	if(wifi_manager_send_command(&command, 0) != ESP_OK){
+		ESP_LOGW(TAG, "connection request dropped: command queue full");
 	}
-	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_STA_CONNECT_BIT);
 }
 
 
 char* wifi_manager_get_ip_info_json(){
-	return ip_info_json;
+	const wifi_manager_json_t *json = locked_ip_info_json ? locked_ip_info_json : &ip_info_document.versions[atomic_load(&ip_info_document.current)].json;
+	return (char*)json->json;
+}
+
+uint32_t wifi_manager_get_ap_list_age(){
+	if(!scan_completed){
+		return UINT32_MAX;
+	}
+	return (xTaskGetTickCount() - last_scan_tick) * portTICK_PERIOD_MS;
+}
+
+uint32_t wifi_manager_get_ip_info_json_generation(){
+	const wifi_manager_json_t *json = locked_ip_info_json ? locked_ip_info_json : &ip_info_document.versions[atomic_load(&ip_info_document.current)].json;
+	return json->generation;
+}
+
+uint32_t wifi_manager_get_json_age(const wifi_manager_json_t *json){
+	if(!json->timestamped){
+		return UINT32_MAX;
+	}
+	return (xTaskGetTickCount() - json->timestamp) * portTICK_PERIOD_MS;
+}
+
+
+void wifi_manager_set_connect_hook(wifi_manager_connect_hook_t hook){
+	connect_hook = hook;
+}
+
+void wifi_manager_set_mode_hook(wifi_manager_mode_hook_t hook){
+	mode_hook = hook;
+	mode_notified = false;
+}
+
+bool wifi_manager_is_softap_running(){
+	return softap_running;
+}
+
+/**
+ * @brief Calls the mode hook if the connection or the softAP changed since it was last called.
+ */
+static void wifi_manager_notify_mode(){
+	bool sta_connected = (xEventGroupGetBits(wifi_manager_event_group) & WIFI_MANAGER_WIFI_CONNECTED_BIT) != 0;
+
+	if(mode_hook && (!mode_notified || sta_connected != mode_sta_connected || softap_running != mode_softap_running)){
+		mode_notified = true;
+		mode_sta_connected = sta_connected;
+		mode_softap_running = softap_running;
+		mode_hook(sta_connected, softap_running);
+	}
+}
+
+/**
+ * @brief Turns the softAP, the HTTP server and the captive portal DNS server on or off. Cancels a pending shutdown.
+ *
+ * The mode is changed while the driver runs: the station keeps its connection.
+ */
+static void wifi_manager_set_softap(bool running){
+	softap_stop_at = 0;
+	if(running == softap_running){
+		return;
+	}
+
+	int64_t now = esp_timer_get_time();
+	ESP_LOGI(TAG, "policy: %s at %u ms, %s for %u ms", running ? "APSTA" : "STA", (unsigned int)(now / 1000),
+			softap_running ? "APSTA" : "STA", (unsigned int)((now - softap_since) / 1000));
+	softap_since = now;
+
+	if(running){
+		if(esp_wifi_set_mode(WIFI_MODE_APSTA) != ESP_OK){
+			ESP_LOGE(TAG, "could not turn the softAP back on");
+			return;
+		}
+		esp_wifi_set_bandwidth(WIFI_IF_AP, wifi_manager_settings->ap_bandwidth);
+		http_server_set_event_start();
+	}
+	else{
+		http_server_set_event_stop();
+		if(esp_wifi_set_mode(WIFI_MODE_STA) != ESP_OK){
+			ESP_LOGE(TAG, "could not turn the softAP off");
+			http_server_set_event_start();
+			return;
+		}
+	}
+	softap_running = running;
+}
+
+/**
+ * @brief Moves between APSTA and STA modes, and between power save modes, according to the connection state.
+ *
+ * - the softAP is needed for as long as there is no connection, and always runs unless sta_only is set;
+ * - with WIFI_MANAGER_POLICY_KEEP_AP_WITH_CLIENTS, it also stays up while a device is associated to it;
+ * - it is turned off WIFI_MANAGER_SOFTAP_SHUTDOWN_DELAY_MS after it stopped being needed, but comes back right away;
+ * - sta_power_save only applies once connected with the softAP off: softAP clients would miss beacons otherwise.
+ *
+ * Called at the end of every iteration of the wifi manager task.
+ */
+static void wifi_manager_apply_policy(){
+	bool connected = (xEventGroupGetBits(wifi_manager_event_group) & WIFI_MANAGER_WIFI_CONNECTED_BIT) != 0;
+	bool clients = WIFI_MANAGER_POLICY_KEEP_AP_WITH_CLIENTS && ap_clients > 0;
+	int64_t now = esp_timer_get_time();
+
+	if(!connected || !wifi_manager_settings->sta_only || clients){
+		wifi_manager_set_softap(true);
+	}
+	else if(softap_running){
+		if(softap_stop_at == 0){
+			softap_stop_at = now + (int64_t)WIFI_MANAGER_SOFTAP_SHUTDOWN_DELAY_MS * 1000;
+		}
+		else if(now >= softap_stop_at){
+			wifi_manager_set_softap(false);
+		}
+	}
+
+	wifi_ps_type_t ps = (connected && !softap_running) ? wifi_manager_settings->sta_power_save : WIFI_PS_NONE;
+	if(ps != power_save && esp_wifi_set_ps(ps) == ESP_OK){
+		ESP_LOGI(TAG, "policy: power save %d at %u ms, %d for %u ms", ps, (unsigned int)(now / 1000), power_save,
+				(unsigned int)((now - power_save_since) / 1000));
+		power_save = ps;
+		power_save_since = now;
+	}
+
+	wifi_manager_notify_mode();
+}
+
+/**
+ * @brief Moves the softAP to the least congested channel according to the access point table.
+ * @param force true to move even when the gain is below WIFI_MANAGER_AP_CHANNEL_HYSTERESIS.
+ */
+static void wifi_manager_select_ap_channel(bool force){
+	wifi_config_t config;
+	wifi_country_t country;
+	bool ht40 = wifi_manager_settings->ap_bandwidth == WIFI_BW_HT40;
+	uint8_t first = 1, last = 13;
+
+	if(esp_wifi_get_config(WIFI_IF_AP, &config) != ESP_OK){
+		return;
+	}
+	if(esp_wifi_get_country(&country) == ESP_OK && country.nchan > 0){
+		first = country.schan;
+		last = country.schan + country.nchan - 1;
+	}
+	if(last > 13){
+		/* channel 14 is 802.11b only */
+		last = 13;
+	}
+
+	uint8_t best = config.ap.channel;
+	uint32_t best_load = UINT32_MAX, current_load = UINT32_MAX;
+	for(uint8_t channel = first; channel <= last; channel++){
+		uint32_t load = ap_table_channel_load(channel, ht40);
+		if(load < best_load){
+			best = channel;
+			best_load = load;
+		}
+		if(channel == config.ap.channel){
+			current_load = load;
+		}
+	}
+
+	if(best == config.ap.channel){
+		return;
+	}
+	if(!force && current_load != UINT32_MAX && (uint64_t)best_load * 100 > (uint64_t)current_load * (100 - WIFI_MANAGER_AP_CHANNEL_HYSTERESIS)){
+		return;
+	}
+
+	ESP_LOGI(TAG, "moving the softAP from channel %d (load %u) to channel %d (load %u)", config.ap.channel,
+			(unsigned int)current_load, best, (unsigned int)best_load);
+	config.ap.channel = best;
+	if(esp_wifi_set_config(WIFI_IF_AP, &config) != ESP_OK){
+		ESP_LOGE(TAG, "could not move the softAP to channel %d", best);
+	}
+}
+
+wifi_manager_ip_source_t wifi_manager_get_ip_source(){
+	return ip_source;
+}
+
+
+/**
+ * @brief Chooses how the STA interface gets its address for the coming connection.
+ *
+ * The static profile of the network comes first, then the lease cached from the last DHCP exchange on the network
+ * if it did not reach its renewal time. Both are applied before associating, so SYSTEM_EVENT_STA_GOT_IP is posted
+ * as soon as the association completes instead of after a DHCP exchange. Otherwise the DHCP client runs as usual.
+ */
+static void wifi_manager_configure_sta_ip(){
+	wifi_nvs_ip_config_t ip_config;
+	tcpip_adapter_dhcp_status_t status;
+	struct timeval now;
+
+	ip_source = WIFI_MANAGER_IP_DHCP;
+	lease_renew_at = 0;
+
+	if(wifi_manager_load_static_ip(&ip_config) && memcmp(ip_config.ssid, wifi_manager_config_sta.sta.ssid, sizeof(ip_config.ssid)) == 0){
+		ip_source = WIFI_MANAGER_IP_STATIC;
+	}
+	else{
+		/* after power on nothing is held: the lease starts at its last address change, which may make it look older */
+		if(lease_held.ssid[0] == '\0' && !wifi_manager_load_ip_lease(&lease_held)){
+			memset(&lease_held, 0x00, sizeof(lease_held));
+		}
+		ip_config = lease_held;
+	}
+
+	if(ip_source == WIFI_MANAGER_IP_DHCP && ip_config.lease_time != 0 && memcmp(ip_config.ssid, wifi_manager_config_sta.sta.ssid, sizeof(ip_config.ssid)) == 0){
+		/* the clock starts over from 0 on power on: a lease obtained "in the future" cannot be trusted */
+		int64_t renew = ip_config.obtained + ip_config.lease_time / 2;
+		gettimeofday(&now, NULL);
+		if(now.tv_sec >= ip_config.obtained && now.tv_sec < renew){
+			ip_source = WIFI_MANAGER_IP_LEASE;
+			lease_renew_at = esp_timer_get_time() + (renew - now.tv_sec) * 1000000LL;
+		}
+	}
+
+	ESP_ERROR_CHECK(tcpip_adapter_dhcpc_get_status(TCPIP_ADAPTER_IF_STA, &status));
+	if(ip_source == WIFI_MANAGER_IP_DHCP){
+		if(status != TCPIP_ADAPTER_DHCP_STARTED){
+			ESP_ERROR_CHECK(tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA));
+		}
+	}
+	else{
+		if(status != TCPIP_ADAPTER_DHCP_STOPPED){
+			ESP_ERROR_CHECK(tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA));
+		}
+		ESP_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &ip_config.ip_info));
+		/* a profile without dns server is refused: name resolution is then up to the application */
+		if(tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &ip_config.dns) != ESP_OK){
+			ESP_LOGD(TAG, "no dns server for %s", wifi_manager_config_sta.sta.ssid);
+		}
+		ESP_LOGI(TAG, "using %s address %s", ip_source == WIFI_MANAGER_IP_STATIC ? "static" : "cached", ip4addr_ntoa(&ip_config.ip_info.ip));
+	}
+}
+
+/**
+ * @brief Caches the lease the DHCP client holds so that the next connection to the network can reuse it.
+ *
+ * NVS is only written when the address, mask, gateway, dns server or duration of the lease changed: a renewal
+ * of the same lease only updates lease_held.
+ */
+static void wifi_manager_save_lease(){
+	wifi_nvs_ip_config_t lease;
+	struct netif *netif = NULL;
+	struct dhcp *dhcp;
+	struct timeval now;
+
+	if(tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, (void**)&netif) != ESP_OK || netif == NULL){
+		return;
+	}
+	dhcp = netif_dhcp_data(netif);
+	if(dhcp == NULL || dhcp->offered_t0_lease == 0){
+		return;
+	}
+
+	memset(&lease, 0x00, sizeof(lease));
+	memcpy(lease.ssid, wifi_manager_config_sta.sta.ssid, sizeof(lease.ssid));
+	ESP_ERROR_CHECK(tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &lease.ip_info));
+	tcpip_adapter_get_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &lease.dns);
+	lease.lease_time = dhcp->offered_t0_lease;
+
+	lease.obtained = lease_held.obtained;
+	bool changed = memcmp(&lease, &lease_held, sizeof(lease)) != 0;
+	gettimeofday(&now, NULL);
+	lease.obtained = now.tv_sec;
+	lease_held = lease;
+	if(changed){
+		wifi_manager_save_ip_lease(&lease);
+	}
+}
+
+/**
+ * @brief Shortens the wait of the manager loop so that it does not go past a deadline.
+ * @param at esp_timer time of the deadline.
+ * @return true if the deadline is already reached.
+ */
+static bool wifi_manager_wait_until(int64_t at, TickType_t *wait_ticks){
+	int64_t remaining_ms = (at - esp_timer_get_time()) / 1000;
+
+	if(remaining_ms <= 0){
+		return true;
+	}
+
+	TickType_t ticks = remaining_ms < (int64_t)(portMAX_DELAY - 1) * portTICK_PERIOD_MS ? pdMS_TO_TICKS(remaining_ms) + 1 : portMAX_DELAY - 1;
+	if(ticks < *wait_ticks){
+		*wait_ticks = ticks;
+	}
+	return false;
+}
+
+/**
+ * @brief Hands a reused lease back to the DHCP client once it reached its renewal time.
+ *
+ * Only the server can extend the lease: the DHCP client is restarted and the lease it obtains is cached and published
+ * once SYSTEM_EVENT_STA_GOT_IP is posted.
+ */
+static void wifi_manager_renew_lease(){
+	ESP_LOGI(TAG, "cached lease reached its renewal time");
+	lease_renew_at = 0;
+	ip_source = WIFI_MANAGER_IP_DHCP;
+	wifi_manager_clear_bits(WIFI_MANAGER_STA_GOT_IP_BIT);
+	ESP_ERROR_CHECK(tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA));
+}
+
+
+/**
+ * @brief Reports the outcome of a connection attempt to the log and to the connect hook.
+ * @param start time the connection was requested at, as returned by esp_timer_get_time.
+ */
+static void wifi_manager_connect_done(wifi_manager_connect_path_t path, bool success, int64_t start){
+	uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+
+	ESP_LOGI(TAG, "%s connection %s after %u ms", path == WIFI_MANAGER_CONNECT_FAST ? "targeted" : "full scan", success ? "got an IP" : "failed", (unsigned int)elapsed_ms);
+	if(success){
+		metrics_add(METRICS_WIFI_CONNECTS, 1);
+		metrics_observe(METRICS_WIFI_CONNECT_TIME, elapsed_ms * 1000);
+	}
+	else{
+		metrics_add(METRICS_WIFI_CONNECT_FAILURES, 1);
+	}
+	if(connect_hook){
+		connect_hook(path, success, elapsed_ms);
+	}
+}
+
+
+/**
+ * @brief Connects the STA interface with the given config.
+ *
+ * 2 scenarios here: connection is successful and SYSTEM_EVENT_STA_GOT_IP will be posted
+ * or it's a failure and we get a SYSTEM_EVENT_STA_DISCONNECTED with a reason code.
+ * Note that the reason code is not exploited. For all intent and purposes a failure is a failure.
+ * @return the event group bits once either happened.
+ */
+static EventBits_t wifi_manager_attempt_connection(wifi_config_t *config){
+
+	/* reset the disconnect bit first as it is later tested */
+	wifi_manager_clear_bits(WIFI_MANAGER_STA_DISCONNECT_BIT);
+	ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, config));
+	/* the attempt is opened first: its events can be handled before esp_wifi_connect returns */
+	wifi_timeline_connect(config);
+	ESP_ERROR_CHECK(esp_wifi_connect());
+
+	return xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT | WIFI_MANAGER_STA_DISCONNECT_BIT, pdFALSE, pdFALSE, portMAX_DELAY );
+}
+
+
+/**
+ * @brief Connects to the network of wifi_manager_config_sta.
+ * @param bssid access point to connect to straight on its channel, skipping the all channel probe. Ignored when
+ * channel is 0.
+ * @param fallback probe all channels if the access point could not be reached.
+ * @param start time the connection was requested at, as returned by esp_timer_get_time.
+ * @return true if an IP was obtained.
+ */
+static bool wifi_manager_connect_sta(const uint8_t *bssid, uint8_t channel, wifi_auth_mode_t authmode, bool fallback, int64_t start){
+	EventBits_t uxBits = 0;
+
+	wifi_manager_configure_sta_ip();
+
+	if(channel != 0){
+		wifi_config_t fast_config = wifi_manager_config_sta;
+		fast_config.sta.scan_method = WIFI_FAST_SCAN;
+		fast_config.sta.bssid_set = true;
+		memcpy(fast_config.sta.bssid, bssid, sizeof(fast_config.sta.bssid));
+		fast_config.sta.channel = channel;
+		fast_config.sta.threshold.authmode = authmode;
+
+		uxBits = wifi_manager_attempt_connection(&fast_config);
+		wifi_manager_connect_done(WIFI_MANAGER_CONNECT_FAST, uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT, start);
+	}
+	if((uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) == 0 && (fallback || channel == 0)){
+		uxBits = wifi_manager_attempt_connection(&wifi_manager_config_sta);
+		wifi_manager_connect_done(WIFI_MANAGER_CONNECT_FULL_SCAN, uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT, start);
+	}
+
+	return uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT;
+}
+
+/**
+ * @brief Lists the saved networks found by the last scan, best first.
+ *
+ * Networks with a higher priority come first. Between networks of the same priority the strongest signal wins,
+ * minus WIFI_MANAGER_FAILURE_PENALTY_DBM for every failed attempt in a row.
+ * @param candidates room for WIFI_NVS_MAX_NETWORKS candidates.
+ * @return the number of candidates.
+ */
+static uint8_t wifi_manager_rank_networks(wifi_manager_candidate_t *candidates){
+	uint8_t count = 0;
+
+	for(uint16_t i = 0; i < ap_table_count() && count < WIFI_NVS_MAX_NETWORKS; i++){
+
+		/* the table is sorted by signal strength: the first access point of a network is its strongest */
+		if(ap_table_is_duplicate(i)){
+			continue;
+		}
+		const ap_table_entry_t *ap = ap_table_get(i);
+		const wifi_nvs_network_t *network = wifi_manager_find_network(ap->ssid);
+		if(network == NULL){
+			continue;
+		}
+
+		wifi_manager_candidate_t candidate;
+		candidate.network = network;
+		memcpy(candidate.bssid, ap->bssid, sizeof(candidate.bssid));
+		candidate.channel = ap->primary;
+		candidate.authmode = ap->authmode;
+		candidate.score = ap_table_rssi(ap) - network->failures * WIFI_MANAGER_FAILURE_PENALTY_DBM;
+
+		/* insertion sort: there are a handful of saved networks at most */
+		uint8_t j = count++;
+		while(j > 0 && (candidates[j - 1].network->priority < network->priority ||
+				(candidates[j - 1].network->priority == network->priority && candidates[j - 1].score < candidate.score))){
+			candidates[j] = candidates[j - 1];
+			j--;
+		}
+		candidates[j] = candidate;
+	}
+
+	return count;
+}
+
+/**
+ * @brief Connects to the best network of the credential store.
+ *
+ * The network of the last successful association is tried first, straight on its access point: most of the time the
+ * device did not move. Otherwise all channels are scanned once and the saved networks found are tried in turn, from
+ * the best one.
+ * @return true if an IP was obtained. wifi_manager_config_sta then holds the network.
+ */
+static bool wifi_manager_connect_best(int64_t start){
+	const wifi_nvs_network_t *last = wifi_manager_find_network(wifi_manager_config_sta.sta.ssid);
+	wifi_manager_candidate_t candidates[WIFI_NVS_MAX_NETWORKS];
+
+	if(last != NULL && last->channel != 0 && wifi_manager_connect_sta(last->bssid, last->channel, last->authmode, false, start)){
+		return true;
+	}
+
+	wifi_manager_scan_all_channels();
+
+	uint8_t count = wifi_manager_rank_networks(candidates);
+	ESP_LOGI(TAG, "%d saved networks in range", count);
+	for(uint8_t i = 0; i < count; i++){
+		const wifi_nvs_network_t *network = candidates[i].network;
+
+		memset(wifi_manager_config_sta.sta.ssid, 0x00, sizeof(wifi_manager_config_sta.sta.ssid));
+		memset(wifi_manager_config_sta.sta.password, 0x00, sizeof(wifi_manager_config_sta.sta.password));
+		memcpy(wifi_manager_config_sta.sta.ssid, network->ssid, sizeof(network->ssid));
+		memcpy(wifi_manager_config_sta.sta.password, network->password, sizeof(network->password));
+		ESP_LOGI(TAG, "trying %.*s", (int)sizeof(network->ssid), network->ssid);
+
+		if(wifi_manager_connect_sta(candidates[i].bssid, candidates[i].channel, candidates[i].authmode, false, start)){
+			return true;
+		}
+		wifi_manager_save_network_failure(network->ssid);
+	}
+
+	return false;
 }
 
 
 void wifi_manager_destroy(){
 
 	/* heap buffers */
-	free(accessp_records);
-	accessp_records = NULL;
-	free(accessp_json);
-	accessp_json = NULL;
-	free(ip_info_json);
-	ip_info_json = NULL;
+#if !WIFI_MANAGER_STATIC_ALLOCATION
+	free(scan_records);
+	for(int i = 0; i < WIFI_MANAGER_JSON_VERSIONS; i++){
+		free(ap_list_document.versions[i].buffer);
+		free(ip_info_document.versions[i].buffer);
+	}
+#endif
+	scan_records = NULL;
+	for(int i = 0; i < WIFI_MANAGER_JSON_VERSIONS; i++){
+		ap_list_document.versions[i].buffer = NULL;
+		ap_list_document.versions[i].size = 0;
+		ip_info_document.versions[i].buffer = NULL;
+		ip_info_document.versions[i].size = 0;
+	}
 
 
 	/* RTOS objects */
 	vSemaphoreDelete(wifi_manager_json_mutex);
 	wifi_manager_json_mutex = NULL;
+	vSemaphoreDelete(wifi_manager_json_writer_mutex);
+	wifi_manager_json_writer_mutex = NULL;
 	vEventGroupDelete(wifi_manager_event_group);
 
 	vTaskDelete(NULL);
 }
 
 
+size_t wifi_manager_get_static_size(){
+	size_t size = sizeof(ap_list_document) + sizeof(ip_info_document) + sizeof(pending_commands);
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	size += sizeof(wifi_manager_arena);
+#endif
+	return size + http_server_get_static_size() + wifi_nvs_get_static_size() + ap_table_get_static_size() +
+			metrics_get_static_size() + wifi_timeline_get_static_size() + trace_get_static_size();
+}
+
+
 
 void wifi_manager( void * pvParameters ) {
 
 	wifi_settings_t * wifi_settings = (wifi_settings_t*) pvParameters;
+	wifi_manager_settings = wifi_settings;
+	metrics_register_task();
+	TRACE_REGISTER_TASK();
 
 	/* memory allocation of objects used by the task */
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	ESP_LOGI(TAG, "static memory mode: %u bytes", (unsigned int)wifi_manager_get_static_size());
+	wifi_manager_json_mutex = xSemaphoreCreateMutexStatic(&wifi_manager_arena.json_mutex);
+	wifi_manager_json_writer_mutex = xSemaphoreCreateMutexStatic(&wifi_manager_arena.json_writer_mutex);
+	scan_records = wifi_manager_arena.scan_records;
+	for(int i = 0; i < WIFI_MANAGER_JSON_VERSIONS; i++){
+		ap_list_document.versions[i].buffer = wifi_manager_arena.ap_list[i];
+		ap_list_document.versions[i].size = sizeof(wifi_manager_arena.ap_list[i]);
+		ip_info_document.versions[i].buffer = wifi_manager_arena.ip_info[i];
+		ip_info_document.versions[i].size = sizeof(wifi_manager_arena.ip_info[i]);
+	}
+#else
 	wifi_manager_json_mutex = xSemaphoreCreateMutex();
-	accessp_records = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * MAX_AP_NUM);
-	accessp_json = (char*)malloc(MAX_AP_NUM * JSON_ONE_APP_SIZE + 4); //4 bytes for json encapsulation of "[\n" and "]\0"
+	wifi_manager_json_writer_mutex = xSemaphoreCreateMutex();
+	scan_records = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * MAX_AP_NUM);
+#endif
+	/* json generations start from a random value so that entity tags from a previous boot never match */
+	ap_list_document.generation = esp_random();
+	ip_info_document.generation = esp_random();
 	wifi_manager_clear_access_points_json();
-	ip_info_json = (char*)malloc(sizeof(char) * JSON_IP_INFO_SIZE);
 	wifi_manager_clear_ip_info_json();
 
 	/* initialize the tcp stack */
 	tcpip_adapter_init();
 
     /* event handler and event group for the wifi driver */
+#if WIFI_MANAGER_STATIC_ALLOCATION
+	wifi_manager_event_group = xEventGroupCreateStatic(&wifi_manager_arena.event_group);
+	wifi_manager_queue = xQueueCreateStatic(WIFI_MANAGER_COMMAND_QUEUE_SIZE, sizeof(wifi_manager_command_t), wifi_manager_arena.queue_storage, &wifi_manager_arena.queue);
+#else
 	wifi_manager_event_group = xEventGroupCreate();
+	wifi_manager_queue = xQueueCreate(WIFI_MANAGER_COMMAND_QUEUE_SIZE, sizeof(wifi_manager_command_t));
+#endif
     //ESP_ERROR_CHECK(esp_event_loop_init(wifi_manager_event_handler, NULL));
 	esp_event_loop_set_cb(wifi_manager_event_handler, NULL);
 
-    /* wifi scanner config */
-	wifi_scan_config_t scan_config = {
-		.ssid = 0,
-		.bssid = 0,
-		.channel = 0,
-		.show_hidden = false
-	};
-
-
 	/* try to get access to previously saved wifi */
 	if (wifi_manager_load_sta_config(&wifi_manager_config_sta)){
 		ESP_LOGD(TAG, "saved wifi found on startup");
-		/* request a connection */
-		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_STA_CONNECT_BIT);
+		/* request a connection to the best saved network */
+		wifi_manager_command_t command = { .id = WIFI_MANAGER_CMD_CONNECT };
+		wifi_manager_add_command(&command);
 	}
 
 	/* start the softAP access point */
@@ -344,9 +1316,9 @@ void wifi_manager( void * pvParameters ) {
 	/* assign a static IP to the AP network interface */
 	tcpip_adapter_ip_info_t info;
 	memset(&info, 0x00, sizeof(info));
-	IP4_ADDR(&info.ip, 192, 168, 1, 1);
-	IP4_ADDR(&info.gw, 192, 168, 1, 1);
-	IP4_ADDR(&info.netmask, 255, 255, 255, 0);
+	ip4addr_aton(DEFAULT_AP_IP, &info.ip);
+	ip4addr_aton(DEFAULT_AP_GATEWAY, &info.gw);
+	ip4addr_aton(DEFAULT_AP_NETMASK, &info.netmask);
 	ESP_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_AP, &info));
 
 	/* start dhcp server */
@@ -367,13 +1339,14 @@ void wifi_manager( void * pvParameters ) {
 	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
 	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
 	ESP_ERROR_CHECK(esp_wifi_set_bandwidth(WIFI_IF_AP, wifi_settings->ap_bandwidth));
-	ESP_ERROR_CHECK(esp_wifi_set_ps(wifi_settings->sta_power_save));
+	/* power save is left to the policy once connected */
+	ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
 
 	// configure the softAP and start it */
 	wifi_config_t ap_config = {
 		.ap = {
 			.ssid_len = 0,
-			.channel = wifi_settings->ap_channel,
+			.channel = wifi_settings->ap_channel != WIFI_MANAGER_AP_CHANNEL_AUTO ? wifi_settings->ap_channel : DEFAULT_AP_CHANNEL,
 			.authmode = WIFI_AUTH_OPEN,
 			.ssid_hidden = wifi_settings->ap_ssid_hidden,
 			.max_connection = AP_MAX_CONNECTIONS,
@@ -398,143 +1371,268 @@ void wifi_manager( void * pvParameters ) {
 
 	/* wait for access point to start */
 	xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_AP_STARTED, pdFALSE, pdTRUE, portMAX_DELAY );
+	softap_since = power_save_since = esp_timer_get_time();
+
+	/* nothing is associated yet: all channels are scanned to start the portal on the least congested one.
+	 * The scan also fills the access point list */
+	if(wifi_settings->ap_channel == WIFI_MANAGER_AP_CHANNEL_AUTO){
+		wifi_manager_scan_all_channels();
+		wifi_manager_select_ap_channel(true);
+		ap_channel_check_at = esp_timer_get_time() + (int64_t)WIFI_MANAGER_AP_CHANNEL_PERIOD_MS * 1000;
+	}
 
 	ESP_LOGD(TAG, "softAP started, starting http_server");
 	http_server_set_event_start();
+	/* started once: each call of init_dns_server creates a task and a socket, and the component has no stop */
 	init_dns_server();
 
 	EventBits_t uxBits;
+	wifi_manager_command_t command;
 	for(;;){
 
-		/* actions that can trigger: request a connection, a scan, or a disconnection */
-		uxBits = xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_STA_CONNECT_BIT | WIFI_MANAGER_REQUEST_WIFI_SCAN | WIFI_MANAGER_REQUEST_WIFI_DISCONNECT, pdFALSE, pdFALSE, portMAX_DELAY );
-		if(uxBits & WIFI_MANAGER_REQUEST_WIFI_DISCONNECT){
-			/* user requested a disconnect, this will in effect disconnect the wifi but also erase NVS memory*/
+		/* commands waiting for the task are processed right away, a deferred scan when it is due */
+		TickType_t wait_ticks = wifi_manager_pending_wait();
+
+		/* a reused lease is handed back to the DHCP client at its renewal time: the wait must not go past it */
+		if(lease_renew_at != 0 && wifi_manager_wait_until(lease_renew_at, &wait_ticks)){
+			wifi_manager_renew_lease();
+		}
+
+		/* the policy is applied again when a pending softAP shutdown is due */
+		if(softap_stop_at != 0){
+			wifi_manager_wait_until(softap_stop_at, &wait_ticks);
+		}
+		if(ap_channel_check_at != 0){
+			wifi_manager_wait_until(ap_channel_check_at, &wait_ticks);
+		}
+
+		/* once the backoff elapsed the best saved network is tried again, unless a connection is already requested */
+		if(wifi_link_get_retry_at() != 0 && wifi_manager_wait_until(wifi_link_get_retry_at(), &wait_ticks) &&
+				wifi_manager_find_command(WIFI_MANAGER_CMD_CONNECT) == NULL){
+			wifi_manager_command_t retry = { .id = WIFI_MANAGER_CMD_CONNECT };
+			wifi_manager_add_command(&retry);
+			wait_ticks = 0;
+		}
+
+		/* actions that can trigger: a command, or an event of the driver. All queued commands are taken at once so
+		 * that they can be coalesced and run by priority */
+		if(xQueueReceive(wifi_manager_queue, &command, wait_ticks) == pdTRUE){
+			do{
+				wifi_manager_add_command(&command);
+			}while(xQueueReceive(wifi_manager_queue, &command, 0) == pdTRUE);
+		}
+		uxBits = xEventGroupGetBits(wifi_manager_event_group);
+
+		/* a json update dropped while every version was held is written now that one was released */
+		wifi_manager_refresh_stale_json();
+
+		if((uxBits & WIFI_MANAGER_STA_DISCONNECT_BIT) && !(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) && wifi_link_get_state() == WIFI_LINK_CONNECTED &&
+				wifi_manager_find_command(WIFI_MANAGER_CMD_CONNECT) == NULL && wifi_manager_find_command(WIFI_MANAGER_CMD_DISCONNECT) == NULL){
+			/* the connection was lost without being asked to: a reconnection is scheduled */
+			int64_t now = esp_timer_get_time();
+			wifi_manager_clear_bits(WIFI_MANAGER_STA_DISCONNECT_BIT);
+			wifi_link_lost(sta_disconnect_reason, now, esp_random());
+			ESP_LOGW(TAG, "connection to %s lost (reason %d), retrying in %d ms", wifi_manager_config_sta.sta.ssid, sta_disconnect_reason, (int)((wifi_link_get_retry_at() - now) / 1000));
+
+			/* the address went with the link */
+			lease_renew_at = 0;
+			wifi_manager_generate_ip_info_json(UPDATE_LOST_CONNECTION);
+		}
+		if((uxBits & WIFI_MANAGER_STA_GOT_IP_BIT) && wifi_manager_find_command(WIFI_MANAGER_CMD_CONNECT) == NULL){
+			/* the DHCP client obtained an address outside of a connection request, as after a lease renewal */
+			wifi_manager_clear_bits(WIFI_MANAGER_STA_GOT_IP_BIT);
+			if((uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) && ip_source == WIFI_MANAGER_IP_DHCP){
+				wifi_manager_save_lease();
+				wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
+			}
+		}
+
+		/* one command per iteration, by priority: the loop comes back right away for the next one */
+		wifi_manager_command_t *pending;
+		if(wifi_manager_find_command(WIFI_MANAGER_CMD_DISCONNECT)){
+			/* user requested a disconnect, this will in effect disconnect the wifi but also forget the network */
+			wifi_link_stop();
 
 			/*disconnect only if it was connected to begin with! */
 			if( uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT ){
-				xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT);
+				wifi_manager_clear_bits(WIFI_MANAGER_STA_DISCONNECT_BIT);
 				ESP_ERROR_CHECK(esp_wifi_disconnect());
 
 				/* wait until wifi disconnects. From experiments, it seems to take about 150ms to disconnect */
 				xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT, pdFALSE, pdTRUE, portMAX_DELAY );
 			}
-			xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT);
+			wifi_manager_clear_bits(WIFI_MANAGER_STA_DISCONNECT_BIT);
 
-			/* erase configuration */
+			/* forget the network: the other saved networks stay */
 			//FIXME:wifi_manager_config_sta = {};
-			wifi_manager_clear_sta_config();
+			wifi_manager_forget_network(wifi_manager_config_sta.sta.ssid);
 
 			/* update JSON status */
-			if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-				wifi_manager_generate_ip_info_json(UPDATE_USER_DISCONNECT);
-				wifi_manager_unlock_json_buffer();
-			}
-			else{
-				/* Even if someone were to furiously refresh a web resource that needs the json mutex,
-				 * it seems impossible that this thread cannot obtain the mutex. Abort here is reasonnable.
-				 */
-				abort();
-			}
+			wifi_manager_generate_ip_info_json(UPDATE_USER_DISCONNECT);
 
-			/* finally: release the scan request bit */
-			xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_WIFI_DISCONNECT);
+			wifi_manager_complete_commands(WIFI_MANAGER_CMD_DISCONNECT, ESP_OK);
 		}
-		if(uxBits & WIFI_MANAGER_REQUEST_STA_CONNECT_BIT){
+		else if((pending = wifi_manager_find_command(WIFI_MANAGER_CMD_CONNECT)) != NULL){
+			/* an empty ssid asks for the best saved network */
+			bool automatic = pending->ssid[0] == '\0';
+			if(!automatic){
+				memset(wifi_manager_config_sta.sta.ssid, 0x00, sizeof(wifi_manager_config_sta.sta.ssid));
+				memset(wifi_manager_config_sta.sta.password, 0x00, sizeof(wifi_manager_config_sta.sta.password));
+				memcpy(wifi_manager_config_sta.sta.ssid, pending->ssid, sizeof(pending->ssid));
+				memcpy(wifi_manager_config_sta.sta.password, pending->password, sizeof(pending->password));
+			}
+
 			//someone requested a connection!
 			ESP_LOGI(TAG, "Reconnecting to %s", wifi_manager_config_sta.sta.ssid);
+			wifi_timeline_request();
 
 			/* first thing: if the esp32 is already connected to a access point: disconnect */
 			if( (uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) == (WIFI_MANAGER_WIFI_CONNECTED_BIT) ){
 
-				xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT);
+				wifi_manager_clear_bits(WIFI_MANAGER_STA_DISCONNECT_BIT);
 				ESP_ERROR_CHECK(esp_wifi_disconnect());
 
 				/* wait until wifi disconnects. From experiments, it seems to take about 150ms to disconnect */
 				xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT, pdFALSE, pdTRUE, portMAX_DELAY );
+				wifi_timeline_disconnected();
 			}
 
-			/* set the new config and connect - reset the disconnect bit first as it is later tested */
-			xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT);
-			ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_manager_config_sta));
-			ESP_ERROR_CHECK(esp_wifi_connect());
+			int64_t connect_start = esp_timer_get_time();
+			bool connected;
+			wifi_link_attempt();
+			if(automatic){
+				connected = wifi_manager_connect_best(connect_start);
+			}
+			else{
+				/* the access point of the last association with this network is tried first if there is one */
+				const wifi_nvs_network_t *network = wifi_manager_find_network(wifi_manager_config_sta.sta.ssid);
+				if(network != NULL && network->channel != 0){
+					connected = wifi_manager_connect_sta(network->bssid, network->channel, network->authmode, true, connect_start);
+				}
+				else{
+					connected = wifi_manager_connect_sta(NULL, 0, WIFI_AUTH_OPEN, true, connect_start);
+				}
+				if(!connected){
+					wifi_manager_save_network_failure(wifi_manager_config_sta.sta.ssid);
+				}
+			}
 
-			/* 2 scenarios here: connection is successful and SYSTEM_EVENT_STA_GOT_IP will be posted
-			 * or it's a failure and we get a SYSTEM_EVENT_STA_DISCONNECTED with a reason code.
-			 * Note that the reason code is not exploited. For all intent and purposes a failure is a failure.
+			/* Update the json regardless of connection status.
+			 * If connection was succesful an IP will get assigned.
+			 * If the connection attempt is failed we mark it as a failed connection attempt
+			 * as it is important for the front end app to distinguish failed attempt to
+			 * regular disconnects
+			 *
+			 * Only save the config if the connection was successful!
 			 */
-			uxBits = xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT | WIFI_MANAGER_STA_DISCONNECT_BIT, pdFALSE, pdFALSE, portMAX_DELAY );
-
-			if(uxBits & (WIFI_MANAGER_WIFI_CONNECTED_BIT | WIFI_MANAGER_STA_DISCONNECT_BIT)){
-
-				/* Update the json regardless of connection status.
-				 * If connection was succesful an IP will get assigned.
-				 * If the connection attempt is failed we mark it as a failed connection attempt
-				 * as it is important for the front end app to distinguish failed attempt to
-				 * regular disconnects
-				 */
-				if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
+			if(connected){
+				wifi_link_connected();
 
-					/* only save the config if the connection was successful! */
-					if(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT){
-
-						/* generate the connection info with success */
-						wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
-
-						/* save wifi config in NVS */
-						wifi_manager_save_sta_config(&wifi_manager_config_sta);
-
-						// FIXME: Is this success?
-						printf("wifi_manager configured - restarting...");
-						vTaskDelay(5000/portTICK_PERIOD_MS);
-						esp_restart();
-					}
-					else{
-
-						/* failed attempt to connect regardles of the reason */
-						wifi_manager_generate_ip_info_json( UPDATE_FAILED_ATTEMPT );
+				/* generate the connection info with success */
+				wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
+				if(ip_source == WIFI_MANAGER_IP_DHCP){
+					wifi_manager_save_lease();
+				}
 
-						/* otherwise: reset the config */
-						//FIXME: wifi_manager_config_sta = {};
-					}
-					wifi_manager_unlock_json_buffer();
+				/* save the network in NVS, with the access point for a fast connection next time */
+				wifi_ap_record_t ap;
+				if(esp_wifi_sta_get_ap_info(&ap) == ESP_OK){
+					wifi_manager_save_network_success(&wifi_manager_config_sta, &ap);
 				}
 				else{
-					/* Even if someone were to furiously refresh a web resource that needs the json mutex,
-					 * it seems impossible that this thread cannot obtain the mutex. Abort here is reasonnable.
-					 */
-					abort();
+					wifi_manager_save_sta_config(&wifi_manager_config_sta);
 				}
+				wifi_manager_complete_commands(WIFI_MANAGER_CMD_CONNECT, ESP_OK);
+
+#if WIFI_MANAGER_RESTART_ON_CONNECT
+				if(!automatic){
+					printf("wifi_manager configured - restarting...");
+					vTaskDelay(5000/portTICK_PERIOD_MS);
+					esp_restart();
+				}
+#endif
 			}
 			else{
-				/* hit portMAX_DELAY limit ? */
-				abort();
+
+				/* failed attempt to connect regardles of the reason. Automatic attempts keep reporting the connection as
+				 * lost: the front end app reports a failed attempt as wrong credentials */
+				wifi_manager_generate_ip_info_json( automatic ? UPDATE_LOST_CONNECTION : UPDATE_FAILED_ATTEMPT );
+
+				/* retry with backoff as long as there is a saved network to go back to */
+				int64_t now = esp_timer_get_time();
+				wifi_link_failed(sta_disconnect_reason, now, esp_random(), wifi_manager_get_network_count() > 0);
+				if(wifi_link_get_state() == WIFI_LINK_BACKOFF){
+					ESP_LOGI(TAG, "connection failed (reason %d), retrying in %d ms", sta_disconnect_reason, (int)((wifi_link_get_retry_at() - now) / 1000));
+				}
+
+				/* the address was meant for a connection that did not happen: nothing to renew */
+				lease_renew_at = 0;
+
+				/* otherwise: reset the config */
+				//FIXME: wifi_manager_config_sta = {};
+				wifi_manager_complete_commands(WIFI_MANAGER_CMD_CONNECT, ESP_FAIL);
 			}
 
-			/* finally: release the connection request bit */
-			xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_STA_CONNECT_BIT);
+			/* finally: the address obtained was processed with the connection */
+			wifi_manager_clear_bits(WIFI_MANAGER_STA_GOT_IP_BIT);
 		}
-		else if(uxBits & WIFI_MANAGER_REQUEST_WIFI_SCAN){
+		else if(wifi_manager_find_command(WIFI_MANAGER_CMD_SCAN) && wifi_manager_pending_wait() == 0){
 
-			/* safe guard against overflow */
-			if(ap_num > MAX_AP_NUM) ap_num = MAX_AP_NUM;
+			TickType_t age = xTaskGetTickCount() - last_scan_tick;
+			bool scanning = wifi_scan_slices_running();
+			scan_deferred = false;
 
-			ESP_ERROR_CHECK(esp_wifi_disconnect());
-			ESP_ERROR_CHECK(esp_wifi_scan_start(&scan_config, true));
-			ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_num, accessp_records));
+			if(!scanning && scan_completed && age < pdMS_TO_TICKS(WIFI_MANAGER_SCAN_CACHE_TTL_MS)){
+				/* results are still fresh: every pending request is served by the cached list */
+				ESP_LOGD(TAG, "scan request served from cache (%u ms old)", (unsigned int)(age * portTICK_PERIOD_MS));
+				wifi_manager_complete_commands(WIFI_MANAGER_CMD_SCAN, ESP_OK);
+			}
+			else if(!scanning && scan_completed && age < pdMS_TO_TICKS(WIFI_MANAGER_SCAN_MIN_INTERVAL_MS)){
+				/* too early: keep the request pending until the minimum interval elapsed */
+				scan_deferred = true;
+				scan_resume_tick = last_scan_tick + pdMS_TO_TICKS(WIFI_MANAGER_SCAN_MIN_INTERVAL_MS);
+			}
+			else if(!scanning && !(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT)){
 
-			/* make sure the http server isn't trying to access the list while it gets refreshed */
-			if(wifi_manager_lock_json_buffer( ( TickType_t ) 20 )){
-				wifi_manager_generate_acess_points_json();
-				wifi_manager_unlock_json_buffer();
+				wifi_manager_scan_all_channels();
 			}
 			else{
-				ESP_LOGD(TAG, "could not get access to json mutex in wifi_scan");
-			}
+				/* connected: an all channel scan would keep the radio away from the access point for seconds.
+				 * Channels are scanned one at a time with a bounded dwell time, going back to the access point
+				 * in between. The request stays pending until the last channel is scanned so the loop comes back
+				 * to it, and requests made in the meantime are served by this scan. */
+				if(!scanning){
+					wifi_scan_slices_start();
+				}
 
-			/* finally: release the scan request bit */
-			xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_WIFI_SCAN);
+				uint16_t count = MAX_AP_NUM;
+				TickType_t delay;
+				bool complete = wifi_scan_slice(&scan_config, scan_records, &count, &delay);
+				ap_table_update(scan_records, count);
+				if(!complete){
+					scan_deferred = true;
+					scan_resume_tick = xTaskGetTickCount() + delay;
+				}
+				else{
+					wifi_manager_publish_scan();
+					wifi_manager_complete_commands(WIFI_MANAGER_CMD_SCAN, ESP_OK);
+				}
+			}
 		}
+		else if(ap_channel_check_at != 0 && esp_timer_get_time() >= ap_channel_check_at){
+			/* auto channel: the softAP moves away from a congested channel while nobody uses it. While connected it
+			 * has to share the channel of the access point */
+			ap_channel_check_at = esp_timer_get_time() + (int64_t)WIFI_MANAGER_AP_CHANNEL_PERIOD_MS * 1000;
+			if(softap_running && ap_clients == 0 && !(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT)){
+				if(!scan_completed || xTaskGetTickCount() - last_scan_tick >= pdMS_TO_TICKS(WIFI_MANAGER_SCAN_CACHE_TTL_MS)){
+					wifi_manager_scan_all_channels();
+				}
+				wifi_manager_select_ap_channel(false);
+			}
+		}
+
+		/* the state may have changed: the softAP and power save follow */
+		wifi_manager_apply_policy();
 	} /* for(;;) */
 	vTaskDelay( (TickType_t)10);
 } /*void wifi_manager*/
@@ -1,96 +1,417 @@
+#include <stddef.h>
 #include <string.h>
 #include "esp_log.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 
 #include "wifi_nvs.h"
+#include "trace.h"
 
 static const char wifi_manager_nvs_namespace[] = "espwifimgr";
 static const char TAG[] = "WIFIMGRSET";
 
-esp_err_t wifi_manager_clear_sta_config() {
+/** @brief Version of the layout of the credential store blob. */
+#define WIFI_NVS_STORE_VERSION		2
+
+/**
+ * @brief The credential store as saved in flash: a single blob, read once.
+ *
+ * Only the count networks in use are saved, after the header. The header tells the size of a network, so that
+ * a store saved by a firmware holding more networks can still be loaded.
+ */
+typedef struct {
+	uint8_t version;				/* WIFI_NVS_STORE_VERSION */
+	uint8_t count;
+	uint16_t network_size;			/* sizeof(wifi_nvs_network_t) */
+	uint32_t sequence;				/* last_success of the most recent association */
+	wifi_nvs_network_t networks[WIFI_NVS_MAX_LOADED_NETWORKS];	/* at most WIFI_NVS_MAX_NETWORKS once loaded */
+} wifi_nvs_store_t;
+
+/**
+ * @brief Access point of the last successful association, as saved by firmwares holding a single network.
+ */
+typedef struct {
+	uint8_t ssid[32];
+	uint8_t bssid[6];
+	uint8_t channel;
+	wifi_auth_mode_t authmode;
+} wifi_nvs_legacy_ap_info_t;
+
+static wifi_nvs_store_t store;
+static bool store_loaded = false;
+
+/**
+ * @brief writes a blob of the namespace and commits it.
+ */
+static esp_err_t wifi_nvs_save_blob(const char *key, const void *data, size_t size) {
 	nvs_handle handle;
 	esp_err_t esp_err;
-	ESP_LOGD(TAG, "wifi_manager: clearing sta_config");
 
 	esp_err = nvs_open(wifi_manager_nvs_namespace, NVS_READWRITE, &handle);
 	if (esp_err != ESP_OK) return esp_err;
 
-	esp_err = nvs_erase_all(handle);
-	if (esp_err != ESP_OK) return esp_err;
+	TRACE(TRACE_NVS_WRITE_START, TRACE_OBJECT_NONE, size);
+	esp_err = nvs_set_blob(handle, key, data, size);
+	if (esp_err == ESP_OK){
+		esp_err = nvs_commit(handle);
+	}
+	TRACE(TRACE_NVS_WRITE_END, TRACE_OBJECT_NONE, esp_err);
 
-	esp_err = nvs_commit(handle);
-	if (esp_err != ESP_OK) return esp_err;
+	nvs_close(handle);
+
+	return esp_err;
+}
+
+/**
+ * @brief reads a blob of the namespace.
+ * @return true only if it exists with the expected size: a blob of another size was written by a different firmware.
+ */
+static bool wifi_nvs_load_blob(const char *key, void *data, size_t size) {
+	nvs_handle handle;
+	esp_err_t esp_err;
+	size_t sz = size;
+
+	if (nvs_open(wifi_manager_nvs_namespace, NVS_READONLY, &handle) != ESP_OK){
+		return false;
+	}
 
+	esp_err = nvs_get_blob(handle, key, data, &sz);
 	nvs_close(handle);
 
-	return ESP_OK;
+	return esp_err == ESP_OK && sz == size;
 }
 
-esp_err_t wifi_manager_save_sta_config(wifi_config_t* config) {
+/**
+ * @brief writes the networks of the credential store in use.
+ */
+static esp_err_t wifi_nvs_save_store() {
+	store.version = WIFI_NVS_STORE_VERSION;
+	store.network_size = sizeof(wifi_nvs_network_t);
+
+	return wifi_nvs_save_blob("networks", &store, offsetof(wifi_nvs_store_t, networks) + store.count * sizeof(wifi_nvs_network_t));
+}
+
+/**
+ * @brief finds the network that makes room for a new one when the store is full: the one with the lowest priority
+ * that connected least recently.
+ */
+static wifi_nvs_network_t* wifi_nvs_weakest_network() {
+	wifi_nvs_network_t *network = &store.networks[0];
+
+	for(uint8_t i = 1; i < store.count; i++){
+		wifi_nvs_network_t *n = &store.networks[i];
+		if(n->priority < network->priority || (n->priority == network->priority && n->last_success < network->last_success)){
+			network = n;
+		}
+	}
+
+	return network;
+}
+
+/**
+ * @brief imports the single network saved by previous firmwares as separate ssid, password and apinfo blobs.
+ */
+static void wifi_nvs_migrate_store() {
+	nvs_handle handle;
+	wifi_nvs_network_t *network = &store.networks[0];
+	wifi_nvs_legacy_ap_info_t ap_info;
+
+	if(!wifi_nvs_load_blob("ssid", network->ssid, sizeof(network->ssid)) || !wifi_nvs_load_blob("password", network->password, sizeof(network->password))){
+		memset(network, 0x00, sizeof(*network));
+		return;
+	}
+
+	if(wifi_nvs_load_blob("apinfo", &ap_info, sizeof(ap_info)) && memcmp(ap_info.ssid, network->ssid, sizeof(network->ssid)) == 0){
+		memcpy(network->bssid, ap_info.bssid, sizeof(network->bssid));
+		network->channel = ap_info.channel;
+		network->authmode = ap_info.authmode;
+	}
+	/* the network connected before since it was saved */
+	network->last_success = store.sequence = 1;
+	store.count = 1;
+
+	if(wifi_nvs_save_store() == ESP_OK && nvs_open(wifi_manager_nvs_namespace, NVS_READWRITE, &handle) == ESP_OK){
+		nvs_erase_key(handle, "ssid");
+		nvs_erase_key(handle, "password");
+		nvs_erase_key(handle, "apinfo");
+		nvs_commit(handle);
+		nvs_close(handle);
+	}
 
+	ESP_LOGI(TAG, "saved network %.*s moved to the credential store", (int)sizeof(network->ssid), network->ssid);
+}
+
+/**
+ * @brief reads the credential store blob in place, with as many networks as the firmware that saved it held.
+ * @return true if there is one with a known layout, the store is left empty otherwise.
+ */
+static bool wifi_nvs_read_store() {
 	nvs_handle handle;
 	esp_err_t esp_err;
+	size_t size = sizeof(store);
 
-	ESP_LOGD(TAG, "wifi_manager: About to save config to flash");
+	if (nvs_open(wifi_manager_nvs_namespace, NVS_READONLY, &handle) != ESP_OK){
+		return false;
+	}
 
-	if(config){
+	esp_err = nvs_get_blob(handle, "networks", &store, &size);
+	nvs_close(handle);
+
+	if(esp_err == ESP_ERR_NVS_INVALID_LENGTH){
+		ESP_LOGW(TAG, "credential store of %d bytes: more than %d networks, ignored", (int)size, WIFI_NVS_MAX_LOADED_NETWORKS);
+	}
+	if(esp_err != ESP_OK || size < offsetof(wifi_nvs_store_t, networks) || store.version != WIFI_NVS_STORE_VERSION ||
+			store.network_size != sizeof(wifi_nvs_network_t) ||
+			size != offsetof(wifi_nvs_store_t, networks) + store.count * sizeof(wifi_nvs_network_t)){
+		memset(&store, 0x00, sizeof(store));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief reads the credential store the first time it is needed.
+ *
+ * A store saved with a larger WIFI_NVS_MAX_NETWORKS keeps the networks with the highest priority that connected
+ * most recently, as if they had been added one by one.
+ */
+static void wifi_nvs_load_store() {
+	uint8_t saved_count;
+
+	if(store_loaded){
+		return;
+	}
+	store_loaded = true;
+
+	if(!wifi_nvs_read_store()){
+		wifi_nvs_migrate_store();
+		return;
+	}
+	if(store.count <= WIFI_NVS_MAX_NETWORKS){
+		return;
+	}
+
+	/* the networks beyond WIFI_NVS_MAX_NETWORKS replace the weakest of the first ones if they are stronger */
+	saved_count = store.count;
+	store.count = WIFI_NVS_MAX_NETWORKS;
+	for(uint8_t i = WIFI_NVS_MAX_NETWORKS; i < saved_count; i++){
+		const wifi_nvs_network_t *n = &store.networks[i];
+		wifi_nvs_network_t *weakest = wifi_nvs_weakest_network();
+		if(n->priority > weakest->priority || (n->priority == weakest->priority && n->last_success > weakest->last_success)){
+			*weakest = *n;
+		}
+	}
+	memset(&store.networks[WIFI_NVS_MAX_NETWORKS], 0x00, (saved_count - WIFI_NVS_MAX_NETWORKS) * sizeof(wifi_nvs_network_t));
+	ESP_LOGW(TAG, "credential store of %d networks: kept %d", saved_count, store.count);
+}
+
+static wifi_nvs_network_t* wifi_nvs_find_network(const uint8_t *ssid) {
+	wifi_nvs_load_store();
+	for(uint8_t i = 0; i < store.count; i++){
+		if(memcmp(store.networks[i].ssid, ssid, sizeof(store.networks[i].ssid)) == 0){
+			return &store.networks[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief finds the network of the sta config, adds it if it is not in the store yet.
+ * @param changed set to true if the network was added or its password changed, left alone otherwise.
+ */
+static wifi_nvs_network_t* wifi_nvs_add_network(const wifi_config_t* config, bool *changed) {
+	wifi_nvs_network_t *network = wifi_nvs_find_network(config->sta.ssid);
 
-		esp_err = nvs_open(wifi_manager_nvs_namespace, NVS_READWRITE, &handle);
-		if (esp_err != ESP_OK) return esp_err;
+	if(network == NULL){
+		if(store.count < WIFI_NVS_MAX_NETWORKS){
+			network = &store.networks[store.count++];
+		}
+		else{
+			network = wifi_nvs_weakest_network();
+			ESP_LOGI(TAG, "credential store full: forgetting %.*s", (int)sizeof(network->ssid), network->ssid);
+		}
+		memset(network, 0x00, sizeof(*network));
+		memcpy(network->ssid, config->sta.ssid, sizeof(network->ssid));
+		*changed = true;
+	}
+	if(memcmp(network->password, config->sta.password, sizeof(network->password)) != 0){
+		memcpy(network->password, config->sta.password, sizeof(network->password));
+		*changed = true;
+	}
 
-		esp_err = nvs_set_blob(handle, "ssid", config->sta.ssid, 32);
-		if (esp_err != ESP_OK) return esp_err;
+	return network;
+}
 
-		esp_err = nvs_set_blob(handle, "password", config->sta.password, 64);
-		if (esp_err != ESP_OK) return esp_err;
+esp_err_t wifi_manager_clear_sta_config() {
+	nvs_handle handle;
+	esp_err_t esp_err;
+	ESP_LOGD(TAG, "wifi_manager: clearing sta_config");
 
+	memset(&store, 0x00, sizeof(store));
+	store_loaded = true;
+
+	esp_err = nvs_open(wifi_manager_nvs_namespace, NVS_READWRITE, &handle);
+	if (esp_err != ESP_OK) return esp_err;
+
+	esp_err = nvs_erase_all(handle);
+	if (esp_err == ESP_OK){
 		esp_err = nvs_commit(handle);
-		if (esp_err != ESP_OK) return esp_err;
+	}
 
-		nvs_close(handle);
+	nvs_close(handle);
 
-		ESP_LOGD(TAG, "ssid:%s password:%s", config->sta.ssid, config->sta.password);
+	return esp_err;
+}
+
+esp_err_t wifi_manager_save_sta_config(wifi_config_t* config) {
 
+	ESP_LOGD(TAG, "wifi_manager: About to save config to flash");
 
+	if(config){
+		bool changed = false;
+		wifi_nvs_add_network(config, &changed);
+		ESP_LOGD(TAG, "ssid:%s password:%s", config->sta.ssid, config->sta.password);
+		return changed ? wifi_nvs_save_store() : ESP_OK;
 	}
 
 	return ESP_OK;
 }
 
 bool wifi_manager_load_sta_config(wifi_config_t* config) {
+	const wifi_nvs_network_t *best = NULL;
+
+	wifi_nvs_load_store();
+	for(uint8_t i = 0; i < store.count; i++){
+		const wifi_nvs_network_t *n = &store.networks[i];
+		if(best == NULL || n->last_success > best->last_success || (n->last_success == best->last_success && n->priority > best->priority)){
+			best = n;
+		}
+	}
+
+	if(best == NULL){
+		return false;
+	}
+
+	memcpy(config->sta.ssid, best->ssid, sizeof(best->ssid));
+	memcpy(config->sta.password, best->password, sizeof(best->password));
+
+	return true;
+}
+
+size_t wifi_nvs_get_static_size() {
+	return sizeof(store);
+}
+
+uint8_t wifi_manager_get_network_count() {
+	wifi_nvs_load_store();
+	return store.count;
+}
+
+const wifi_nvs_network_t* wifi_manager_get_network(uint8_t index) {
+	wifi_nvs_load_store();
+	return index < store.count ? &store.networks[index] : NULL;
+}
+
+const wifi_nvs_network_t* wifi_manager_find_network(const uint8_t *ssid) {
+	return wifi_nvs_find_network(ssid);
+}
+
+esp_err_t wifi_manager_set_network_priority(const uint8_t *ssid, uint8_t priority) {
+	wifi_nvs_network_t *network = wifi_nvs_find_network(ssid);
+
+	if(network == NULL) return ESP_ERR_NOT_FOUND;
+	if(network->priority == priority) return ESP_OK;
+
+	network->priority = priority;
+	return wifi_nvs_save_store();
+}
+
+esp_err_t wifi_manager_forget_network(const uint8_t *ssid) {
+	wifi_nvs_network_t *network = wifi_nvs_find_network(ssid);
+
+	if(network == NULL) return ESP_OK;
+
+	/* keep the networks contiguous */
+	*network = store.networks[--store.count];
+	memset(&store.networks[store.count], 0x00, sizeof(store.networks[store.count]));
+
+	return wifi_nvs_save_store();
+}
+
+esp_err_t wifi_manager_save_network_success(const wifi_config_t* config, const wifi_ap_record_t* ap) {
+	bool changed = false;
+	wifi_nvs_network_t *network = wifi_nvs_add_network(config, &changed);
+
+	if(memcmp(network->bssid, ap->bssid, sizeof(network->bssid)) != 0 || network->channel != ap->primary || network->authmode != ap->authmode || network->failures != 0){
+		memcpy(network->bssid, ap->bssid, sizeof(network->bssid));
+		network->channel = ap->primary;
+		network->authmode = ap->authmode;
+		network->failures = 0;
+		changed = true;
+	}
+
+	/* reconnecting to the most recent network changes nothing: the sequence only moves when another one connects */
+	if(network->last_success == 0 || network->last_success != store.sequence){
+		network->last_success = ++store.sequence;
+		changed = true;
+	}
+
+	if(!changed){
+		return ESP_OK;
+	}
+
+	ESP_LOGD(TAG, "network saved: channel %d authmode %d", network->channel, network->authmode);
+
+	return wifi_nvs_save_store();
+}
+
+esp_err_t wifi_manager_save_network_failure(const uint8_t *ssid) {
+	wifi_nvs_network_t *network = wifi_nvs_find_network(ssid);
+
+	if(network == NULL || network->failures == UINT8_MAX) return ESP_OK;
+
+	/* the count is only written when it reaches a power of two, or along with any other change of the store: a
+	 * network failing in a loop costs 8 writes, and a restart loses less than half of its count */
+	network->failures++;
+	if((network->failures & (network->failures - 1)) != 0 && network->failures != UINT8_MAX) return ESP_OK;
+
+	return wifi_nvs_save_store();
+}
+
+esp_err_t wifi_manager_save_ip_lease(const wifi_nvs_ip_config_t* ip_config) {
+	ESP_LOGD(TAG, "lease saved: %u s", (unsigned int)ip_config->lease_time);
+	return wifi_nvs_save_blob("iplease", ip_config, sizeof(*ip_config));
+}
+
+bool wifi_manager_load_ip_lease(wifi_nvs_ip_config_t* ip_config) {
+	return wifi_nvs_load_blob("iplease", ip_config, sizeof(*ip_config));
+}
+
+esp_err_t wifi_manager_save_static_ip(const wifi_nvs_ip_config_t* ip_config) {
+	return wifi_nvs_save_blob("ipstatic", ip_config, sizeof(*ip_config));
+}
+
+bool wifi_manager_load_static_ip(wifi_nvs_ip_config_t* ip_config) {
+	return wifi_nvs_load_blob("ipstatic", ip_config, sizeof(*ip_config));
+}
+
+esp_err_t wifi_manager_clear_static_ip() {
 	nvs_handle handle;
 	esp_err_t esp_err;
 
-	if (nvs_open(wifi_manager_nvs_namespace, NVS_READONLY, &handle) != ESP_OK){
-        return false;
-    }
-
-    /* allocate buffer */
-    size_t sz;
-    uint8_t *buff = malloc(sizeof(uint8_t) * 128);
-    memset(buff, 0x00, sizeof(sz));
-
-    /* ssid */
-    sz = sizeof(config->sta.ssid);
-    esp_err = nvs_get_blob(handle, "ssid", buff, &sz);
-    if(esp_err != ESP_OK){
-        free(buff);
-        return false;
-    }
-    memcpy(config->sta.ssid, buff, sz);
-
-    /* password */
-    sz = sizeof(config->sta.password);
-    esp_err = nvs_get_blob(handle, "password", buff, &sz);
-    if(esp_err != ESP_OK){
-        free(buff);
-        return false;
-    }
-    memcpy(config->sta.password, buff, sz);
-
-    free(buff);
-    nvs_close(handle);
-
-    return true;
+	esp_err = nvs_open(wifi_manager_nvs_namespace, NVS_READWRITE, &handle);
+	if (esp_err != ESP_OK) return esp_err;
+
+	esp_err = nvs_erase_key(handle, "ipstatic");
+	if (esp_err == ESP_OK){
+		esp_err = nvs_commit(handle);
+	}
+	else if (esp_err == ESP_ERR_NVS_NOT_FOUND){
+		esp_err = ESP_OK;
+	}
+
+	nvs_close(handle);
+
+	return esp_err;
 }
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+@file wifi_scan.c
+@brief Scan made one channel at a time while the STA is connected.
+
+The state is only accessed by the wifi manager task and needs no locking.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#include "wifi_manager.h"
+#include "wifi_scan.h"
+#include "trace.h"
+
+static const char TAG[] = "WIFISCAN";
+
+/* @brief time in ms the driver may take to switch channel, on the way out and again on the way back */
+#define WIFI_SCAN_CHANNEL_SWITCH_MS		5
+
+/* @brief channel of the next slice, 0 when no sliced scan is in progress */
+static uint8_t scan_channel = 0;
+static uint8_t scan_last_channel = 0;
+
+
+void wifi_scan_slices_start(){
+	wifi_country_t country;
+
+	if(esp_wifi_get_country(&country) == ESP_OK && country.nchan > 0){
+		scan_channel = country.schan;
+		scan_last_channel = country.schan + country.nchan - 1;
+	}
+	else{
+		scan_channel = 1;
+		scan_last_channel = 11;
+	}
+}
+
+bool wifi_scan_slices_running(){
+	return scan_channel != 0;
+}
+
+uint8_t wifi_scan_slices_channel(){
+	return scan_channel;
+}
+
+bool wifi_scan_slice(const wifi_scan_config_t *config, wifi_ap_record_t *records, uint16_t *count, TickType_t *delay){
+	wifi_scan_config_t slice_config = *config;
+
+	slice_config.channel = scan_channel;
+	slice_config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+	slice_config.scan_time.active.min = 0;
+	/* the dwell covers the whole time away from the access point, channel switches included */
+	slice_config.scan_time.active.max = WIFI_MANAGER_SCAN_DWELL_MS - 2 * WIFI_SCAN_CHANNEL_SWITCH_MS;
+
+	TRACE(TRACE_SCAN_START, TRACE_OBJECT_NONE, scan_channel);
+	if(esp_wifi_scan_start(&slice_config, true) != ESP_OK || esp_wifi_scan_get_ap_records(count, records) != ESP_OK){
+		ESP_LOGD(TAG, "could not scan channel %d", scan_channel);
+		*count = 0;
+	}
+	TRACE(TRACE_SCAN_END, TRACE_OBJECT_NONE, *count);
+
+	if(scan_channel < scan_last_channel){
+		scan_channel++;
+		*delay = pdMS_TO_TICKS(WIFI_MANAGER_SCAN_SLICE_INTERVAL_MS);
+		return false;
+	}
+
+	scan_channel = 0;
+	*delay = 0;
+	return true;
+}
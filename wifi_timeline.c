@@ -0,0 +1,244 @@
+/*
+Copyright (c) 2017 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file wifi_timeline.c
+@brief Timestamps of the phases of the last connection attempts of the STA interface.
+
+The ring is written by the wifi manager task and the event handler, and read by http workers: it is
+protected by a spinlock held only to copy a single entry.
+
+@see https://idyl.io
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_wifi_types.h"
+#include "esp_timer.h"
+
+#include "json.h"
+#include "wifi_timeline.h"
+
+static wifi_timeline_attempt_t timeline[WIFI_TIMELINE_SIZE];
+
+/* @brief sequence number of the last attempt, 0 before the first one */
+static uint32_t sequence = 0;
+
+/* @brief true while the last attempt has neither obtained an IP nor failed */
+static bool attempt_open = false;
+
+/* @brief the request the next attempts belong to */
+static int64_t requested_at = 0;
+static uint32_t disconnected_us = 0;
+
+static portMUX_TYPE timeline_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char * const phase_names[WIFI_TIMELINE_PHASE_COUNT] = {
+	"disconnected", "connect", "associated", "got_ip", "failed"
+};
+
+
+/**
+ * @brief Time since the request, never 0 which stands for a phase that did not happen.
+ */
+static uint32_t wifi_timeline_elapsed() {
+	int64_t elapsed = esp_timer_get_time() - requested_at;
+
+	return elapsed > 0 ? (uint32_t)elapsed : 1;
+}
+
+
+void wifi_timeline_request() {
+	portENTER_CRITICAL(&timeline_mux);
+	requested_at = esp_timer_get_time();
+	disconnected_us = 0;
+	portEXIT_CRITICAL(&timeline_mux);
+}
+
+
+void wifi_timeline_disconnected() {
+	uint32_t elapsed = wifi_timeline_elapsed();
+
+	portENTER_CRITICAL(&timeline_mux);
+	disconnected_us = elapsed;
+	portEXIT_CRITICAL(&timeline_mux);
+}
+
+
+void wifi_timeline_connect(const wifi_config_t *config) {
+	uint32_t elapsed = wifi_timeline_elapsed();
+
+	portENTER_CRITICAL(&timeline_mux);
+	wifi_timeline_attempt_t *attempt = &timeline[sequence++ % WIFI_TIMELINE_SIZE];
+	memset(attempt, 0x00, sizeof(wifi_timeline_attempt_t));
+	attempt->sequence = sequence;
+	attempt->requested_ms = (uint32_t)(requested_at / 1000);
+	attempt->phases[WIFI_TIMELINE_DISCONNECTED] = disconnected_us;
+	attempt->phases[WIFI_TIMELINE_CONNECT] = elapsed;
+	memcpy(attempt->ssid, config->sta.ssid, sizeof(attempt->ssid));
+	if(config->sta.bssid_set){
+		memcpy(attempt->bssid, config->sta.bssid, sizeof(attempt->bssid));
+		attempt->channel = config->sta.channel;
+		attempt->targeted = true;
+	}
+	attempt_open = true;
+	portEXIT_CRITICAL(&timeline_mux);
+}
+
+
+/**
+ * @brief Gets the attempt in progress. Must be called with the spinlock held.
+ * @return NULL if there is none.
+ */
+static wifi_timeline_attempt_t* wifi_timeline_current() {
+	return attempt_open ? &timeline[(sequence - 1) % WIFI_TIMELINE_SIZE] : NULL;
+}
+
+
+void wifi_timeline_associated(const uint8_t *bssid, uint8_t channel) {
+	uint32_t elapsed = wifi_timeline_elapsed();
+
+	portENTER_CRITICAL(&timeline_mux);
+	wifi_timeline_attempt_t *attempt = wifi_timeline_current();
+	if(attempt){
+		attempt->phases[WIFI_TIMELINE_ASSOCIATED] = elapsed;
+		memcpy(attempt->bssid, bssid, sizeof(attempt->bssid));
+		attempt->channel = channel;
+	}
+	portEXIT_CRITICAL(&timeline_mux);
+}
+
+
+void wifi_timeline_got_ip() {
+	uint32_t elapsed = wifi_timeline_elapsed();
+
+	portENTER_CRITICAL(&timeline_mux);
+	wifi_timeline_attempt_t *attempt = wifi_timeline_current();
+	if(attempt){
+		attempt->phases[WIFI_TIMELINE_GOT_IP] = elapsed;
+		attempt_open = false;
+	}
+	portEXIT_CRITICAL(&timeline_mux);
+}
+
+
+void wifi_timeline_failed(uint8_t reason) {
+	uint32_t elapsed = wifi_timeline_elapsed();
+
+	portENTER_CRITICAL(&timeline_mux);
+	wifi_timeline_attempt_t *attempt = wifi_timeline_current();
+	if(attempt){
+		attempt->phases[WIFI_TIMELINE_FAILED] = elapsed;
+		attempt->reason = reason;
+		attempt_open = false;
+	}
+	portEXIT_CRITICAL(&timeline_mux);
+}
+
+
+/**
+ * @brief Copies an attempt.
+ * @param age 0 for the most recent attempt.
+ * @return false if there is no such attempt.
+ */
+static bool wifi_timeline_copy(uint8_t age, wifi_timeline_attempt_t *attempt) {
+	bool found = false;
+
+	portENTER_CRITICAL(&timeline_mux);
+	if(age < WIFI_TIMELINE_SIZE && age < sequence){
+		*attempt = timeline[(sequence - 1 - age) % WIFI_TIMELINE_SIZE];
+		found = true;
+	}
+	portEXIT_CRITICAL(&timeline_mux);
+
+	return found;
+}
+
+
+uint8_t wifi_timeline_get(wifi_timeline_attempt_t *attempts, uint8_t count) {
+	uint8_t copied = 0;
+
+	while(copied < count && wifi_timeline_copy(copied, &attempts[copied])){
+		copied++;
+	}
+
+	return copied;
+}
+
+
+size_t wifi_timeline_get_static_size() {
+	return sizeof(timeline);
+}
+
+size_t wifi_timeline_format_json(char *buffer, size_t size) {
+	wifi_timeline_attempt_t attempt;
+	size_t len = 0;
+	int written;
+
+	if(size < sizeof("[]\n")){
+		return 0;
+	}
+	buffer[len++] = '[';
+
+	for(uint8_t age = 0; wifi_timeline_copy(age, &attempt); age++){
+		written = snprintf(buffer + len, size - len, "%s{\"seq\":%u,\"at\":%u,\"ssid\":", age ? ",\n" : "",
+				(unsigned int)attempt.sequence, (unsigned int)attempt.requested_ms);
+		if(written < 0 || written >= size - len) return 0;
+		len += written;
+
+		written = json_print_string(attempt.ssid, sizeof(attempt.ssid), (unsigned char*)buffer + len, size - len);
+		if(written == 0) return 0;
+		len += written;
+
+		if(attempt.channel){
+			written = snprintf(buffer + len, size - len, ",\"bssid\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"chan\":%d",
+					attempt.bssid[0], attempt.bssid[1], attempt.bssid[2], attempt.bssid[3], attempt.bssid[4], attempt.bssid[5], attempt.channel);
+		}
+		else{
+			written = snprintf(buffer + len, size - len, ",\"bssid\":null,\"chan\":null");
+		}
+		if(written < 0 || written >= size - len) return 0;
+		len += written;
+
+		for(int phase = 0; phase < WIFI_TIMELINE_PHASE_COUNT; phase++){
+			if(attempt.phases[phase]){
+				written = snprintf(buffer + len, size - len, ",\"%s\":%u", phase_names[phase], (unsigned int)attempt.phases[phase]);
+			}
+			else{
+				written = snprintf(buffer + len, size - len, ",\"%s\":null", phase_names[phase]);
+			}
+			if(written < 0 || written >= size - len) return 0;
+			len += written;
+		}
+
+		written = snprintf(buffer + len, size - len, ",\"reason\":%d,\"targeted\":%s}", attempt.reason, attempt.targeted ? "true" : "false");
+		if(written < 0 || written >= size - len) return 0;
+		len += written;
+	}
+
+	written = snprintf(buffer + len, size - len, "]\n");
+	if(written < 0 || written >= size - len) return 0;
+
+	return len + written;
+}